@@ -0,0 +1,144 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 呼び出し側のバッファへ AT コマンド（先頭の "AT" を除く）を組み立てる（ヒープ確保なし）
+// 例: AtCommandWriter(buf, sizeof(buf), "+CASEND=").arg(0).arg(len) → "+CASEND=0,20"
+// 引数は自動でカンマ区切りになる。バッファ不足・引用符や制御文字を含む文字列引数で ok() が false になり、
+// c_str() は空文字列を返す（壊れたコマンドを送らない）
+class AtCommandWriter {
+public:
+  AtCommandWriter(char* buf, size_t capacity, const char* command);
+
+  // int32_t/size_t が int と long のどちらでも曖昧にならないよう両方を受ける
+  AtCommandWriter& arg(long v);
+  AtCommandWriter& arg(unsigned long v);
+  AtCommandWriter& arg(int v) { return arg((long)v); }
+  AtCommandWriter& arg(unsigned v) { return arg((unsigned long)v); }
+  // "..." で囲んだ文字列引数
+  AtCommandWriter& quoted(const char* s);
+  // 引用符を付けずにそのまま追加する（"host",port のような複合値。区切りのカンマは付ける）
+  AtCommandWriter& raw(const char* s);
+
+  bool ok() const { return ok_; }
+  const char* c_str() const { return ok_ ? buf_ : ""; }
+  size_t length() const { return ok_ ? len_ : 0; }
+
+private:
+  void separator();
+  void put(char c);
+  void putStr(const char* s);
+
+  char* buf_;
+  size_t cap_;
+  size_t len_;
+  bool ok_;
+  bool first_;
+};
+
+// 応答・URC の種別
+enum AtEventType : uint8_t {
+  AT_EVENT_NONE = 0,
+  AT_EVENT_OK,
+  AT_EVENT_ERROR,
+  AT_EVENT_CME_ERROR,  // +CME ERROR: n / +CMS ERROR: n（code に番号）
+  AT_EVENT_PROMPT,     // データ入力の "> "（改行を待たずに通知）
+  AT_EVENT_ECHO,       // コマンドのエコー（ATE1 の場合）
+  AT_EVENT_CNACT,      // +CNACT: <cid>,<status>,"<ip>"（pdp）
+  AT_EVENT_APP_PDP,    // +APP PDP: <cid>,ACTIVE|DEACTIVE（URC, pdp）
+  AT_EVENT_SMSTATE,    // +SMSTATE: <n>（code）
+  AT_EVENT_CGATT,      // +CGATT: <n>（code）
+  AT_EVENT_CSQ,        // +CSQ: <rssi>,<ber>（signal）
+  AT_EVENT_CESQ,       // +CESQ: <rxlev>,<ber>,<rscp>,<ecno>,<rsrq>,<rsrp>（signal）
+  AT_EVENT_CAOPEN,     // +CAOPEN: <cid>,<result>（socket）
+  AT_EVENT_CASTATE,    // +CASTATE: <cid>,<state>（URC, socket）
+  AT_EVENT_CADATAIND,  // +CADATAIND: <cid>（URC, socket.cid）
+  AT_EVENT_INFO,       // その他の行（line を参照）
+};
+
+const char* atEventName(AtEventType t);
+
+struct AtPdpState {
+  uint8_t cid;
+  uint8_t status;   // 1 = 有効
+  char ip[16];      // +CNACT のみ（無ければ空）
+};
+
+struct AtSignal {
+  uint8_t rssi;     // 0-31, 99 = 不明（+CSQ のみ）
+  uint8_t ber;
+  uint8_t rsrq;     // 0-34, 255 = 不明（+CESQ のみ）
+  uint8_t rsrp;     // 0-97, 255 = 不明（+CESQ のみ）
+};
+
+struct AtSocketState {
+  uint8_t cid;
+  uint8_t state;    // +CAOPEN の結果（0 = 成功）/ +CASTATE の状態
+};
+
+struct AtEvent {
+  AtEventType type;
+  int32_t code;
+  union {
+    AtPdpState pdp;
+    AtSignal signal;
+    AtSocketState socket;
+  };
+  const char* line;   // 行の内容（終端NUL付き, 次の push() まで有効）
+  uint16_t lineLen;
+  bool truncated;     // 行がバッファより長く、末尾を捨てた
+};
+
+// モデムからの受信バイトを1バイトずつ受け取り、行単位で種別と値を解析する（ヒープ確保なし）
+// 行より長い部分は捨てて truncated を立てる。空行は無視する
+class AtTokenizer {
+public:
+  static const size_t MAX_LINE = 192;
+
+  AtTokenizer() { reset(); }
+  void reset();
+  // 1つの応答・URCが完成したら ev に格納して true
+  bool push(uint8_t c, AtEvent& ev);
+
+  uint32_t lines() const { return lines_; }
+  uint32_t truncatedLines() const { return truncatedLines_; }
+
+private:
+  void classify(AtEvent& ev);
+
+  char line_[MAX_LINE + 1];
+  uint16_t len_;
+  bool truncated_;
+  bool promptCandidate_;
+  uint32_t lines_;
+  uint32_t truncatedLines_;
+};
+
+// 1コマンド分の応答を集約する（最終結果コードで完了）
+// 応答の途中に届いた URC も集約する（+CNACT? の応答と +APP PDP を区別しない）
+struct AtReply {
+  AtEventType final;      // OK / ERROR / CME_ERROR（未完了・タイムアウトは NONE）
+  int32_t errorCode;
+  bool prompt;            // "> " を受けた（プロンプト待ちのコマンド用）
+  uint8_t pdpActive;      // PDP の有効状態（bit n = cid n）
+  uint8_t pdpSeen;        // 状態を受けた cid（bit n）
+  char pdpIp0[16];        // cid 0 の IP アドレス
+  int8_t cgatt;           // -1 = 応答なし
+  int8_t smstate;
+  uint8_t rssi;           // 99 = 応答なし
+  uint8_t rsrq;           // +CESQ の値（255 = 応答なし・不明）
+  uint8_t rsrp;
+  int8_t caopenResult;    // -1 = 応答なし
+  uint16_t infoLines;     // 種別不明の行数
+
+  void clear();
+  // ev を集約し、最終結果コードなら true
+  bool apply(const AtEvent& ev);
+  bool ok() const { return final == AT_EVENT_OK; }
+  bool pdpIsActive(uint8_t cid) const { return cid < 8 && (pdpActive & (1u << cid)) != 0; }
+  // +CESQ の RSRP [dBm]（不明なら 0）
+  int16_t rsrpDbm() const { return rsrp <= 97 ? (int16_t)(rsrp - 141) : 0; }
+  // ログ用の要約（例: "OK pdp0=1 ip=10.0.0.1 cgatt=1 smstate=1"）
+  size_t summarize(char* out, size_t outSize) const;
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 測位結果（+CGNSINF の1行分）
+struct GnssFix {
+  bool valid;
+  int32_t latE6;      // 緯度 x1e6 [deg]
+  int32_t lonE6;      // 経度 x1e6 [deg]
+  float altM;
+  float speedKmh;
+  float hdop;
+  uint8_t satsUsed;
+  uint32_t epoch;     // 測位時刻（UTCエポック秒）
+  uint32_t monoMs;    // 測位した時点の millis()
+};
+
+// +CGNSINF 応答（例: +CGNSINF: 1,1,20240501123456.000,35.681236,139.767125,40.1,0.00,0.0,1,,1.2,1.5,0.9,,12,8,,,35,,）
+// を解析する。測位できていない（fix=0）・形式不正なら false
+// 空欄の項目は 0 として扱う
+bool parseCgnsinf(const char* response, GnssFix& fix);
+
+// 2点間の距離 [m]（正距円筒近似。移動判定に使う数km以内で十分な精度）
+float gnssDistanceM(int32_t latE6a, int32_t lonE6a, int32_t latE6b, int32_t lonE6b);
+
+struct GnssConfig {
+  uint32_t movingIntervalMs = 300000;       // 移動中の測位間隔（既定5分）
+  uint32_t stationaryIntervalMs = 1800000;  // 静止時の測位間隔（静止が続く毎に倍化）
+  uint32_t maxIntervalMs = 7200000;         // 静止時・測位失敗時の間隔の上限（2時間。動き出しを見逃す時間の上限）
+  uint32_t retryIntervalMs = 600000;        // 測位できなかった場合の再試行間隔（失敗が続く毎に倍化）
+  uint32_t hotTimeoutMs = 45000;            // 前回の測位から hotValidMs 以内（ホットスタート）の測位待ち上限
+  uint32_t coldTimeoutMs = 120000;          // それ以外（コールドスタート）の測位待ち上限
+  uint32_t hotValidMs = 7200000;            // エフェメリスが有効とみなす時間（2時間）
+  uint32_t reattachEstimateMs = 8000;       // LTE 再接続の見込み（実測の平均で置き換える）
+  float motionThresholdM = 50.0f;           // 前回の測位からこれ以上離れたら移動中
+  float motionSpeedKmh = 3.0f;              // 対地速度がこれ以上なら移動中
+  uint8_t maxDutyPct = 10;                  // LTE を止めている時間の割合の上限
+};
+
+struct GnssStats {
+  uint32_t windows;        // 測位のために LTE を止めた回数
+  uint32_t fixes;
+  uint32_t timeouts;
+  uint32_t lastTtffMs;     // GNSS 電源投入から測位までの時間
+  uint32_t maxTtffMs;
+  uint64_t totalTtffMs;
+  uint32_t lastReattachMs; // GNSS 停止から LTE 再接続までの時間
+  uint32_t maxReattachMs;
+  uint64_t totalReattachMs;
+  uint64_t radioOffMs;     // LTE を止めていた時間の合計（測位待ち + 再接続）
+  uint32_t deferredUplinks;  // 測位中に期限が来て測位後へ遅らせた送信の数
+  uint32_t maxUplinkDelayMs; // それらの送信が遅れた時間の最大
+  uint64_t totalUplinkDelayMs;
+};
+
+// LTE と GNSS の時分割スケジューラ（SIM7080 は LTE 通信中に GNSS を動かせない）
+// - 測位は送信の合間に行う。送信周期が測位待ち上限 + 再接続より長ければ次の送信までに収まる時だけ始め、
+//   短ければ送信の直後に始めて、期限の来た送信は測位後へ遅らせる
+// - 測位間隔は移動の有無（前回の測位からの距離・対地速度）で決める。静止が続けば倍化し、
+//   LTE を止める時間の割合が maxDutyPct を超えないよう、実測の所要時間から下限を設ける
+// - 最後の測位結果を保持し、読み取り値に経過時間と共に添付する
+class GnssScheduler {
+public:
+  enum Phase : uint8_t { PHASE_IDLE = 0, PHASE_ACQUIRING = 1 };
+
+  GnssScheduler();
+
+  void setConfig(const GnssConfig& config) { config_ = config; }
+  const GnssConfig& config() const { return config_; }
+
+  // 測位を始めるべきか（msUntilUplink: 次の送信期限までの時間, reportIntervalMs: 送信周期）
+  bool shouldStart(uint32_t nowMs, uint32_t msUntilUplink, uint32_t reportIntervalMs) const;
+  // 測位を始めた（GNSS 電源投入）。今回の測位待ち上限を返す
+  uint32_t start(uint32_t nowMs);
+  // 測位待ちの上限を過ぎたか
+  bool expired(uint32_t nowMs) const;
+  // 測位の終了（fix が nullptr なら失敗）。reattachMs は LTE 再接続に要した時間
+  void finish(uint32_t acquiredAtMs, const GnssFix* fix, uint32_t reattachMs, uint32_t nowMs);
+  // 測位中に期限が来た送信を、測位後 delayMs 遅れで送った
+  void recordDeferredUplink(uint32_t delayMs);
+
+  Phase phase() const { return phase_; }
+  bool hasFix() const { return last_.valid; }
+  const GnssFix& lastFix() const { return last_; }
+  bool moving() const { return moving_; }
+  uint32_t nextFixInMs(uint32_t nowMs) const;
+  uint32_t currentIntervalMs() const { return intervalMs_; }
+  // 今始めた場合に LTE を止める見込み時間（測位待ち上限 + 再接続）
+  uint32_t windowMs(uint32_t nowMs) const;
+  const GnssStats& stats() const { return stats_; }
+
+private:
+  uint32_t minIntervalMs() const;
+  uint32_t reattachEstimateMs() const;
+  uint32_t timeoutFor(uint32_t nowMs) const;
+
+  GnssConfig config_;
+  GnssStats stats_;
+  Phase phase_;
+  GnssFix last_;
+  bool moving_;
+  uint8_t stationaryStreak_;
+  uint8_t failStreak_;
+  uint32_t startedMs_;
+  uint32_t timeoutMs_;
+  uint32_t nextFixMs_;
+  uint32_t intervalMs_;
+  bool everStarted_;
+};
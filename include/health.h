@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 復旧処理のレベル（軽い順）
+enum RecoveryLevel : uint8_t {
+  RECOVERY_PDP_REACTIVATE = 0, // ensurePdp0Active() の GPRS 再接続
+  RECOVERY_MODEM_RESET = 1,    // resetModem()
+  RECOVERY_HARD_RESET = 2,     // hardResetModem()
+  RECOVERY_DEVICE_RESTART = 3, // ESP.restart() を伴う再起動（次回起動時に計上）
+  RECOVERY_LEVEL_COUNT = 4,
+};
+
+// 再起動を跨いで保持するカウンタ（RTC_NOINIT 領域に置く想定）
+struct HealthCounters {
+  uint32_t magic;
+  uint16_t recoveries[RECOVERY_LEVEL_COUNT];
+};
+
+// ヘルスサンプル（1回分）
+struct HealthSample {
+  uint8_t resetReason;        // esp_reset_reason()
+  uint32_t uptimeSec;
+  uint32_t freeHeap;
+  uint32_t minFreeHeap;       // 起動後の最小空きヒープ
+  uint32_t largestFreeBlock;  // 断片化の指標
+  uint32_t loopStackHwm;      // loop タスクのスタック残量最小値（バイト）
+  uint32_t logTaskStackHwm;   // ログドレインタスクのスタック残量最小値（バイト）
+  uint32_t maxLoopMs;         // 前回フレーム以降の loop() 1周の最大時間
+  uint16_t recoveries[RECOVERY_LEVEL_COUNT];
+};
+
+// ヘルスフレーム（UDP用バイナリ, リトルエンディアン, 32バイト固定）
+//   0: u8  種別 HEALTH_FRAME_TYPE
+//   1: u8  リセット理由
+//   2: u16 再起動回数
+//   4: u32 稼働秒数
+//   8: u32 空きヒープ
+//  12: u32 最小空きヒープ
+//  16: u32 最大連続空きブロック
+//  20: u16 loop スタック残量
+//  22: u16 ログタスクスタック残量
+//  24: u16 loop 最大時間(ms, 65535で飽和)
+//  26: u16 PDP再活性化回数
+//  28: u16 モデムリセット回数
+//  30: u16 ハードリセット回数
+static const uint8_t HEALTH_FRAME_TYPE = 0xA1;
+static const size_t HEALTH_FRAME_SIZE = 32;
+static const uint32_t HEALTH_COUNTERS_MAGIC = 0x48454C54; // "HELT"
+
+size_t encodeHealthFrame(const HealthSample& s, uint8_t* out, size_t outSize);
+
+// MQTT用のJSON表現（{"health":{...}}）。書き込んだ文字数を返す
+size_t formatHealthJson(const HealthSample& s, char* out, size_t outSize);
+
+// loop() 1周の所要時間の最大値を追跡する
+class LoopTimer {
+public:
+  LoopTimer() : startUs_(0), maxUs_(0) {}
+  void begin(uint32_t nowUs) { startUs_ = nowUs; }
+  void end(uint32_t nowUs) {
+    uint32_t d = nowUs - startUs_;
+    if (d > maxUs_) maxUs_ = d;
+  }
+  // 最大値を読み出してリセットする
+  uint32_t takeMaxUs() {
+    uint32_t m = maxUs_;
+    maxUs_ = 0;
+    return m;
+  }
+
+private:
+  uint32_t startUs_;
+  uint32_t maxUs_;
+};
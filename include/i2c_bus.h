@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// I2Cバスの物理操作を抽象化するインターフェース
+// 実機では WireI2cDriver（Wire + GPIO）、ホスト環境ではフェイク実装に差し替えてテストできる
+class I2cBusDriver {
+public:
+  virtual ~I2cBusDriver() {}
+  virtual bool begin(uint32_t clockHz) = 0;
+  virtual void end() = 0;
+  // 指定アドレスへ空書き込みし、endTransmission() の戻り値（0=ACK）を返す
+  virtual uint8_t probe(uint8_t address) = 0;
+  // SDA ラインが Low に張り付いているか（バス未初期化状態で呼ばれる）
+  virtual bool sdaIsLow() = 0;
+  // SCL を1クロック分トグルする（バス未初期化状態で呼ばれる）
+  virtual void pulseScl() = 0;
+  // STOP コンディションを手動生成する（バス未初期化状態で呼ばれる）
+  virtual void generateStop() = 0;
+  virtual uint32_t nowMs() = 0;
+  virtual uint32_t nowUs() = 0;
+};
+
+// デバイス単位のトランザクション統計とバックオフ状態
+struct I2cDeviceStats {
+  uint8_t address;
+  const char* name;
+  uint32_t transactions;
+  uint32_t errors;
+  uint32_t skipped;          // バックオフ中で読み取りを見送った回数
+  uint8_t consecutiveErrors;
+  uint32_t lastLatencyUs;
+  uint32_t maxLatencyUs;
+  uint64_t totalLatencyUs;
+  uint32_t backoffMs;        // 現在のバックオフ幅
+  uint32_t backoffUntilMs;   // この時刻まで読み取りを見送る
+};
+
+// I2Cバスマネージャ
+// - Fast-mode（400kHz）での初期化。400kHz で応答しないバス（長い配線・弱いプルアップ）は 100kHz に落とす
+// - デバイス毎のレイテンシ/エラー統計
+// - バスハング検出時の SCL トグルによるバスクリアと再初期化
+// - 失敗が続くデバイスのみを指数バックオフで見送り、健全なデバイスの読み取りは止めない
+class I2cBusManager {
+public:
+  static const uint32_t STANDARD_MODE_HZ = 100000;
+  static const uint32_t FAST_MODE_HZ = 400000;
+  static const size_t MAX_DEVICES = 8;
+  static const uint8_t ERRORS_BEFORE_BACKOFF = 3;   // 連続失敗がこの回数に達したらバックオフ開始
+  static const uint8_t ERRORS_BEFORE_RECOVERY = 2;  // 連続失敗がこの回数に達したらバスハングを疑う
+  static const uint8_t ERRORS_BEFORE_FALLBACK = 3;  // Fast-mode でこの回数連続失敗したら 100kHz を試す
+  static const uint32_t BACKOFF_BASE_MS = 5000;
+  static const uint32_t BACKOFF_MAX_MS = 300000;
+  static const uint8_t CLEAR_PULSES = 9;
+
+  explicit I2cBusManager(I2cBusDriver& driver);
+
+  bool begin(uint32_t clockHz = FAST_MODE_HZ);
+  uint32_t clockHz() const { return clockHz_; }
+
+  // 登録済みデバイスを probe し、現在のクロックで応答しないデバイスが 100kHz では応答するなら
+  // 100kHz に落とす（落とした場合 true）。どのクロックでも応答しなければ元のクロックに戻す
+  bool verifyClock();
+  // 100kHz で初期化し直す（既に 100kHz 以下なら false）。応答の確認はしない
+  bool fallBackToStandardMode();
+  uint32_t clockFallbacks() const { return clockFallbacks_; }
+
+  // デバイスを登録してハンドル（0以上）を返す。登録できない場合は -1
+  int addDevice(uint8_t address, const char* name);
+
+  // バックオフ中なら true（読み取りを見送るべき）
+  bool inBackoff(int handle);
+
+  // トランザクションの開始/終了を記録する。終了時の結果でバックオフ・バス復旧を判断する
+  void beginTransaction(int handle);
+  void endTransaction(int handle, bool ok);
+
+  // fn() を計測付きで実行する。バックオフ中は fn() を呼ばずに false を返す
+  template <typename Fn>
+  bool transact(int handle, Fn fn) {
+    if (inBackoff(handle)) return false;
+    beginTransaction(handle);
+    bool ok = fn();
+    endTransaction(handle, ok);
+    return ok;
+  }
+
+  // SDA 張り付きを SCL トグルで解放し、バスを再初期化する
+  bool recoverBus();
+
+  // 7bit の有効アドレス範囲（0x08-0x77）を走査する。found には ACK したアドレスを格納
+  size_t scan(uint8_t* found, size_t maxFound);
+
+  const I2cDeviceStats* stats(int handle) const;
+  size_t deviceCount() const { return deviceCount_; }
+  uint32_t recoveries() const { return recoveries_; }
+  uint32_t failedRecoveries() const { return failedRecoveries_; }
+
+private:
+  bool validHandle(int handle) const;
+  bool probeAfterError(int handle);
+  // silentMask（bit i = デバイス i）のいずれかが 100kHz で応答すれば 100kHz のまま true、
+  // どれも応答しなければ元のクロックに戻して false
+  bool tryStandardMode(uint8_t silentMask);
+
+  I2cBusDriver& driver_;
+  uint32_t clockHz_;
+  I2cDeviceStats devices_[MAX_DEVICES];
+  size_t deviceCount_;
+  uint32_t txStartUs_;
+  uint32_t recoveries_;
+  uint32_t failedRecoveries_;
+  uint32_t clockFallbacks_;
+};
+
+#ifdef ARDUINO
+#include <Wire.h>
+
+// 実機用ドライバ: Wire と GPIO 直接操作でバスクリアを行う
+class WireI2cDriver : public I2cBusDriver {
+public:
+  WireI2cDriver(TwoWire& wire, int sdaPin, int sclPin);
+  bool begin(uint32_t clockHz) override;
+  void end() override;
+  uint8_t probe(uint8_t address) override;
+  bool sdaIsLow() override;
+  void pulseScl() override;
+  void generateStop() override;
+  uint32_t nowMs() override;
+  uint32_t nowUs() override;
+
+private:
+  TwoWire& wire_;
+  int sdaPin_;
+  int sclPin_;
+};
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+// リトルエンディアンでのバイナリフレーム組み立て用ヘルパ
+
+// 16bit 値を書き込む（範囲外は 0xFFFF に飽和）
+inline void putU16(uint8_t* p, uint32_t v) {
+  if (v > 0xFFFF) v = 0xFFFF;
+  p[0] = (uint8_t)(v & 0xFF);
+  p[1] = (uint8_t)((v >> 8) & 0xFF);
+}
+
+// 符号付き16bit 値を書き込む（範囲外は飽和）
+inline void putI16(uint8_t* p, int32_t v) {
+  if (v > 32767) v = 32767;
+  if (v < -32768) v = -32768;
+  uint16_t u = (uint16_t)(int16_t)v;
+  p[0] = (uint8_t)(u & 0xFF);
+  p[1] = (uint8_t)((u >> 8) & 0xFF);
+}
+
+inline void putU32(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t)(v & 0xFF);
+  p[1] = (uint8_t)((v >> 8) & 0xFF);
+  p[2] = (uint8_t)((v >> 16) & 0xFF);
+  p[3] = (uint8_t)((v >> 24) & 0xFF);
+}
+
+inline uint16_t getU16(const uint8_t* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+inline int16_t getI16(const uint8_t* p) {
+  return (int16_t)getU16(p);
+}
+
+inline uint32_t getU32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// 物理量をスケーリングして 16bit 符号なし整数に丸める（負値は0, 上限で飽和）
+inline uint32_t scaleU(float v, float scale) {
+  if (!(v > 0.0f)) return 0;
+  float s = v * scale + 0.5f;
+  return s >= 65535.0f ? 0xFFFF : (uint32_t)s;
+}
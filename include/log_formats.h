@@ -0,0 +1,45 @@
+#pragma once
+
+// 遅延ロガーで使用するフォーマット文字列の一覧
+// レコードにはフォーマットIDと引数のみを格納し、整形はドレインタスク（またはホスト側デコーダ）で行う
+// 既存IDの番号を変えるとダンプの復号が合わなくなるため、追加は必ず末尾に行うこと
+#define LOG_FORMAT_LIST(X) \
+  X(LF_PDP_STATE,             "ensurePdp0Active(): +CNACT? %s") \
+  X(LF_PDP_ACTIVATING,        "ensurePdp0Active(): activating PDP#0 with AT+CNACT=0,1 ...") \
+  X(LF_PDP_ACT_ERROR,         "ensurePdp0Active(): AT+CNACT=0,1 returned error/timeout") \
+  X(LF_PDP_STATE_AFTER,       "ensurePdp0Active(): +CNACT? after activation attempt: %s") \
+  X(LF_PDP_ACTIVE,            "ensurePdp0Active(): PDP#0 active with IP") \
+  X(LF_PDP_GPRS_RECONNECT,    "ensurePdp0Active(): trying GPRS reconnect (disconnect -> connect)...") \
+  X(LF_PDP_GPRS_FAILED,       "ensurePdp0Active(): gprsConnect failed") \
+  X(LF_PDP_RETRY,             "ensurePdp0Active(): retry %d/%d in %d ms") \
+  X(LF_PDP_FAILED,            "ensurePdp0Active(): failed to activate PDP#0") \
+  X(LF_SEND_INIT_FAILED,      "Failed to initiate data send, retry %d/%d, waiting for %d ms") \
+  X(LF_SEND_RECOVERY,         "Modem status check failed, attempting recovery...") \
+  X(LF_SEND_REOPEN_FAILED,    "Failed to reopen UDP socket after multiple attempts") \
+  X(LF_SEND_DATA_FAILED,      "Failed to send data, retrying...") \
+  X(LF_SEND_OK,               "Data sent successfully! (%u bytes, attempt %d)") \
+  X(LF_MQTT_PDP_RETRY,        "PDP#0 activation failed, retry %d/%d after %d ms") \
+  X(LF_MQTT_PDP_BEFORE,       "PDP status before SMCONN: %s") \
+  X(LF_MQTT_STATE_BEFORE,     "SMSTATE before SMCONN: %s") \
+  X(LF_MQTT_CONNECTING,       "MQTT connecting (AT+SMCONN)...") \
+  X(LF_MQTT_STATE_AFTER,      "SMSTATE after SMCONN: %s") \
+  X(LF_MQTT_CONNECTED,        "MQTT connected") \
+  X(LF_MQTT_CONNECT_RETRY,    "MQTT connect retry %d/%d, waiting %d ms") \
+  X(LF_MQTT_PUBLISHING,       "Publishing via MQTT: topic=%s len=%d qos=%d") \
+  X(LF_MQTT_PUB_NO_PROMPT,    "SMPUB prompt not received") \
+  X(LF_MQTT_PUB_FAILED,       "SMPUB publish failed") \
+  X(LF_MQTT_PUB_OK,           "SMPUB OK") \
+  X(LF_MQTT_STATE_AFTER_PUB,  "SMSTATE after publish: %s") \
+  X(LF_LOG_DROPPED,           "log ring overflow: %u records dropped") \
+  X(LF_BENCH_LOG,             "bench record %d %d %.2f") \
+  X(LF_TREND_DRAW,            "trend chart: %u points appended in %u us")
+
+enum LogFormatId {
+#define LOG_FORMAT_ENUM(id, fmt) id,
+  LOG_FORMAT_LIST(LOG_FORMAT_ENUM)
+#undef LOG_FORMAT_ENUM
+  LF_COUNT
+};
+
+// フォーマットIDから書式文字列を取得する（範囲外は nullptr）
+const char* logFormatString(unsigned id);
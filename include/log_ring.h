@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "log_formats.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+enum LogLevel : uint8_t {
+  LOG_LEVEL_NONE = 0,
+  LOG_LEVEL_ERROR = 1,
+  LOG_LEVEL_WARN = 2,
+  LOG_LEVEL_INFO = 3,
+  LOG_LEVEL_DEBUG = 4,
+};
+
+// レコード引数（整数/浮動小数/短い文字列）
+struct LogArg {
+  char tag;          // 'i' = int32, 'u' = uint32, 'f' = float, 's' = string
+  union {
+    int32_t i;
+    uint32_t u;
+    float f;
+  } v;
+  const char* s;
+};
+
+inline LogArg toLogArg(int x) { LogArg a; a.tag = 'i'; a.v.i = x; a.s = nullptr; return a; }
+inline LogArg toLogArg(long x) { LogArg a; a.tag = 'i'; a.v.i = (int32_t)x; a.s = nullptr; return a; }
+inline LogArg toLogArg(unsigned x) { LogArg a; a.tag = 'u'; a.v.u = x; a.s = nullptr; return a; }
+inline LogArg toLogArg(unsigned long x) { LogArg a; a.tag = 'u'; a.v.u = (uint32_t)x; a.s = nullptr; return a; }
+inline LogArg toLogArg(float x) { LogArg a; a.tag = 'f'; a.v.f = x; a.s = nullptr; return a; }
+inline LogArg toLogArg(double x) { LogArg a; a.tag = 'f'; a.v.f = (float)x; a.s = nullptr; return a; }
+inline LogArg toLogArg(const char* x) { LogArg a; a.tag = 's'; a.v.u = 0; a.s = x ? x : ""; return a; }
+#ifdef ARDUINO
+inline LogArg toLogArg(const String& x) { return toLogArg(x.c_str()); }
+#endif
+
+// 遅延バイナリロガー
+// ホットパスではフォーマットIDと引数をRAMリングバッファにコピーするだけで、
+// 文字列整形とシリアル出力は低優先度のドレインタスクで行う。
+//
+// レコード形式（リトルエンディアン）:
+//   u8 len | u8 level | u16 fmtId | u32 timestampMs | args...
+//   引数: 'i'/'u'/'f' + 4バイト, 's' + u8 長さ + 文字列（CR/LFは'|'に置換、最大 MAX_STR_ARG バイト）
+// バッファが一杯の場合は新しいレコードを破棄し、破棄数を数える（書き込み側をブロックしない）
+class LogRing {
+public:
+  static const size_t MAX_RECORD = 255;
+  static const size_t MAX_STR_ARG = 64;
+  static const size_t MAX_ARGS = 6;
+  static const size_t HEADER_SIZE = 8;
+
+  typedef uint32_t (*ClockFn)();
+
+  LogRing(uint8_t* buffer, size_t size, ClockFn clock);
+
+  void setLevel(LogLevel level) { level_ = level; }
+  LogLevel level() const { return level_; }
+  bool enabled(LogLevel level) const { return level != LOG_LEVEL_NONE && level <= level_; }
+
+  bool write(LogLevel level, uint16_t fmtId, const LogArg* args, size_t argCount);
+
+  template <typename... Args>
+  bool log(LogLevel level, uint16_t fmtId, const Args&... args) {
+    if (!enabled(level)) return false;
+    LogArg list[sizeof...(Args) > 0 ? sizeof...(Args) : 1] = { toLogArg(args)... };
+    return write(level, fmtId, list, sizeof...(Args));
+  }
+
+  // 1レコードを out に取り出す（レコード長を返す。空なら0）
+  size_t read(uint8_t* out, size_t outSize);
+
+  // レコードをテキストへ整形する（"[  12345] I message" 形式）。書き込んだ文字数を返す
+  // 引数の長さがレコードに収まらない（壊れた）レコードは 0 を返す
+  static size_t format(const uint8_t* record, size_t len, char* out, size_t outSize);
+
+  size_t used() const;
+  size_t capacity() const { return size_; }
+  uint32_t written() const { return written_; }
+  uint32_t dropped() const { return dropped_; }
+  // 破棄数を読み出してクリアする（ドレインタスクが通知に使う）
+  uint32_t takeDropped();
+
+private:
+  void lock();
+  void unlock();
+  void putBytes(size_t pos, const uint8_t* src, size_t n);
+  void getBytes(size_t pos, uint8_t* dst, size_t n) const;
+
+  uint8_t* buf_;
+  size_t size_;
+  size_t head_;   // 次に書き込む位置
+  size_t tail_;   // 次に読み出す位置
+  size_t count_;  // 使用中バイト数
+  ClockFn clock_;
+  volatile LogLevel level_;
+  uint32_t written_;
+  uint32_t dropped_;
+  uint32_t droppedReported_;
+#ifdef ARDUINO
+  portMUX_TYPE mux_;
+#endif
+};
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "at_command.h"
+#include "system_clock.h"
+
+// モデムとのバイト列のやり取り（実機は UART、ホストでは応答を模擬するエミュレータ）
+class AtChannel {
+public:
+  virtual ~AtChannel() {}
+  virtual void write(const uint8_t* data, size_t len) = 0;
+  // 受信済みの1バイト（無ければ -1）
+  virtual int read() = 0;
+};
+
+struct AtClientStats {
+  uint32_t commands;     // 送ったコマンド数
+  uint32_t timeouts;     // 最終結果コード（またはプロンプト）を待ち切れなかった数
+  uint64_t txBytes;      // 送ったバイト数（コマンド + 本文）
+  uint64_t rxBytes;      // 受けたバイト数
+};
+
+// AT コマンドの送信と応答の集約（ヒープ確保なし）
+// 応答待ちの間に届いた URC のうち、ソケットの受信通知（+CADATAIND）と切断（+CASTATE: n,0）は記録しておき、
+// takeDataIndication() / takeSocketClosed() で取り出す
+class AtClient {
+public:
+  AtClient(AtChannel& channel, SystemClock* clock);
+
+  void setClock(SystemClock* clock) { clock_ = clock; }
+  SystemClock* clock() const { return clock_; }
+
+  // cmd（先頭の "AT" を除く）を送る。空文字列（組み立てに失敗したコマンド）は送らず false
+  bool send(const char* cmd);
+  // cmd を送って最終結果コード（stopOnPrompt なら "> " も）まで応答を集約する。タイムアウトなら false
+  bool query(const char* cmd, uint32_t timeoutMs, AtReply& reply, bool stopOnPrompt = false);
+  // 送信済みのコマンド・本文に対する応答を待つ
+  bool await(uint32_t timeoutMs, AtReply& reply, bool stopOnPrompt = false);
+  // 次の応答・URC を1つ待つ（timeoutMs = 0 なら受信済みの分だけ見る）
+  bool next(AtEvent& ev, uint32_t timeoutMs);
+  // プロンプト後の本文など、行として扱わないバイト列を送る
+  void writeRaw(const uint8_t* data, size_t len);
+  // "<prefix><長さ><sep>" に続く本文を読む（+SHREAD: n\r\n... / +CARECV: n,...）
+  // out に収まらない分は読み捨てる。戻り値は本文の長さ（out に入れた分ではない）、タイムアウトなら -1
+  int32_t readPayload(const char* prefix, char sep, uint8_t* out, size_t outSize, size_t& stored, uint32_t timeoutMs);
+
+  bool takeDataIndication(uint8_t cid);
+  bool takeSocketClosed(uint8_t cid);
+
+  const AtClientStats& stats() const { return stats_; }
+  void resetStats();
+
+private:
+  int readByte(uint32_t startMs, uint32_t timeoutMs);
+  void note(const AtEvent& ev);
+
+  AtChannel& channel_;
+  SystemClock* clock_;
+  AtTokenizer tokenizer_;
+  AtClientStats stats_;
+  uint16_t dataPending_;   // bit n = cid n に受信データあり
+  uint16_t closed_;        // bit n = cid n が切断された
+};
+
+// TCP ソケット（TinyGsmClient 相当。ホストではエミュレータ）
+class ModemSocket {
+public:
+  virtual ~ModemSocket() {}
+  virtual bool connect(const char* host, uint16_t port, uint32_t timeoutMs) = 0;
+  virtual size_t write(const uint8_t* data, size_t len) = 0;
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual bool connected() = 0;
+  virtual void stop() = 0;
+};
+
+// バックエンドが提供する機能（NATIVE_* はモデム内蔵のスタックで処理する高速経路）
+enum ModemCapability : uint8_t {
+  MODEM_CAP_UDP = 1 << 0,
+  MODEM_CAP_MQTT = 1 << 1,
+  MODEM_CAP_HTTP = 1 << 2,
+  MODEM_CAP_NATIVE_UDP = 1 << 3,   // +CAOPEN/+CASEND
+  MODEM_CAP_NATIVE_MQTT = 1 << 4,  // +SMCONF/+SMCONN/+SMPUB（設定は呼び出し側が +SMCONF で行う）
+  MODEM_CAP_NATIVE_HTTP = 1 << 5,  // +SHCONF/+SHREQ/+SHREAD
+};
+
+// 送信の結果。NOT_STARTED は回線に何も出ていない（プロンプトなし・未接続・コマンドを組み立てられない）
+enum ModemSendResult : uint8_t {
+  MODEM_SEND_OK = 0,
+  MODEM_SEND_NOT_STARTED = 1,
+  MODEM_SEND_FAILED = 2,           // 本文は送ったが完了を確認できなかった
+};
+
+struct MqttSettings {
+  const char* host;
+  uint16_t port;
+  const char* clientId;
+  uint16_t keepAliveSec;
+  bool cleanSession;
+};
+
+// 送信経路の抽象化。UDP 送信・MQTT 発行・HTTP GET を機能として公開し、
+// 呼び出し側は capabilities() を見て使える経路を選ぶ
+class ModemBackend {
+public:
+  virtual ~ModemBackend() {}
+  virtual const char* name() const = 0;
+  virtual uint8_t capabilities() const = 0;
+  bool has(uint8_t caps) const { return (capabilities() & caps) == caps; }
+
+  virtual bool udpOpen(const char* host, uint16_t port, uint32_t timeoutMs) {
+    (void)host; (void)port; (void)timeoutMs;
+    return false;
+  }
+  virtual ModemSendResult udpSend(const uint8_t* data, size_t len) {
+    (void)data; (void)len;
+    return MODEM_SEND_NOT_STARTED;
+  }
+  virtual void udpClose() {}
+
+  // MQTT の接続先とセッション設定（NATIVE_MQTT では呼び出し側が +SMCONF で設定するため使わない）
+  virtual void setMqttSettings(const MqttSettings& settings) { (void)settings; }
+  // 設定済みの値と同じか（異なれば張り直しが必要）
+  virtual bool mqttSettingsApplied(const MqttSettings& settings) const { (void)settings; return true; }
+  virtual bool mqttConnect(uint32_t timeoutMs) = 0;
+  virtual bool mqttConnected() = 0;
+  virtual ModemSendResult mqttPublish(const char* topic, const uint8_t* payload, size_t len, int qos) = 0;
+  virtual void mqttDisconnect() = 0;
+
+  // HTTP GET。本文は body に終端NUL付きで入れる（収まらない分は捨てる）。
+  // 戻り値は HTTP ステータス、接続・応答の失敗は -1
+  virtual int httpGet(const char* host, uint16_t port, const char* path, char* body, size_t bodySize) = 0;
+
+  // 直前のコマンドの応答（ログ用）。AT の応答を持たないバックエンドは nullptr
+  virtual const AtReply* lastReply() const { return nullptr; }
+};
+
+// SIM7080 の内蔵スタックを使うバックエンド（UDP: cid 0, MQTT: +SM*, HTTP: +SH*）
+class Sim7080Backend : public ModemBackend {
+public:
+  explicit Sim7080Backend(AtClient& at);
+
+  const char* name() const override { return "sim7080-native"; }
+  uint8_t capabilities() const override {
+    return MODEM_CAP_UDP | MODEM_CAP_MQTT | MODEM_CAP_HTTP |
+           MODEM_CAP_NATIVE_UDP | MODEM_CAP_NATIVE_MQTT | MODEM_CAP_NATIVE_HTTP;
+  }
+
+  bool udpOpen(const char* host, uint16_t port, uint32_t timeoutMs) override;
+  ModemSendResult udpSend(const uint8_t* data, size_t len) override;
+  void udpClose() override;
+
+  bool mqttConnect(uint32_t timeoutMs) override;
+  bool mqttConnected() override;
+  ModemSendResult mqttPublish(const char* topic, const uint8_t* payload, size_t len, int qos) override;
+  void mqttDisconnect() override;
+
+  int httpGet(const char* host, uint16_t port, const char* path, char* body, size_t bodySize) override;
+
+  const AtReply* lastReply() const override { return &reply_; }
+
+private:
+  AtClient& at_;
+  AtReply reply_;
+  char httpUrl_[64];       // +SHCONF で設定済みの URL（同じなら送らない）
+  bool httpConfigured_;    // BODYLEN/HEADERLEN 設定済み
+};
+
+// TCP ソケットだけを使う汎用バックエンド（TinyGSM が対応する任意のモデム向け）
+// MQTT 3.1.1（CONNECT/PUBLISH/PUBACK のみ）と HTTP/1.1 GET をソケット上で組み立てる。UDP は提供しない
+class GenericBackend : public ModemBackend {
+public:
+  GenericBackend(ModemSocket& mqttSocket, ModemSocket& httpSocket, SystemClock* clock);
+
+  void setClock(SystemClock* clock) { clock_ = clock; }
+
+  const char* name() const override { return "tinygsm-generic"; }
+  uint8_t capabilities() const override { return MODEM_CAP_MQTT | MODEM_CAP_HTTP; }
+
+  void setMqttSettings(const MqttSettings& settings) override;
+  bool mqttSettingsApplied(const MqttSettings& settings) const override;
+  bool mqttConnect(uint32_t timeoutMs) override;
+  bool mqttConnected() override;
+  ModemSendResult mqttPublish(const char* topic, const uint8_t* payload, size_t len, int qos) override;
+  void mqttDisconnect() override;
+
+  int httpGet(const char* host, uint16_t port, const char* path, char* body, size_t bodySize) override;
+
+private:
+  int readByte(ModemSocket& s, uint32_t startMs, uint32_t timeoutMs);
+  bool readPacket(uint8_t expectedType, uint8_t* out, size_t outSize, uint32_t timeoutMs);
+
+  ModemSocket& mqtt_;
+  ModemSocket& http_;
+  SystemClock* clock_;
+  char host_[64];
+  char clientId_[64];
+  uint16_t port_;
+  uint16_t keepAliveSec_;
+  bool cleanSession_;
+  bool session_;
+  uint16_t packetId_;
+  uint32_t lastTxMs_;
+};
+
+// MQTT 3.1.1 のパケットを組み立てる（GenericBackend とエミュレータで共用）。長さを返す（収まらなければ 0）
+size_t mqttEncodeConnect(uint8_t* out, size_t outSize, const char* clientId, uint16_t keepAliveSec, bool cleanSession);
+// PUBLISH の固定ヘッダ・トピック・パケットID（本文は続けて送る）
+size_t mqttEncodePublishHeader(uint8_t* out, size_t outSize, const char* topic, size_t payloadLen, int qos,
+                               uint16_t packetId);
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "modem_backend.h"
+#include "system_clock.h"
+
+// SIM7080 の AT 応答を模擬するエミュレータ（ホストでの検証・-DMODEM_BENCHMARK 用）
+// UART の転送時間（10ビット/バイト）、モデム内の処理時間、回線の往復時間を VirtualClock 上で再現し、
+// バックエンド毎の1送信あたりのコマンド数・UART バイト数・往復回数・所要時間を比べられるようにする。
+// 対応するコマンド: +CAOPEN/+CASEND/+CARECV/+CACLOSE（UDP/TCP）、+SMCONN/+SMPUB/+SMSTATE/+SMDISC、
+// +SHCONF/+SHCONN/+SHREQ/+SHREAD/+SHDISC、+CNACT?、+CSQ/+CESQ（"AT+CSQ;+CESQ" の連結を含む）。それ以外は OK を返す。
+// TCP の相手は port 1883 なら MQTT ブローカー（CONNACK/PUBACK/PINGRESP）、それ以外は HTTP サーバー
+// setFaults() で時刻を指定した障害（回線断・応答の遅れ・ERROR）を注入できる（ソークのシミュレーション用）
+struct EmulatorConfig {
+  uint32_t baud = 115200;
+  uint32_t commandMs = 5;      // モデム内で完結するコマンドの処理時間
+  uint32_t rttMs = 300;        // 回線の往復時間（LTE-M の典型値）
+  int16_t rsrpDbm = -95;       // +CESQ で返す RSRP（FAULT_WEAK_SIGNAL の区間外）
+};
+
+// 注入する障害の種類
+enum EmulatorFaultKind : uint8_t {
+  FAULT_OUTAGE = 0,  // 回線断: +CNACT? は PDP 未接続、回線を使うコマンドは ERROR。開いていたソケット・MQTT は切れる
+  FAULT_SLOW = 1,    // 全てのコマンドの応答が value [ms] 遅れる（AT のタイムアウトを超えると遅れた応答が後から届く）
+  FAULT_ERROR = 2,   // 回線を使うコマンドの value 回に1回が ERROR
+  FAULT_WEAK_SIGNAL = 3,  // +CSQ/+CESQ が RSRP -value [dBm] を返す（送信の失敗・遅れは FAULT_ERROR/FAULT_SLOW を重ねて与える）
+};
+
+// 障害の予定（時刻は VirtualClock の起動からの秒。区間が重なれば両方が効く）
+struct EmulatorFault {
+  uint32_t startS;
+  uint32_t durationS;
+  EmulatorFaultKind kind;
+  uint32_t value;
+};
+
+struct EmulatorStats {
+  uint32_t commands;
+  uint32_t prompts;
+  uint32_t networkRoundTrips;  // 応答を待つ必要のある回線の往復（TCP 接続・CONNACK・PUBACK・HTTP 応答）
+  uint32_t udpDatagrams;
+  uint32_t mqttMessages;
+  uint32_t httpRequests;
+  uint64_t hostToModemBytes;
+  uint64_t modemToHostBytes;
+  uint32_t faultErrors;        // 障害の注入で ERROR を返したコマンド（回線断・FAULT_ERROR）
+  uint32_t slowResponses;      // FAULT_SLOW で遅らせたコマンド
+};
+
+class Sim7080Emulator : public AtChannel {
+public:
+  static const size_t SOCKETS = 4;
+
+  explicit Sim7080Emulator(VirtualClock& clock, const EmulatorConfig& config = EmulatorConfig());
+
+  void write(const uint8_t* data, size_t len) override;
+  int read() override;
+
+  // HTTP サーバーが返す本文
+  void setHttpBody(const char* body) { httpBody_ = body; }
+  // 障害の予定（faults は呼び出し側が保持する）
+  void setFaults(const EmulatorFault* faults, size_t count);
+  // 現在の時刻で有効な kind の障害があれば value を返す
+  bool faultActive(EmulatorFaultKind kind, uint32_t* value = nullptr) const;
+  const EmulatorStats& stats() const { return stats_; }
+  void resetStats();
+
+private:
+  struct Socket {
+    bool open;
+    bool tcp;
+    uint16_t port;
+    uint8_t in[512];      // サーバーが受けたバイト列（パケット・リクエスト単位で処理）
+    size_t inLen;
+    uint8_t rx[1536];     // モデムが受けて +CARECV で渡すバイト列
+    size_t rxLen;
+  };
+  struct Chunk {
+    uint64_t readyUs;
+    uint16_t start;
+    uint16_t len;
+  };
+  enum PendingPayload : uint8_t { PAYLOAD_NONE = 0, PAYLOAD_CASEND = 1, PAYLOAD_SMPUB = 2 };
+
+  uint64_t byteUs() const { return 10000000ULL / config_.baud; }
+  void handleLine(const char* line);
+  void handlePayload();
+  void respond(uint32_t delayMs, const char* text);
+  void respondBytes(uint32_t delayMs, const uint8_t* data, size_t len);
+  void serverReceive(uint8_t cid, const uint8_t* data, size_t len);
+  void serverReply(uint8_t cid, const uint8_t* data, size_t len);
+  // 回線を使うコマンドを障害で失敗させるなら ERROR を返して true
+  bool rejectNetworkCommand();
+
+  VirtualClock& clock_;
+  EmulatorConfig config_;
+  EmulatorStats stats_;
+  const char* httpBody_;
+
+  char line_[320];
+  size_t lineLen_;
+  bool skipLf_;              // コマンド行の \r に続く \n を本文として扱わない
+  PendingPayload pending_;
+  uint8_t pendingCid_;
+  uint8_t pendingQos_;
+  size_t payloadRemaining_;
+  uint8_t payload_[1536];
+  size_t payloadLen_;
+  uint64_t hostTxDoneUs_;    // ホストから送ったバイトがモデムに届き終わる時刻
+
+  uint8_t out_[8192];
+  size_t outLen_;
+  Chunk chunks_[64];
+  size_t chunkHead_;
+  size_t chunkCount_;
+  size_t chunkPos_;
+  uint64_t lastReadyUs_;     // UART は直列なので応答は順に出る
+
+  Socket sockets_[SOCKETS];
+  bool mqttConnected_;
+  size_t httpLength_;
+
+  const EmulatorFault* faults_;
+  size_t faultCount_;
+  uint32_t networkCommands_;  // FAULT_ERROR の間に受けた回線を使うコマンド
+};
+
+// TinyGSM の SIM7080 ドライバのソケット（TinyGsmClient）の AT のやり取りを模した ModemSocket
+// 接続: +CACLOSE, +CASSLCFG, +CAOPEN / 送信: +CASEND / 受信: +CADATAIND を受けて +CARECV
+class EmulatedTinyGsmSocket : public ModemSocket {
+public:
+  EmulatedTinyGsmSocket(AtClient& at, uint8_t mux);
+
+  bool connect(const char* host, uint16_t port, uint32_t timeoutMs) override;
+  size_t write(const uint8_t* data, size_t len) override;
+  int available() override;
+  int read() override;
+  bool connected() override;
+  void stop() override;
+
+private:
+  void poll();
+
+  AtClient& at_;
+  uint8_t mux_;
+  bool connected_;
+  uint8_t rx_[1460];
+  size_t rxLen_;
+  size_t rxPos_;
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 差分OTAのパッチ形式（DPT1）
+//
+//   "DPT1"                      マジック
+//   oldSize  u32 LE             差分の基準となる旧イメージのサイズ
+//   oldSha256[32]               旧イメージの SHA-256（実行中イメージと一致しなければ適用しない）
+//   newSize  u32 LE
+//   newSha256[32]               適用後イメージの SHA-256
+//   sigLen   u16 LE             ここまで（先頭76バイト）の ECDSA P-256/SHA-256 署名（DER）の長さ
+//   sig[sigLen]
+//   命令列:
+//     0x01 COPY   src u32 LE, len u32 LE   旧イメージの src から len バイトを写す
+//     0x02 INSERT len u32 LE, data[len]    パッチ中のデータをそのまま書く
+//
+// 出力は先頭から順に書き出すため、適用状態（DeltaPatchState）を保存しておけば
+// 任意のバイト位置からダウンロードと適用を再開できる
+#define DELTA_MAGIC "DPT1"
+#define DELTA_SIGNED_SIZE 76          // 署名対象のヘッダ部
+#define DELTA_SIGNATURE_MAX 80        // P-256 の DER 署名は最大72バイト
+#define DELTA_HEADER_MAX (DELTA_SIGNED_SIZE + 2 + DELTA_SIGNATURE_MAX)
+
+enum DeltaOpcode : uint8_t {
+  DELTA_OP_COPY = 0x01,
+  DELTA_OP_INSERT = 0x02,
+};
+
+struct DeltaHeader {
+  uint32_t oldSize;
+  uint8_t oldSha256[32];
+  uint32_t newSize;
+  uint8_t newSha256[32];
+  uint16_t sigLen;
+  uint8_t sig[DELTA_SIGNATURE_MAX];
+  uint32_t size;                // ヘッダ全体のバイト数（命令列の開始位置）
+};
+
+// ヘッダを解析する。データ不足・形式不正なら false
+bool parseDeltaHeader(const uint8_t* data, size_t len, DeltaHeader& h);
+
+// 旧イメージの読み出しと新イメージの書き込み（実機はOTAパーティション、ホストではファイル/メモリ）
+class DeltaIo {
+public:
+  virtual ~DeltaIo() {}
+  virtual bool readOld(uint32_t offset, uint8_t* buf, size_t len) = 0;
+  virtual bool writeNew(uint32_t offset, const uint8_t* data, size_t len) = 0;
+};
+
+enum DeltaPhase : uint8_t {
+  DELTA_PHASE_OPCODE = 0,  // 次の命令バイト待ち
+  DELTA_PHASE_ARGS = 1,    // 命令の引数を受信中
+  DELTA_PHASE_INSERT = 2,  // INSERT のデータを受信中
+  DELTA_PHASE_DONE = 3,
+  DELTA_PHASE_ERROR = 4,
+};
+
+// 適用状態（チャンク境界や再起動を跨いで保存できる POD）
+struct DeltaPatchState {
+  uint32_t patchOffset;    // 消費したパッチのバイト数（ヘッダを含む。次に要求する Range の先頭）
+  uint32_t outputOffset;   // 書き出した新イメージのバイト数
+  uint32_t remaining;      // INSERT の残りバイト数
+  uint8_t phase;           // DeltaPhase
+  uint8_t opcode;
+  uint8_t argFill;         // 受信済みの引数バイト数
+  uint8_t args[8];
+};
+
+// ストリーミング適用器。パッチ本文を任意の長さに分割して与えられる
+class DeltaPatcher {
+public:
+  explicit DeltaPatcher(DeltaIo& io);
+
+  // ヘッダ解析済みのパッチを先頭から適用する
+  void begin(const DeltaHeader& h);
+  // 保存しておいた状態から再開する
+  void resume(const DeltaHeader& h, const DeltaPatchState& state);
+
+  // 命令列を与える。形式不正・範囲外・I/O 失敗で false（以降は failed()）
+  bool feed(const uint8_t* data, size_t len);
+
+  bool done() const { return state_.phase == DELTA_PHASE_DONE; }
+  bool failed() const { return state_.phase == DELTA_PHASE_ERROR; }
+  const char* error() const { return error_; }
+  const DeltaPatchState& state() const { return state_; }
+
+  uint32_t copiedBytes() const { return copied_; }
+  uint32_t insertedBytes() const { return inserted_; }
+
+private:
+  bool fail(const char* reason);
+  bool execute();
+  bool write(const uint8_t* data, size_t len);
+
+  DeltaIo& io_;
+  DeltaPatchState state_;
+  uint32_t oldSize_;
+  uint32_t newSize_;
+  uint32_t copied_;
+  uint32_t inserted_;
+  const char* error_;
+};
+
+// ダウンロードの進捗（NVS に保存し、再起動や回線断の後に続きから取得する）
+#define OTA_PROGRESS_MAGIC 0x4F544131UL  // "OTA1"
+struct OtaProgress {
+  uint32_t magic;
+  char version[24];        // 適用中の ota_version
+  uint32_t urlHash;        // ota_url の FNV-1a（URL が変わったら最初から）
+  uint32_t patchSize;      // Content-Range から得たパッチ全体のサイズ
+  DeltaHeader header;
+  DeltaPatchState state;
+  uint32_t resumes;        // 中断からの再開回数
+  uint32_t downloaded;     // 通信で受信した本文の合計（再送分を含む）
+  uint32_t elapsedMs;      // ダウンロードに費やした時間の合計
+};
+
+uint32_t fnv1a32(const char* s);
+
+// "http://host[:port]/path" を分解する（https は非対応）。形式不正なら false
+bool parseHttpUrl(const char* url, char* host, size_t hostSize, uint16_t& port, char* path, size_t pathSize);
+
+// "bytes 0-8191/123456" から先頭・末尾・全体サイズを取り出す
+bool parseContentRange(const char* value, uint32_t& first, uint32_t& last, uint32_t& total);
+
+// 16進表記（小文字）で書き出す。out は 2*len+1 バイト以上
+void formatHex(const uint8_t* data, size_t len, char* out);
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// MQTT ペイロードの形式（メタデータ format キー）
+enum PayloadFormat : uint8_t {
+  FORMAT_JSON = 0,
+  FORMAT_CBOR = 1,     // RFC 8949
+  FORMAT_MSGPACK = 2,
+};
+
+const char* payloadFormatName(PayloadFormat f);
+// "json" / "cbor" / "msgpack"（大文字小文字は区別しない）。不明なら false
+bool parsePayloadFormat(const char* name, PayloadFormat& f);
+
+// 1回分の読み取り値
+struct ReadingValues {
+  float co2;
+  float temp;
+  float humi;
+  float wind;
+  uint32_t ts;
+};
+
+// 読み取り値に添付する位置（最後の測位結果）
+struct ReadingPosition {
+  bool valid;       // 未測位なら false
+  int32_t latE6;    // 緯度 x1e6 [deg]
+  int32_t lonE6;    // 経度 x1e6 [deg]
+  uint32_t ageS;    // 測位からの経過秒
+  float hdop;
+};
+
+// 呼び出し側のバッファへ直接書き込む CBOR / MessagePack エンコーダ（ヒープ確保なし）
+// バッファ不足時は以降の書き込みを捨て ok() が false になる
+class CompactWriter {
+public:
+  CompactWriter(PayloadFormat format, uint8_t* buf, size_t capacity);
+
+  void beginMap(uint8_t entries);
+  void key(const char* k);
+  void uintValue(uint32_t v);
+  void intValue(int32_t v);
+  // decimals 桁に丸めた値を、その精度を失わない最短の表現で書く
+  // （整数になれば整数、CBOR では半精度で足りれば半精度、それ以外は単精度）
+  void floatValue(float v, uint8_t decimals);
+
+  bool ok() const { return ok_; }
+  size_t size() const { return ok_ ? len_ : 0; }
+
+private:
+  void put(uint8_t b);
+  void putBE(uint32_t v, uint8_t bytes);
+  void cborHead(uint8_t major, uint32_t v);
+
+  PayloadFormat format_;
+  uint8_t* buf_;
+  size_t cap_;
+  size_t len_;
+  bool ok_;
+};
+
+// 読み取り値を指定形式で書き込み、バイト数を返す（失敗時0）
+// JSON は {"co2":612.0,"temp":26.1,"humi":54.2,"wind":0.72,"ts":1714566896}（終端NULは含めない）
+// pos が有効なら "lat_e6","lon_e6"（整数の 1e-6 度）と "fix_age"（秒）を加える
+size_t encodeReading(PayloadFormat f, const ReadingValues& r, uint8_t* out, size_t outSize,
+                     const ReadingPosition* pos = nullptr);
+
+// UDP の読み取り値フレーム（メタデータ udp_format）
+// 既定の float は運用中の Harvest のバイナリパーサー設定をそのまま使えるよう、種別バイトを持たない従来の並び。
+// ヘルス 0xA1 / エピソード 0xA2 / メトリクス 0xA3 の補助フレームと先頭の種別で読み分けたい場合は
+// float_v2（0xF1）または compact（0xC1/0xC2）を選び、パーサー設定もあわせて変える
+enum UdpFrameFormat : uint8_t {
+  UDP_FRAME_FLOAT = 0,     // float32 x4 + ts（20バイト, 従来の形式）
+  UDP_FRAME_COMPACT = 1,   // 固定小数点 + 状態ビット（14バイト）
+  UDP_FRAME_FLOAT_V2 = 2,  // 種別 + float32 x4 + ts（21バイト）
+};
+
+const char* udpFrameFormatName(UdpFrameFormat f);
+// "float" / "compact" / "float_v2"（大文字小文字は区別しない）。不明なら false
+bool parseUdpFrameFormat(const char* name, UdpFrameFormat& f);
+// 読み取り値フレームのバイト数（withPosition は compact の位置付き形式）
+size_t udpReadingFrameSize(UdpFrameFormat f, bool withPosition);
+
+// float の読み取り値フレーム（リトルエンディアン）
+// float（20バイト）: 先頭16バイトは導入当初の形式と同じで、既存のパーサー設定のまま読める
+//   0: f32 CO2 [ppm] / 4: f32 温度 [°C] / 8: f32 湿度 [%RH] / 12: f32 風速 [m/s]
+//  16: u32 サンプル時刻（UTCエポック秒, 未同期なら0）
+// float_v2（21バイト）: 先頭に種別（0xF1）を置き、以降は上と同じ並び
+static const size_t FLOAT_READING_FRAME_SIZE = 20;
+static const uint8_t FLOAT_V2_READING_FRAME_TYPE = 0xF1;
+static const size_t FLOAT_V2_READING_FRAME_SIZE = 21;
+
+// typed が true なら float_v2
+size_t encodeFloatReading(const ReadingValues& r, bool typed, uint8_t* out, size_t outSize);
+// 長さで形式を判別する（21バイトは種別も確認）。どちらでもなければ false
+bool decodeFloatReading(const uint8_t* in, size_t len, ReadingValues& r);
+
+// 固定小数点の読み取り値フレーム（リトルエンディアン, 14バイト）
+//   0: u8  版（0xC1。ヘルス 0xA1 / エピソード 0xA2 / メトリクス 0xA3 とも区別できる）
+//   1: u8  状態 bit0 SCD40 OK, bit1 FS3000 OK, bit2 間引いた値との平均, bit3 しきい値超過の即時送信
+//   2: u16 CO2 ppm
+//   4: i16 温度 x100 [°C]
+//   6: u16 湿度 x100 [%RH]
+//   8: u16 風速 x100 [m/s]
+//  10: u32 サンプル時刻（UTCエポック秒, 未同期なら0）
+// 量子化誤差は CO2 ±0.5 ppm, 温湿度・風速 ±0.005 で、各センサーの精度
+// （SCD40: ±(50 ppm + 5%), ±0.8 °C, ±6 %RH / FS3000-1005: ±5% FS）より十分小さい
+// 範囲外の値は各型の上下限に飽和する
+//
+// 位置付き（GNSS 有効時は未測位でもこの形式で送り、フレーム長を一定に保つ。24バイト）
+//   0: u8  版（0xC2）
+//   1..13: 上と同じ
+//  14: i32 緯度 x1e6 [deg]（未測位なら0）
+//  18: i32 経度 x1e6 [deg]（未測位なら0）
+//  22: u8  HDOP x10（25.5 で飽和）
+//  23: u8  測位からの経過分（254 で飽和, 未測位なら 255）
+static const uint8_t COMPACT_READING_VERSION = 0xC1;
+static const size_t COMPACT_READING_FRAME_SIZE = 14;
+static const uint8_t COMPACT_POSITION_VERSION = 0xC2;
+static const size_t COMPACT_POSITION_FRAME_SIZE = 24;
+static const uint8_t READING_STATUS_SCD40_OK = 0x01;
+static const uint8_t READING_STATUS_FS3000_OK = 0x02;
+static const uint8_t READING_STATUS_COALESCED = 0x04;
+static const uint8_t READING_STATUS_ALARM = 0x08;
+
+// pos を渡すと位置付きの形式になる
+size_t encodeCompactReading(const ReadingValues& r, uint8_t status, uint8_t* out, size_t outSize,
+                            const ReadingPosition* pos = nullptr);
+// 版・長さが一致しなければ false（位置付きの形式で pos が nullptr なら位置は読み捨てる）
+bool decodeCompactReading(const uint8_t* in, size_t len, ReadingValues& r, uint8_t& status,
+                          ReadingPosition* pos = nullptr);
+
+// CBOR / MessagePack の読み取り値をデコードする（受信側・検証用）
+// 未知のキー（値は数値）は無視する。形式不正なら false
+// pos を渡すと位置のキーも読む（無ければ valid は false）
+bool decodeReading(PayloadFormat f, const uint8_t* data, size_t len, ReadingValues& r,
+                   ReadingPosition* pos = nullptr);
+
+// IEEE 754 半精度との変換（最近接偶数丸め）
+uint16_t floatToHalf(float f);
+float halfToFloat(uint16_t h);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 無線アクセス方式
+enum RadioAccess : uint8_t {
+  RAT_UNKNOWN = 0,
+  RAT_CATM = 1,    // LTE Cat-M1（+CMNB=1）
+  RAT_NBIOT = 2,   // NB-IoT（+CMNB=2）
+};
+
+const char* radioAccessName(RadioAccess rat);
+// +CBANDCFG の方式名（"CAT-M" / "NB-IOT"）
+const char* radioAccessBandCfgName(RadioAccess rat);
+
+#define REGISTRATION_HINT_MAGIC 0x52454731UL  // "REG1"
+#define REGISTRATION_MAX_BAND 95
+
+// 前回登録に成功した事業者・方式・バンドの記録（NVS に保存する想定）
+struct RegistrationHint {
+  uint32_t magic;
+  uint8_t rat;          // RadioAccess
+  char plmn[8];         // MCC+MNC（例: "44010"）
+  uint32_t bands[3];    // 登録できたバンドのビット集合（bit n = バンド n）
+  uint16_t successes;   // このヒントで登録できた回数
+};
+
+void clearRegistrationHint(RegistrationHint& hint);
+bool registrationHintValid(const RegistrationHint& hint);
+void addRegistrationBand(RegistrationHint& hint, uint8_t band);
+bool hasRegistrationBand(const RegistrationHint& hint, uint8_t band);
+// "1,8,18" の形式でバンド一覧を書き出す（+CBANDCFG 用）。バンドがなければ0
+size_t formatBandList(const RegistrationHint& hint, char* out, size_t outSize);
+
+// +CPSI? 応答（例: +CPSI: LTE CAT-M1,Online,440-10,0x1A2B,...,EUTRAN-BAND1,...）から
+// 方式・PLMN・バンドを取り出す。サービスなし/形式不正なら false
+bool parseCpsi(const char* response, RadioAccess& rat, char* plmn, size_t plmnSize, uint8_t& band);
+
+// 観測した登録結果でヒントを更新する。内容が変わった（保存が必要な）場合 true
+bool updateRegistrationHint(RegistrationHint& hint, RadioAccess rat, const char* plmn, uint8_t band);
+
+// 登録所要時間の統計（起動時と復旧時を区別して記録する）
+struct RegistrationStats {
+  uint32_t attempts;
+  uint32_t fastHits;     // キャッシュした条件に絞った探索で登録できた回数
+  uint32_t widened;      // 絞り込みで登録できず全方式/全バンドに広げた回数
+  uint32_t failures;
+  uint32_t lastMs;
+  uint32_t bestMs;
+  uint32_t worstMs;
+  uint64_t totalMs;      // 成功時の合計
+
+  void record(uint32_t ms, bool ok, bool fast, bool widenedSearch);
+  uint32_t averageMs() const;
+};
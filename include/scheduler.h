@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 期限超過時の扱い
+enum MissPolicy : uint8_t {
+  MISS_SKIP = 0,      // 逃した期限は捨て、次の周期境界に合わせる（位相は維持）
+  MISS_CATCH_UP = 1,  // 逃した期限を順に発火させる（上限 maxCatchUp 回、超過分は捨てる）
+};
+
+// タイマー毎の統計
+struct TimerStats {
+  const char* name;
+  uint32_t fired;
+  uint32_t skipped;        // MISS_SKIP または上限超過で捨てた期限の数
+  uint32_t lastLateMs;     // 直近の発火遅れ（期限からの経過）
+  uint32_t maxLateMs;
+  uint64_t totalLateMs;
+};
+
+// 期限ベースのスケジューラ
+// 次回期限は「前回期限 + 周期」で進めるため、処理時間やブロッキングで周期がずれない。
+// 時刻は呼び出し側から渡す（実機は millis()、ホストでは仮想時計でテストできる）
+class DeadlineScheduler {
+public:
+  static const size_t MAX_TIMERS = 8;
+
+  DeadlineScheduler();
+
+  // タイマーを登録してIDを返す（登録できなければ -1）。最初の期限は nowMs + firstDelayMs
+  int add(const char* name, uint32_t periodMs, MissPolicy policy, uint32_t nowMs,
+          uint32_t firstDelayMs = 0, uint8_t maxCatchUp = 3);
+
+  // 周期を変更する。次回期限は nowMs + periodMs に取り直す
+  void setPeriod(int id, uint32_t periodMs, uint32_t nowMs);
+  uint32_t period(int id) const;
+  void setEnabled(int id, bool enabled);
+
+  // 次の期限を nowMs にする（即時実行の要求）
+  void trigger(int id, uint32_t nowMs);
+
+  // 期限が来ているタイマーのうち最も期限が早いもの（同時なら登録順）のIDを返し、
+  // 次回期限を進める。期限到来がなければ -1
+  int poll(uint32_t nowMs);
+
+  // 次の期限までの時間（期限到来済みなら0、タイマーがなければ UINT32_MAX）
+  uint32_t msUntilNext(uint32_t nowMs) const;
+  // 指定タイマーの次の期限までの時間（期限到来済みなら0、無効なら UINT32_MAX）
+  uint32_t msUntil(int id, uint32_t nowMs) const;
+
+  const TimerStats* stats(int id) const;
+  size_t count() const { return count_; }
+
+private:
+  struct Timer {
+    uint32_t periodMs;
+    uint32_t dueMs;
+    MissPolicy policy;
+    uint8_t maxCatchUp;
+    uint8_t pendingCatchUp;
+    bool enabled;
+    TimerStats stats;
+  };
+
+  bool valid(int id) const { return id >= 0 && (size_t)id < count_; }
+  static bool reached(uint32_t nowMs, uint32_t dueMs) { return (int32_t)(nowMs - dueMs) >= 0; }
+
+  Timer timers_[MAX_TIMERS];
+  size_t count_;
+};
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdio.h>
+#endif
+
+// ファイル操作の抽象化（一度に開くファイルは1つ）
+// 実機では SdFileStore（SD ライブラリ）、ホスト環境では StdioFileStore（通常のファイル）に差し替えて計測できる
+class LogFileStore {
+public:
+  virtual ~LogFileStore() {}
+  virtual bool makeDir(const char* path) = 0;
+  // ファイルサイズ（存在しなければ -1）
+  virtual int32_t fileSize(const char* path) = 0;
+  // 追記用に開く（無ければ作成）
+  virtual bool openAppend(const char* path) = 0;
+  virtual size_t write(const uint8_t* data, size_t len) = 0;
+  // 書き込んだ内容とファイルサイズを媒体へ確定する
+  virtual bool flush() = 0;
+  virtual void close() = 0;
+  virtual uint32_t nowUs() = 0;
+};
+
+// 1件の読み取り値
+struct SdLogRecord {
+  uint32_t time;      // UTCエポック秒（epochTime=false なら起動からの秒数）
+  bool epochTime;
+  float co2;
+  float temp;
+  float humidity;
+  float windSpeed;
+  bool scd40Ok;
+  bool fs3000Ok;
+};
+
+// ファイルヘッダ（リトルエンディアン, 32バイト）。ファイル作成時に最初に書いて確定する
+//   0: "CO2L"
+//   4: u8  形式バージョン
+//   5: u8  レコード長
+//   6: u16 ヘッダ長
+//   8: u32 作成時刻（UTCエポック秒, 未同期なら0）
+//  12: u32 作成時の起動からの秒数
+//  16: char[12] 装置ID（IMSI の末尾, 0埋め）
+//  28: u16 同日内のファイル番号
+//  30: u16 CRC-16/CCITT（0..29）
+// レコード（16バイト固定）
+//   0: u32 時刻（フラグ bit3 が立っていれば起動からの秒数）
+//   4: u16 CO2 ppm
+//   6: i16 温度 x100
+//   8: u16 湿度 x100
+//  10: u16 風速 x100 (m/s)
+//  12: u8  フラグ bit0 SCD40 OK, bit1 FS3000 OK, bit2 予約（0。記録時点では送信結果が未確定のため持たない）, bit3 時刻が起動からの秒数
+//  13: u8  シーケンス番号（下位8ビット, 欠落の検出用）
+//  14: u16 CRC-16/CCITT（0..13）
+// 電源断でレコードが途中まで書かれていても CRC で検出でき、途中で切れたファイルへは追記しない
+static const uint32_t SD_LOG_MAGIC = 0x4C324F43;  // "CO2L"
+static const uint8_t SD_LOG_VERSION = 1;
+static const size_t SD_LOG_HEADER_SIZE = 32;
+static const size_t SD_LOG_RECORD_SIZE = 16;
+
+uint16_t crc16Ccitt(const uint8_t* data, size_t len);
+size_t encodeSdLogHeader(uint32_t epoch, uint32_t uptimeSec, const char* deviceId, uint16_t fileIndex,
+                         uint8_t* out, size_t outSize);
+bool validSdLogHeader(const uint8_t* in, size_t len);
+size_t encodeSdLogRecord(const SdLogRecord& r, uint8_t seq, uint8_t* out, size_t outSize);
+// CRC 不一致なら false
+bool decodeSdLogRecord(const uint8_t* in, SdLogRecord& r, uint8_t& seq);
+
+struct SdLogStats {
+  uint32_t records;        // バッファへ受け付けた件数
+  uint32_t dropped;        // バッファが一杯で破棄した件数
+  uint32_t bytesWritten;
+  uint32_t blocks;         // 書き出し回数
+  uint32_t partialBlocks;  // 経過時間による端数の書き出し回数
+  uint32_t rotations;
+  uint32_t errors;
+  uint32_t lastFlushUs;    // 1回の書き出し（write + flush）の所要時間
+  uint32_t maxFlushUs;
+  uint64_t totalFlushUs;
+  uint32_t maxBuffered;    // バッファ使用量の最大（バイト）
+};
+
+// SDカードへの読み取り値ロガー
+// - append() はレコードを RAM のリングバッファへ積むだけで、媒体への書き込みを待たない（一杯なら破棄して数える）
+// - service() は書き込み側のタスクから呼び、ファイル上のオフセットが 512 バイト境界に揃うブロック単位で書き出す。
+//   最古のレコードが maxAgeMs を超えて滞留したら端数でも書き出す（電源断で失う範囲の上限）
+// - レコードの日付（UTC）の変わり目とサイズ上限でファイルを切り替える。名前は <dir>/YYYYMMDD_NN.bin
+//   （時刻未同期のまま作ったファイルは 00000000）
+// - 開けない・書けない場合は RETRY_MS 後に次の番号のファイルで再試行する
+class SdLogger {
+public:
+  static const size_t BLOCK_SIZE = 512;
+  static const size_t BUFFER_SIZE = 4096;  // 256件（10秒周期で約42分）
+  static const uint32_t RETRY_MS = 10000;
+
+  SdLogger(LogFileStore& store, const char* dir);
+
+  void configure(uint32_t maxFileBytes, uint32_t maxAgeMs);
+  void setDeviceId(const char* id);
+
+  bool append(const SdLogRecord& r, uint32_t nowMs);
+
+  // 1回の呼び出しで書き出すのは最大1ブロック。書き出し・切り替えをしたら true
+  bool service(uint32_t nowMs);
+  // バッファの残りを全て書き出して閉じる（再起動の直前など）
+  void flushAll(uint32_t nowMs);
+
+  bool fileOpen() const { return open_; }
+  const char* currentPath() const { return path_; }
+  size_t buffered() const { return count_; }
+  SdLogStats stats() const;
+
+private:
+  void lock();
+  void unlock();
+  bool openFile(uint32_t nowMs, uint32_t day, uint32_t createdEpoch);
+  void closeFile();
+  uint32_t recordDayAt(size_t offset, uint32_t* epoch) const;
+  bool writeNext(uint32_t nowMs, bool force);
+  bool writeChunk(size_t len);
+
+  LogFileStore& store_;
+  const char* dir_;
+  char deviceId_[12];
+  uint32_t maxFileBytes_;
+  uint32_t maxAgeMs_;
+
+  uint8_t buf_[BUFFER_SIZE];
+  size_t head_;          // 次に書き込む位置
+  size_t tail_;          // 次に書き出す位置
+  size_t count_;
+  uint32_t oldestMs_;    // バッファ中の最古レコードを受け付けた時刻
+  uint8_t stage_[BLOCK_SIZE];  // 書き出し中のブロック（書き出しの間はリングをロックしない）
+  uint8_t seq_;
+
+  bool open_;
+  char path_[40];
+  uint32_t fileDay_;
+  uint16_t fileIndex_;
+  uint32_t fileBytes_;
+  uint32_t retryAtMs_;
+  bool retryPending_;
+
+  SdLogStats stats_;
+#ifdef ARDUINO
+  portMUX_TYPE mux_;
+#endif
+};
+
+#ifdef ARDUINO
+#include <FS.h>
+
+// 実機用: SD ライブラリ（FS）でのファイル操作
+class SdFileStore : public LogFileStore {
+public:
+  explicit SdFileStore(fs::FS& fs) : fs_(fs) {}
+  bool makeDir(const char* path) override;
+  int32_t fileSize(const char* path) override;
+  bool openAppend(const char* path) override;
+  size_t write(const uint8_t* data, size_t len) override;
+  bool flush() override;
+  void close() override;
+  uint32_t nowUs() override { return micros(); }
+
+private:
+  fs::FS& fs_;
+  fs::File file_;
+};
+#else
+
+// ホスト用: 通常のファイル（stdio）でのファイル操作。パスは root の下に作る
+// sync なら flush() で fsync まで行う（媒体への確定の所要時間を含めて計測する場合）
+class StdioFileStore : public LogFileStore {
+public:
+  explicit StdioFileStore(const char* root, bool sync = false);
+  ~StdioFileStore() override { close(); }
+  bool makeDir(const char* path) override;
+  int32_t fileSize(const char* path) override;
+  bool openAppend(const char* path) override;
+  size_t write(const uint8_t* data, size_t len) override;
+  bool flush() override;
+  void close() override;
+  uint32_t nowUs() override;
+
+private:
+  const char* fullPath(const char* path);
+
+  const char* root_;
+  bool sync_;
+  FILE* file_;
+  char path_[256];
+};
+#endif
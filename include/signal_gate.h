@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "payload_codec.h"
+#include "uplink_budget.h"
+
+// 送信直前に測った電波品質（+CSQ / +CESQ）
+struct SignalSample {
+  uint8_t csq;        // 0-31, 99 = 不明
+  int16_t rsrpDbm;    // 0 = 不明
+};
+
+// 電波品質に応じた送信の延期（メタデータ signal_defer_s / signal_weak_rsrp / signal_weak_csq）
+struct SignalGateConfig {
+  uint32_t maxDeferMs = 900000;   // 定期送信を遅らせる上限（既定15分, 0で無効）
+  int16_t weakRsrpDbm = -110;     // RSRP がこれ未満なら弱電界（+CESQ で取れた場合に優先して使う）
+  int16_t recoverRsrpDbm = -105;  // 弱電界の判定後はこれ以上に戻るまで弱電界とみなす
+  uint8_t weakCsq = 10;           // RSRP 不明時: CSQ がこれ未満なら弱電界（10 = -93 dBm）
+  uint8_t recoverCsq = 13;
+};
+
+struct SignalGateStats {
+  uint32_t samples;
+  uint32_t weakSamples;
+  uint32_t deferred;         // 弱電界のため遅らせた定期送信
+  uint32_t flushes;          // 回復後にまとめて送った回数
+  uint32_t flushedReadings;  // それで送った読み取り値
+  uint32_t forcedFlushes;    // 上限時間に達して弱電界のまま送った回数
+  uint32_t urgentWhileWeak;  // 弱電界でも遅らせなかった ALARM/HEALTH
+  uint32_t maxBurst;
+  uint32_t maxDelayMs;       // 遅らせた読み取り値の送信までの遅れの最大
+  uint64_t totalDelayMs;
+};
+
+// 電波品質を見て定期送信を遅らせるかを決める
+// - 弱電界（RSRP、取れなければ CSQ がしきい値未満）では ROUTINE の送信を遅らせ、
+//   回復（ヒステリシス付き）したら溜まった分を続けて送る。ALARM/HEALTH は遅らせない
+// - 最初に遅らせてから maxDeferMs を過ぎたら弱電界のままでも送る（遅れの上限）
+// - 品質が分からない（問い合わせ失敗）場合は遅らせない
+class SignalGate {
+public:
+  SignalGate();
+
+  void setConfig(const SignalGateConfig& config) { config_ = config; }
+  const SignalGateConfig& config() const { return config_; }
+  bool enabled() const { return config_.maxDeferMs > 0; }
+
+  // 最新の電波品質で弱電界かを更新する
+  void update(const SignalSample& s);
+  bool weak() const { return weak_; }
+  const SignalSample& last() const { return last_; }
+
+  // c の送信を遅らせるか（遅らせた分が残っていて上限時間を過ぎた・回復した場合は false）
+  bool shouldDefer(UplinkClass c, uint32_t nowMs);
+  // 送信を1件遅らせた
+  void recordDeferred(uint32_t nowMs);
+  // 遅らせた分を count 件続けて送った。complete なら全て送り終えた（遅れは最初に遅らせた時刻から数える）
+  void recordFlush(uint16_t count, bool complete, uint32_t nowMs);
+  // 遅らせている送信があるか
+  bool deferring() const { return deferring_; }
+  // 最古の遅らせた送信からの経過
+  uint32_t deferredForMs(uint32_t nowMs) const;
+
+  const SignalGateStats& stats() const { return stats_; }
+
+private:
+  SignalGateConfig config_;
+  SignalGateStats stats_;
+  SignalSample last_;
+  bool weak_;
+  bool deferring_;
+  uint32_t oldestDeferredMs_;
+};
+
+// 遅らせた読み取り値（回復後に元の時刻のまま送る）
+struct DeferredReading {
+  ReadingValues values;
+  ReadingPosition position;
+  bool hasPosition;
+  bool scd40Ok;
+  bool fs3000Ok;
+  uint32_t sampledAtMs;
+};
+
+// 遅らせた読み取り値の固定長キュー（古い順に取り出す）
+class DeferredReadingQueue {
+public:
+  static const size_t CAPACITY = 16;
+
+  DeferredReadingQueue() : head_(0), count_(0) {}
+  bool full() const { return count_ == CAPACITY; }
+  bool empty() const { return count_ == 0; }
+  size_t size() const { return count_; }
+  // 満杯なら false
+  bool push(const DeferredReading& r);
+  const DeferredReading& front() const { return items_[head_]; }
+  void pop();
+
+private:
+  DeferredReading items_[CAPACITY];
+  size_t head_;
+  size_t count_;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 長期運用（ソーク）の計測
+// 配信率・サンプルから送信完了までの遅延分布・読み取り1件あたりの AT コマンド数・
+// 再起動回数・空きヒープの傾向を集計し、リリース間で比較できる JSON 1行のレポートにする。
+// 再起動を跨いで集計できるよう POD にしている（RTC_NOINIT 領域に置く想定）
+#define SOAK_STATS_MAGIC 0x534F414BUL  // "SOAK"
+#define SOAK_LATENCY_BUCKET_MS 250
+#define SOAK_LATENCY_BUCKETS 160       // 0〜40秒（超過分は最後のバケット）
+
+struct SoakStats {
+  uint32_t magic;
+  uint64_t elapsedMs;        // 集計開始からの稼働時間（再起動を跨いで加算）
+  uint32_t restarts;         // 集計中のソフトウェア再起動
+  uint32_t sampled;          // センサー読み取り回数
+  uint32_t attempted;        // 読み取り値を送ろうとした回数（設定不正でのスキップを含む）
+  uint32_t delivered;        // 送信に成功した回数
+  uint32_t atCommands;       // モデムへ送った AT コマンド数
+  uint32_t latencyMaxMs;     // サンプルから送信完了まで
+  uint64_t latencyTotalMs;
+  uint32_t latency[SOAK_LATENCY_BUCKETS];
+  // 空きヒープの推移（経過時間[h]に対する最小二乗の傾き）
+  uint32_t heapSamples;
+  uint32_t heapFirst;
+  uint32_t heapLast;
+  uint32_t heapMin;
+  double heapSumX;
+  double heapSumY;
+  double heapSumXX;
+  double heapSumXY;
+};
+
+void soakReset(SoakStats& s);
+bool soakValid(const SoakStats& s);
+
+void soakRecordSample(SoakStats& s);
+// 送信結果。latencyMs はサンプル時刻から送信完了までの時間（失敗時は無視）
+void soakRecordSend(SoakStats& s, bool delivered, uint32_t latencyMs);
+void soakRecordHeap(SoakStats& s, uint32_t freeHeap);
+
+// 遅延の百分位（0〜100）。バケットの上端を返す。記録がなければ0
+uint32_t soakLatencyPercentile(const SoakStats& s, float percentile);
+// 空きヒープの傾き（バイト/時間, 負ならリークの疑い）。2点未満なら0
+float soakHeapSlope(const SoakStats& s);
+// 配信率 = delivered / sampled（送らなかった読み取り値も未配信として数える）
+float soakDeliveryRatio(const SoakStats& s);
+
+// JSON 1行のレポートを書き込み、文字数を返す（収まらなければ0）
+// {"elapsed_s":..,"restarts":..,"sampled":..,"attempted":..,"delivered":..,"delivery_ratio":..,
+//  "latency_ms":{"p50":..,"p95":..,"p99":..,"max":..,"avg":..},"at_per_reading":..,
+//  "heap":{"first":..,"last":..,"min":..,"slope_per_h":..}}
+size_t formatSoakReport(const SoakStats& s, char* out, size_t outSize);
+
+// 送信バイト列から AT コマンドの数を数える（行頭の "AT" を1コマンドとする）
+class AtCommandCounter {
+public:
+  AtCommandCounter() : count_(0), state_(0) {}
+  void feed(const uint8_t* data, size_t len);
+  uint32_t count() const { return count_; }
+
+private:
+  uint32_t count_;
+  uint8_t state_;  // 0: 行頭, 1: 行頭の 'A' の直後, 2: 行の途中
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 時間の取得と待機の抽象化
+// 実機では ArduinoClock（millis()/micros()/delay()）、ホスト環境では VirtualClock に差し替えて、
+// 待機やタイムアウトを実時間を使わずに進められる
+class SystemClock {
+public:
+  virtual ~SystemClock() {}
+  virtual uint32_t nowMs() = 0;
+  virtual uint32_t nowUs() = 0;
+  virtual void sleepMs(uint32_t ms) = 0;
+};
+
+// 離散イベント方式の仮想時計（ホストでのシミュレーション用）
+// sleepMs() は待機期間内に予約されたイベントを時刻順に実行してから時刻を進めるため、
+// 1日分の動作（周期処理・通信断・復旧）を数秒で、ミリ秒単位の正確な時刻で再現できる
+class VirtualClock : public SystemClock {
+public:
+  typedef void (*EventFn)(void* ctx, uint32_t nowMs);
+  static const size_t MAX_EVENTS = 32;
+
+  explicit VirtualClock(uint64_t startUs = 0);
+
+  uint32_t nowMs() override { return (uint32_t)(nowUs_ / 1000); }
+  uint32_t nowUs() override { return (uint32_t)nowUs_; }
+  void sleepMs(uint32_t ms) override { sleepUs((uint64_t)ms * 1000); }
+  void sleepUs(uint64_t us);
+
+  // 起動からの経過時間（32ビットの millis() と違い折り返さない）
+  uint64_t elapsedUs() const { return nowUs_; }
+
+  // delayMs 後に fn を実行する（同時刻は予約順）。満杯なら false
+  bool schedule(uint32_t delayMs, EventFn fn, void* ctx);
+  // 次のイベントの時刻まで進めて実行する。イベントがなければ false
+  bool runNext();
+  size_t pending() const { return count_; }
+
+  // 待機の統計（タイミングの検証用）
+  uint32_t sleeps() const { return sleeps_; }
+  uint64_t sleptUs() const { return sleptUs_; }
+  uint32_t eventsRun() const { return eventsRun_; }
+
+private:
+  struct Event {
+    uint64_t atUs;
+    uint32_t seq;
+    EventFn fn;
+    void* ctx;
+  };
+
+  void runDue(uint64_t untilUs);
+
+  uint64_t nowUs_;
+  Event events_[MAX_EVENTS];  // 時刻（同時刻は seq）の昇順
+  size_t count_;
+  uint32_t seq_;
+  uint32_t sleeps_;
+  uint64_t sleptUs_;
+  uint32_t eventsRun_;
+};
+
+#ifdef ARDUINO
+
+// 実機用: Arduino の millis()/micros()/delay()
+class ArduinoClock : public SystemClock {
+public:
+  uint32_t nowMs() override;
+  uint32_t nowUs() override;
+  void sleepMs(uint32_t ms) override;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+// 暦日時から UNIX エポック秒（UTC）を求める
+// tzQuarterHours: 15分単位のタイムゾーン（+CCLK の ±zz。JST は +36）
+uint32_t civilToEpoch(int year, int month, int day, int hour, int minute, int second, int tzQuarterHours);
+
+// UTCエポック秒 → YYYYMMDD（0 なら 0）
+uint32_t epochToDayStamp(uint32_t epoch);
+
+// +CCLK? 応答（例: +CCLK: "24/05/01,12:34:56+36"）を解析してエポック秒（UTC）を返す
+// 年が 2020 年未満（モデム未同期の既定値）や形式不正の場合は false
+bool parseCclk(const char* response, uint32_t& epochSec);
+
+// millis() と UTC の対応を保持し、ドリフト補正付きで現在時刻を求める時刻サービス
+// ミリ秒カウンタのラップアラウンドは差分演算で吸収する（同期点から±約24.8日以内の時刻を扱う前提）
+class TimeSync {
+public:
+  static const int32_t MAX_DRIFT_PPM = 500;
+  // ドリフト推定に使う基準点からの最短経過時間。+CCLK? は秒分解能のため、
+  // 10分程度の間隔では量子化誤差だけで ±1667ppm になり推定にならない
+  static const uint32_t MIN_DRIFT_BASELINE_MS = 4UL * 3600UL * 1000UL;
+  // 基準点を保持する最長期間（millis() の差分演算が破綻しない範囲に収める）
+  static const uint32_t MAX_DRIFT_BASELINE_MS = 7UL * 24UL * 3600UL * 1000UL;
+  // 基準点からのずれがこれ以下なら分解能（両端の秒切り捨て＋AT応答遅延）に埋もれるとみなす
+  static const int32_t MIN_DRIFT_OFFSET_MS = 2000;
+
+  TimeSync();
+
+  // 同期点を追加する。monoMs はエポック秒を取得した時点の millis()
+  // ドリフトは同期点ごとではなく、数時間以上離れた基準点との比較でのみ推定する。
+  // ずれが分解能以下の間は基準点を据え置き、基線を伸ばして次の同期で再評価する
+  void sync(uint32_t monoMs, uint32_t epochSec);
+
+  bool synced() const { return synced_; }
+
+  // 指定した millis() 時点の UTC エポック秒（未同期なら 0）
+  uint32_t epochAt(uint32_t monoMs) const;
+  // 指定した millis() 時点の UTC エポックミリ秒（未同期なら 0）
+  uint64_t epochMsAt(uint32_t monoMs) const;
+
+  // 推定ドリフト（ppm, 正なら millis() が遅れている）
+  float driftPpm() const { return driftPpm_; }
+  // 直前の同期で観測した予測誤差（ms）
+  int32_t lastOffsetMs() const { return lastOffsetMs_; }
+  uint32_t syncCount() const { return syncCount_; }
+  uint32_t lastSyncMono() const { return refMono_; }
+
+private:
+  bool synced_;
+  uint32_t refMono_;
+  uint64_t refEpochMs_;
+  float driftPpm_;
+  int32_t lastOffsetMs_;
+  uint32_t syncCount_;
+  // ドリフト推定の基準点（補正なしの millis() と UTC の対応）
+  uint32_t anchorMono_;
+  uint64_t anchorEpochMs_;
+  uint32_t driftEstimates_;
+};
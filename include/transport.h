@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 送信経路
+enum TransportId : uint8_t {
+  TRANSPORT_UDP = 0,   // uni.soracom.io:23080（バイナリ）
+  TRANSPORT_MQTT = 1,  // beam.soracom.io:1883（JSON）
+  TRANSPORT_COUNT = 2,
+};
+
+const char* transportName(TransportId t);
+
+// 1回の送信で回線上に出る推定バイト数（IP/UDP/TCP/MQTT ヘッダを含む）
+size_t estimateUdpWireBytes(size_t payloadSize);
+size_t estimateMqttWireBytes(size_t topicLen, size_t payloadSize, int qos);
+
+// フェイルオーバーの設定値
+struct TransportConfig {
+  bool failoverEnabled = true;
+  uint8_t failoverAfter = 2;          // 優先経路でこの回数連続失敗したら代替経路へ
+  float minSuccessRate = 0.5f;        // 成功率（指数移動平均）がこれを下回っても代替経路へ
+  uint32_t cooldownMs = 600000;       // 代替経路に留まる時間（優先経路の再試行失敗毎に倍化）
+  uint32_t maxCooldownMs = 3600000;
+  float msPerByte = 2.0f;             // リンクコストにおける1バイトの重み（ms換算）
+};
+
+// 経路毎の統計
+struct TransportStats {
+  uint32_t attempts;
+  uint32_t delivered;
+  uint16_t consecutiveFailures;
+  float successRate;      // 指数移動平均（0..1, 初期値1）
+  float latencyMs;        // 成功時の所要時間（接続を含む）の指数移動平均
+  uint64_t wireBytes;     // 失敗分を含む推定送信バイト数
+  uint32_t lastUsedMs;
+};
+
+// 成功率・遅延・配信1件あたりのバイト数から経路を選び、障害時は代替経路へ一定時間切替える。
+// クールダウン経過後は優先経路を1回試し（プローブ）、成功すれば戻る。
+// 時刻は呼び出し側から渡す（ホストで仮想時計を使って検証できる）
+class TransportManager {
+public:
+  explicit TransportManager(const TransportConfig& config = TransportConfig());
+
+  void setConfig(const TransportConfig& config) { config_ = config; }
+  const TransportConfig& config() const { return config_; }
+
+  // 優先経路（メタデータの mqtt フラグ）。変更時はフェイルオーバー状態を解除する
+  void setPreferred(TransportId t);
+  TransportId preferred() const { return preferred_; }
+
+  // 経路が使える状態か（MQTT はトピック設定が有効な場合のみ）
+  void setAvailable(TransportId t, bool available);
+  bool available(TransportId t) const { return available_[t]; }
+
+  // 今回の送信に使う経路
+  TransportId select(uint32_t nowMs);
+
+  // 送信結果を記録する。戻り値は経路の切替が起きたか
+  bool report(TransportId t, bool ok, uint32_t latencyMs, size_t wireBytes, uint32_t nowMs);
+
+  // 配信1件あたりのコスト（遅延 + バイト数×重み を成功率で割ったもの, 小さいほど良い）
+  float linkCost(TransportId t) const;
+  // 配信1件あたりの推定バイト数（失敗分を含む）
+  float bytesPerDelivered(TransportId t) const;
+
+  bool failedOver() const { return failedOver_; }
+  uint32_t failovers() const { return failovers_; }
+  uint32_t cooldownRemainingMs(uint32_t nowMs) const;
+  const TransportStats& stats(TransportId t) const { return stats_[t]; }
+
+private:
+  TransportId alternate(TransportId t) const {
+    return t == TRANSPORT_UDP ? TRANSPORT_MQTT : TRANSPORT_UDP;
+  }
+  bool degraded(TransportId t) const;
+
+  TransportConfig config_;
+  TransportId preferred_;
+  bool available_[TRANSPORT_COUNT];
+  TransportStats stats_[TRANSPORT_COUNT];
+  bool failedOver_;
+  uint32_t failoverUntilMs_;
+  uint32_t currentCooldownMs_;
+  uint32_t failovers_;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "trend_history.h"
+
+// 描画先の抽象化（実機は M5.Lcd、ホストでは描画量を数えるフェイクに差し替えられる）
+class TrendCanvas {
+public:
+  virtual ~TrendCanvas() {}
+  virtual void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) = 0;
+  virtual void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color) = 0;
+  virtual void drawPixel(int16_t x, int16_t y, uint16_t color) = 0;
+};
+
+enum TrendSpan : uint8_t {
+  TREND_SPAN_1H = 0,   // 詳細履歴
+  TREND_SPAN_24H = 1,  // 粗い履歴（LTTB）
+};
+
+// CO2 の推移グラフ（掃引表示）
+// 横軸は時刻を表示幅で割った位置を折り返して使い、新しい点は前の点からの線分と、
+// その先の数列の消去だけを描く（1サンプルあたり数列分の描画で済み、全体の再描画は不要）。
+// 縦軸の上限を超えた値が来た場合だけ全体を描き直す
+class TrendChart {
+public:
+  static const uint16_t COLOR_BG = 0x0000;
+  static const uint16_t COLOR_GRID = 0x4208;
+  static const uint16_t COLOR_OK = 0x07E0;
+  static const uint16_t COLOR_WARN = 0xFFE0;
+  static const uint16_t COLOR_ALARM = 0xF800;
+  static const uint16_t Y_MIN_PPM = 400;
+  static const uint16_t Y_MAX_PPM = 2000;       // 既定の上限（超えたら500単位で広げる）
+  static const uint16_t WARN_PPM = 1000;
+  static const int16_t ERASE_AHEAD = 6;         // 現在位置の先に空ける列数
+
+  TrendChart(TrendCanvas& canvas, int16_t x, int16_t y, int16_t w, int16_t h);
+
+  void configure(TrendSpan span, uint16_t alarmPpm);
+  TrendSpan span() const { return span_; }
+  uint16_t alarmPpm() const { return alarmPpm_; }
+  uint32_t spanSeconds() const { return span_ == TREND_SPAN_1H ? 3600 : 86400; }
+
+  // 表示範囲の履歴から全体を描き直す（画面切替・範囲変更時）
+  void redraw(const TrendHistory& history, uint32_t nowSec);
+  // 1点を追記する。縦軸の上限を超えて全体の描き直しが必要なら false（何も描かない）
+  bool append(TrendPoint p);
+
+  uint16_t yMax() const { return yMax_; }
+  uint32_t appended() const { return appended_; }
+
+private:
+  int16_t columnOf(uint32_t t) const;
+  int16_t rowOf(uint16_t v) const;
+  uint16_t colorOf(uint16_t v) const;
+  void eraseColumns(int16_t from, int16_t count);
+  void plot(TrendPoint p, bool erase);
+
+  TrendCanvas& canvas_;
+  int16_t x_;
+  int16_t y_;
+  int16_t w_;
+  int16_t h_;
+  TrendSpan span_;
+  uint16_t alarmPpm_;
+  uint16_t yMax_;
+  bool hasLast_;
+  uint32_t lastT_;
+  int16_t lastCol_;
+  int16_t lastRow_;
+  uint32_t appended_;
+};
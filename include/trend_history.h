@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CO2 の推移を固定サイズのメモリで保持する2段階の履歴
+// - 詳細: 直近の全サンプル（既定の10秒周期で1時間分）
+// - 粗い履歴: 24時間を270秒毎のバケットに分け、各バケットから LTTB（Largest-Triangle-Three-Buckets）で
+//   形を最もよく残す1点を選んで保持する（320点 = LCD の横幅）
+// バケットの代表点は次のバケットの平均が分かった時点（2バケット後のサンプル到着時）に決まる。
+// 時刻は単調増加の秒で与える（逆行したサンプルは捨てる）。millis()/1000 は約49.7日で0に戻るため、
+// 呼び出し側は millis() の差分を64ビットに積算した起動からの経過時間を使う
+struct TrendPoint {
+  uint32_t t;
+  uint16_t value;
+};
+
+class TrendHistory {
+public:
+  static const size_t RAW_CAPACITY = 360;
+  static const size_t COARSE_CAPACITY = 320;
+  static const uint32_t COARSE_BUCKET_S = 270;  // 24h / 320
+
+  TrendHistory();
+
+  // サンプルを追加する。粗い履歴に点が確定した場合 true
+  bool add(uint32_t t, uint16_t value);
+  void clear();
+
+  // 古い順（0 が最古）
+  size_t rawCount() const { return rawCount_; }
+  TrendPoint raw(size_t i) const;
+  size_t coarseCount() const { return coarseCount_; }
+  TrendPoint coarse(size_t i) const;
+
+  static size_t memoryBytes() { return sizeof(TrendHistory); }
+
+private:
+  bool finalizeBucket(uint32_t bucket);
+
+  uint32_t rawT_[RAW_CAPACITY];
+  uint16_t rawV_[RAW_CAPACITY];
+  size_t rawHead_;    // 最古の位置
+  size_t rawCount_;
+  uint32_t coarseT_[COARSE_CAPACITY];
+  uint16_t coarseV_[COARSE_CAPACITY];
+  size_t coarseHead_;
+  size_t coarseCount_;
+  uint32_t pendingBucket_;  // 代表点が未確定の最古のバケット
+  bool hasPending_;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 前面ボタン（M5Stack の A/B/C）
+enum ButtonId : uint8_t {
+  BUTTON_A = 0,  // 画面切替（現在値 → 1時間 → 24時間）
+  BUTTON_B = 1,  // 即時送信
+  BUTTON_C = 2,  // 回線診断画面の表示/解除
+  BUTTON_COUNT = 3,
+};
+
+// 押下の立ち上がりで即座に確定し、その後の一定時間はチャタリングとして無視する（先頭エッジ方式）
+// 押下を安定待ちしないため、入力から処理開始までの遅延はポーリング周期だけになる
+class ButtonDebouncer {
+public:
+  static const uint32_t LOCKOUT_US = 30000;
+
+  ButtonDebouncer() : pressed_(false), edgeUs_(0) {}
+
+  // pressed: 現在のレベル（押下中なら true）。新たな押下を確定したら true
+  bool update(bool pressed, uint32_t nowUs);
+  bool pressed() const { return pressed_; }
+  // 最後に確定した押下を検出した時刻
+  uint32_t edgeUs() const { return edgeUs_; }
+
+private:
+  bool pressed_;
+  uint32_t edgeUs_;
+};
+
+// 入力から画面反映までの遅延の統計（10ms 刻みのヒストグラム）
+struct InputLatencyStats {
+  static const uint32_t BUCKET_US = 10000;
+  static const size_t BUCKETS = 32;
+
+  uint32_t count;
+  uint32_t overBudget;   // 目標時間を超えた回数
+  uint32_t lastUs;
+  uint32_t maxUs;
+  uint32_t maxWaitUs;    // 表示の排他待ち（ループ側の描画完了待ち）の最大
+  uint64_t totalUs;
+  uint32_t histogram[BUCKETS];
+
+  // latencyUs: 押下検出から描画完了まで, waitUs: そのうち排他待ちの時間
+  void record(uint32_t latencyUs, uint32_t waitUs, uint32_t budgetUs);
+  uint32_t averageUs() const;
+  // 百分位点（バケット上端で近似, 最大値で頭打ち）
+  uint32_t percentileUs(float percentile) const;
+};
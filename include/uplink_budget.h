@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "payload_codec.h"
+
+// 送信の優先度クラス（小さいほど優先）
+enum UplinkClass : uint8_t {
+  UPLINK_ALARM = 0,    // しきい値超過の即時送信（予算に関わらず必ず送る）
+  UPLINK_HEALTH = 1,   // ヘルスフレーム・換気エピソード要約
+  UPLINK_ROUTINE = 2,  // 定期の読み取り値・周期メトリクス（予算が厳しいと最初に間引く）
+  UPLINK_CLASS_COUNT = 3,
+};
+
+const char* uplinkClassName(UplinkClass c);
+
+// 通信量の予算（メタデータ budget_daily_kb / budget_monthly_kb, 0 は無制限）
+struct BudgetConfig {
+  uint32_t dailyBytes = 0;
+  uint32_t monthlyBytes = 0;
+  uint8_t priorityReservePct = 10;  // 1日の枠のうち ALARM/HEALTH 用に残す割合
+  uint32_t paceSlackSec = 3600;     // 1日の経過に比例した枠に対する前借りの許容（秒）
+};
+
+#define BUDGET_COUNTERS_MAGIC 0x31474442UL  // "BDG1"
+
+// 期間毎の使用量（NVS に保存し、再起動を跨いで月の累計を保つ）
+struct BudgetCounters {
+  uint32_t magic;
+  uint32_t day;                              // YYYYMMDD（UTC, 時刻未同期のまま始まった期間は0）
+  uint32_t dayBytes;
+  uint32_t monthBytes;
+  uint32_t classBytes[UPLINK_CLASS_COUNT];   // 当月のクラス別内訳
+  uint32_t thinnedToday;                     // 今日間引いた定期送信の件数
+  uint32_t blockedToday;                     // 今日予算超過で見送った HEALTH の件数
+  uint32_t appliedUsedKb;                    // メタデータ budget_month_used_kb を最後に適用した値（+1, 0 は未適用）
+};
+
+enum BudgetDecision : uint8_t {
+  BUDGET_SEND = 0,
+  BUDGET_THIN = 1,   // 定期送信を今回は見送る（値は次に送る回へ合算する）
+  BUDGET_BLOCK = 2,  // 予算超過で見送る
+};
+
+// 日次・月次の通信量予算に基づく送信可否の判定と、AT 層で送出したバイト数の計上
+// - ALARM は常に送信する（使用量には計上する）
+// - ROUTINE は「1日の枠 × 経過割合（+前借り）」の線を超えたら間引き、1日の送信量を日中に平準化する。
+//   1日の枠は日次予算と「月の残り ÷ 月の残り日数」の小さい方で、ALARM/HEALTH 用に一部を残す
+// - HEALTH は1日の枠・月の予算を超えた場合だけ見送る
+// 時刻（UTCエポック秒）が未同期（0）の間は期間の切替と比例配分を行わず、上限だけを適用する
+class UplinkBudget {
+public:
+  UplinkBudget();
+
+  void setConfig(const BudgetConfig& config) { config_ = config; }
+  const BudgetConfig& config() const { return config_; }
+  bool limited() const { return config_.dailyBytes > 0 || config_.monthlyBytes > 0; }
+
+  // 保存していた使用量を復元する（不正なら0から）
+  void restore(const BudgetCounters& saved);
+  const BudgetCounters& counters() const { return counters_; }
+  // 前回の保存以降に変化があるか
+  bool dirty() const { return dirty_; }
+  void markSaved() { dirty_ = false; }
+
+  // 日付・月の切替（切り替わったら true）
+  bool rollover(uint32_t epoch);
+  BudgetDecision admit(UplinkClass c, size_t estimatedBytes, uint32_t epoch);
+  // 実際に送出したバイト数（再送分を含む）を計上する
+  void charge(UplinkClass c, size_t wireBytes);
+
+  // 今日の送信枠（無制限なら0）
+  uint32_t dayAllowance(uint32_t epoch) const;
+  // 当月の使用量を外部の値（課金データ等）に合わせる。同じ値の再適用は無視する
+  bool applyMonthUsage(uint32_t usedKb);
+
+private:
+  uint32_t routineLine(uint32_t allowance, uint32_t epoch) const;
+
+  BudgetConfig config_;
+  BudgetCounters counters_;
+  bool dirty_;
+};
+
+// 間引いた読み取り値の平均を次の送信に載せるための積算（センサー毎に有効な値だけを平均する）
+class ReadingCoalescer {
+public:
+  ReadingCoalescer() { clear(); }
+  void clear();
+  void add(const ReadingValues& v, bool scd40Ok, bool fs3000Ok);
+  // 積算中の件数（最新の1件を含めない）
+  uint16_t pending() const { return count_; }
+  // 積算した値と latest の平均（時刻は latest）。積算はクリアする
+  ReadingValues takeMean(const ReadingValues& latest, bool scd40Ok, bool fs3000Ok);
+
+private:
+  float co2_;
+  float temp_;
+  float humi_;
+  float wind_;
+  uint16_t scdCount_;
+  uint16_t fsCount_;
+  uint16_t count_;
+};
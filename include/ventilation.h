@@ -0,0 +1,151 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 換気解析の設定値
+struct VentilationConfig {
+  float outdoorPpm = 420.0f;        // 外気CO2濃度（減衰の漸近値）
+  float minExcessPpm = 150.0f;      // 減衰開始とみなすピーク時の外気比超過量の下限
+  float startDropPpm = 40.0f;       // ピークからこれだけ下がったら減衰エピソード開始
+  float noisePpm = 20.0f;           // この量を超える上昇で減衰エピソード終了
+  float endExcessPpm = 50.0f;       // 外気比超過がこれを下回ったら終了（センサー精度以下）
+  uint32_t minDurationSec = 600;    // 有効なエピソードの最短時間
+  uint32_t maxDurationSec = 4 * 3600;
+  uint16_t minSamples = 6;
+  float minR2 = 0.8f;               // 指数フィットの決定係数の下限
+  float alarmPpm = 1000.0f;         // 即時送信のしきい値
+  float alarmHysteresisPpm = 100.0f;
+};
+
+// 減衰エピソードの要約
+struct VentilationEpisode {
+  uint32_t startSec;
+  uint32_t endSec;
+  float startPpm;
+  float endPpm;
+  float ach;        // 換気回数 [回/h]
+  float r2;
+  float meanWind;   // エピソード中の平均風速 [m/s]（風速が無効なら負値）
+  uint16_t samples;
+};
+
+// 送信周期毎の集計
+struct VentilationIntervalStats {
+  uint16_t samples;
+  float meanPpm;
+  float maxPpm;
+  float meanWind;
+};
+
+// 片対数線形回帰による指数減衰フィット（定数メモリ）
+// ln(C - C_out) = ln(C0 - C_out) - λt を最小二乗で解く
+class DecayFit {
+public:
+  DecayFit() { reset(); }
+  void reset();
+  // t: エピソード開始からの秒数, excessPpm: C - C_out（正の値のみ）
+  void add(float t, float excessPpm);
+  // λ [1/s] と決定係数を求める。点数不足や分散ゼロの場合は false
+  bool solve(float& lambda, float& r2) const;
+  uint16_t count() const { return n_; }
+
+private:
+  uint16_t n_;
+  double st_, sy_, stt_, sty_, syy_;
+};
+
+// CO2 減衰エピソードの検出と換気回数の推定、風速との相関を逐次計算する
+class VentilationAnalyzer {
+public:
+  enum Event : uint8_t {
+    EVENT_NONE = 0,
+    EVENT_EPISODE = 1,    // 有効なエピソードが確定した
+    EVENT_ALARM_ON = 2,   // しきい値を上回った
+    EVENT_ALARM_OFF = 4,  // しきい値を下回った（ヒステリシス込み）
+  };
+
+  explicit VentilationAnalyzer(const VentilationConfig& config = VentilationConfig());
+
+  void setConfig(const VentilationConfig& config) { config_ = config; }
+  const VentilationConfig& config() const { return config_; }
+
+  // 1サンプルを投入し、発生したイベントのビットOR を返す
+  uint8_t update(uint32_t tSec, float co2, bool co2Valid, float wind, bool windValid);
+
+  const VentilationEpisode& lastEpisode() const { return last_; }
+  uint16_t episodeCount() const { return episodes_; }
+  bool decaying() const { return state_ == STATE_DECAYING; }
+  bool alarmActive() const { return alarm_; }
+  float lastAch() const { return episodes_ > 0 ? last_.ach : 0.0f; }
+
+  // 換気回数と平均風速のピアソン相関係数（2エピソード未満や分散ゼロなら 0）
+  float windAchCorrelation() const;
+
+  // 送信周期毎の集計（リセットしない。送信を見送った周期の分は次の集計に含まれる）
+  VentilationIntervalStats intervalStats() const;
+  // 送信周期毎の集計を取り出してリセットする
+  VentilationIntervalStats takeIntervalStats();
+
+private:
+  enum State : uint8_t { STATE_IDLE, STATE_DECAYING };
+
+  void startEpisode(uint32_t tSec, float co2);
+  bool finishEpisode(uint32_t tSec);
+
+  VentilationConfig config_;
+  State state_;
+  bool alarm_;
+  bool primed_;
+
+  // IDLE 中のピーク/谷追跡
+  float peakPpm_;
+  uint32_t peakSec_;
+  float troughPpm_;
+
+  // 減衰中の状態
+  DecayFit fit_;
+  uint32_t startSec_;
+  float startPpm_;
+  float minPpm_;
+  float lastPpm_;
+  uint32_t lastSec_;
+  double windSum_;
+  uint16_t windCount_;
+
+  VentilationEpisode last_;
+  uint16_t episodes_;
+
+  // 風速-換気回数の相関（逐次和）
+  uint16_t corrN_;
+  double cx_, cy_, cxx_, cyy_, cxy_;
+
+  // 送信周期の集計
+  uint16_t ivN_;
+  double ivSum_;
+  float ivMax_;
+  double ivWindSum_;
+  uint16_t ivWindN_;
+};
+
+// 換気エピソードフレーム（UDP用, 20バイト, リトルエンディアン）
+// 読み取り値と同じ宛先に届くため、受信側は長さではなく先頭の種別で区別する（payload_codec.h 参照）
+//   0: u8 種別 0xA2 | 1: u8 予約 | 2: u16 継続秒 | 4: u16 開始ppm | 6: u16 終了ppm
+//   8: u16 換気回数x100 | 10: u16 R2x1000 | 12: u16 平均風速x100(無効時0xFFFF) | 14: u16 サンプル数
+//  16: u32 終了時の稼働秒
+static const uint8_t VENTILATION_EPISODE_FRAME_TYPE = 0xA2;
+static const size_t VENTILATION_EPISODE_FRAME_SIZE = 20;
+
+// 換気メトリクスフレーム（UDP用, 16バイト, リトルエンディアン）
+//   0: u8 種別 0xA3 | 1: u8 フラグ(bit0=アラーム, bit1=減衰中) | 2: u16 サンプル数 | 4: u16 平均ppm
+//   6: u16 最大ppm | 8: u16 直近換気回数x100 | 10: i16 風速-換気相関x1000 | 12: u16 平均風速x100
+//  14: u16 累計エピソード数
+static const uint8_t VENTILATION_METRICS_FRAME_TYPE = 0xA3;
+static const size_t VENTILATION_METRICS_FRAME_SIZE = 16;
+
+size_t encodeEpisodeFrame(const VentilationEpisode& e, uint8_t* out, size_t outSize);
+size_t encodeMetricsFrame(const VentilationAnalyzer& a, const VentilationIntervalStats& st,
+                          uint8_t* out, size_t outSize);
+size_t formatEpisodeJson(const VentilationEpisode& e, char* out, size_t outSize);
+size_t formatMetricsJson(const VentilationAnalyzer& a, const VentilationIntervalStats& st,
+                         char* out, size_t outSize);
@@ -0,0 +1,380 @@
+#include "at_command.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// ==== Command writer ====
+
+AtCommandWriter::AtCommandWriter(char* buf, size_t capacity, const char* command)
+  : buf_(buf), cap_(capacity), len_(0), ok_(capacity > 0), first_(true) {
+  if (ok_) buf_[0] = '\0';
+  putStr(command);
+}
+
+void AtCommandWriter::put(char c) {
+  if (!ok_ || len_ + 1 >= cap_) {
+    ok_ = false;
+    return;
+  }
+  buf_[len_++] = c;
+  buf_[len_] = '\0';
+}
+
+void AtCommandWriter::putStr(const char* s) {
+  while (*s != '\0' && ok_) put(*s++);
+}
+
+void AtCommandWriter::separator() {
+  if (!first_) put(',');
+  first_ = false;
+}
+
+AtCommandWriter& AtCommandWriter::arg(long v) {
+  separator();
+  char tmp[21];
+  snprintf(tmp, sizeof(tmp), "%ld", v);
+  putStr(tmp);
+  return *this;
+}
+
+AtCommandWriter& AtCommandWriter::arg(unsigned long v) {
+  separator();
+  char tmp[21];
+  snprintf(tmp, sizeof(tmp), "%lu", v);
+  putStr(tmp);
+  return *this;
+}
+
+AtCommandWriter& AtCommandWriter::quoted(const char* s) {
+  separator();
+  put('"');
+  for (; *s != '\0' && ok_; ++s) {
+    // 引用符・制御文字はエスケープできない（モデムがコマンドの区切りと解釈する）
+    if (*s == '"' || (uint8_t)*s < 0x20 || *s == 0x7F) {
+      ok_ = false;
+      break;
+    }
+    put(*s);
+  }
+  put('"');
+  return *this;
+}
+
+AtCommandWriter& AtCommandWriter::raw(const char* s) {
+  separator();
+  for (; *s != '\0' && ok_; ++s) {
+    if (*s == '\r' || *s == '\n') {
+      ok_ = false;
+      break;
+    }
+    put(*s);
+  }
+  return *this;
+}
+
+// ==== Tokenizer ====
+
+const char* atEventName(AtEventType t) {
+  switch (t) {
+    case AT_EVENT_OK: return "OK";
+    case AT_EVENT_ERROR: return "ERROR";
+    case AT_EVENT_CME_ERROR: return "CME ERROR";
+    case AT_EVENT_PROMPT: return "PROMPT";
+    case AT_EVENT_ECHO: return "ECHO";
+    case AT_EVENT_CNACT: return "+CNACT";
+    case AT_EVENT_APP_PDP: return "+APP PDP";
+    case AT_EVENT_SMSTATE: return "+SMSTATE";
+    case AT_EVENT_CGATT: return "+CGATT";
+    case AT_EVENT_CSQ: return "+CSQ";
+    case AT_EVENT_CESQ: return "+CESQ";
+    case AT_EVENT_CAOPEN: return "+CAOPEN";
+    case AT_EVENT_CASTATE: return "+CASTATE";
+    case AT_EVENT_CADATAIND: return "+CADATAIND";
+    case AT_EVENT_INFO: return "INFO";
+    default: return "NONE";
+  }
+}
+
+namespace {
+
+// "+XXX: " に続くカンマ区切りの引数を先頭から読む
+struct ArgCursor {
+  const char* p;
+  const char* end;
+
+  void skipSpaces() {
+    while (p < end && *p == ' ') p++;
+  }
+  bool nextInt(int32_t& v) {
+    skipSpaces();
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+    if (p >= end || *p < '0' || *p > '9') return false;
+    int32_t x = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+      if (x < 100000000) x = x * 10 + (*p - '0');
+      p++;
+    }
+    v = neg ? -x : x;
+    skipComma();
+    return true;
+  }
+  // 引用符の有無に関わらず次の引数を out へ写す（長すぎる分は切り捨て）
+  bool nextStr(char* out, size_t outSize) {
+    skipSpaces();
+    size_t n = 0;
+    bool quoted = p < end && *p == '"';
+    if (quoted) p++;
+    while (p < end && (quoted ? *p != '"' : *p != ',')) {
+      if (n + 1 < outSize) out[n++] = *p;
+      p++;
+    }
+    if (quoted && p < end) p++;
+    if (outSize > 0) out[n] = '\0';
+    skipComma();
+    return true;
+  }
+  void skipComma() {
+    skipSpaces();
+    if (p < end && *p == ',') p++;
+  }
+};
+
+bool startsWith(const char* s, size_t len, const char* prefix, size_t& prefixLen) {
+  prefixLen = strlen(prefix);
+  return len >= prefixLen && memcmp(s, prefix, prefixLen) == 0;
+}
+
+uint8_t clampU8(int32_t v) {
+  return v < 0 ? 0 : (v > 255 ? 255 : (uint8_t)v);
+}
+
+}  // namespace
+
+void AtTokenizer::reset() {
+  len_ = 0;
+  truncated_ = false;
+  promptCandidate_ = false;
+  line_[0] = '\0';
+  lines_ = 0;
+  truncatedLines_ = 0;
+}
+
+bool AtTokenizer::push(uint8_t c, AtEvent& ev) {
+  if (promptCandidate_) {
+    // プロンプト直後の空白は読み捨てる
+    promptCandidate_ = false;
+    if (c == ' ') return false;
+  }
+  if (c == '\r' || c == '\n') {
+    if (len_ == 0 && !truncated_) return false;
+    line_[len_] = '\0';
+    memset(&ev, 0, sizeof(ev));
+    ev.line = line_;
+    ev.lineLen = len_;
+    ev.truncated = truncated_;
+    lines_++;
+    if (truncated_) truncatedLines_++;
+    classify(ev);
+    len_ = 0;
+    truncated_ = false;
+    return true;
+  }
+  if (len_ == 0 && !truncated_ && c == '>') {
+    memset(&ev, 0, sizeof(ev));
+    ev.type = AT_EVENT_PROMPT;
+    line_[0] = '\0';
+    ev.line = line_;
+    promptCandidate_ = true;
+    return true;
+  }
+  if (len_ < MAX_LINE) {
+    line_[len_++] = (char)c;
+  } else {
+    truncated_ = true;
+  }
+  return false;
+}
+
+void AtTokenizer::classify(AtEvent& ev) {
+  const char* s = line_;
+  size_t n = len_;
+  size_t k;
+  ev.type = AT_EVENT_INFO;
+  if (n == 2 && memcmp(s, "OK", 2) == 0) {
+    ev.type = AT_EVENT_OK;
+    return;
+  }
+  if (n == 5 && memcmp(s, "ERROR", 5) == 0) {
+    ev.type = AT_EVENT_ERROR;
+    return;
+  }
+  if (n >= 2 && (s[0] == 'A' || s[0] == 'a') && (s[1] == 'T' || s[1] == 't')) {
+    ev.type = AT_EVENT_ECHO;
+    return;
+  }
+  if (s[0] != '+') return;
+
+  ArgCursor a = { s, s + n };
+  int32_t v0 = 0, v1 = 0;
+  if (startsWith(s, n, "+CME ERROR:", k) || startsWith(s, n, "+CMS ERROR:", k)) {
+    a.p += k;
+    ev.type = AT_EVENT_CME_ERROR;
+    if (!a.nextInt(ev.code)) ev.code = -1;
+  } else if (startsWith(s, n, "+CNACT:", k)) {
+    a.p += k;
+    if (!a.nextInt(v0) || !a.nextInt(v1)) return;
+    ev.type = AT_EVENT_CNACT;
+    ev.pdp.cid = clampU8(v0);
+    ev.pdp.status = clampU8(v1);
+    a.nextStr(ev.pdp.ip, sizeof(ev.pdp.ip));
+  } else if (startsWith(s, n, "+APP PDP:", k)) {
+    a.p += k;
+    if (!a.nextInt(v0)) return;
+    char state[12];
+    a.nextStr(state, sizeof(state));
+    ev.type = AT_EVENT_APP_PDP;
+    ev.pdp.cid = clampU8(v0);
+    ev.pdp.status = strcmp(state, "ACTIVE") == 0 ? 1 : 0;
+  } else if (startsWith(s, n, "+SMSTATE:", k)) {
+    a.p += k;
+    if (!a.nextInt(ev.code)) return;
+    ev.type = AT_EVENT_SMSTATE;
+  } else if (startsWith(s, n, "+CGATT:", k)) {
+    a.p += k;
+    if (!a.nextInt(ev.code)) return;
+    ev.type = AT_EVENT_CGATT;
+  } else if (startsWith(s, n, "+CSQ:", k)) {
+    a.p += k;
+    if (!a.nextInt(v0) || !a.nextInt(v1)) return;
+    ev.type = AT_EVENT_CSQ;
+    ev.signal.rssi = clampU8(v0);
+    ev.signal.ber = clampU8(v1);
+    ev.signal.rsrq = 255;
+    ev.signal.rsrp = 255;
+  } else if (startsWith(s, n, "+CESQ:", k)) {
+    // LTE では rxlev/rscp/ecno は 99/255（不明）、rsrq/rsrp だけが有効
+    a.p += k;
+    int32_t v[6];
+    for (int i = 0; i < 6; i++) {
+      if (!a.nextInt(v[i])) return;
+    }
+    ev.type = AT_EVENT_CESQ;
+    ev.signal.rssi = 99;
+    ev.signal.ber = clampU8(v[1]);
+    ev.signal.rsrq = clampU8(v[4]);
+    ev.signal.rsrp = clampU8(v[5]);
+  } else if (startsWith(s, n, "+CAOPEN:", k) || startsWith(s, n, "+CASTATE:", k)) {
+    bool open = s[3] == 'O';
+    a.p += k;
+    if (!a.nextInt(v0) || !a.nextInt(v1)) return;
+    ev.type = open ? AT_EVENT_CAOPEN : AT_EVENT_CASTATE;
+    ev.socket.cid = clampU8(v0);
+    ev.socket.state = clampU8(v1);
+  } else if (startsWith(s, n, "+CADATAIND:", k)) {
+    a.p += k;
+    if (!a.nextInt(v0)) return;
+    ev.type = AT_EVENT_CADATAIND;
+    ev.socket.cid = clampU8(v0);
+  }
+}
+
+// ==== Reply ====
+
+void AtReply::clear() {
+  memset(this, 0, sizeof(*this));
+  final = AT_EVENT_NONE;
+  cgatt = -1;
+  smstate = -1;
+  rssi = 99;
+  rsrq = 255;
+  rsrp = 255;
+  caopenResult = -1;
+}
+
+bool AtReply::apply(const AtEvent& ev) {
+  switch (ev.type) {
+    case AT_EVENT_OK:
+    case AT_EVENT_ERROR:
+      final = ev.type;
+      return true;
+    case AT_EVENT_CME_ERROR:
+      final = ev.type;
+      errorCode = ev.code;
+      return true;
+    case AT_EVENT_PROMPT:
+      prompt = true;
+      break;
+    case AT_EVENT_CNACT:
+    case AT_EVENT_APP_PDP:
+      if (ev.pdp.cid < 8) {
+        uint8_t bit = (uint8_t)(1u << ev.pdp.cid);
+        pdpSeen |= bit;
+        if (ev.pdp.status == 1) {
+          pdpActive |= bit;
+        } else {
+          pdpActive &= (uint8_t)~bit;
+        }
+        if (ev.type == AT_EVENT_CNACT && ev.pdp.cid == 0) {
+          memcpy(pdpIp0, ev.pdp.ip, sizeof(pdpIp0));
+        }
+      }
+      break;
+    case AT_EVENT_SMSTATE:
+      smstate = (int8_t)ev.code;
+      break;
+    case AT_EVENT_CGATT:
+      cgatt = (int8_t)ev.code;
+      break;
+    case AT_EVENT_CSQ:
+      rssi = ev.signal.rssi;
+      break;
+    case AT_EVENT_CESQ:
+      rsrq = ev.signal.rsrq;
+      rsrp = ev.signal.rsrp;
+      break;
+    case AT_EVENT_CAOPEN:
+      caopenResult = (int8_t)ev.socket.state;
+      break;
+    case AT_EVENT_INFO:
+      infoLines++;
+      break;
+    default:
+      break;
+  }
+  return false;
+}
+
+size_t AtReply::summarize(char* out, size_t outSize) const {
+  if (outSize == 0) return 0;
+  out[0] = '\0';
+  size_t n = 0;
+  auto append = [&](const char* fmt, long v) {
+    if (n + 1 >= outSize) return;
+    int w = snprintf(out + n, outSize - n, fmt, v);
+    if (w > 0) n = n + (size_t)w < outSize ? n + (size_t)w : outSize - 1;
+  };
+  auto appendStr = [&](const char* s) {
+    while (*s != '\0' && n + 1 < outSize) out[n++] = *s++;
+    out[n] = '\0';
+  };
+
+  appendStr(final == AT_EVENT_NONE ? "timeout" : atEventName(final));
+  if (final == AT_EVENT_CME_ERROR) append(" %ld", errorCode);
+  for (uint8_t cid = 0; cid < 8; cid++) {
+    if ((pdpSeen & (1u << cid)) == 0) continue;
+    append(" pdp%ld=", cid);
+    appendStr(pdpIsActive(cid) ? "1" : "0");
+  }
+  if (pdpIp0[0] != '\0') {
+    appendStr(" ip=");
+    appendStr(pdpIp0);
+  }
+  if (cgatt >= 0) append(" cgatt=%ld", cgatt);
+  if (smstate >= 0) append(" smstate=%ld", smstate);
+  if (rssi != 99) append(" csq=%ld", rssi);
+  if (rsrp <= 97) append(" rsrp=%ld", rsrpDbm());
+  if (caopenResult >= 0) append(" caopen=%ld", caopenResult);
+  if (prompt) appendStr(" prompt");
+  return n;
+}
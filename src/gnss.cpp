@@ -0,0 +1,211 @@
+#include "gnss.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "time_sync.h"
+
+// +CGNSINF の項目位置
+// 0:実行状態 1:測位状態 2:UTC日時 3:緯度 4:経度 5:高度 6:対地速度 7:方位 8:測位モード 9:予約
+// 10:HDOP 11:PDOP 12:VDOP 13:予約 14:可視衛星数 15:使用衛星数 ...
+static const int CGNSINF_MAX_FIELDS = 21;
+
+static int parseDigits(const char* p, int n) {
+  int v = 0;
+  for (int i = 0; i < n; i++) {
+    if (p[i] < '0' || p[i] > '9') return -1;
+    v = v * 10 + (p[i] - '0');
+  }
+  return v;
+}
+
+static bool fieldEmpty(const char* f) {
+  return *f == ',' || *f == '\r' || *f == '\n' || *f == '\0';
+}
+
+bool parseCgnsinf(const char* response, GnssFix& fix) {
+  memset(&fix, 0, sizeof(fix));
+  const char* p = strstr(response, "+CGNSINF:");
+  if (p == nullptr) return false;
+  p += 9;
+  while (*p == ' ') p++;
+
+  const char* fields[CGNSINF_MAX_FIELDS];
+  int count = 0;
+  fields[count++] = p;
+  for (; *p != '\0' && *p != '\r' && *p != '\n' && count < CGNSINF_MAX_FIELDS; p++) {
+    if (*p == ',') fields[count++] = p + 1;
+  }
+  if (count < 11) return false;
+  if (fieldEmpty(fields[1]) || atoi(fields[1]) != 1) return false;
+  if (fieldEmpty(fields[3]) || fieldEmpty(fields[4])) return false;
+
+  double lat = strtod(fields[3], nullptr);
+  double lon = strtod(fields[4], nullptr);
+  if (lat < -90.0 || lat > 90.0 || lon < -180.0 || lon > 180.0) return false;
+  fix.latE6 = (int32_t)lround(lat * 1e6);
+  fix.lonE6 = (int32_t)lround(lon * 1e6);
+  fix.altM = fieldEmpty(fields[5]) ? 0.0f : (float)strtod(fields[5], nullptr);
+  fix.speedKmh = fieldEmpty(fields[6]) ? 0.0f : (float)strtod(fields[6], nullptr);
+  fix.hdop = fieldEmpty(fields[10]) ? 0.0f : (float)strtod(fields[10], nullptr);
+  // 使用衛星数が空欄のファームウェアでは可視衛星数で代用する
+  if (count > 15 && !fieldEmpty(fields[15])) {
+    fix.satsUsed = (uint8_t)atoi(fields[15]);
+  } else if (count > 14 && !fieldEmpty(fields[14])) {
+    fix.satsUsed = (uint8_t)atoi(fields[14]);
+  }
+
+  // yyyyMMddhhmmss.sss（UTC）
+  const char* t = fields[2];
+  int year = parseDigits(t, 4);
+  int mo = parseDigits(t + 4, 2);
+  int dd = parseDigits(t + 6, 2);
+  int hh = parseDigits(t + 8, 2);
+  int mi = parseDigits(t + 10, 2);
+  int ss = parseDigits(t + 12, 2);
+  if (year >= 2020 && mo >= 1 && mo <= 12 && dd >= 1 && dd <= 31 && hh >= 0 && hh <= 23 &&
+      mi >= 0 && mi <= 59 && ss >= 0 && ss <= 60) {
+    fix.epoch = civilToEpoch(year, mo, dd, hh, mi, ss, 0);
+  }
+  fix.valid = true;
+  return true;
+}
+
+float gnssDistanceM(int32_t latE6a, int32_t lonE6a, int32_t latE6b, int32_t lonE6b) {
+  const double R = 6371000.0;
+  const double DEG = 3.14159265358979323846 / 180.0 / 1e6;
+  double lat1 = latE6a * DEG;
+  double lat2 = latE6b * DEG;
+  double dLon = (double)(lonE6b - lonE6a) * DEG;
+  if (dLon > 3.14159265358979323846) dLon -= 2 * 3.14159265358979323846;
+  if (dLon < -3.14159265358979323846) dLon += 2 * 3.14159265358979323846;
+  double x = dLon * cos((lat1 + lat2) / 2);
+  double y = lat2 - lat1;
+  return (float)(sqrt(x * x + y * y) * R);
+}
+
+GnssScheduler::GnssScheduler()
+  : phase_(PHASE_IDLE),
+    moving_(false),
+    stationaryStreak_(0),
+    failStreak_(0),
+    startedMs_(0),
+    timeoutMs_(0),
+    nextFixMs_(0),
+    intervalMs_(0),
+    everStarted_(false) {
+  memset(&stats_, 0, sizeof(stats_));
+  memset(&last_, 0, sizeof(last_));
+}
+
+// LTE 再接続の見込み（実測があればその平均）
+uint32_t GnssScheduler::reattachEstimateMs() const {
+  if (stats_.windows > 0 && stats_.totalReattachMs > 0) {
+    return (uint32_t)(stats_.totalReattachMs / stats_.windows);
+  }
+  return config_.reattachEstimateMs;
+}
+
+// 前回の測位からエフェメリスの有効期間内ならホットスタートの待ち時間
+uint32_t GnssScheduler::timeoutFor(uint32_t nowMs) const {
+  if (last_.valid && nowMs - last_.monoMs < config_.hotValidMs) return config_.hotTimeoutMs;
+  return config_.coldTimeoutMs;
+}
+
+// 実測の平均所要時間から、LTE を止める割合が maxDutyPct 以下になる測位間隔
+uint32_t GnssScheduler::minIntervalMs() const {
+  if (stats_.windows == 0 || config_.maxDutyPct == 0) return 0;
+  uint64_t avgOff = stats_.radioOffMs / stats_.windows;
+  uint64_t minInterval = avgOff * 100 / config_.maxDutyPct;
+  return minInterval > UINT32_MAX ? UINT32_MAX : (uint32_t)minInterval;
+}
+
+uint32_t GnssScheduler::windowMs(uint32_t nowMs) const {
+  return timeoutFor(nowMs) + reattachEstimateMs();
+}
+
+uint32_t GnssScheduler::nextFixInMs(uint32_t nowMs) const {
+  if (!everStarted_) return 0;
+  int32_t remaining = (int32_t)(nextFixMs_ - nowMs);
+  return remaining > 0 ? (uint32_t)remaining : 0;
+}
+
+bool GnssScheduler::shouldStart(uint32_t nowMs, uint32_t msUntilUplink, uint32_t reportIntervalMs) const {
+  if (phase_ != PHASE_IDLE) return false;
+  if (nextFixInMs(nowMs) > 0) return false;
+  uint32_t window = windowMs(nowMs);
+  if (reportIntervalMs == 0 || reportIntervalMs > window) {
+    // 次の送信までに測位と再接続が収まる時だけ始める
+    return msUntilUplink >= window;
+  }
+  // 送信周期の方が短い：送信の直後（周期の前半）に始め、期限の来た送信は測位後へ遅らせる
+  return msUntilUplink >= reportIntervalMs / 2;
+}
+
+uint32_t GnssScheduler::start(uint32_t nowMs) {
+  timeoutMs_ = timeoutFor(nowMs);
+  phase_ = PHASE_ACQUIRING;
+  startedMs_ = nowMs;
+  everStarted_ = true;
+  stats_.windows++;
+  return timeoutMs_;
+}
+
+bool GnssScheduler::expired(uint32_t nowMs) const {
+  return phase_ == PHASE_ACQUIRING && nowMs - startedMs_ >= timeoutMs_;
+}
+
+void GnssScheduler::finish(uint32_t acquiredAtMs, const GnssFix* fix, uint32_t reattachMs, uint32_t nowMs) {
+  if (phase_ != PHASE_ACQUIRING) return;
+  phase_ = PHASE_IDLE;
+  stats_.radioOffMs += nowMs - startedMs_;
+  stats_.lastReattachMs = reattachMs;
+  stats_.totalReattachMs += reattachMs;
+  if (reattachMs > stats_.maxReattachMs) stats_.maxReattachMs = reattachMs;
+
+  uint32_t interval;
+  if (fix != nullptr && fix->valid) {
+    uint32_t ttff = acquiredAtMs - startedMs_;
+    stats_.fixes++;
+    stats_.lastTtffMs = ttff;
+    stats_.totalTtffMs += ttff;
+    if (ttff > stats_.maxTtffMs) stats_.maxTtffMs = ttff;
+
+    bool moved = fix->speedKmh >= config_.motionSpeedKmh;
+    if (last_.valid &&
+        gnssDistanceM(last_.latE6, last_.lonE6, fix->latE6, fix->lonE6) >= config_.motionThresholdM) {
+      moved = true;
+    }
+    moving_ = moved;
+    last_ = *fix;
+    last_.monoMs = acquiredAtMs;
+    failStreak_ = 0;
+    if (moving_) {
+      stationaryStreak_ = 0;
+      interval = config_.movingIntervalMs;
+    } else {
+      // 静止が続くほど間隔を倍にする（上限 maxIntervalMs）
+      uint8_t shift = stationaryStreak_ < 8 ? stationaryStreak_ : 8;
+      if (stationaryStreak_ < 255) stationaryStreak_++;
+      uint64_t v = (uint64_t)config_.stationaryIntervalMs << shift;
+      interval = v > config_.maxIntervalMs ? config_.maxIntervalMs : (uint32_t)v;
+    }
+  } else {
+    stats_.timeouts++;
+    uint8_t shift = failStreak_ < 8 ? failStreak_ : 8;
+    if (failStreak_ < 255) failStreak_++;
+    uint64_t v = (uint64_t)config_.retryIntervalMs << shift;
+    interval = v > config_.maxIntervalMs ? config_.maxIntervalMs : (uint32_t)v;
+  }
+  uint32_t lowest = minIntervalMs();
+  if (interval < lowest) interval = lowest;
+  intervalMs_ = interval;
+  nextFixMs_ = nowMs + interval;
+}
+
+void GnssScheduler::recordDeferredUplink(uint32_t delayMs) {
+  stats_.deferredUplinks++;
+  stats_.totalUplinkDelayMs += delayMs;
+  if (delayMs > stats_.maxUplinkDelayMs) stats_.maxUplinkDelayMs = delayMs;
+}
@@ -0,0 +1,43 @@
+#include "health.h"
+#include "le_codec.h"
+
+#include <stdio.h>
+#include <string.h>
+
+size_t encodeHealthFrame(const HealthSample& s, uint8_t* out, size_t outSize) {
+  if (outSize < HEALTH_FRAME_SIZE) return 0;
+  out[0] = HEALTH_FRAME_TYPE;
+  out[1] = s.resetReason;
+  putU16(out + 2, s.recoveries[RECOVERY_DEVICE_RESTART]);
+  putU32(out + 4, s.uptimeSec);
+  putU32(out + 8, s.freeHeap);
+  putU32(out + 12, s.minFreeHeap);
+  putU32(out + 16, s.largestFreeBlock);
+  putU16(out + 20, s.loopStackHwm);
+  putU16(out + 22, s.logTaskStackHwm);
+  putU16(out + 24, s.maxLoopMs);
+  putU16(out + 26, s.recoveries[RECOVERY_PDP_REACTIVATE]);
+  putU16(out + 28, s.recoveries[RECOVERY_MODEM_RESET]);
+  putU16(out + 30, s.recoveries[RECOVERY_HARD_RESET]);
+  return HEALTH_FRAME_SIZE;
+}
+
+size_t formatHealthJson(const HealthSample& s, char* out, size_t outSize) {
+  int n = snprintf(out, outSize,
+                   "{\"health\":{\"rst\":%u,\"boots\":%u,\"up\":%lu,\"heap\":%lu,\"minheap\":%lu,"
+                   "\"maxblk\":%lu,\"stk\":%lu,\"logstk\":%lu,\"loopms\":%lu,\"pdp\":%u,\"mreset\":%u,\"hreset\":%u}}",
+                   (unsigned)s.resetReason,
+                   (unsigned)s.recoveries[RECOVERY_DEVICE_RESTART],
+                   (unsigned long)s.uptimeSec,
+                   (unsigned long)s.freeHeap,
+                   (unsigned long)s.minFreeHeap,
+                   (unsigned long)s.largestFreeBlock,
+                   (unsigned long)s.loopStackHwm,
+                   (unsigned long)s.logTaskStackHwm,
+                   (unsigned long)s.maxLoopMs,
+                   (unsigned)s.recoveries[RECOVERY_PDP_REACTIVATE],
+                   (unsigned)s.recoveries[RECOVERY_MODEM_RESET],
+                   (unsigned)s.recoveries[RECOVERY_HARD_RESET]);
+  if (n < 0) return 0;
+  return (size_t)n < outSize ? (size_t)n : outSize - 1;
+}
@@ -0,0 +1,236 @@
+#include "i2c_bus.h"
+
+#include <string.h>
+
+I2cBusManager::I2cBusManager(I2cBusDriver& driver)
+  : driver_(driver),
+    clockHz_(0),
+    deviceCount_(0),
+    txStartUs_(0),
+    recoveries_(0),
+    failedRecoveries_(0),
+    clockFallbacks_(0) {
+  memset(devices_, 0, sizeof(devices_));
+}
+
+bool I2cBusManager::begin(uint32_t clockHz) {
+  clockHz_ = clockHz;
+  // 前回の異常終了などで SDA が張り付いている場合に備え、初期化前にバスクリアを行う
+  if (driver_.sdaIsLow()) {
+    for (uint8_t i = 0; i < CLEAR_PULSES && driver_.sdaIsLow(); ++i) {
+      driver_.pulseScl();
+    }
+    driver_.generateStop();
+  }
+  return driver_.begin(clockHz_);
+}
+
+bool I2cBusManager::verifyClock() {
+  if (clockHz_ <= STANDARD_MODE_HZ) return false;
+  uint8_t silent = 0;   // bit i = デバイス i が現在のクロックで応答しない
+  for (size_t i = 0; i < deviceCount_; ++i) {
+    if (driver_.probe(devices_[i].address) != 0) silent |= 1u << i;
+  }
+  if (silent == 0) return false;
+  return tryStandardMode(silent);
+}
+
+bool I2cBusManager::tryStandardMode(uint8_t silentMask) {
+  uint32_t fastHz = clockHz_;
+  if (!fallBackToStandardMode()) return false;
+  for (size_t i = 0; i < deviceCount_; ++i) {
+    if ((silentMask & (1u << i)) && driver_.probe(devices_[i].address) == 0) return true;
+  }
+  // 100kHz でも応答しない（未接続）ならクロックの問題ではないので元に戻す
+  driver_.end();
+  clockHz_ = fastHz;
+  clockFallbacks_--;
+  driver_.begin(clockHz_);
+  return false;
+}
+
+bool I2cBusManager::fallBackToStandardMode() {
+  if (clockHz_ <= STANDARD_MODE_HZ) return false;
+  driver_.end();
+  clockHz_ = STANDARD_MODE_HZ;
+  clockFallbacks_++;
+  driver_.begin(clockHz_);
+  return true;
+}
+
+int I2cBusManager::addDevice(uint8_t address, const char* name) {
+  for (size_t i = 0; i < deviceCount_; ++i) {
+    if (devices_[i].address == address) return (int)i;
+  }
+  if (deviceCount_ >= MAX_DEVICES) return -1;
+  I2cDeviceStats& d = devices_[deviceCount_];
+  memset(&d, 0, sizeof(d));
+  d.address = address;
+  d.name = name;
+  return (int)deviceCount_++;
+}
+
+bool I2cBusManager::validHandle(int handle) const {
+  return handle >= 0 && (size_t)handle < deviceCount_;
+}
+
+bool I2cBusManager::inBackoff(int handle) {
+  if (!validHandle(handle)) return true;
+  I2cDeviceStats& d = devices_[handle];
+  if (d.backoffUntilMs == 0) return false;
+  // millis() のラップアラウンドを考慮して差分で比較
+  if ((int32_t)(driver_.nowMs() - d.backoffUntilMs) >= 0) {
+    d.backoffUntilMs = 0; // バックオフ明け: 次の1回を試行として通す
+    return false;
+  }
+  d.skipped++;
+  return true;
+}
+
+void I2cBusManager::beginTransaction(int handle) {
+  (void)handle;
+  txStartUs_ = driver_.nowUs();
+}
+
+void I2cBusManager::endTransaction(int handle, bool ok) {
+  if (!validHandle(handle)) return;
+  I2cDeviceStats& d = devices_[handle];
+  uint32_t latency = driver_.nowUs() - txStartUs_;
+  d.transactions++;
+  d.lastLatencyUs = latency;
+  d.totalLatencyUs += latency;
+  if (latency > d.maxLatencyUs) d.maxLatencyUs = latency;
+
+  if (ok) {
+    d.consecutiveErrors = 0;
+    d.backoffMs = 0;
+    d.backoffUntilMs = 0;
+    return;
+  }
+
+  d.errors++;
+  if (d.consecutiveErrors < 255) d.consecutiveErrors++;
+
+  // Fast-mode で失敗が続き、デバイスが Fast-mode の probe にも応答しない場合は信号品質を疑って
+  // 100kHz で probe し直す。100kHz で応答したときだけ 100kHz に落とす（未接続のデバイスの NACK では
+  // バス全体を落とさない）。連続失敗の回数は残し、再び失敗すれば通常どおりバックオフする
+  if (d.consecutiveErrors == ERRORS_BEFORE_FALLBACK && clockHz_ > STANDARD_MODE_HZ &&
+      driver_.probe(d.address) != 0 && tryStandardMode((uint8_t)(1u << handle))) {
+    return;
+  }
+
+  // 失敗が続く場合はバスハングを疑い、必要ならバスクリア
+  if (d.consecutiveErrors >= ERRORS_BEFORE_RECOVERY) {
+    probeAfterError(handle);
+  }
+
+  // 閾値以上の連続失敗で指数バックオフ（このデバイスのみ見送る）
+  if (d.consecutiveErrors >= ERRORS_BEFORE_BACKOFF) {
+    d.backoffMs = d.backoffMs == 0 ? BACKOFF_BASE_MS : d.backoffMs * 2;
+    if (d.backoffMs > BACKOFF_MAX_MS) d.backoffMs = BACKOFF_MAX_MS;
+    d.backoffUntilMs = driver_.nowMs() + d.backoffMs;
+    if (d.backoffUntilMs == 0) d.backoffUntilMs = 1; // 0 は「バックオフなし」を意味するため回避
+  }
+}
+
+bool I2cBusManager::probeAfterError(int handle) {
+  // endTransmission の戻り値: 0=ACK, 2/3=NACK（デバイス不在・バスは正常）, 4/5=バス異常/タイムアウト
+  uint8_t rc = driver_.probe(devices_[handle].address);
+  if (rc == 4 || rc == 5) {
+    return recoverBus();
+  }
+  return true;
+}
+
+bool I2cBusManager::recoverBus() {
+  driver_.end();
+  // スレーブが SDA を保持している場合、最大9クロックで現在のバイト転送を完了させて解放させる
+  for (uint8_t i = 0; i < CLEAR_PULSES && driver_.sdaIsLow(); ++i) {
+    driver_.pulseScl();
+  }
+  driver_.generateStop();
+  bool released = !driver_.sdaIsLow();
+  bool ok = driver_.begin(clockHz_) && released;
+  if (ok) {
+    recoveries_++;
+  } else {
+    failedRecoveries_++;
+  }
+  return ok;
+}
+
+size_t I2cBusManager::scan(uint8_t* found, size_t maxFound) {
+  size_t n = 0;
+  for (uint8_t address = 0x08; address <= 0x77; ++address) {
+    if (driver_.probe(address) == 0) {
+      if (n < maxFound) found[n] = address;
+      n++;
+    }
+  }
+  return n;
+}
+
+const I2cDeviceStats* I2cBusManager::stats(int handle) const {
+  return validHandle(handle) ? &devices_[handle] : nullptr;
+}
+
+#ifdef ARDUINO
+
+WireI2cDriver::WireI2cDriver(TwoWire& wire, int sdaPin, int sclPin)
+  : wire_(wire), sdaPin_(sdaPin), sclPin_(sclPin) {}
+
+bool WireI2cDriver::begin(uint32_t clockHz) {
+  bool ok = wire_.begin(sdaPin_, sclPin_, clockHz);
+  // 張り付いたデバイスで読み取りが長時間ブロックしないようタイムアウトを短めに設定
+  wire_.setTimeOut(50);
+  return ok;
+}
+
+void WireI2cDriver::end() {
+  wire_.end();
+}
+
+uint8_t WireI2cDriver::probe(uint8_t address) {
+  wire_.beginTransmission(address);
+  return wire_.endTransmission();
+}
+
+bool WireI2cDriver::sdaIsLow() {
+  pinMode(sdaPin_, INPUT_PULLUP);
+  delayMicroseconds(5);
+  return digitalRead(sdaPin_) == LOW;
+}
+
+void WireI2cDriver::pulseScl() {
+  // 100kHz 相当（5us Low / 5us High）でトグル
+  pinMode(sclPin_, OUTPUT_OPEN_DRAIN);
+  digitalWrite(sclPin_, LOW);
+  delayMicroseconds(5);
+  digitalWrite(sclPin_, HIGH);
+  delayMicroseconds(5);
+}
+
+void WireI2cDriver::generateStop() {
+  // SCL High の間に SDA を Low → High に遷移させる
+  pinMode(sdaPin_, OUTPUT_OPEN_DRAIN);
+  pinMode(sclPin_, OUTPUT_OPEN_DRAIN);
+  digitalWrite(sclPin_, LOW);
+  digitalWrite(sdaPin_, LOW);
+  delayMicroseconds(5);
+  digitalWrite(sclPin_, HIGH);
+  delayMicroseconds(5);
+  digitalWrite(sdaPin_, HIGH);
+  delayMicroseconds(5);
+  pinMode(sdaPin_, INPUT_PULLUP);
+  pinMode(sclPin_, INPUT_PULLUP);
+}
+
+uint32_t WireI2cDriver::nowMs() {
+  return millis();
+}
+
+uint32_t WireI2cDriver::nowUs() {
+  return micros();
+}
+
+#endif
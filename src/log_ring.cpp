@@ -0,0 +1,242 @@
+#include "log_ring.h"
+
+#include <stdio.h>
+
+static const char* const LOG_FORMAT_TABLE[] = {
+#define LOG_FORMAT_STRING(id, fmt) fmt,
+  LOG_FORMAT_LIST(LOG_FORMAT_STRING)
+#undef LOG_FORMAT_STRING
+};
+
+const char* logFormatString(unsigned id) {
+  return id < LF_COUNT ? LOG_FORMAT_TABLE[id] : nullptr;
+}
+
+LogRing::LogRing(uint8_t* buffer, size_t size, ClockFn clock)
+  : buf_(buffer),
+    size_(size),
+    head_(0),
+    tail_(0),
+    count_(0),
+    clock_(clock),
+    level_(LOG_LEVEL_INFO),
+    written_(0),
+    dropped_(0),
+    droppedReported_(0) {
+#ifdef ARDUINO
+  portMUX_INITIALIZE(&mux_);
+#endif
+}
+
+void LogRing::lock() {
+#ifdef ARDUINO
+  portENTER_CRITICAL(&mux_);
+#endif
+}
+
+void LogRing::unlock() {
+#ifdef ARDUINO
+  portEXIT_CRITICAL(&mux_);
+#endif
+}
+
+void LogRing::putBytes(size_t pos, const uint8_t* src, size_t n) {
+  size_t first = size_ - pos;
+  if (first > n) first = n;
+  memcpy(buf_ + pos, src, first);
+  if (n > first) memcpy(buf_, src + first, n - first);
+}
+
+void LogRing::getBytes(size_t pos, uint8_t* dst, size_t n) const {
+  size_t first = size_ - pos;
+  if (first > n) first = n;
+  memcpy(dst, buf_ + pos, first);
+  if (n > first) memcpy(dst + first, buf_, n - first);
+}
+
+bool LogRing::write(LogLevel level, uint16_t fmtId, const LogArg* args, size_t argCount) {
+  if (!enabled(level)) return false;
+
+  // レコードはスタック上で組み立ててからリングへ一括コピーする
+  uint8_t rec[MAX_RECORD];
+  size_t len = HEADER_SIZE;
+  uint32_t ts = clock_ ? clock_() : 0;
+  rec[1] = (uint8_t)level;
+  rec[2] = (uint8_t)(fmtId & 0xFF);
+  rec[3] = (uint8_t)(fmtId >> 8);
+  memcpy(rec + 4, &ts, sizeof(ts));
+
+  if (argCount > MAX_ARGS) argCount = MAX_ARGS;
+  for (size_t i = 0; i < argCount; ++i) {
+    const LogArg& a = args[i];
+    if (a.tag == 's') {
+      if (len + 2 > MAX_RECORD) break;
+      size_t n = strlen(a.s);
+      if (n > MAX_STR_ARG) n = MAX_STR_ARG;
+      if (len + 2 + n > MAX_RECORD) n = MAX_RECORD - len - 2;
+      rec[len++] = 's';
+      rec[len++] = (uint8_t)n;
+      for (size_t k = 0; k < n; ++k) {
+        char c = a.s[k];
+        rec[len++] = (c == '\r' || c == '\n') ? '|' : (uint8_t)c;
+      }
+    } else {
+      if (len + 5 > MAX_RECORD) break;
+      rec[len++] = (uint8_t)a.tag;
+      memcpy(rec + len, &a.v, 4);
+      len += 4;
+    }
+  }
+  rec[0] = (uint8_t)len;
+
+  lock();
+  bool ok = (size_ - count_) >= len;
+  if (ok) {
+    putBytes(head_, rec, len);
+    head_ = (head_ + len) % size_;
+    count_ += len;
+    written_++;
+  } else {
+    dropped_++;
+  }
+  unlock();
+  return ok;
+}
+
+size_t LogRing::read(uint8_t* out, size_t outSize) {
+  lock();
+  if (count_ == 0) {
+    unlock();
+    return 0;
+  }
+  uint8_t len = buf_[tail_];
+  if (len > outSize) {
+    // 呼び出し側バッファが小さい場合はレコードを読み捨てる
+    tail_ = (tail_ + len) % size_;
+    count_ -= len;
+    unlock();
+    return 0;
+  }
+  getBytes(tail_, out, len);
+  tail_ = (tail_ + len) % size_;
+  count_ -= len;
+  unlock();
+  return len;
+}
+
+size_t LogRing::used() const {
+  return count_;
+}
+
+uint32_t LogRing::takeDropped() {
+  lock();
+  uint32_t n = dropped_ - droppedReported_;
+  droppedReported_ = dropped_;
+  unlock();
+  return n;
+}
+
+size_t LogRing::format(const uint8_t* record, size_t len, char* out, size_t outSize) {
+  if (outSize == 0) return 0;
+  out[0] = '\0';
+  if (len < HEADER_SIZE || record[0] != len) return 0;
+
+  static const char LEVEL_CHARS[] = "-EWID";
+  uint8_t level = record[1];
+  uint16_t fmtId = (uint16_t)(record[2] | (record[3] << 8));
+  uint32_t ts;
+  memcpy(&ts, record + 4, sizeof(ts));
+
+  size_t pos = 0;
+  auto append = [&](int n) {
+    if (n > 0) {
+      pos += (size_t)n;
+      if (pos >= outSize) pos = outSize - 1;
+    }
+  };
+
+  append(snprintf(out, outSize, "[%8lu] %c ", (unsigned long)ts, level < 5 ? LEVEL_CHARS[level] : '?'));
+
+  const char* fmt = logFormatString(fmtId);
+  if (fmt == nullptr) {
+    append(snprintf(out + pos, outSize - pos, "<unknown format %u>", (unsigned)fmtId));
+    return pos;
+  }
+
+  // 壊れた・別ビルドのダンプでも out と strArg の外へ書かないよう、引数の長さは全て検証して
+  // 合わなければレコードごと捨てる
+  auto reject = [&]() {
+    out[0] = '\0';
+    return (size_t)0;
+  };
+
+  size_t argPos = HEADER_SIZE;
+  char spec[16];
+  char strArg[MAX_STR_ARG + 1];
+
+  for (const char* p = fmt; *p && pos < outSize - 1; ++p) {
+    if (*p != '%') {
+      out[pos++] = *p;
+      out[pos] = '\0';
+      continue;
+    }
+    if (p[1] == '%') {
+      out[pos++] = '%';
+      out[pos] = '\0';
+      ++p;
+      continue;
+    }
+
+    // 変換指定子を抽出（長さ修飾子 l/h/z は引数を正規化しているため除去）
+    size_t sp = 0;
+    spec[sp++] = '%';
+    ++p;
+    while (*p && strchr("diouxXcsfFeEgG", *p) == nullptr && sp < sizeof(spec) - 2) {
+      if (*p != 'l' && *p != 'h' && *p != 'z') spec[sp++] = *p;
+      ++p;
+    }
+    if (*p == '\0') break;
+    char conv = *p;
+    spec[sp++] = conv;
+    spec[sp] = '\0';
+
+    if (argPos >= len) {
+      append(snprintf(out + pos, outSize - pos, "<?>"));
+      continue;
+    }
+
+    char tag = (char)record[argPos++];
+    if (tag == 's') {
+      if (argPos >= len) return reject();
+      uint8_t n = record[argPos++];
+      if (n > MAX_STR_ARG || argPos + n > len) return reject();
+      memcpy(strArg, record + argPos, n);
+      strArg[n] = '\0';
+      argPos += n;
+      append(snprintf(out + pos, outSize - pos, conv == 's' ? spec : "%s", strArg));
+      continue;
+    }
+
+    if ((tag != 'i' && tag != 'u' && tag != 'f') || argPos + 4 > len) return reject();
+    uint32_t raw;
+    float f;
+    memcpy(&raw, record + argPos, 4);
+    memcpy(&f, record + argPos, 4);
+    argPos += 4;
+    if (tag != 'f') {
+      f = tag == 'i' ? (float)(int32_t)raw : (float)raw;
+    }
+    if (strchr("fFeEgG", conv)) {
+      append(snprintf(out + pos, outSize - pos, spec, (double)f));
+    } else if (conv == 's') {
+      append(snprintf(out + pos, outSize - pos, "<bad arg>"));
+    } else if (conv == 'd' || conv == 'i' || conv == 'c') {
+      int v = tag == 'f' ? (int)f : (int)(int32_t)raw;
+      append(snprintf(out + pos, outSize - pos, spec, v));
+    } else {
+      unsigned v = tag == 'f' ? (unsigned)f : (unsigned)raw;
+      append(snprintf(out + pos, outSize - pos, spec, v));
+    }
+  }
+  return pos;
+}
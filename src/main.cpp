@@ -5,20 +5,105 @@
 #include "SparkFun_SCD4x_Arduino_Library.h"
 #include "SparkFun_FS3000_Arduino_Library.h"
 
-#define TINY_GSM_MODEM_SIM7080
+// モデムの種類は platformio.ini の build_flags（-DTINY_GSM_MODEM_xxx）で指定する。
+// 既定の内蔵スタックのバックエンドは SIM7080 専用のため、他のモデムでは汎用バックエンドを指定する
+#if !defined(TINY_GSM_MODEM_SIM7080) && !defined(MODEM_BACKEND_GENERIC)
+#error "The built-in backend requires -DTINY_GSM_MODEM_SIM7080; add -DMODEM_BACKEND_GENERIC for other modems"
+#endif
 #include <TinyGsmClient.h>
 #include <ArduinoHttpClient.h>
 #include <ArduinoJson.h>
 
 #include <stdlib.h>
 
+#include "i2c_bus.h"
+#include "log_ring.h"
+#include "health.h"
+#include "ventilation.h"
+#include "time_sync.h"
+#include "scheduler.h"
+#include "transport.h"
+#include "payload_codec.h"
+#include "registration.h"
+#include "ota_delta.h"
+#include "system_clock.h"
+#include "soak_stats.h"
+#include "trend_history.h"
+#include "trend_chart.h"
+#include "ui_input.h"
+#include "sd_logger.h"
+#include "uplink_budget.h"
+#include "gnss.h"
+#include "at_command.h"
+#include "signal_gate.h"
+#include "modem_backend.h"
+#include "modem_emulator.h"
+
+#include <esp_system.h>
+#include <esp_heap_caps.h>
+#include <esp_idf_version.h>
+#include <Preferences.h>
+#include <SD.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+#include <mbedtls/pk.h>
+#if __has_include("ota_pubkey.h")
+#include "ota_pubkey.h"  // tools/ota_delta.py keygen で生成（未生成ならOTAは無効）
+#define OTA_SIGNING_KEY_AVAILABLE
+#endif
+
+// 時刻の取得と待機は sysClock 経由で行う
+// 実機は ArduinoClock。ホストのシミュレーションでは VirtualClock に差し替え、待機やタイムアウトを即時に進める
+ArduinoClock arduinoClock;
+SystemClock* sysClock = &arduinoClock;
+static inline uint32_t nowMs() { return sysClock->nowMs(); }
+static inline uint32_t nowUs() { return sysClock->nowUs(); }
+static inline void sleepMs(uint32_t ms) { sysClock->sleepMs(ms); }
+
 // インスタンス生成
 SCD4x scd40;
 FS3000 fs3000;
 
+// I2Cバス（PortA: SDA=21, SCL=22）
+#define I2C_SDA 21
+#define I2C_SCL 22
+WireI2cDriver i2cDriver(Wire, I2C_SDA, I2C_SCL);
+I2cBusManager i2cBus(i2cDriver);
+int i2cDevScd40 = -1;
+int i2cDevFs3000 = -1;
+
 // センサー読み取り周期 (ミリ秒)
 static unsigned long INTERVAL = 10000; // デフォルト値は10秒
-unsigned long lastUpdate = 0;
+
+// 周期処理のスケジューラ（期限ベース。送信がブロックしても周期はずれない）
+static unsigned long DISPLAY_INTERVAL = 5000;           // LCD更新周期
+static unsigned long METADATA_INTERVAL = 3600000;       // メタデータ再取得周期（既定1時間）
+DeadlineScheduler scheduler;
+int timerSample = -1;
+int timerUplink = -1;
+int timerDisplay = -1;
+int timerMetadata = -1;
+int timerOta = -1;
+int timerSoak = -1;
+int timerGnss = -1;
+
+// 最新の読み取り値（サンプリングと送信・表示を分離するため保持）
+struct SensorReading {
+  float co2;
+  float temp;
+  float humidity;
+  float windSpeed;
+  bool scd40Ok;
+  bool fs3000Ok;
+  uint32_t epoch;
+  unsigned long sampledAtMs;
+  bool valid;
+};
+SensorReading latestReading = {};
+uint8_t pendingVentEvents = 0;
+bool lastSendAttempted = false;
+bool lastSendSuccess = false;
 
 // 通信状態監視用変数
 int consecutiveFailures = 0;
@@ -36,17 +121,218 @@ String subscriberName = "Unknown";
 #define SerialAT Serial2
 #define ENDPOINT "uni.soracom.io"
 
-const char udpServer[] = "uni.soracom.io"; // サーバーのIPアドレス
-const uint16_t udpPort = 23080;         // サーバーのポート番号
+// 送信先（-DUDP_SERVER='"192.168.1.10"' -DMQTT_BROKER='"192.168.1.10"' 等でローカルの受信スタンドイン
+// tools/ingest_standin.py へ向け、Harvest を介さずにデコード結果と遅延を確認できる）
+#ifndef UDP_SERVER
+#define UDP_SERVER "uni.soracom.io"
+#endif
+#ifndef UDP_PORT
+#define UDP_PORT 23080
+#endif
+#ifndef MQTT_BROKER
+#define MQTT_BROKER "beam.soracom.io"
+#endif
+#ifndef MQTT_BROKER_PORT
+#define MQTT_BROKER_PORT 1883
+#endif
+
+const char udpServer[] = UDP_SERVER; // サーバーのIPアドレス
+const uint16_t udpPort = UDP_PORT;   // サーバーのポート番号
+
+// モデムUART設定
+// 起動時に AT+IPR で MODEM_TARGET_BAUD への切替を試み、応答がなければ 115200 に戻す
+// RTS/CTS を使う場合は build_flags で -DMODEM_RTS_PIN=xx -DMODEM_CTS_PIN=yy を指定
+#define MODEM_DEFAULT_BAUD 115200
+#ifndef MODEM_TARGET_BAUD
+#define MODEM_TARGET_BAUD 460800
+#endif
+#ifndef MODEM_RX_BUFFER_SIZE
+#define MODEM_RX_BUFFER_SIZE 4096
+#endif
+uint32_t modemBaud = MODEM_DEFAULT_BAUD;
+volatile uint32_t modemUartOverflows = 0;
+volatile uint32_t modemUartErrors = 0;
+
+// モデムへ送った AT コマンドを数えるストリーム（TinyGSM の送受信はこれを経由する）
+class AtCountingStream : public Stream {
+public:
+  explicit AtCountingStream(Stream& inner) : inner_(inner) {}
+  int available() override { return inner_.available(); }
+  int read() override { return inner_.read(); }
+  int peek() override { return inner_.peek(); }
+  void flush() override { inner_.flush(); }
+  size_t write(uint8_t b) override {
+    counter_.feed(&b, 1);
+    return inner_.write(b);
+  }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    counter_.feed(buffer, size);
+    return inner_.write(buffer, size);
+  }
+  uint32_t commands() const { return counter_.count(); }
+
+private:
+  Stream& inner_;
+  AtCommandCounter counter_;
+};
+AtCountingStream modemStream(SerialAT);
+TinyGsm modem(modemStream);
+bool udpSocketOpen = false;
+
+// 送信・状態確認の AT コマンドは TinyGSM の waitResponse（応答を String に溜めて indexOf で探す）を通さず、
+// AtClient で送って受信バイトを AtTokenizer で行毎に解析し、AtReply に集約する（ヒープ確保なし）
+class UartAtChannel : public AtChannel {
+public:
+  void write(const uint8_t* data, size_t len) override { modemStream.write(data, len); }
+  int read() override { return modemStream.read(); }
+};
+UartAtChannel uartAtChannel;
+AtClient atClient(uartAtChannel, sysClock);
+
+// 状態確認コマンドを送り、応答の要約を out に書いて返す（診断ログ用）
+static const char* atQuerySummary(const char* cmd, char* out, size_t outSize) {
+  AtReply reply;
+  atClient.query(cmd, 5000, reply);
+  reply.summarize(out, outSize);
+  return out;
+}
+
+// 送信経路（UDP 送信・MQTT 発行・HTTP GET）のバックエンド
+// 既定は SIM7080 の内蔵スタック（+CA*/+SM*/+SH*）。-DMODEM_BACKEND_GENERIC では TinyGsmClient の TCP ソケットだけを使い、
+// MQTT/HTTP をソケット上で組み立てる（TinyGSM が対応する他のモデムへ移植する際の経路。UDP は使えない）
+Sim7080Backend sim7080Backend(atClient);
+#ifdef MODEM_BACKEND_GENERIC
+class TinyGsmSocket : public ModemSocket {
+public:
+  TinyGsmSocket(TinyGsm& modem, uint8_t mux) : client_(modem, mux) {}
+  bool connect(const char* host, uint16_t port, uint32_t timeoutMs) override {
+    return client_.connect(host, port, (int)((timeoutMs + 999) / 1000));
+  }
+  size_t write(const uint8_t* data, size_t len) override { return client_.write(data, len); }
+  int available() override { return client_.available(); }
+  int read() override { return client_.read(); }
+  bool connected() override { return client_.connected(); }
+  void stop() override { client_.stop(); }
+
+private:
+  TinyGsmClient client_;
+};
+TinyGsmSocket genericMqttSocket(modem, 1);
+TinyGsmSocket genericHttpSocket(modem, 2);
+GenericBackend genericBackend(genericMqttSocket, genericHttpSocket, sysClock);
+ModemBackend* modemBackend = &genericBackend;
+#else
+ModemBackend* modemBackend = &sim7080Backend;
+#endif
+
+// 使用中のバックエンドの直前の応答の要約（AT の応答を持たないバックエンドは "n/a"）
+static const char* backendReplySummary(char* out, size_t outSize) {
+  const AtReply* reply = modemBackend->lastReply();
+  if (reply != nullptr) {
+    reply->summarize(out, outSize);
+  } else if (outSize > 0) {
+    snprintf(out, outSize, "n/a");
+  }
+  return out;
+}
+
+// ネットワーク登録の高速化
+// 前回登録できた事業者・方式（Cat-M/NB-IoT）・バンドを NVS に保存し、次回はそれに絞って探索する。
+// 絞り込みで登録できなければ全方式・全バンドに広げて探索し直す
+#define REGISTRATION_FAST_TIMEOUT 20000L
+#define CATM_BANDS_ALL "1,2,3,4,5,8,12,13,14,18,19,20,25,26,27,28,66,85"
+#define NBIOT_BANDS_ALL "1,2,3,4,5,8,12,13,18,19,20,25,26,28,66,71,85"
+RegistrationHint registrationHint;
+RegistrationStats bootRegistration;      // 起動時の登録
+RegistrationStats recoveryRegistration;  // resetModem / hardResetModem 後の登録
+// モデムに設定済みの探索条件（+CNMP/+CMNB/+CBANDCFG はモデムの不揮発領域に残るため再起動後も有効）
+enum RadioSearchMode : uint8_t { SEARCH_UNKNOWN = 0, SEARCH_RESTRICTED = 1, SEARCH_WIDE = 2 };
+RadioSearchMode radioSearchMode = SEARCH_UNKNOWN;
+
+// 差分OTA（メタデータ ota_url / ota_version で配信）
+// 実行中イメージとの差分を Range 要求でチャンク毎に取得し、非実行側のOTAパーティションへ適用する。
+// 1回のタイマー発火で1チャンクだけ処理するため、ダウンロード中も計測・送信は継続する。
+// 進捗は NVS に保存し、回線断や再起動の後は続きから再開する。
+// 新イメージは最初の送信成功で確定し、それまでに再起動すれば旧イメージへ戻す。
+// 標準の arduino-esp32 はブートローダーのロールバック（CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE）が
+// 無効で新イメージが PENDING_VERIFY にならないため、切替前のパーティションと確定前の起動回数を
+// NVS に残し、アプリ側で esp_ota_set_boot_partition() により戻す
+#ifndef FIRMWARE_VERSION
+#define FIRMWARE_VERSION "1.0.0"
+#endif
+#define OTA_CHUNK_SIZE 8192
+#define OTA_STEP_INTERVAL 2000
+#define OTA_MAX_CHUNK_FAILURES 5             // 連続失敗でメタデータ再取得まで中断
+#define OTA_CONFIRM_TIMEOUT 600000UL         // 新イメージをこの時間内に確定できなければ旧イメージへ戻す
+#define OTA_MAX_UNCONFIRMED_BOOTS 1          // 確定前の起動をこの回数まで許す（超えたら旧イメージへ戻す）
+enum OtaPhase : uint8_t { OTA_IDLE = 0, OTA_DOWNLOADING = 1, OTA_REBOOT_PENDING = 2 };
+OtaPhase otaPhase = OTA_IDLE;
+String otaUrl = "";
+OtaProgress otaProgress;
+uint8_t otaChunkFailures = 0;
+bool otaPendingVerify = false;  // 起動中のイメージが未確定（OTA直後の初回起動）
+bool otaBootloaderRollback = false;  // ブートローダーのロールバックが有効で PENDING_VERIFY 状態
+
+// 送信経路のフェイルオーバー（優先経路はメタデータの mqtt フラグ）
+// 優先経路が連続失敗したら代替経路へ一定時間切替え、クールダウン後に優先経路を再試行する
+TransportManager transports;
 
-TinyGsm modem(SerialAT);
+// 通信量の予算（メタデータ budget_daily_kb / budget_monthly_kb）
+// 送信前に優先度クラスで判定し、送出したバイト数は +CASEND / +SMPUB で本文を書き出す箇所で計上する
+// ALARM は常に送り、予算が厳しい間は定期の読み取り値を間引いて次に送る値へ平均として合算する
+#define BUDGET_SAVE_INTERVAL 900000UL  // 使用量を NVS へ保存する間隔（日付・月の切替時は即時）
+UplinkBudget uplinkBudget;
+UplinkClass currentUplinkClass = UPLINK_ROUTINE;  // 送信中のフレームのクラス（AT 層での計上先）
+ReadingCoalescer thinnedReadings;
+unsigned long lastBudgetSave = 0;
+
+// 電波品質に応じた送信の延期（メタデータ signal_defer_s / signal_weak_rsrp / signal_weak_csq）
+// 定期送信の前に +CSQ/+CESQ を測り、弱電界なら読み取り値をキューに溜めて送らず、回復したら続けて送る。
+// 溜めきれない分は間引きと同様に次に送る値へ平均として合算する。ALARM/HEALTH は遅らせない
+SignalGate signalGate;
+DeferredReadingQueue deferredReadings;
+
+// GNSS 測位（メタデータ gnss / gnss_interval_s / gnss_timeout_s）
+// SIM7080 は LTE と GNSS を同時に使えないため、送信の合間に無線を止め（CFUN=0）て測位し、終わったら再接続する。
+// 測位中はタイマーで +CGNSINF を読むだけでループを塞がない。その間に期限の来た送信・メタデータ取得・OTA は
+// 再接続後へ遅らせる。最後の測位結果は読み取り値に経過時間と共に添付する
+#define GNSS_POLL_MS 2000
+bool gnssEnabled = false;
+GnssScheduler gnss;
+volatile bool gnssRadioOff = false;    // 測位のため LTE を止めている（表示用に UI タスクからも読む）
+volatile unsigned long gnssWindowStartMs = 0;
+unsigned long gnssDeferredSince = 0;   // 測位中に最初に期限の来た送信の時刻（0 = なし）
+bool gnssDeferredMetadata = false;
+bool gnssDeferredOta = false;
 
 // MQTT設定状態
 bool mqttEnabled = false;
 String mqttTopic = "";
 int mqttQos = 0; // 0 or 1
 bool mqttConnected = false;
-bool mqttConfigValid = false;
+PayloadFormat mqttFormat = FORMAT_JSON; // 読み取り値のMQTTペイロード形式（メタデータ format）
+UdpFrameFormat udpFrameFormat = UDP_FRAME_FLOAT; // 読み取り値のUDPフレーム形式（メタデータ udp_format）
+bool mqttConfigValid = false; // topic/qos が有効（mqtt=false でもフェイルオーバー先として使用）
+bool mqttConfigApplied = false; // SMCONF 一式を現在のモデムに適用済みか
+
+// MQTTセッション維持
+// 永続セッション（CLEANSS=0）と固定の ClientID で再接続時もブローカー側のセッションを引き継ぎ、
+// キープアライブは送信周期から決める（周期毎の PUBLISH だけでセッションが維持され PINGREQ が不要）
+#define MQTT_MIN_KEEPALIVE_S 60
+#define MQTT_MAX_KEEPALIVE_S 1800
+bool mqttPersistentSession = true;
+struct MqttSessionStats {
+  uint32_t connects;          // SMCONN 成功回数
+  uint32_t reconnects;        // 2回目以降の接続（セッション断からの復帰）
+  uint32_t connectFailures;
+  uint32_t publishes;
+  uint32_t smconfSent;
+  uint32_t smconfSkipped;     // 適用済みと同じ値のため省略した SMCONF
+  uint32_t lastHandshakeMs;   // SMCONN の所要時間
+  uint32_t maxHandshakeMs;
+  uint64_t totalHandshakeMs;
+};
+MqttSessionStats mqttSession = {};
 
 // メタデータから指定可能な MQTT ClientID 候補（未指定なら空）
 // - clientid: SIMタグ名を指定し、その値を採用（推奨）
@@ -56,6 +342,191 @@ bool mqttClientIdFromMetadata = false;
 String mqttClientIdTagKey = "";
 bool mqttClientIdIsFromTagKey = false;
 
+// 遅延ロガー（ホットパスはバイナリレコードをリングバッファへ積むだけ。整形/出力はドレインタスクで実施）
+static uint8_t logBuffer[8192];
+static uint32_t logClock() { return nowMs(); }
+LogRing logRing(logBuffer, sizeof(logBuffer), logClock);
+#define LOGE(id, ...) logRing.log(LOG_LEVEL_ERROR, id, ##__VA_ARGS__)
+#define LOGW(id, ...) logRing.log(LOG_LEVEL_WARN, id, ##__VA_ARGS__)
+#define LOGI(id, ...) logRing.log(LOG_LEVEL_INFO, id, ##__VA_ARGS__)
+#define LOGD(id, ...) logRing.log(LOG_LEVEL_DEBUG, id, ##__VA_ARGS__)
+
+// ヘルステレメトリ
+// 再起動回数と復旧レベル毎の回数はソフトウェアリセットを跨いで保持する
+RTC_NOINIT_ATTR HealthCounters healthCounters;
+LoopTimer loopTimer;
+TaskHandle_t logDrainTaskHandle = NULL;
+static unsigned long HEALTH_INTERVAL = 600000; // ヘルスフレーム送信間隔（既定10分, 0で無効）
+unsigned long lastHealthSent = 0;
+
+// 換気解析（CO2減衰からの換気回数推定）
+// analytics=true の場合は生データの代わりに派生メトリクスとエピソード要約のみを送信する
+VentilationAnalyzer ventilation;
+bool analyticsMode = false;
+static unsigned long ANALYTICS_INTERVAL = 300000; // メトリクスフレーム送信間隔（既定5分）
+unsigned long lastAnalyticsSent = 0;
+
+// 長期運用（ソーク）の計測: 配信率・遅延分布・AT コマンド数・再起動・空きヒープの傾向
+// 電源投入で集計を始め、ソフトウェア再起動を跨いで加算する。一定周期で JSON 1行のレポートを出力
+#ifndef SOAK_REPORT_INTERVAL
+#ifdef SOAK_BENCHMARK
+#define SOAK_REPORT_INTERVAL 600000UL
+#else
+#define SOAK_REPORT_INTERVAL 3600000UL
+#endif
+#endif
+RTC_NOINIT_ATTR SoakStats soakStats;
+unsigned long soakUpdatedMs = 0;
+uint32_t soakAtCommandsSeen = 0;
+
+// CO2推移グラフ（BtnA で 現在値 → 1時間 → 24時間 の画面を切り替え）
+// 履歴は固定サイズ（詳細1時間 + LTTB で間引いた24時間）で、グラフは新しい点の分だけ追記描画する
+class LcdTrendCanvas : public TrendCanvas {
+public:
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) override {
+    M5.Lcd.fillRect(x, y, w, h, color);
+  }
+  void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color) override {
+    M5.Lcd.drawLine(x0, y0, x1, y1, color);
+  }
+  void drawPixel(int16_t x, int16_t y, uint16_t color) override {
+    M5.Lcd.drawPixel(x, y, color);
+  }
+};
+enum ScreenMode : uint8_t { SCREEN_MAIN = 0, SCREEN_TREND_1H, SCREEN_TREND_24H, SCREEN_DIAG };
+const int16_t TREND_HEADER_H = 20;  // グラフ上部の見出し行
+TrendHistory co2History;
+LcdTrendCanvas lcdTrendCanvas;
+TrendChart trendChart(lcdTrendCanvas, 0, TREND_HEADER_H, 320, 240 - TREND_HEADER_H);
+ScreenMode screenMode = SCREEN_MAIN;
+bool trendNeedsRedraw = true;
+uint32_t trendDrawnT = 0;  // グラフに描画済みの最新の点の時刻（秒）
+// 推移グラフの時刻: millis() の差分を64ビットに積算した起動からの経過時間（49.7日毎の millis() の
+// ラップでも単調増加のまま）。サンプリング側は uiMutex を取らずに時刻を付けるため、積算はスピンロックで守る
+uint64_t trendClockMs = 0;
+uint32_t trendClockLastMs = 0;
+portMUX_TYPE trendClockMux = portMUX_INITIALIZER_UNLOCKED;
+
+uint32_t trendSeconds() {
+  portENTER_CRITICAL(&trendClockMux);
+  uint32_t now = nowMs();
+  trendClockMs += (uint32_t)(now - trendClockLastMs);
+  trendClockLastMs = now;
+  uint32_t sec = (uint32_t)(trendClockMs / 1000);
+  portEXIT_CRITICAL(&trendClockMux);
+  return sec;
+}
+
+// SD の書き出し・マウントで uiMutex が塞がっている間のサンプル（ループ側だけが触る）
+// サンプリングは uiMutex を待たずにここへ積み、次に取れたときに co2History へまとめて追加する
+#define CO2_HISTORY_PENDING 8
+TrendPoint co2HistoryPending[CO2_HISTORY_PENDING];
+uint8_t co2HistoryPendingCount = 0;
+uint32_t co2HistoryDeferred = 0;   // uiMutex を取れずに後回しにしたサンプル
+uint32_t co2HistoryDropped = 0;    // 後回しの間に溢れて捨てたサンプル
+
+// ボタン入力（通信処理と独立したUIタスクで 10ms 毎にポーリングし、押下から描画までをUIタスク内で完結する）
+// LCD・表示用の状態・co2History は uiMutex で排他する。ループ側は描画1回分より長く保持しない
+// （モデムの復旧や送信の待ちの間は保持しない）ため、復旧中でも押下から画面反映までは
+//   ポーリング周期 + ループ側の描画1回 + 自画面の描画1回 に収まる
+#define UI_POLL_MS 10
+#define UI_LATENCY_BUDGET_US 150000UL  // 押下から描画完了までの目標（超過回数を記録）
+const int16_t UI_TOAST_H = 18;         // 操作の確認表示の高さ
+const unsigned long UI_TOAST_MS = 3000;
+struct UiStatus {
+  float co2;
+  float temp;
+  float humidity;
+  float windSpeed;
+  bool scd40Ok;
+  bool fs3000Ok;
+  bool sendAttempted;
+  bool sendSuccess;
+  uint8_t transport;  // TransportId
+  bool failover;
+  bool mqttConfigValid;
+  bool mqttConnected;
+  int mqttQos;
+  bool analytics;
+  float ach;
+  uint16_t episodes;
+  uint16_t alarmPpm;
+  int failures;
+  unsigned long intervalMs;
+  bool otaActive;
+  uint8_t otaPercent;
+  char otaVersion[24];
+  char imsi[16];
+  char name[16];
+  int8_t csq;
+  uint8_t rat;        // RadioAccess
+  char plmn[8];
+  uint32_t registrationMs;
+  unsigned long lastSuccessMs;
+  uint32_t modemBaud;
+  uint16_t recoveries[RECOVERY_LEVEL_COUNT];
+  bool budgetLimited;
+  uint32_t budgetDayBytes;
+  uint32_t budgetDayAllowance;
+  uint32_t budgetMonthBytes;
+  uint32_t budgetMonthly;
+  uint32_t budgetThinned;
+  bool gnssEnabled;
+  bool gnssFixValid;
+  bool gnssMoving;
+  int32_t gnssLatE6;
+  int32_t gnssLonE6;
+  uint32_t gnssFixAgeS;
+  uint32_t gnssTimeouts;
+};
+UiStatus uiStatus = {};
+SemaphoreHandle_t uiMutex = NULL;
+TaskHandle_t uiTaskHandle = NULL;
+ButtonDebouncer buttons[BUTTON_COUNT];
+InputLatencyStats inputLatency = {};
+volatile bool uiForceSend = false;         // BtnB の即時送信要求（ループ側で処理）
+volatile bool modemRecovering = false;     // resetModem / hardResetModem の実行中
+volatile unsigned long recoveryStartedMs = 0;
+int8_t lastCsq = 99;                       // 最後に取得した CSQ（99 = 不明）
+char uiToast[40] = "";
+unsigned long uiToastUntil = 0;
+
+// モデム復旧中の表示用（入れ子の呼び出しでは最も外側の開始時刻を保持する）
+struct RecoveryScope {
+  bool outer;
+  RecoveryScope() : outer(!modemRecovering) {
+    if (outer) {
+      recoveryStartedMs = nowMs();
+      modemRecovering = true;
+    }
+  }
+  ~RecoveryScope() {
+    if (outer) modemRecovering = false;
+  }
+};
+
+// SDカードへの読み取り値の記録（通信状態に関わらず全サンプルを残す）
+// サンプリング側は RAM のバッファへ積むだけで、書き込みは専用タスクが 512 バイト単位で行う。
+// SD は LCD と SPI バスを共有するため、書き込みタスクは uiMutex を保持して書き出す（1ブロック毎に解放）。
+// サンプリング側は uiMutex を待たない（addCo2History 参照）
+#ifndef SD_LOG_MAX_FILE_BYTES
+#define SD_LOG_MAX_FILE_BYTES (4UL * 1024 * 1024)
+#endif
+#define SD_LOG_MAX_AGE_MS 60000UL      // これより長くバッファに留めない（電源断で失う範囲の上限）
+#define SD_LOG_POLL_MS 250
+#define SD_MOUNT_RETRY_MS 30000UL
+SdFileStore sdStore(SD);
+SdLogger sdLogger(sdStore, "/logs");
+bool sdMounted = false;
+TaskHandle_t sdLogTaskHandle = NULL;
+
+// 時刻同期（モデムのネットワーク時刻/NTP → millis() と UTC の対応）
+TimeSync timeSync;
+const unsigned long TIME_SYNC_INTERVAL = 6UL * 3600UL * 1000UL; // 6時間毎に再同期
+const unsigned long TIME_SYNC_RETRY = 10UL * 60UL * 1000UL;     // 未同期時の再試行間隔
+unsigned long lastTimeSyncAttempt = 0;
+#define NTP_SERVER "pool.ntp.org"
+
 // 関数プロトタイプ宣言
 bool checkModemStatus();
 void hardResetModem();
@@ -64,15 +535,84 @@ void sendData(uint8_t* payload, size_t payloadSize);
 bool sendDataWithStatus(uint8_t* payload, size_t payloadSize);
 void resetModem();
 void readAndSendData();
+void sampleSensors();
+void sendLatestReading();
+void updateDisplay();
+void refreshUiStatus();
+void renderScreen();
+void drawMainScreen();
+void drawTrendScreen();
+void addCo2History(uint32_t t, uint16_t value);
+void drawDiagScreen();
+void drawUiToast();
+void startUiTask();
+void startSdLogTask();
+void printSdLogStats();
+void benchmarkSdLogging();
+void printUiStats();
+void benchmarkTrendChart();
+void setupScheduler();
+void printSchedulerStats();
 void scanI2CDevices();
+void printI2cStats();
+void startLogDrainTask();
+void benchmarkLogging();
+void initHealthCounters();
+void initSoakStats();
+void updateSoakStats();
+void printSoakReport();
+void setupModemUart();
+bool negotiateModemBaud();
+bool ensureModemBaud();
+void benchmarkModemUart();
+void countRecovery(RecoveryLevel level);
+void sampleHealth(HealthSample& sample);
+bool sendHealthFrame();
+bool sendUplinkFrame(uint8_t* frame, size_t frameSize, const char* json);
+bool transportUsable();
+size_t estimateUplinkBytes(size_t frameSize, size_t mqttLen);
+void chargeUplink(size_t wireBytes);
+void loadBudgetCounters();
+void saveBudgetCounters(bool force);
+void printBudgetStats();
+void gnssStep();
+void gnssDefer(int timer, unsigned long now);
+void printGnssStats();
+bool signalDeferReading(UplinkClass c, const ReadingValues& values, const ReadingPosition* pos, unsigned long now);
+void flushDeferredReadings(unsigned long now);
+bool sendReadingFrame(const ReadingValues& values, uint8_t status, const ReadingPosition* pos,
+                      const uint8_t* mqttPayload, size_t mqttLen);
+void printSignalStats();
+void benchmarkSignalGate();
+void benchmarkGnss();
+bool sendViaTransport(uint8_t* frame, size_t frameSize, const uint8_t* mqttPayload, size_t mqttLen);
+bool sendOnTransport(TransportId t, uint8_t* frame, size_t frameSize, const uint8_t* mqttPayload, size_t mqttLen);
+void benchmarkPayloadFormats();
+void benchmarkAtLayer();
+void benchmarkModemBackends();
+void printTransportStats();
+unsigned long connectionTimeout();
+bool syncModemTime();
+void loadRegistrationHint();
+void saveRegistrationHint();
+bool registerNetwork(bool recovery, uint32_t timeoutMs);
+void initOta();
+void startOta(const char* url, const char* version);
+void otaStep();
+void confirmOtaImage();
+void rollBackOtaImage(const char* reason);
 
 // MQTT関連プロトタイプ
 bool mqttConfigure();
 bool mqttConnect();
-bool mqttPublish(const String& topic, const String& json, int qos);
+bool mqttPublish(const String& topic, const uint8_t* payload, size_t payloadLen, int qos);
 void mqttDisconnect();
 bool isMqttOnline();
 bool isValidMqttTopic(const String& topic);
+uint32_t mqttKeepAliveSec();
+bool mqttConfigChanged();
+void clearSmconfCache();
+void printMqttSessionStats();
 bool ensurePdp0Active();
 
 // SORACOM subscriber tag fetch helper
@@ -81,11 +621,11 @@ String fetchSubscriberTag(const String& tagKey);
 // Ensure PDP context #0 is active and has an IP address
 bool ensurePdp0Active() {
   // Check current PDP context status
-  String pdp = "";
-  modem.sendAT("+CNACT?");
-  modem.waitResponse(5000L, pdp);
-  SerialMon.println("ensurePdp0Active(): current +CNACT?");
-  SerialMon.println(pdp);
+  AtReply pdp;
+  char summary[96];
+  atClient.query("+CNACT?", 5000, pdp);
+  pdp.summarize(summary, sizeof(summary));
+  LOGD(LF_PDP_STATE, summary);
 
   auto hasIp = []() -> bool {
     IPAddress ip = modem.localIP();
@@ -93,7 +633,7 @@ bool ensurePdp0Active() {
   };
 
   // Already active?
-  if (pdp.indexOf("+CNACT: 0,1") != -1 && hasIp()) {
+  if (pdp.pdpIsActive(0) && hasIp()) {
     return true;
   }
 
@@ -101,32 +641,31 @@ bool ensurePdp0Active() {
   const int baseDelay = 1000;
 
   for (int attempt = 0; attempt < maxActTries; ++attempt) {
-    SerialMon.println("ensurePdp0Active(): activating PDP#0 with AT+CNACT=0,1 ...");
+    LOGI(LF_PDP_ACTIVATING);
     modem.sendAT("+CNACT=0,1");
     int r = modem.waitResponse(20000L);
     if (r != 1) {
-      SerialMon.println("ensurePdp0Active(): AT+CNACT=0,1 returned error/timeout");
+      LOGW(LF_PDP_ACT_ERROR);
     }
 
     // Re-check status
-    pdp = "";
-    modem.sendAT("+CNACT?");
-    modem.waitResponse(5000L, pdp);
-    SerialMon.println("ensurePdp0Active(): +CNACT? after activation attempt:");
-    SerialMon.println(pdp);
-
-    if (pdp.indexOf("+CNACT: 0,1") != -1 && hasIp()) {
-      SerialMon.println("ensurePdp0Active(): PDP#0 active with IP");
+    atClient.query("+CNACT?", 5000, pdp);
+    pdp.summarize(summary, sizeof(summary));
+    LOGD(LF_PDP_STATE_AFTER, summary);
+
+    if (pdp.pdpIsActive(0) && hasIp()) {
+      LOGI(LF_PDP_ACTIVE);
       return true;
     }
 
     // As a stronger recovery, after the first failed attempt, try GPRS reconnect
     if (attempt >= 1) {
-      SerialMon.println("ensurePdp0Active(): trying GPRS reconnect (disconnect -> connect)...");
+      LOGW(LF_PDP_GPRS_RECONNECT);
+      countRecovery(RECOVERY_PDP_REACTIVATE);
       modem.gprsDisconnect();
-      delay(1000);
+      sleepMs(1000);
       if (!modem.gprsConnect("soracom.io", "sora", "sora")) {
-        SerialMon.println("ensurePdp0Active(): gprsConnect failed");
+        LOGE(LF_PDP_GPRS_FAILED);
       } else {
         SerialMon.print("ensurePdp0Active(): Local IP after gprsConnect: ");
         SerialMon.println(modem.localIP());
@@ -135,86 +674,255 @@ bool ensurePdp0Active() {
 
     int jitter = rand() % 1000;
     int delayTime = baseDelay * (1 << attempt) + jitter;
-    SerialMon.printf("ensurePdp0Active(): retry %d/%d in %d ms\n", attempt + 1, maxActTries, delayTime);
-    delay(delayTime);
+    LOGI(LF_PDP_RETRY, attempt + 1, maxActTries, delayTime);
+    sleepMs(delayTime);
   }
 
-  SerialMon.println("ensurePdp0Active(): failed to activate PDP#0");
+  LOGE(LF_PDP_FAILED);
   return false;
 }
-// センサーデータの読み取り、送信、画面更新を行う関数
-void readAndSendData() {
-  unsigned long current = millis();
+// センサーデータを読み取り、最新値として保持する関数（サンプリングタイマーから呼ばれる）
+void sampleSensors() {
+  unsigned long current = nowMs();
 
-  // SCD40データの取得
-  bool scd40Success = false;
+  // SCD40データの取得（バックオフ中は見送り、他デバイスの読み取りは継続）
+  // 5秒周期の測定の合間（データ未準備）はバス異常ではないため失敗として数えず、前回値を使う
   float co2 = 0, temp = 0, humidity = 0;
-  
-  if (scd40.readMeasurement()) {
+  bool scd40Fresh = false;
+  bool scd40BusOk = i2cBus.transact(i2cDevScd40, [&]() {
+    if (!scd40.getDataReadyStatus()) {
+      // I2C の失敗でも false が返るため、ACK が返れば未準備とみなす
+      return i2cDriver.probe(0x62) == 0;
+    }
+    if (!scd40.readMeasurement()) return false;
     co2 = scd40.getCO2();
     temp = scd40.getTemperature();
     humidity = scd40.getHumidity();
+    scd40Fresh = true;
+    return true;
+  });
+  bool scd40Success = scd40Fresh;
+  if (scd40BusOk && !scd40Fresh && latestReading.valid && latestReading.scd40Ok) {
+    co2 = latestReading.co2;
+    temp = latestReading.temp;
+    humidity = latestReading.humidity;
     scd40Success = true;
   }
 
+  // サンプル時刻（UTCエポック秒, 未同期なら0）
+  uint32_t sampleEpoch = timeSync.epochAt(current);
+
   // FS3000データの取得
-  bool fs3000Success = false;
   float windSpeed = 0;
   
   // 公式ライブラリの方式を使用
-  windSpeed = fs3000.readMetersPerSecond();
-  if (windSpeed >= 0) {
-    fs3000Success = true;
+  bool fs3000Success = i2cBus.transact(i2cDevFs3000, [&]() {
+    windSpeed = fs3000.readMetersPerSecond();
+    return windSpeed >= 0;
+  });
+  if (fs3000Success) {
     SerialMon.printf("FS3000 Raw: %d, Velocity: %.2f m/s\n", fs3000.readRaw(), windSpeed);
   } else {
-    SerialMon.println("FS3000 readMetersPerSecond() failed");
+    SerialMon.println("FS3000 readMetersPerSecond() failed or in backoff");
+    windSpeed = 0;
+  }
+  printI2cStats();
+
+  // 換気解析（定数メモリの逐次処理）
+  unsigned long analyticsStart = nowUs();
+  uint8_t ventEvents = ventilation.update(current / 1000, co2, scd40Fresh, windSpeed, fs3000Success);
+  unsigned long analyticsUs = nowUs() - analyticsStart;
+  SerialMon.printf("Ventilation: %s ach=%.2f/h episodes=%u corr=%.3f alarm=%s (update %lu us)\n",
+                   ventilation.decaying() ? "decaying" : "idle", ventilation.lastAch(),
+                   ventilation.episodeCount(), ventilation.windAchCorrelation(),
+                   ventilation.alarmActive() ? "on" : "off", analyticsUs);
+  pendingVentEvents |= ventEvents;
+  if (analyticsMode && (ventEvents & VentilationAnalyzer::EVENT_ALARM_ON)) {
+    // しきい値超過は次の送信周期を待たずに即時送信
+    SerialMon.printf("CO2 crossed %.0f ppm, sending reading immediately\n", ventilation.config().alarmPpm);
+    scheduler.trigger(timerUplink, current);
+  }
+
+  soakRecordSample(soakStats);
+  if (scd40Fresh) {
+    addCo2History(trendSeconds(), (uint16_t)co2);
+  }
+
+  latestReading.co2 = co2;
+  latestReading.temp = temp;
+  latestReading.humidity = humidity;
+  latestReading.windSpeed = windSpeed;
+  latestReading.scd40Ok = scd40Success;
+  latestReading.fs3000Ok = fs3000Success;
+  latestReading.epoch = sampleEpoch;
+  latestReading.sampledAtMs = current;
+  latestReading.valid = true;
+
+  // SDカードへの記録（バッファへ積むだけ。一杯なら破棄して数える）
+  SdLogRecord sdRecord = {};
+  sdRecord.epochTime = sampleEpoch != 0;
+  sdRecord.time = sampleEpoch != 0 ? sampleEpoch : current / 1000;
+  sdRecord.co2 = co2;
+  sdRecord.temp = temp;
+  sdRecord.humidity = humidity;
+  sdRecord.windSpeed = windSpeed;
+  sdRecord.scd40Ok = scd40Success;
+  sdRecord.fs3000Ok = fs3000Success;
+  sdLogger.append(sdRecord, current);
+
+  // シリアル出力の更新
+  if (scd40Success && fs3000Success) {
+    SerialMon.printf("CO2: %.0f ppm, Temp: %.2f C, Hum: %.2f %%, Wind: %.2f m/s\n",
+                    co2, temp, humidity, windSpeed);
+  } else if (scd40Success) {
+    SerialMon.printf("CO2: %.0f ppm, Temp: %.2f C, Hum: %.2f %%, Wind: Error\n",
+                    co2, temp, humidity);
+  } else if (fs3000Success) {
+    SerialMon.printf("CO2: Error, Wind: %.2f m/s\n", windSpeed);
+  } else {
+    SerialMon.println("Both sensors failed to read data");
   }
+}
 
-  // データをバイナリ形式でパッキング（16バイトに拡張）
-  uint8_t payload[16];
-  memcpy(payload, &co2, sizeof(co2));
-  memcpy(payload + 4, &temp, sizeof(temp));
-  memcpy(payload + 8, &humidity, sizeof(humidity));
-  memcpy(payload + 12, &windSpeed, sizeof(windSpeed));
-  // co2::float:32:little-endian Temp::float:32:little-endian Humi::float:32:little-endian Wind::float:32:little-endian
+
+// 最新の読み取り値（と解析結果）を送信する関数（送信タイマーから呼ばれる）
+void sendLatestReading() {
+  unsigned long current = nowMs();
+  if (!latestReading.valid) {
+    sampleSensors();
+  }
+  float co2 = latestReading.co2;
+  float temp = latestReading.temp;
+  float humidity = latestReading.humidity;
+  float windSpeed = latestReading.windSpeed;
+  uint32_t sampleEpoch = latestReading.epoch;
+  uint8_t ventEvents = pendingVentEvents;
+  pendingVentEvents = 0;
+  uint32_t nowEpoch = timeSync.epochAt(current);
 
   bool sendSuccess = false;
-  SerialMon.println("Preparing to send data...");
-
-  if (mqttEnabled) {
-    if (mqttConfigValid) {
-      // JSONペイロードを生成
-      String json = String("{\"co2\":") + String(co2, 1)
-                  + ",\"temp\":" + String(temp, 1)
-                  + ",\"humi\":" + String(humidity, 1)
-                  + ",\"wind\":" + String(windSpeed, 2) + "}";
-      SerialMon.print("MQTT JSON: ");
-      SerialMon.println(json);
-
-      // 接続確認し、未接続なら接続
-      if (!isMqttOnline()) {
-        SerialMon.println("MQTT not online. Attempting connect...");
-        mqttConnect();
+  // 解析モードでは生データはしきい値超過時のみ即時送信する
+  UplinkClass rawClass = (ventEvents & VentilationAnalyzer::EVENT_ALARM_ON) ? UPLINK_ALARM : UPLINK_ROUTINE;
+  bool sendRaw = !analyticsMode || rawClass == UPLINK_ALARM;
+
+  // MQTT設定不正で代替経路もない場合は送信しない
+  bool configError = !transportUsable();
+
+  // 経路毎の形式（MQTTはJSON/CBOR/MessagePack, UDPはバイナリ）
+  ReadingValues values = { co2, temp, humidity, windSpeed, sampleEpoch };
+  // GNSS 有効時は最後の測位結果を添付する（MQTT は測位済みの場合だけキーを加え、
+  // UDP の固定小数点フレームは未測位でも位置付きの形式にしてフレーム長を一定に保つ）
+  ReadingPosition position = {};
+  const ReadingPosition* pos = nullptr;
+  if (gnssEnabled) {
+    const GnssFix& fix = gnss.lastFix();
+    position.valid = fix.valid;
+    position.latE6 = fix.latE6;
+    position.lonE6 = fix.lonE6;
+    position.ageS = fix.valid ? (current - fix.monoMs) / 1000 : 0;
+    position.hdop = fix.hdop;
+    pos = &position;
+  }
+  uint8_t mqttPayload[160];
+  size_t mqttLen = 0;
+  size_t payloadLen = udpReadingFrameSize(udpFrameFormat, pos != nullptr);
+  bool coalesced = false;
+  if (sendRaw && !configError) {
+    mqttLen = encodeReading(mqttFormat, values, mqttPayload, sizeof(mqttPayload), pos);
+    if (uplinkBudget.admit(rawClass, estimateUplinkBytes(payloadLen, mqttLen), nowEpoch) != BUDGET_SEND) {
+      // 予算の枠を超えるペースなので今回は送らず、次に送る値へ平均として合算する
+      thinnedReadings.add(values, latestReading.scd40Ok, latestReading.fs3000Ok);
+      SerialMon.printf("Budget: routine reading thinned (%u pending)\n", (unsigned)thinnedReadings.pending());
+      sendRaw = false;
+    } else if (signalGate.enabled() && signalDeferReading(rawClass, values, pos, current)) {
+      // 弱電界: 回復後にまとめて送る
+      sendRaw = false;
+    } else if (rawClass == UPLINK_ROUTINE && thinnedReadings.pending() > 0) {
+      SerialMon.printf("Budget: sending mean of %u readings\n", (unsigned)thinnedReadings.pending() + 1);
+      values = thinnedReadings.takeMean(values, latestReading.scd40Ok, latestReading.fs3000Ok);
+      mqttLen = encodeReading(mqttFormat, values, mqttPayload, sizeof(mqttPayload), pos);
+      coalesced = true;
+    }
+  }
+  bool sendAttempted = sendRaw;
+  if (sendRaw) {
+    SerialMon.println("Preparing to send data...");
+  }
+
+  if (!sendRaw) {
+    // 解析モード: 生データは送信しない（弱電界で遅らせた場合も同様）
+  } else if (configError) {
+    SerialMon.println("MQTT config invalid (topic/qos). Skipping send and waiting for metadata update.");
+    // 送信失敗としてカウントしない（仕様）
+    sendSuccess = false;
+  } else {
+    // 弱電界で遅らせていた読み取り値があれば、回復した今のうちに古い順に続けて送る
+    flushDeferredReadings(current);
+    // 状態ビット: センサーの成否と送信理由（固定小数点フレームのみ）
+    uint8_t status = (latestReading.scd40Ok ? READING_STATUS_SCD40_OK : 0) |
+                     (latestReading.fs3000Ok ? READING_STATUS_FS3000_OK : 0) |
+                     (coalesced ? READING_STATUS_COALESCED : 0) |
+                     (rawClass == UPLINK_ALARM ? READING_STATUS_ALARM : 0);
+    currentUplinkClass = rawClass;
+    sendSuccess = sendReadingFrame(values, status, pos, mqttPayload, mqttLen);
+  }
+
+  if (sendRaw) {
+    soakRecordSend(soakStats, sendSuccess, nowMs() - latestReading.sampledAtMs);
+  }
+
+  // 解析モード: エピソード要約と周期メトリクスの送信
+  if (analyticsMode) {
+    if (ventEvents & VentilationAnalyzer::EVENT_EPISODE) {
+      uint8_t frame[VENTILATION_EPISODE_FRAME_SIZE];
+      char json[192];
+      size_t frameSize = encodeEpisodeFrame(ventilation.lastEpisode(), frame, sizeof(frame));
+      size_t jsonLen = formatEpisodeJson(ventilation.lastEpisode(), json, sizeof(json));
+      SerialMon.printf("Ventilation episode: %s\n", json);
+      if (uplinkBudget.admit(UPLINK_HEALTH, estimateUplinkBytes(frameSize, jsonLen), nowEpoch) != BUDGET_SEND) {
+        SerialMon.println("Budget: episode summary dropped (daily/monthly budget exhausted)");
+      } else {
+        currentUplinkClass = UPLINK_HEALTH;
+        bool ok = sendUplinkFrame(frame, frameSize, json);
+        sendSuccess = sendAttempted ? (sendSuccess && ok) : ok;
+        sendAttempted = true;
+      }
+    }
+    if (lastAnalyticsSent == 0 || current - lastAnalyticsSent >= ANALYTICS_INTERVAL) {
+      // 間引く場合は集計をリセットせず、次に送るメトリクスへ含める
+      VentilationIntervalStats st = ventilation.intervalStats();
+      uint8_t frame[VENTILATION_METRICS_FRAME_SIZE];
+      char json[192];
+      size_t frameSize = encodeMetricsFrame(ventilation, st, frame, sizeof(frame));
+      size_t jsonLen = formatMetricsJson(ventilation, st, json, sizeof(json));
+      if (uplinkBudget.admit(UPLINK_ROUTINE, estimateUplinkBytes(frameSize, jsonLen), nowEpoch) != BUDGET_SEND) {
+        SerialMon.println("Budget: metrics thinned, interval stats carried over");
+        lastAnalyticsSent = current;
+      } else {
+        ventilation.takeIntervalStats();
+        SerialMon.printf("Ventilation metrics: %s\n", json);
+        currentUplinkClass = UPLINK_ROUTINE;
+        bool ok = sendUplinkFrame(frame, frameSize, json);
+        sendSuccess = sendAttempted ? (sendSuccess && ok) : ok;
+        sendAttempted = true;
+        if (ok) lastAnalyticsSent = current;
       }
-      sendSuccess = mqttPublish(mqttTopic, json, mqttQos);
-    } else {
-      SerialMon.println("MQTT config invalid (topic/qos). Skipping send and waiting for metadata update.");
-      // 送信失敗としてカウントしない（仕様）
-      sendSuccess = false;
     }
   } else {
-    // UDP送信
-    SerialMon.println("Sending data via UDP...");
-    sendSuccess = sendDataWithStatus(payload, sizeof(payload));
+    // 通常モードでは周期集計を使わないため毎回破棄
+    ventilation.takeIntervalStats();
   }
   
-  if (sendSuccess) {
+  if (!sendAttempted) {
+    // 送信なしのサイクル（解析モード）は成否を数えない
+  } else if (sendSuccess) {
     // 送信成功
     consecutiveFailures = 0; // 失敗カウンターをリセット
     lastSuccessfulSend = current; // 最後の成功送信時間を更新
+    confirmOtaImage(); // OTA直後なら新イメージを確定
   } else {
     // 送信失敗（ただしMQTT設定不正時はカウントしない）
-    if (!(mqttEnabled && !mqttConfigValid)) {
+    if (!configError) {
       consecutiveFailures++;
       SerialMon.printf("Consecutive failures: %d/%d\n", consecutiveFailures, MAX_CONSECUTIVE_FAILURES);
       
@@ -226,76 +934,391 @@ void readAndSendData() {
     }
   }
 
+  // ヘルスフレームの定期送信（センサーペイロードとは別フレーム）
+  if (HEALTH_INTERVAL > 0 && (lastHealthSent == 0 || current - lastHealthSent >= HEALTH_INTERVAL)) {
+    if (sendHealthFrame()) {
+      lastHealthSent = current;
+      confirmOtaImage();
+    }
+  }
+  saveBudgetCounters(false);
+
+  lastSendAttempted = sendAttempted;
+  lastSendSuccess = sendSuccess;
+  updateSoakStats();
+  soakRecordHeap(soakStats, ESP.getFreeHeap());
+}
+
+// 表示用の状態をループ側の変数から写す（uiMutex を保持して呼ぶ。UIタスクからは呼ばない）
+void refreshUiStatus() {
+  UiStatus& s = uiStatus;
+  s.co2 = latestReading.co2;
+  s.temp = latestReading.temp;
+  s.humidity = latestReading.humidity;
+  s.windSpeed = latestReading.windSpeed;
+  s.scd40Ok = latestReading.scd40Ok;
+  s.fs3000Ok = latestReading.fs3000Ok;
+  s.sendAttempted = lastSendAttempted;
+  s.sendSuccess = lastSendSuccess;
+  TransportId active = transports.select(nowMs());
+  s.transport = active;
+  s.failover = active != transports.preferred();
+  s.mqttConfigValid = mqttConfigValid;
+  s.mqttConnected = mqttConnected;
+  s.mqttQos = mqttQos;
+  s.analytics = analyticsMode;
+  s.ach = ventilation.lastAch();
+  s.episodes = ventilation.episodeCount();
+  s.alarmPpm = (uint16_t)ventilation.config().alarmPpm;
+  s.failures = consecutiveFailures;
+  s.intervalMs = INTERVAL;
+  s.otaActive = otaPhase == OTA_DOWNLOADING && otaProgress.header.newSize > 0;
+  s.otaPercent = s.otaActive ? (uint8_t)((uint64_t)otaProgress.state.outputOffset * 100 / otaProgress.header.newSize) : 0;
+  snprintf(s.otaVersion, sizeof(s.otaVersion), "%s", otaProgress.version);
+
+  // IMSIは長いので後半6桁、回線名は先頭10文字だけ表示
+  if (subscriberImsi.length() > 6) {
+    snprintf(s.imsi, sizeof(s.imsi), "...%s", subscriberImsi.c_str() + subscriberImsi.length() - 6);
+  } else {
+    snprintf(s.imsi, sizeof(s.imsi), "%s", subscriberImsi.c_str());
+  }
+  if (subscriberName.length() > 10) {
+    snprintf(s.name, sizeof(s.name), "%.10s...", subscriberName.c_str());
+  } else {
+    snprintf(s.name, sizeof(s.name), "%s", subscriberName.c_str());
+  }
+
+  s.csq = lastCsq;
+  s.rat = registrationHint.rat;
+  snprintf(s.plmn, sizeof(s.plmn), "%s", registrationHintValid(registrationHint) ? registrationHint.plmn : "-");
+  s.registrationMs = bootRegistration.lastMs;
+  if (recoveryRegistration.attempts > 0) s.registrationMs = recoveryRegistration.lastMs;
+  s.lastSuccessMs = lastSuccessfulSend;
+  s.modemBaud = modemBaud;
+  for (int i = 0; i < RECOVERY_LEVEL_COUNT; i++) {
+    s.recoveries[i] = healthCounters.recoveries[i];
+  }
+  s.budgetLimited = uplinkBudget.limited();
+  s.budgetDayBytes = uplinkBudget.counters().dayBytes;
+  s.budgetDayAllowance = uplinkBudget.dayAllowance(timeSync.epochAt(nowMs()));
+  s.budgetMonthBytes = uplinkBudget.counters().monthBytes;
+  s.budgetMonthly = uplinkBudget.config().monthlyBytes;
+  s.budgetThinned = uplinkBudget.counters().thinnedToday;
+  s.gnssEnabled = gnssEnabled;
+  s.gnssFixValid = gnss.hasFix();
+  s.gnssMoving = gnss.moving();
+  s.gnssLatE6 = gnss.lastFix().latE6;
+  s.gnssLonE6 = gnss.lastFix().lonE6;
+  s.gnssFixAgeS = gnss.hasFix() ? (nowMs() - gnss.lastFix().monoMs) / 1000 : 0;
+  s.gnssTimeouts = gnss.stats().timeouts;
+}
+
+// 最新値と通信状態でLCDを更新する関数（表示タイマーから呼ばれる）
+void updateDisplay() {
+  xSemaphoreTake(uiMutex, portMAX_DELAY);
+  refreshUiStatus();
+  renderScreen();
+  xSemaphoreGive(uiMutex);
+}
+
+// 現在の画面を描画する（uiMutex を保持して呼ぶ。描画は uiStatus と co2History だけを読む）
+void renderScreen() {
+  if (screenMode == SCREEN_TREND_1H || screenMode == SCREEN_TREND_24H) {
+    drawTrendScreen();
+  } else if (screenMode == SCREEN_DIAG) {
+    drawDiagScreen();
+  } else {
+    drawMainScreen();
+  }
+  drawUiToast();
+}
+
+void drawMainScreen() {
+  const UiStatus& s = uiStatus;
+
   // LCD表示の更新
   M5.Lcd.clear(BLACK);
   M5.Lcd.setCursor(0, 0);
   M5.Lcd.setTextFont(4);
   M5.Lcd.println("CO2 + Wind Monitor");
   
-  if (scd40Success) {
-    M5.Lcd.printf("CO2   : %.0f ppm\n", co2);
-    M5.Lcd.printf("Temp  : %.2f C\n", temp);
-    M5.Lcd.printf("Hum   : %.2f %%\n", humidity);
+  if (s.scd40Ok) {
+    M5.Lcd.printf("CO2   : %.0f ppm\n", s.co2);
+    M5.Lcd.printf("Temp  : %.2f C\n", s.temp);
+    M5.Lcd.printf("Hum   : %.2f %%\n", s.humidity);
   } else {
     M5.Lcd.println("SCD40: Error");
   }
   
-  if (fs3000Success) {
-    M5.Lcd.printf("Wind  : %.2f m/s\n", windSpeed);
+  if (s.fs3000Ok) {
+    M5.Lcd.printf("Wind  : %.2f m/s\n", s.windSpeed);
   } else {
     M5.Lcd.println("FS3000: Error");
   }
   
   // 通信状態を表示
   M5.Lcd.setTextFont(2);
-  if (mqttEnabled) {
-    if (mqttConfigValid) {
-      M5.Lcd.printf("Mode   : MQTT qos=%d\n", mqttQos);
+  const char* failoverMark = s.failover ? " [failover]" : "";
+  if (s.transport == TRANSPORT_MQTT) {
+    if (s.mqttConfigValid) {
+      M5.Lcd.printf("Mode   : MQTT qos=%d%s\n", s.mqttQos, failoverMark);
     } else {
       M5.Lcd.println("Mode   : MQTT CONFIG ERR");
     }
   } else {
-    M5.Lcd.println("Mode   : UDP");
+    M5.Lcd.printf("Mode   : UDP%s\n", failoverMark);
   }
-  M5.Lcd.printf("Network: %s\n", sendSuccess ? "OK" : "Error");
-  M5.Lcd.printf("Fails: %d/%d\n", consecutiveFailures, MAX_CONSECUTIVE_FAILURES);
-  M5.Lcd.printf("Interval: %lu sec\n", INTERVAL / 1000); // 送信インターバルを秒単位で表示
-  
-  // IMSIは長いので後半6桁だけ表示
-  String shortImsi = subscriberImsi;
-  if (shortImsi.length() > 6) {
-    shortImsi = "..." + shortImsi.substring(shortImsi.length() - 6);
+  if (modemRecovering) {
+    M5.Lcd.println("Network: Recovering");
+  } else if (gnssRadioOff) {
+    M5.Lcd.printf("Network: GNSS fix (%lu s)\n", (nowMs() - gnssWindowStartMs) / 1000);
+  } else {
+    M5.Lcd.printf("Network: %s\n", !s.sendAttempted ? "Idle" : (s.sendSuccess ? "OK" : "Error"));
   }
-  M5.Lcd.printf("IMSI: %s\n", shortImsi.c_str()); // 回線のIMSI（短縮表示）
-  
-  // 回線名も長い場合は省略
-  String shortName = subscriberName;
-  if (shortName.length() > 10) {
-    shortName = shortName.substring(0, 10) + "...";
+  if (s.episodes > 0) {
+    M5.Lcd.printf("ACH: %.2f /h (%u ep)%s\n", s.ach, s.episodes, s.analytics ? " [analytics]" : "");
+  }
+  M5.Lcd.printf("Fails: %d/%d\n", s.failures, MAX_CONSECUTIVE_FAILURES);
+  M5.Lcd.printf("Interval: %lu sec\n", s.intervalMs / 1000); // 送信インターバルを秒単位で表示
+  if (s.budgetLimited) {
+    // 今日の使用量/枠（KB）と今月の使用量
+    M5.Lcd.printf("Data: %.1f/%.1f KB today, %lu KB mo\n", s.budgetDayBytes / 1024.0f,
+                  s.budgetDayAllowance / 1024.0f, (unsigned long)(s.budgetMonthBytes / 1024));
   }
-  M5.Lcd.printf("Name: %s\n", shortName.c_str()); // 回線の名前（短縮表示）
+  if (s.otaActive) {
+    M5.Lcd.printf("OTA %s: %u%%\n", s.otaVersion, s.otaPercent);
+  }
+  M5.Lcd.printf("IMSI: %s\n", s.imsi); // 回線のIMSI（短縮表示）
+  M5.Lcd.printf("Name: %s\n", s.name); // 回線の名前（短縮表示）
+}
 
-  // シリアル出力の更新
-  if (scd40Success && fs3000Success) {
-    SerialMon.printf("CO2: %.0f ppm, Temp: %.2f C, Hum: %.2f %%, Wind: %.2f m/s\n",
-                    co2, temp, humidity, windSpeed);
-  } else if (scd40Success) {
-    SerialMon.printf("CO2: %.0f ppm, Temp: %.2f C, Hum: %.2f %%, Wind: Error\n",
-                    co2, temp, humidity);
-  } else if (fs3000Success) {
-    SerialMon.printf("CO2: Error, Wind: %.2f m/s\n", windSpeed);
+// 推移の履歴へ追加する。SD の書き込みタスクが uiMutex を保持している間は待たずに後回しにする
+// （サンプリングの周期を SD の書き出し・マウントの所要時間で遅らせない）
+void addCo2History(uint32_t t, uint16_t value) {
+  if (xSemaphoreTake(uiMutex, 0) != pdTRUE) {
+    if (co2HistoryPendingCount == CO2_HISTORY_PENDING) {
+      // 最古を捨てる
+      memmove(co2HistoryPending, co2HistoryPending + 1, (CO2_HISTORY_PENDING - 1) * sizeof(TrendPoint));
+      co2HistoryPendingCount--;
+      co2HistoryDropped++;
+    }
+    co2HistoryPending[co2HistoryPendingCount++] = TrendPoint{ t, value };
+    co2HistoryDeferred++;
+    return;
+  }
+  for (uint8_t i = 0; i < co2HistoryPendingCount; i++) {
+    co2History.add(co2HistoryPending[i].t, co2HistoryPending[i].value);
+  }
+  co2HistoryPendingCount = 0;
+  co2History.add(t, value);
+  xSemaphoreGive(uiMutex);
+}
+
+// 推移グラフ画面の更新（前回描画した点より新しい点だけを追記する）
+void drawTrendScreen() {
+  uint32_t nowSec = trendSeconds();
+  uint16_t alarmPpm = uiStatus.alarmPpm;
+  TrendSpan span = screenMode == SCREEN_TREND_24H ? TREND_SPAN_24H : TREND_SPAN_1H;
+  unsigned long t0 = nowUs();
+  if (trendChart.span() != span || trendChart.alarmPpm() != alarmPpm) {
+    trendChart.configure(span, alarmPpm);
+    trendNeedsRedraw = true;
+  }
+
+  bool coarse = span == TREND_SPAN_24H;
+  size_t n = coarse ? co2History.coarseCount() : co2History.rawCount();
+  size_t appended = 0;
+  if (!trendNeedsRedraw) {
+    for (size_t i = 0; i < n; ++i) {
+      TrendPoint p = coarse ? co2History.coarse(i) : co2History.raw(i);
+      if (p.t <= trendDrawnT) continue;
+      if (!trendChart.append(p)) {
+        // 縦軸の上限を超えたので全体を描き直す
+        trendNeedsRedraw = true;
+        break;
+      }
+      trendDrawnT = p.t;
+      appended++;
+    }
+  }
+  if (trendNeedsRedraw) {
+    trendChart.redraw(co2History, nowSec);
+    trendDrawnT = n > 0 ? (coarse ? co2History.coarse(n - 1) : co2History.raw(n - 1)).t : 0;
+    trendNeedsRedraw = false;
+    appended = 0;
+  }
+  unsigned long drawUs = nowUs() - t0;
+
+  // 見出し行（最新値・表示範囲・縦軸の上限）
+  M5.Lcd.fillRect(0, 0, 320, TREND_HEADER_H, BLACK);
+  M5.Lcd.setCursor(0, 2);
+  M5.Lcd.setTextFont(2);
+  if (uiStatus.scd40Ok) {
+    M5.Lcd.printf("CO2 %.0f ppm  [%s]  max %u", uiStatus.co2, coarse ? "24h" : "1h", trendChart.yMax());
   } else {
-    SerialMon.println("Both sensors failed to read data");
+    M5.Lcd.printf("SCD40: Error  [%s]", coarse ? "24h" : "1h");
   }
-  
-  // 最後の更新時間を記録
-  lastUpdate = current;
+  LOGD(LF_TREND_DRAW, (unsigned)appended, drawUs);
+}
+
+// 回線診断画面（モデムには問い合わせず、最後に観測した状態だけを表示する）
+void drawDiagScreen() {
+  const UiStatus& s = uiStatus;
+  unsigned long now = nowMs();
+  M5.Lcd.clear(BLACK);
+  M5.Lcd.setCursor(0, 0);
+  M5.Lcd.setTextFont(4);
+  M5.Lcd.println("Link Diagnostics");
+  M5.Lcd.setTextFont(2);
+  if (modemRecovering) {
+    M5.Lcd.printf("State    : RECOVERING (%lu s)\n", (now - recoveryStartedMs) / 1000);
+  } else if (gnssRadioOff) {
+    M5.Lcd.printf("State    : GNSS FIX (%lu s, LTE off)\n", (now - gnssWindowStartMs) / 1000);
+  } else {
+    M5.Lcd.printf("State    : %s\n", !s.sendAttempted ? "Idle" : (s.sendSuccess ? "OK" : "Error"));
+  }
+  M5.Lcd.printf("Operator : %s %s\n", s.plmn, radioAccessName((RadioAccess)s.rat));
+  if (s.csq >= 0 && s.csq <= 31) {
+    M5.Lcd.printf("CSQ      : %d (%d dBm)\n", s.csq, -113 + 2 * s.csq);
+  } else {
+    M5.Lcd.println("CSQ      : unknown");
+  }
+  M5.Lcd.printf("Register : %lu ms (last)\n", (unsigned long)s.registrationMs);
+  M5.Lcd.printf("Transport: %s%s%s\n", transportName((TransportId)s.transport), s.failover ? " [failover]" : "",
+                s.transport == TRANSPORT_MQTT ? (s.mqttConnected ? " conn" : " disc") : "");
+  if (s.lastSuccessMs > 0) {
+    M5.Lcd.printf("Last OK  : %lu s ago\n", (now - s.lastSuccessMs) / 1000);
+  } else {
+    M5.Lcd.println("Last OK  : never");
+  }
+  M5.Lcd.printf("Fails    : %d/%d\n", s.failures, MAX_CONSECUTIVE_FAILURES);
+  M5.Lcd.printf("Recovery : pdp %u rst %u hard %u\n", s.recoveries[RECOVERY_PDP_REACTIVATE],
+                s.recoveries[RECOVERY_MODEM_RESET], s.recoveries[RECOVERY_HARD_RESET]);
+  M5.Lcd.printf("UART     : %lu baud\n", (unsigned long)s.modemBaud);
+  if (s.budgetLimited) {
+    M5.Lcd.printf("Budget   : %lu/%lu KB mo, thin %lu\n", (unsigned long)(s.budgetMonthBytes / 1024),
+                  (unsigned long)(s.budgetMonthly / 1024), (unsigned long)s.budgetThinned);
+  } else {
+    M5.Lcd.printf("Data     : %lu KB mo (no budget)\n", (unsigned long)(s.budgetMonthBytes / 1024));
+  }
+  if (s.gnssEnabled && s.gnssFixValid) {
+    M5.Lcd.printf("GNSS     : %.5f,%.5f %lus %s\n", s.gnssLatE6 / 1e6, s.gnssLonE6 / 1e6,
+                  (unsigned long)s.gnssFixAgeS, s.gnssMoving ? "moving" : "still");
+  } else if (s.gnssEnabled) {
+    M5.Lcd.printf("GNSS     : no fix (%lu timeouts)\n", (unsigned long)s.gnssTimeouts);
+  }
+  M5.Lcd.printf("Input    : max %lu ms (%lu presses)\n", (unsigned long)(inputLatency.maxUs / 1000),
+                (unsigned long)inputLatency.count);
 }
 
+// 操作の確認表示（画面下端の1行。期限が切れたら次の描画で消える）
+void drawUiToast() {
+  if (uiToast[0] == '\0') return;
+  if ((long)(nowMs() - uiToastUntil) >= 0) {
+    uiToast[0] = '\0';
+    if (screenMode != SCREEN_MAIN && screenMode != SCREEN_DIAG) {
+      M5.Lcd.fillRect(0, 240 - UI_TOAST_H, 320, UI_TOAST_H, BLACK);
+      trendNeedsRedraw = true;
+    }
+    return;
+  }
+  M5.Lcd.fillRect(0, 240 - UI_TOAST_H, 320, UI_TOAST_H, NAVY);
+  M5.Lcd.setTextFont(2);
+  M5.Lcd.setTextColor(WHITE, NAVY);
+  M5.Lcd.setCursor(4, 240 - UI_TOAST_H + 2);
+  M5.Lcd.print(uiToast);
+  M5.Lcd.setTextColor(WHITE);
+}
+
+// センサーデータの読み取り、送信、画面更新をまとめて行う関数（起動直後の初回用）
+void readAndSendData() {
+  sampleSensors();
+  sendLatestReading();
+  updateDisplay();
+}
+
+// メタデータ（userdata）で認識するキー。これ以外のキーはパース時に読み捨てる
+static const char* const METADATA_KEYS[] = {
+  "interval_s", "metadata_interval_s", "log_level", "health_interval_s",
+  "analytics", "analytics_interval_s", "alarm_ppm", "outdoor_ppm",
+  "mqtt", "topic", "qos", "format", "udp_format", "mqtt_persist", "failover", "failover_cooldown_s",
+  "ota_url", "ota_version",
+  "budget_daily_kb", "budget_monthly_kb", "budget_month_used_kb",
+  "gnss", "gnss_interval_s", "gnss_timeout_s",
+  "signal_defer_s", "signal_weak_rsrp", "signal_weak_csq",
+};
+
+// 認識キーの値だけを保持する固定サイズのアリーナ（ヒープを使わず、userdata の大きさに依存しない）
+#define METADATA_ARENA_SIZE 1024
+static StaticJsonDocument<METADATA_ARENA_SIZE> metadataDoc;
+// フィルタは認識キーの数だけのメンバーを持つ（キーは静的文字列のため複製されない）
+static StaticJsonDocument<JSON_OBJECT_SIZE(sizeof(METADATA_KEYS) / sizeof(METADATA_KEYS[0]))> metadataFilter;
+
+// 区間内の空きヒープ（内部RAM）の最小値から、その区間で増えた使用量のピークを測る
+// IDF 5.1 以降は heap_caps_monitor_local_minimum_free_size_start() で区間内の最小値をアロケータ自身が記録する。
+// それより前（Arduino-ESP32 2.x は IDF 4.4）は起動以来の最小値しかリセットできないため、sample() を呼んだ時点の
+// 空き容量の最小で近似する（サンプル間の一時的な確保は見逃す）
+class HeapPeakMonitor {
+public:
+  HeapPeakMonitor() : startFree_(heap_caps_get_free_size(MALLOC_CAP_INTERNAL)), minFree_(startFree_) {
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+    heap_caps_monitor_local_minimum_free_size_start();
+#endif
+  }
+  ~HeapPeakMonitor() {
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+    heap_caps_monitor_local_minimum_free_size_stop();
+#endif
+  }
+  void sample() {
+    uint32_t f = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    if (f < minFree_) minFree_ = f;
+  }
+  uint32_t startFree() const { return startFree_; }
+  // 開始時からの使用量の増分の最大 [bytes]
+  uint32_t peakBytes() {
+    sample();
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+    uint32_t localMin = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+    if (localMin < minFree_) minFree_ = localMin;
+#endif
+    return startFree_ > minFree_ ? startFree_ - minFree_ : 0;
+  }
+
+private:
+  uint32_t startFree_;
+  uint32_t minFree_;
+};
+
+// 受信バイト数を数えるストリームのラッパー（HTTPボディを直接パーサーへ流す）
+// monitor を渡すと 64 バイト毎に空きヒープを標本化する
+class CountingStream : public Stream {
+public:
+  explicit CountingStream(Stream& inner, HeapPeakMonitor* monitor = nullptr)
+    : inner_(inner), monitor_(monitor), count_(0) {}
+  int available() override { return inner_.available(); }
+  int read() override {
+    int c = inner_.read();
+    if (c >= 0 && (++count_ & 63) == 0 && monitor_ != nullptr) monitor_->sample();
+    return c;
+  }
+  int peek() override { return inner_.peek(); }
+  size_t write(uint8_t b) override { return inner_.write(b); }
+  size_t count() const { return count_; }
+
+private:
+  Stream& inner_;
+  HeapPeakMonitor* monitor_;
+  size_t count_;
+};
+
 // SORACOMメタデータからインターバル設定を取得する関数
 void fetchAndUpdateInterval() {
   SerialMon.println("Fetching interval/MQTT settings from SORACOM metadata...");
   
+  // 取得1回（接続・ヘッダー・ボディのパース）で増えたヒープのピーク。失敗時も含めて出力する
+  HeapPeakMonitor heapPeak;
+
   // HTTPクライアントの初期化
   TinyGsmClient client(modem);
   HttpClient http(client, "metadata.soracom.io", 80);
@@ -303,36 +1326,65 @@ void fetchAndUpdateInterval() {
   // HTTPリクエストの送信
   SerialMon.println("Making HTTP GET request to metadata.soracom.io/v1/userdata");
   int err = http.get("/v1/userdata");
+  heapPeak.sample();
   if (err != 0) {
-    SerialMon.printf("HTTP GET failed (error code: %d)\n", err);
+    SerialMon.printf("HTTP GET failed (error code: %d, fetch heap peak %lu bytes)\n", err,
+                     (unsigned long)heapPeak.peakBytes());
     return; // 失敗した場合は現在の設定を維持
   }
   
   // レスポンスコードの確認
   int status = http.responseStatusCode();
+  heapPeak.sample();
   if (status != 200) {
-    SerialMon.printf("HTTP response error: %d\n", status);
+    SerialMon.printf("HTTP response error: %d (fetch heap peak %lu bytes)\n", status,
+                     (unsigned long)heapPeak.peakBytes());
     return; // 失敗した場合は現在の設定を維持
   }
   
-  // レスポンスデータの取得
-  String response = http.responseBody();
-  SerialMon.println("Response: " + response);
-  
-  // JSONデータのパース（MQTTキー追加に備えサイズ拡張）
-  DynamicJsonDocument doc(512);
-  DeserializationError error = deserializeJson(doc, response);
+  // レスポンスボディを String に溜めず、フィルタで認識キーだけを残しながらストリームから直接パース
+  if (metadataFilter.isNull()) {
+    for (size_t i = 0; i < sizeof(METADATA_KEYS) / sizeof(METADATA_KEYS[0]); i++) {
+      metadataFilter[METADATA_KEYS[i]] = true;
+    }
+  }
+  uint32_t heapBefore = ESP.getFreeHeap();
+  int contentLength = http.contentLength();
+  http.skipResponseHeaders();
+  CountingStream body(http, &heapPeak);
+  body.setTimeout(5000);
+  unsigned long parseStart = nowMs();
+  StaticJsonDocument<METADATA_ARENA_SIZE>& doc = metadataDoc;
+  DeserializationError error = deserializeJson(doc, body, DeserializationOption::Filter(metadataFilter));
+  unsigned long parseMs = nowMs() - parseStart;
+  uint32_t heapAfter = ESP.getFreeHeap();
+  SerialMon.printf("Metadata: streamed %u bytes (content-length %d) in %lu ms, arena %u/%u bytes, heap free %lu -> %lu "
+                   "(fetch peak %lu bytes from %lu, min since boot %lu)\n",
+                   (unsigned)body.count(), contentLength, parseMs,
+                   (unsigned)doc.memoryUsage(), (unsigned)doc.capacity(),
+                   (unsigned long)heapBefore, (unsigned long)heapAfter, (unsigned long)heapPeak.peakBytes(),
+                   (unsigned long)heapPeak.startFree(), (unsigned long)ESP.getMinFreeHeap());
   if (error) {
     SerialMon.print("JSON parsing failed: ");
     SerialMon.println(error.c_str());
+    if (error == DeserializationError::NoMemory) {
+      SerialMon.println("Recognised metadata values exceed the parse arena; keeping current settings");
+    }
     return; // 失敗した場合は現在の設定を維持
   }
+  SerialMon.print("Response (recognised keys): ");
+  serializeJson(doc, SerialMon);
+  SerialMon.println();
   
   // interval_s値の取得
   if (doc.containsKey("interval_s")) {
     unsigned long newInterval = doc["interval_s"].as<unsigned long>() * 1000; // 秒からミリ秒に変換
-    if (newInterval != INTERVAL) {
+    if (newInterval == 0) {
+      SerialMon.println("interval_s must be positive, ignoring");
+    } else if (newInterval != INTERVAL) {
       INTERVAL = newInterval;
+      scheduler.setPeriod(timerSample, INTERVAL, nowMs());
+      scheduler.setPeriod(timerUplink, INTERVAL, nowMs());
       SerialMon.printf("Interval updated to %lu ms\n", INTERVAL);
     } else {
       SerialMon.println("Interval unchanged");
@@ -341,6 +1393,47 @@ void fetchAndUpdateInterval() {
     SerialMon.println("interval_s not found in metadata");
   }
 
+  // 換気解析モードとパラメータ
+  if (doc.containsKey("analytics")) {
+    analyticsMode = doc["analytics"].as<bool>();
+    SerialMon.printf("Analytics mode: %s\n", analyticsMode ? "on" : "off");
+  }
+  if (doc.containsKey("analytics_interval_s")) {
+    ANALYTICS_INTERVAL = doc["analytics_interval_s"].as<unsigned long>() * 1000;
+  }
+  {
+    VentilationConfig vc = ventilation.config();
+    if (doc.containsKey("alarm_ppm")) vc.alarmPpm = doc["alarm_ppm"].as<float>();
+    if (doc.containsKey("outdoor_ppm")) vc.outdoorPpm = doc["outdoor_ppm"].as<float>();
+    ventilation.setConfig(vc);
+  }
+
+  // メタデータ再取得周期（秒）
+  if (doc.containsKey("metadata_interval_s")) {
+    unsigned long newMetaInterval = doc["metadata_interval_s"].as<unsigned long>() * 1000;
+    if (newMetaInterval >= 60000) {
+      METADATA_INTERVAL = newMetaInterval;
+      scheduler.setPeriod(timerMetadata, METADATA_INTERVAL, nowMs());
+    }
+  }
+
+  // ヘルスフレーム送信間隔（秒, 0で無効）
+  if (doc.containsKey("health_interval_s")) {
+    HEALTH_INTERVAL = doc["health_interval_s"].as<unsigned long>() * 1000;
+    SerialMon.printf("Health interval set to %lu ms\n", HEALTH_INTERVAL);
+  }
+
+  // ログレベル（0=なし, 1=ERROR, 2=WARN, 3=INFO, 4=DEBUG）
+  if (doc.containsKey("log_level")) {
+    int newLevel = doc["log_level"].as<int>();
+    if (newLevel >= LOG_LEVEL_NONE && newLevel <= LOG_LEVEL_DEBUG) {
+      logRing.setLevel((LogLevel)newLevel);
+      SerialMon.printf("Log level set to %d\n", newLevel);
+    } else {
+      SerialMon.printf("Invalid log_level in metadata: %d\n", newLevel);
+    }
+  }
+
   // MQTT設定の取得と検証
   bool prevMqttEnabled = mqttEnabled;
   bool newMqttEnabled = false;
@@ -352,7 +1445,8 @@ void fetchAndUpdateInterval() {
     newMqttEnabled = doc["mqtt"].as<bool>();
   }
 
-  if (newMqttEnabled) {
+  // topic は mqtt=false でもフェイルオーバー先として検証する
+  if (newMqttEnabled || doc.containsKey("topic")) {
     if (doc.containsKey("topic")) {
       newTopic = doc["topic"].as<String>();
     }
@@ -374,7 +1468,7 @@ void fetchAndUpdateInterval() {
 
     newConfigValid = topicOk && qosOk;
 
-    if (!newConfigValid) {
+    if (!newConfigValid && newMqttEnabled) {
       SerialMon.println("MQTT config invalid in metadata (topic/qos). MQTT send will be disabled until corrected.");
     }
   }
@@ -388,13 +1482,38 @@ void fetchAndUpdateInterval() {
   mqttEnabled = newMqttEnabled;
   mqttTopic = newTopic;
   mqttQos = newQos;
-  mqttConfigValid = newMqttEnabled ? newConfigValid : false;
+  mqttConfigValid = newConfigValid;
 
   // clientId はメタデータからは取得しない方針
+  // （決定済みの mqttClientId は永続セッションのため起動中は維持する）
   mqttClientIdFromMetadata = false;
   mqttClientIdIsFromTagKey = false;
   mqttClientIdTagKey = "";
-  mqttClientId = "";
+
+  // 読み取り値のMQTTペイロード形式（json / cbor / msgpack）
+  if (doc.containsKey("format")) {
+    const char* formatName = doc["format"].as<const char*>();
+    if (!parsePayloadFormat(formatName, mqttFormat)) {
+      SerialMon.printf("Unknown payload format in metadata: %s (keeping %s)\n",
+                       formatName ? formatName : "(null)", payloadFormatName(mqttFormat));
+    }
+  }
+
+  // 読み取り値のUDPフレーム形式（float / compact。Harvest のバイナリパーサー設定も合わせて変更する）
+  if (doc.containsKey("udp_format")) {
+    const char* formatName = doc["udp_format"].as<const char*>();
+    if (parseUdpFrameFormat(formatName, udpFrameFormat)) {
+      SerialMon.printf("UDP frame format: %s\n", udpFrameFormatName(udpFrameFormat));
+    } else {
+      SerialMon.printf("Unknown udp_format in metadata: %s (keeping %s)\n",
+                       formatName ? formatName : "(null)", udpFrameFormatName(udpFrameFormat));
+    }
+  }
+
+  // 永続セッション（既定 true。false で CLEANSS=1）
+  if (doc.containsKey("mqtt_persist")) {
+    mqttPersistentSession = doc["mqtt_persist"].as<bool>();
+  }
 
   SerialMon.printf("MQTT enabled: %s, topic: %s, qos: %d, valid: %s\n",
                    mqttEnabled ? "true" : "false",
@@ -402,79 +1521,163 @@ void fetchAndUpdateInterval() {
                    mqttQos,
                    mqttConfigValid ? "true" : "false");
   SerialMon.println("MQTT clientId: metadata is ignored; will use SIM tag 'azure_device_name' → tag 'name' → IMSI → IMEI");
+  SerialMon.printf("MQTT payload format: %s\n", payloadFormatName(mqttFormat));
+  SerialMon.printf("MQTT session: %s, keepalive %lu s\n", mqttPersistentSession ? "persistent" : "clean",
+                   (unsigned long)mqttKeepAliveSec());
+
+  // 送信経路のフェイルオーバー設定
+  TransportConfig tc = transports.config();
+  if (doc.containsKey("failover")) tc.failoverEnabled = doc["failover"].as<bool>();
+  if (doc.containsKey("failover_cooldown_s")) {
+    unsigned long cooldown = doc["failover_cooldown_s"].as<unsigned long>() * 1000;
+    if (cooldown >= 60000) tc.cooldownMs = cooldown;
+  }
+  transports.setConfig(tc);
+  // UDP はモデムの内蔵スタックでのみ送れる（汎用バックエンドでは MQTT のみ）
+  bool udpAvailable = modemBackend->has(MODEM_CAP_UDP);
+  transports.setPreferred(mqttEnabled || !udpAvailable ? TRANSPORT_MQTT : TRANSPORT_UDP);
+  transports.setAvailable(TRANSPORT_MQTT, mqttConfigValid);
+  transports.setAvailable(TRANSPORT_UDP, udpAvailable);
+  SerialMon.printf("Transport: preferred %s, failover %s (MQTT %s, cooldown %lu s)\n",
+                   transportName(transports.preferred()), tc.failoverEnabled ? "on" : "off",
+                   mqttConfigValid ? "available" : "unavailable", (unsigned long)(tc.cooldownMs / 1000));
+
+  // 通信量の予算（KB, 0 で無制限）。budget_month_used_kb は課金データ等に合わせて当月の使用量を補正する
+  // （同じ値は一度だけ適用するため、置いたままでも再取得の度に戻らない）
+  BudgetConfig bc = uplinkBudget.config();
+  if (doc.containsKey("budget_daily_kb")) bc.dailyBytes = doc["budget_daily_kb"].as<uint32_t>() * 1024;
+  if (doc.containsKey("budget_monthly_kb")) bc.monthlyBytes = doc["budget_monthly_kb"].as<uint32_t>() * 1024;
+  uplinkBudget.setConfig(bc);
+  if (doc.containsKey("budget_month_used_kb") &&
+      uplinkBudget.applyMonthUsage(doc["budget_month_used_kb"].as<uint32_t>())) {
+    SerialMon.printf("Budget: month usage set to %lu KB\n", (unsigned long)doc["budget_month_used_kb"].as<uint32_t>());
+    saveBudgetCounters(true);
+  }
+  if (uplinkBudget.limited()) {
+    SerialMon.printf("Budget: daily %lu KB, monthly %lu KB (0 = unlimited)\n",
+                     (unsigned long)(bc.dailyBytes / 1024), (unsigned long)(bc.monthlyBytes / 1024));
+  }
+
+  // GNSS 測位（gnss_interval_s は移動中の測位間隔, gnss_timeout_s はコールドスタート時の測位待ち上限）
+  if (doc.containsKey("gnss")) {
+    gnssEnabled = doc["gnss"].as<bool>();
+    scheduler.setEnabled(timerGnss, gnssEnabled);
+  }
+  {
+    GnssConfig gc = gnss.config();
+    if (doc.containsKey("gnss_interval_s")) {
+      unsigned long moving = doc["gnss_interval_s"].as<unsigned long>() * 1000;
+      if (moving >= 60000) gc.movingIntervalMs = moving;
+    }
+    if (doc.containsKey("gnss_timeout_s")) {
+      unsigned long timeout = doc["gnss_timeout_s"].as<unsigned long>() * 1000;
+      if (timeout >= 30000 && timeout <= 600000) gc.coldTimeoutMs = timeout;
+    }
+    gnss.setConfig(gc);
+    if (gnssEnabled) {
+      SerialMon.printf("GNSS: on, moving interval %lu s, cold timeout %lu s\n",
+                       (unsigned long)(gc.movingIntervalMs / 1000), (unsigned long)(gc.coldTimeoutMs / 1000));
+    }
+  }
+
+  // 電波品質に応じた送信の延期（signal_defer_s は遅らせる上限で 0 なら無効、しきい値は弱電界とみなす RSRP dBm / CSQ）
+  {
+    SignalGateConfig sc = signalGate.config();
+    if (doc.containsKey("signal_defer_s")) {
+      unsigned long defer = doc["signal_defer_s"].as<unsigned long>();
+      if (defer <= 86400) sc.maxDeferMs = defer * 1000;
+    }
+    if (doc.containsKey("signal_weak_rsrp")) {
+      int rsrp = doc["signal_weak_rsrp"].as<int>();
+      if (rsrp >= -135 && rsrp <= -80) {
+        sc.weakRsrpDbm = rsrp;
+        sc.recoverRsrpDbm = rsrp + 5;
+      }
+    }
+    if (doc.containsKey("signal_weak_csq")) {
+      int csq = doc["signal_weak_csq"].as<int>();
+      if (csq >= 1 && csq <= 28) {
+        sc.weakCsq = csq;
+        sc.recoverCsq = csq + 3;
+      }
+    }
+    signalGate.setConfig(sc);
+    if (signalGate.enabled()) {
+      SerialMon.printf("Signal: defer up to %lu s while RSRP < %d dBm (CSQ < %u)\n",
+                       (unsigned long)(sc.maxDeferMs / 1000), sc.weakRsrpDbm, (unsigned)sc.weakCsq);
+    }
+  }
+
+  // 差分OTA（ota_version が実行中と異なれば ota_url のパッチを取得して適用）
+  if (doc.containsKey("ota_url") && doc.containsKey("ota_version")) {
+    startOta(doc["ota_url"].as<const char*>(), doc["ota_version"].as<const char*>());
+  }
 }
 
 // 回線情報を取得する関数
 void fetchSubscriberInfo() {
   SerialMon.println("Fetching subscriber information...");
-  
-  // HTTPクライアントの初期化
-  TinyGsmClient client(modem);
+  char body[128];
   
   // IMSIの取得
   SerialMon.println("Fetching IMSI...");
-  HttpClient httpImsi(client, "metadata.soracom.io", 80);
-  int errImsi = httpImsi.get("/v1/subscriber.imsi");
-  if (errImsi == 0) {
-    int statusImsi = httpImsi.responseStatusCode();
-    if (statusImsi == 200) {
-      String imsi = httpImsi.responseBody();
-      imsi.trim(); // 余分な空白や改行を削除
-      if (imsi.length() > 0) {
-        subscriberImsi = imsi;
-        SerialMon.println("IMSI: " + subscriberImsi);
-      }
-    } else {
-      SerialMon.printf("IMSI HTTP response error: %d\n", statusImsi);
+  int statusImsi = modemBackend->httpGet("metadata.soracom.io", 80, "/v1/subscriber.imsi", body, sizeof(body));
+  if (statusImsi == 200) {
+    String imsi = body;
+    imsi.trim(); // 余分な空白や改行を削除
+    if (imsi.length() > 0) {
+      subscriberImsi = imsi;
+      SerialMon.println("IMSI: " + subscriberImsi);
+      // SDログのヘッダに記録する装置ID（IMSI の末尾11桁）
+      xSemaphoreTake(uiMutex, portMAX_DELAY);
+      sdLogger.setDeviceId(imsi.length() > 11 ? imsi.c_str() + imsi.length() - 11 : imsi.c_str());
+      xSemaphoreGive(uiMutex);
     }
+  } else if (statusImsi > 0) {
+    SerialMon.printf("IMSI HTTP response error: %d\n", statusImsi);
   } else {
-    SerialMon.printf("IMSI HTTP GET failed (error code: %d)\n", errImsi);
+    SerialMon.printf("IMSI HTTP GET failed (%s)\n", modemBackend->name());
   }
   
   // 回線名の取得
   SerialMon.println("Fetching subscriber name...");
-  HttpClient httpName(client, "metadata.soracom.io", 80);
-  int errName = httpName.get("/v1/subscriber.tags.name");
-  if (errName == 0) {
-    int statusName = httpName.responseStatusCode();
-    if (statusName == 200) {
-      String name = httpName.responseBody();
-      name.trim(); // 余分な空白や改行を削除
-      if (name.length() > 0) {
-        subscriberName = name;
-        SerialMon.println("Subscriber name: " + subscriberName);
-      }
-    } else {
-      SerialMon.printf("Subscriber name HTTP response error: %d\n", statusName);
+  int statusName = modemBackend->httpGet("metadata.soracom.io", 80, "/v1/subscriber.tags.name", body, sizeof(body));
+  if (statusName == 200) {
+    String name = body;
+    name.trim(); // 余分な空白や改行を削除
+    if (name.length() > 0) {
+      subscriberName = name;
+      SerialMon.println("Subscriber name: " + subscriberName);
     }
+  } else if (statusName > 0) {
+    SerialMon.printf("Subscriber name HTTP response error: %d\n", statusName);
   } else {
-    SerialMon.printf("Subscriber name HTTP GET failed (error code: %d)\n", errName);
+    SerialMon.printf("Subscriber name HTTP GET failed (%s)\n", modemBackend->name());
   }
 }
 
   // 任意の subscriber タグ値を取得（存在しない/エラー時は空文字）
  String fetchSubscriberTag(const String& tagKey) {
    SerialMon.printf("Fetching subscriber tag: %s\n", tagKey.c_str());
-   TinyGsmClient client(modem);
-   HttpClient http(client, "metadata.soracom.io", 80);
    String path = "/v1/subscriber.tags." + tagKey;
-   int err = http.get(path.c_str());
-   if (err != 0) {
-     SerialMon.printf("HTTP GET failed for %s (err=%d)\n", path.c_str(), err);
+   char body[128];
+   int status = modemBackend->httpGet("metadata.soracom.io", 80, path.c_str(), body, sizeof(body));
+   if (status < 0) {
+     SerialMon.printf("HTTP GET failed for %s (%s)\n", path.c_str(), modemBackend->name());
      return "";
    }
-   int status = http.responseStatusCode();
    if (status != 200) {
      SerialMon.printf("HTTP response error for %s: %d\n", path.c_str(), status);
      return "";
    }
-   String value = http.responseBody();
+   String value = body;
    value.trim();
    return value;
  }
 void setup() {
   // --- M5Stackの初期化 ---
   M5.begin();
+  uiMutex = xSemaphoreCreateMutex();
   
   // === デバッグ情報の出力（フラッシュサイズ問題の診断用） ===
   SerialMon.println("=== FLASH DEBUG INFO ===");
@@ -486,8 +1689,18 @@ void setup() {
   SerialMon.printf("Chip ID: %08X\n", (uint32_t)(ESP.getEfuseMac() >> 32));
   SerialMon.println("========================");
 
-  // --- I2C初期化 (PortAのSDA=21, SCL=22) ---
-  Wire.begin(21, 22);
+  // --- I2C初期化 (PortAのSDA=21, SCL=22, Fast-mode 400kHz) ---
+  if (!i2cBus.begin(I2cBusManager::FAST_MODE_HZ)) {
+    SerialMon.println("I2C bus init failed at 400kHz, falling back to 100kHz");
+    i2cBus.begin(I2cBusManager::STANDARD_MODE_HZ);
+  }
+  i2cDevScd40 = i2cBus.addDevice(0x62, "SCD40");
+  i2cDevFs3000 = i2cBus.addDevice(0x28, "FS3000");
+  // Wire.begin() はクロックに関わらず成功するため、400kHz で応答しないデバイスがあれば 100kHz で確かめる
+  // （運用中も Fast-mode で読み取りの失敗が続けば 100kHz に落とす）
+  if (i2cBus.verifyClock()) {
+    SerialMon.println("I2C devices did not respond at 400kHz, falling back to 100kHz");
+  }
 
   // --- I2Cデバイススキャン ---
   scanI2CDevices();
@@ -518,11 +1731,56 @@ void setup() {
     SerialMon.println("FS3000 range set to 0-7.23 m/s (FS3000-1005)");
   }
 
+  // 周期タイマーの登録（ネットワーク初期化に失敗しても計測・表示は継続する）
+  setupScheduler();
+
   // --- SIM7080の初期化 ---
   SerialMon.begin(115200);
-  delay(10);
-  SerialAT.begin(115200, SERIAL_8N1, MODEM_RX, MODEM_TX);
-  delay(3000);
+  sleepMs(10);
+
+  // 再起動を跨ぐヘルスカウンタの初期化
+  initHealthCounters();
+  initSoakStats();
+
+  // 前回登録できた事業者・方式・バンドの読み込み
+  loadRegistrationHint();
+  loadBudgetCounters();
+
+  // OTA後の初回起動の判定とダウンロード進捗の読み込み
+  initOta();
+
+  // 遅延ロガーのドレインタスクを起動
+  startLogDrainTask();
+#ifdef LOG_BENCHMARK
+  benchmarkLogging();
+#endif
+#ifdef PAYLOAD_BENCHMARK
+  benchmarkPayloadFormats();
+#endif
+#ifdef TREND_BENCHMARK
+  benchmarkTrendChart();
+#endif
+#ifdef SD_BENCHMARK
+  benchmarkSdLogging();
+#endif
+#ifdef GNSS_BENCHMARK
+  benchmarkGnss();
+#endif
+#ifdef AT_BENCHMARK
+  benchmarkAtLayer();
+#endif
+#ifdef MODEM_BENCHMARK
+  benchmarkModemBackends();
+#endif
+#ifdef SIGNAL_BENCHMARK
+  benchmarkSignalGate();
+#endif
+  setupModemUart();
+  sleepMs(3000);
+  negotiateModemBaud();
+#ifdef UART_BENCHMARK
+  benchmarkModemUart();
+#endif
 
   // モデムの初期化
   SerialMon.println("Initializing modem...");
@@ -552,16 +1810,18 @@ void setup() {
   int retryCount = 0;
   int maxRetries = 5;
   int baseDelay = 1000; // 1秒
-  while (!modem.waitForNetwork() && retryCount < maxRetries) {
+  bool registered = registerNetwork(false, 60000L);
+  while (!registered && retryCount < maxRetries) {
     SerialMon.println("Retrying network registration...");
     retryCount++;
     int jitter = rand() % 1000; // 0から999ミリ秒のランダムな遅延
     int delayTime = baseDelay * (1 << retryCount) + jitter; // exponential backoff with jitter
     SerialMon.printf("Retry %d/%d, waiting for %d ms\n", retryCount, maxRetries, delayTime);
-    delay(delayTime);
+    sleepMs(delayTime);
+    registered = modem.waitForNetwork();
   }
 
-  if (retryCount == maxRetries) {
+  if (!registered) {
     SerialMon.println("Failed to register to network after maximum retries");
     return;
   }
@@ -573,13 +1833,14 @@ void setup() {
 
   //信号品質の取得
   int8_t csq = modem.getSignalQuality();
+  lastCsq = csq;
   SerialMon.print("Signal quality: ");
   SerialMon.println(csq);
   
   //SORACOMのAPNに接続
   if (!modem.gprsConnect("soracom.io", "sora", "sora")) {
     SerialMon.println("GPRS connection failed");
-    delay(10000);
+    sleepMs(10000);
     return;
   }
   SerialMon.println("GPRS connected");
@@ -589,6 +1850,9 @@ void setup() {
   SerialMon.print("Local IP: ");
   SerialMon.println(localIP);
 
+  // 時刻同期（読み取り値のタイムスタンプ用）
+  syncModemTime();
+
   // メタデータからインターバル設定と回線情報を取得
   fetchAndUpdateInterval();
   fetchSubscriberInfo();
@@ -601,6 +1865,8 @@ void setup() {
     if (!mqttConnect()) {
       SerialMon.println("MQTT connect failed. Will retry automatically before publish.");
     }
+  } else if (!mqttEnabled && !modemBackend->has(MODEM_CAP_UDP)) {
+    SerialMon.printf("UDP is not available on modem backend %s; uplinks will use MQTT\n", modemBackend->name());
   } else if (!mqttEnabled) {
     // UDPソケットの初期化（リトライ処理付き）
     int socketRetries = 3;
@@ -610,39 +1876,31 @@ void setup() {
     for (int attempt = 0; attempt < socketRetries; attempt++) {
       // UDPソケットをクローズ
       SerialMon.println("Closing any existing UDP socket...");
-      modem.sendAT("+CACLOSE=0");
-      modem.waitResponse(10000L);
+      modemBackend->udpClose();
       
       // モデムの状態確認
-      String cgattStatus = "";
-      modem.sendAT("+CGATT?");
-      if (modem.waitResponse(5000L, cgattStatus) == 1) {
-        SerialMon.print("Network attachment status: ");
-        SerialMon.println(cgattStatus);
+      AtReply cgatt;
+      if (atClient.query("+CGATT?", 5000, cgatt) && cgatt.ok()) {
+        SerialMon.printf("Network attachment status: %d\n", cgatt.cgatt);
         
-        if (cgattStatus.indexOf("+CGATT: 1") == -1) {
+        if (cgatt.cgatt != 1) {
           SerialMon.println("Modem not attached to network, reconnecting...");
           modem.gprsConnect("soracom.io", "sora", "sora");
-          delay(2000);
+          sleepMs(2000);
         }
       }
 
       // UDPソケットを開く（ATコマンド使用）
       SerialMon.println("Opening UDP socket...");
-      // ATコマンド送信
-      modem.sendAT("+CAOPEN=0,0,\"UDP\",\"" + String(udpServer) + "\"," + String(udpPort));
-
-      // レスポンスを取得して詳細を表示
-      String atResponse = "";
-      int response = modem.waitResponse(15000L, atResponse); // タイムアウトを15秒に延長
-
-      if (response == 1) {
+      if (modemBackend->udpOpen(udpServer, udpPort, 15000)) { // タイムアウトを15秒に延長
         SerialMon.println("UDP socket opened successfully!");
         socketOpened = true;
+        udpSocketOpen = true;
         break; // 成功したのでループを抜ける
       } else {
-        SerialMon.println("Failed to open UDP socket. AT Response:");
-        SerialMon.println(atResponse);
+        char summary[96];
+        SerialMon.printf("Failed to open UDP socket. AT Response: %s\n",
+                         backendReplySummary(summary, sizeof(summary)));
         
         // バッファをクリア
         while (SerialAT.available()) {
@@ -654,14 +1912,14 @@ void setup() {
           int jitter = rand() % 1000;
           int delayTime = socketBaseDelay * (1 << attempt) + jitter;
           SerialMon.printf("Retry %d/%d, waiting for %d ms\n", attempt + 1, socketRetries, delayTime);
-          delay(delayTime);
+          sleepMs(delayTime);
         }
       }
     }
     
     if (!socketOpened) {
       SerialMon.println("Failed to open UDP socket after maximum retries. Restarting...");
-      delay(1000);
+      sleepMs(1000);
       ESP.restart(); // 再起動
     }
   } else {
@@ -670,7 +1928,12 @@ void setup() {
   
   // setup完了後、すぐに初回のデータ送信と画面更新を行う
   SerialMon.println("Setup completed, performing initial data reading and sending...");
+  // SDカードへの記録タスクを起動（以降 LCD と SD の SPI アクセスは uiMutex で排他。カードが無くても起動し、挿入を定期的に確認する）
+  startSdLogTask();
   readAndSendData();
+
+  // 以降のボタン入力はUIタスクが処理する
+  startUiTask();
 }
 
 // モデムの状態を詳細に確認する関数
@@ -678,17 +1941,16 @@ bool checkModemStatus() {
   SerialMon.println("Checking modem status in detail...");
   
   // ネットワーク接続状態の確認
-  String cgattStatus = "";
-  modem.sendAT("+CGATT?");
-  if (modem.waitResponse(5000L, cgattStatus) != 1) {
+  AtReply cgatt;
+  if (!atClient.query("+CGATT?", 5000, cgatt) || !cgatt.ok()) {
     SerialMon.println("Failed to get network attachment status");
     return false;
   }
-  SerialMon.print("Network attachment status: ");
-  SerialMon.println(cgattStatus);
+  SerialMon.printf("Network attachment status: %d\n", cgatt.cgatt);
   
   // シグナル強度の確認
   int8_t csq = modem.getSignalQuality();
+  lastCsq = csq;
   SerialMon.print("Signal quality: ");
   SerialMon.println(csq);
   if (csq < 5 || csq > 31) {
@@ -705,39 +1967,44 @@ bool checkModemStatus() {
   }
   
   // PDP状態の確認
-  String pdpStatus = "";
-  modem.sendAT("+CNACT?");
-  if (modem.waitResponse(5000L, pdpStatus) == 1) {
-    SerialMon.print("PDP context status: ");
-    SerialMon.println(pdpStatus);
-    bool pdp0Active = pdpStatus.indexOf("+CNACT: 0,1") != -1;
-    bool pdp1Active = pdpStatus.indexOf("+CNACT: 1,1") != -1;
-    if (!pdp0Active && !pdp1Active) {
+  AtReply pdp;
+  if (atClient.query("+CNACT?", 5000, pdp) && pdp.ok()) {
+    char summary[96];
+    pdp.summarize(summary, sizeof(summary));
+    SerialMon.printf("PDP context status: %s\n", summary);
+    if (!pdp.pdpIsActive(0) && !pdp.pdpIsActive(1)) {
       SerialMon.println("PDP context not active");
       return false;
     }
   }
   
-  return cgattStatus.indexOf("+CGATT: 1") != -1;
+  return cgatt.cgatt == 1;
 }
 
 // モデムをハードリセットする関数
 void hardResetModem() {
   SerialMon.println("Performing hard reset of modem...");
+  RecoveryScope recovery;
+  countRecovery(RECOVERY_HARD_RESET);
   
   // モデムの電源を切る（ATコマンドでの電源制御）
   modem.sendAT("+CPOWD=1");
   modem.waitResponse(10000L);
-  delay(5000);
+  sleepMs(5000);
+  // 電源断でソケットとMQTT設定は失われる
+  udpSocketOpen = false;
+  mqttConnected = false;
+  clearSmconfCache();
   
-  // モデムを再初期化
+  // モデムを再初期化（電源再投入後はボーレートが保存値に戻る場合があるため再確認）
   SerialMon.println("Reinitializing modem...");
+  ensureModemBaud();
   modem.init();
-  delay(3000);
+  sleepMs(3000);
   
   // ネットワークに再接続
   SerialMon.println("Waiting for network registration...");
-  if (!modem.waitForNetwork(60000L)) {
+  if (!registerNetwork(true, 60000L)) {
     SerialMon.println("Network registration failed after hard reset");
     ESP.restart();
     return;
@@ -758,6 +2025,9 @@ void hardResetModem() {
   SerialMon.println("GPRS connected");
   SerialMon.print("Local IP: ");
   SerialMon.println(modem.localIP());
+
+  // モデム再起動でローカル時刻が失われるため再同期
+  syncModemTime();
   
   // メタデータからインターバル設定と回線情報を取得
   fetchAndUpdateInterval();
@@ -766,14 +2036,14 @@ void hardResetModem() {
 
 // UDPソケットを開く関数（リトライ処理付き）
 bool openUdpSocket() {
+  if (!modemBackend->has(MODEM_CAP_UDP)) return false;
   int socketRetries = 3;
   int socketBaseDelay = 1000;
   
   for (int attempt = 0; attempt < socketRetries; attempt++) {
     // UDPソケットをクローズ
     SerialMon.println("Closing any existing UDP socket...");
-    modem.sendAT("+CACLOSE=0");
-    modem.waitResponse(10000L);
+    modemBackend->udpClose();
     
     // バッファをクリア
     while (SerialAT.available()) {
@@ -782,20 +2052,18 @@ bool openUdpSocket() {
     
     // UDPソケットを開く
     SerialMon.println("Opening UDP socket...");
-    modem.sendAT("+CAOPEN=0,0,\"UDP\",\"" + String(udpServer) + "\"," + String(udpPort));
-    
-    String atResponse = "";
-    int response = modem.waitResponse(20000L, atResponse); // タイムアウトを20秒に延長
-    
-    if (response == 1) {
+    if (modemBackend->udpOpen(udpServer, udpPort, 20000)) { // タイムアウトを20秒に延長
       SerialMon.println("UDP socket opened successfully!");
+      udpSocketOpen = true;
       return true;
     } else {
-      SerialMon.println("Failed to open UDP socket. AT Response:");
-      SerialMon.println(atResponse);
+      char summary[96];
+      SerialMon.printf("Failed to open UDP socket. AT Response: %s\n",
+                       backendReplySummary(summary, sizeof(summary)));
       
-      if (atResponse.length() == 0) {
-        SerialMon.println("Empty AT response, checking modem status...");
+      const AtReply* reply = modemBackend->lastReply();
+      if (reply != nullptr && reply->final == AT_EVENT_NONE) {
+        SerialMon.println("No AT response, checking modem status...");
         if (!checkModemStatus()) {
           SerialMon.println("Modem status check failed, performing hard reset...");
           hardResetModem();
@@ -806,7 +2074,7 @@ bool openUdpSocket() {
         int jitter = rand() % 1000;
         int delayTime = socketBaseDelay * (1 << attempt) + jitter;
         SerialMon.printf("Retry %d/%d, waiting for %d ms\n", attempt + 1, socketRetries, delayTime);
-        delay(delayTime);
+        sleepMs(delayTime);
       }
     }
   }
@@ -819,16 +2087,16 @@ void sendData(uint8_t* payload, size_t payloadSize) {
   int baseDelay = 1000;
   
   for (int attempt = 0; attempt < maxRetries; attempt++) {
-    // データ送信ATコマンド
-    modem.sendAT("+CASEND=0," + String(payloadSize));
-    if (modem.waitResponse(">") != 1) {
+    // データ送信（プロンプトが出なければ回線には何も出ていない）
+    ModemSendResult result = modemBackend->udpSend(payload, payloadSize);
+    if (result == MODEM_SEND_NOT_STARTED) {
       // 指数バックオフ + ジッター戦略
       int jitter = rand() % 1000;
       int delayTime = baseDelay * (1 << attempt) + jitter;
       
       SerialMon.printf("Failed to initiate data send, retrying...\n");
       SerialMon.printf("Retry %d/%d, waiting for %d ms\n", attempt + 1, maxRetries, delayTime);
-      delay(delayTime);
+      sleepMs(delayTime);
       
       // モデムの詳細な状態確認
       if (!checkModemStatus()) {
@@ -840,9 +2108,9 @@ void sendData(uint8_t* payload, size_t payloadSize) {
         } else {
           // GPRSに再接続
           modem.gprsDisconnect();
-          delay(1000);
+          sleepMs(1000);
           modem.gprsConnect("soracom.io", "sora", "sora");
-          delay(2000);
+          sleepMs(2000);
         }
       }
       
@@ -861,11 +2129,10 @@ void sendData(uint8_t* payload, size_t payloadSize) {
         }
       }
     } else {
-      // データ送信
-      SerialAT.write(payload, payloadSize);
-      if (modem.waitResponse() != 1) {
+      chargeUplink(estimateUdpWireBytes(payloadSize));
+      if (result != MODEM_SEND_OK) {
         SerialMon.println("Failed to send data, retrying...");
-        delay(500);
+        sleepMs(500);
         continue;
       }
 
@@ -885,20 +2152,19 @@ bool sendDataWithStatus(uint8_t* payload, size_t payloadSize) {
   int baseDelay = 1000;
   
   for (int attempt = 0; attempt < maxRetries; attempt++) {
-    // データ送信ATコマンド
-    modem.sendAT("+CASEND=0," + String(payloadSize));
-    if (modem.waitResponse(">") != 1) {
+    // データ送信（プロンプトが出なければ回線には何も出ていない）
+    ModemSendResult result = modemBackend->udpSend(payload, payloadSize);
+    if (result == MODEM_SEND_NOT_STARTED) {
       // 指数バックオフ + ジッター戦略
       int jitter = rand() % 1000;
       int delayTime = baseDelay * (1 << attempt) + jitter;
       
-      SerialMon.printf("Failed to initiate data send, retrying...\n");
-      SerialMon.printf("Retry %d/%d, waiting for %d ms\n", attempt + 1, maxRetries, delayTime);
-      delay(delayTime);
+      LOGW(LF_SEND_INIT_FAILED, attempt + 1, maxRetries, delayTime);
+      sleepMs(delayTime);
       
       // モデムの詳細な状態確認
       if (!checkModemStatus()) {
-        SerialMon.println("Modem status check failed, attempting recovery...");
+        LOGW(LF_SEND_RECOVERY);
         
         // 2回目以降のリトライでハードリセットを試みる
         if (attempt >= 1) {
@@ -906,15 +2172,15 @@ bool sendDataWithStatus(uint8_t* payload, size_t payloadSize) {
         } else {
           // GPRSに再接続
           modem.gprsDisconnect();
-          delay(1000);
+          sleepMs(1000);
           modem.gprsConnect("soracom.io", "sora", "sora");
-          delay(2000);
+          sleepMs(2000);
         }
       }
       
       // UDPソケットを再度開く
       if (!openUdpSocket()) {
-        SerialMon.println("Failed to reopen UDP socket after multiple attempts");
+        LOGE(LF_SEND_REOPEN_FAILED);
         
         // 最後のリトライでなければ続行
         if (attempt < maxRetries - 1) {
@@ -927,14 +2193,14 @@ bool sendDataWithStatus(uint8_t* payload, size_t payloadSize) {
         }
       }
     } else {
-      SerialAT.write(payload, payloadSize);
-      if (modem.waitResponse() != 1) {
-        SerialMon.println("Failed to send data, retrying...");
-        delay(500);
+      chargeUplink(estimateUdpWireBytes(payloadSize));
+      if (result != MODEM_SEND_OK) {
+        LOGW(LF_SEND_DATA_FAILED);
+        sleepMs(500);
         continue;
       }
 
-      SerialMon.println("Data sent successfully!");
+      LOGI(LF_SEND_OK, payloadSize, attempt + 1);
       return true; // 成功
     }
   }
@@ -947,6 +2213,8 @@ bool sendDataWithStatus(uint8_t* payload, size_t payloadSize) {
 // モデムをリセットする関数
 void resetModem() {
   SerialMon.println("Resetting modem connection...");
+  RecoveryScope recovery;
+  countRecovery(RECOVERY_MODEM_RESET);
   
   // モデムの状態を詳細に確認
   if (!checkModemStatus()) {
@@ -957,22 +2225,25 @@ void resetModem() {
   
   // GPRSを切断
   modem.gprsDisconnect();
-  delay(1000);
+  sleepMs(1000);
   
   // UDPソケットをクローズ（UDPモード時のみ有効だが、冪等に実行）
   modem.sendAT("+CACLOSE=0");
   modem.waitResponse(5000L);
+  udpSocketOpen = false;
   
   // MQTTセッションがあるなら明示的に切断（保険）
   mqttDisconnect();
 
   // モデムをソフトリセット
   modem.restart();
-  delay(3000);
+  sleepMs(3000);
+  ensureModemBaud();
+  clearSmconfCache();
   
   // ネットワークに再接続
   SerialMon.println("Reconnecting to network...");
-  if (!modem.waitForNetwork(60000L)) {
+  if (!registerNetwork(true, 60000L)) {
     SerialMon.println("Network reconnection failed, performing hard reset");
     hardResetModem();
     return;
@@ -985,6 +2256,9 @@ void resetModem() {
     return;
   }
 
+  // モデム再起動でローカル時刻が失われるため再同期
+  syncModemTime();
+
   // 最新メタデータを取得（モード/トピック/qosの更新を反映）
   fetchAndUpdateInterval();
   fetchSubscriberInfo();
@@ -1013,65 +2287,184 @@ void resetModem() {
 
 // I2Cデバイススキャン関数
 void scanI2CDevices() {
-  SerialMon.println("Scanning I2C devices...");
-  byte error, address;
-  int nDevices = 0;
+  SerialMon.printf("Scanning I2C devices at %lu Hz...\n", (unsigned long)i2cBus.clockHz());
+  uint8_t found[16];
+  unsigned long scanStart = nowUs();
+  size_t nDevices = i2cBus.scan(found, sizeof(found));
+  unsigned long scanUs = nowUs() - scanStart;
   
-  for(address = 1; address < 127; address++) {
-    Wire.beginTransmission(address);
-    error = Wire.endTransmission();
-    
-    if (error == 0) {
-      SerialMon.printf("I2C device found at address 0x%02X", address);
-      if (address == 0x28) {
-        SerialMon.print(" (FS3000 Air Velocity Sensor)");
-      } else if (address == 0x62) {
-        SerialMon.print(" (SCD40 CO2 Sensor)");
-      }
-      SerialMon.println();
-      nDevices++;
+  for (size_t i = 0; i < nDevices && i < sizeof(found); i++) {
+    SerialMon.printf("I2C device found at address 0x%02X", found[i]);
+    if (found[i] == 0x28) {
+      SerialMon.print(" (FS3000 Air Velocity Sensor)");
+    } else if (found[i] == 0x62) {
+      SerialMon.print(" (SCD40 CO2 Sensor)");
     }
+    SerialMon.println();
   }
   
   if (nDevices == 0) {
     SerialMon.println("No I2C devices found");
   } else {
-    SerialMon.printf("Found %d I2C devices\n", nDevices);
+    SerialMon.printf("Found %d I2C devices\n", (int)nDevices);
   }
+  SerialMon.printf("I2C scan took %lu us\n", scanUs);
   SerialMon.println();
 }
 
+// I2Cデバイス毎のトランザクション統計を出力する関数
+void printI2cStats() {
+  for (size_t i = 0; i < i2cBus.deviceCount(); i++) {
+    const I2cDeviceStats* d = i2cBus.stats((int)i);
+    unsigned long avgUs = d->transactions > 0 ? (unsigned long)(d->totalLatencyUs / d->transactions) : 0;
+    SerialMon.printf("I2C %s(0x%02X): tx=%lu err=%lu skip=%lu last=%luus avg=%luus max=%luus backoff=%lums\n",
+                     d->name, d->address,
+                     (unsigned long)d->transactions, (unsigned long)d->errors, (unsigned long)d->skipped,
+                     (unsigned long)d->lastLatencyUs, avgUs, (unsigned long)d->maxLatencyUs,
+                     (unsigned long)d->backoffMs);
+  }
+  if (i2cBus.recoveries() > 0 || i2cBus.failedRecoveries() > 0) {
+    SerialMon.printf("I2C bus recoveries: %lu ok, %lu failed\n",
+                     (unsigned long)i2cBus.recoveries(), (unsigned long)i2cBus.failedRecoveries());
+  }
+  if (i2cBus.clockFallbacks() > 0) {
+    SerialMon.printf("I2C bus running at %lu Hz (fell back from 400kHz)\n", (unsigned long)i2cBus.clockHz());
+  }
+}
+
 void loop() {
-  unsigned long current = millis();
+  loopTimer.begin(nowUs());
+  unsigned long current = nowMs();
   
-  // 長時間通信が成功していない場合、モデムをリセット
-  if (lastSuccessfulSend > 0 && (current - lastSuccessfulSend) > CONNECTION_TIMEOUT) {
-    SerialMon.println("Communication timeout detected. No successful data transmission for 5 minutes.");
+  // 長時間通信が成功していない場合、モデムをリセット（GNSS 測位で LTE を止めている間は除く）
+  if (!gnssRadioOff && lastSuccessfulSend > 0 && (current - lastSuccessfulSend) > connectionTimeout()) {
+    SerialMon.printf("Communication timeout detected. No successful data transmission for %lu sec.\n",
+                     connectionTimeout() / 1000);
     resetModem();
     lastSuccessfulSend = current; // リセット後にタイムアウトカウンターをリセット
   }
   
-  // インターバルに基づいてデータ送信と画面更新
-  if (current - lastUpdate >= INTERVAL) {
-    readAndSendData();
+  // 定期的な時刻再同期（ドリフト補正用）
+  unsigned long syncPeriod = timeSync.synced() ? TIME_SYNC_INTERVAL : TIME_SYNC_RETRY;
+  if (!gnssRadioOff && current - lastTimeSyncAttempt >= syncPeriod) {
+    syncModemTime();
+  }
+
+  // 期限の来たタイマーを処理（1周で1件ずつ処理し、ボタン等の応答性を保つ）
+  int due = scheduler.poll(nowMs());
+  if (due < 0) {
+    // 期限到来なし
+  } else if (due == timerSample) {
+    sampleSensors();
+  } else if (gnssRadioOff && (due == timerUplink || due == timerMetadata || due == timerOta)) {
+    // 測位中は LTE を使えないため、再接続後へ遅らせる
+    gnssDefer(due, current);
+  } else if (due == timerUplink) {
+    sendLatestReading();
+    printSchedulerStats();
+    printTransportStats();
+    printMqttSessionStats();
+    printUiStats();
+    printSdLogStats();
+    printBudgetStats();
+    printGnssStats();
+    printSignalStats();
+  } else if (due == timerDisplay) {
+    updateDisplay();
+  } else if (due == timerMetadata) {
+    fetchAndUpdateInterval();
+  } else if (due == timerOta) {
+    otaStep();
+  } else if (due == timerSoak) {
+    printSoakReport();
+  } else if (due == timerGnss) {
+    gnssStep();
+  }
+
+  // BtnB の即時送信要求（UIタスクは受付の表示だけを行い、送信はここで次の周回に行う）
+  if (uiForceSend) {
+    uiForceSend = false;
+    scheduler.trigger(timerUplink, nowMs());
   }
 
-  M5.update();
+  // OTA後のイメージを時間内に確定できなければ旧イメージへ戻す
+  if (otaPendingVerify && current > OTA_CONFIRM_TIMEOUT) {
+    rollBackOtaImage("new image not confirmed in time");
+  }
+
+  loopTimer.end(nowUs());
 }
 // ==== MQTT helper implementations (SIM7080 AT commands) ====
 
+// 適用済みの SMCONF 値（同じ値の再適用を省略する。モデムのリセットとMQTTスタック再初期化で破棄）
+struct SmconfEntry {
+  const char* key;
+  String value;
+};
+static SmconfEntry smconfApplied[] = {
+  { "URL", "" }, { "CONNID", "" }, { "CLIENTID", "" }, { "CLEANSS", "" }, { "KEEPTIME", "" },
+  { "ASYNCMODE", "" }, { "USERNAME", "" }, { "PASSWORD", "" }, { "QOS", "" },
+};
+
+static SmconfEntry* smconfEntry(const char* key) {
+  for (size_t i = 0; i < sizeof(smconfApplied) / sizeof(smconfApplied[0]); ++i) {
+    if (strcmp(smconfApplied[i].key, key) == 0) return &smconfApplied[i];
+  }
+  return nullptr;
+}
+
+void clearSmconfCache() {
+  for (size_t i = 0; i < sizeof(smconfApplied) / sizeof(smconfApplied[0]); ++i) {
+    smconfApplied[i].value = "";
+  }
+  mqttConfigApplied = false;
+}
+
+// 適用済みなら true（省略数を計上）
+static bool smconfCached(const char* key) {
+  SmconfEntry* e = smconfEntry(key);
+  if (e == nullptr || e->value.length() == 0) return false;
+  mqttSession.smconfSkipped++;
+  return true;
+}
+
+static bool smconfCachedAs(const char* key, const String& value) {
+  SmconfEntry* e = smconfEntry(key);
+  return e != nullptr && e->value.length() > 0 && e->value == value;
+}
+
+// AT+SMCONF="key",value を送る（適用済みと同じ値なら送らない）
+static bool smconfSet(const char* key, const String& value) {
+  if (smconfCachedAs(key, value)) {
+    mqttSession.smconfSkipped++;
+    return true;
+  }
+  char cmd[160];
+  AtReply reply;
+  AtCommandWriter w(cmd, sizeof(cmd), "+SMCONF=");
+  w.quoted(key).raw(value.c_str());
+  mqttSession.smconfSent++;
+  if (!atClient.query(w.c_str(), 5000, reply) || !reply.ok()) {
+    SerialMon.printf("SMCONF %s failed\n", key);
+    return false;
+  }
+  SmconfEntry* e = smconfEntry(key);
+  if (e != nullptr) e->value = value;
+  return true;
+}
+
 // MQTT URL設定のフォールバック実装
 static bool mqttConfUrlWithFallback() {
+  if (smconfCached("URL")) return true;
+
   // 1) 推奨: URL と ポートを分けて設定
-  modem.sendAT("+SMCONF=\"URL\",\"beam.soracom.io\",1883");
-  if (modem.waitResponse(5000L) == 1) {
+  if (smconfSet("URL", String("\"") + MQTT_BROKER + "\"," + String(MQTT_BROKER_PORT))) {
     return true;
   }
   SerialMon.println("SMCONF URL with separate port failed, trying single-arg fallback...");
 
   // 2) 一部FW向け: "beam.soracom.io,1883" を単一引数として渡す
-  modem.sendAT("+SMCONF=\"URL\",\"beam.soracom.io,1883\"");
-  if (modem.waitResponse(5000L) == 1) {
+  if (smconfSet("URL", String("\"") + MQTT_BROKER + "," + String(MQTT_BROKER_PORT) + "\"")) {
     return true;
   }
   SerialMon.println("SMCONF URL fallback also failed");
@@ -1087,27 +2480,16 @@ bool isValidMqttTopic(const String& topic) {
   return true;
 }
 
-bool mqttConfigure() {
-  bool ok = true;
-
-  // URL
-  if (!mqttConfUrlWithFallback()) ok = false;
-  // Force MQTT to use PDP context ID 0
-  // Note: Some SIM7080 firmware variants use CONTEXTID instead of CONNID
-  modem.sendAT("+SMCONF=\"CONNID\",0");
-  int smconfConnIdResp = modem.waitResponse(5000L);
-  if (smconfConnIdResp != 1) {
-    SerialMon.println("SMCONF CONNID failed, trying CONTEXTID...");
-    modem.sendAT("+SMCONF=\"CONTEXTID\",0");
-    if (modem.waitResponse(5000L) != 1) { SerialMon.println("SMCONF CONTEXTID failed"); ok = false; }
-  }
+// MQTT の ClientID を決める。優先順:
+// 1) メタデータ clientid=タグ名 → そのタグ値（metadata-tag:KEY）
+//    （後方互換）client_id / clientId のリテラル
+// 2) SIMタグ name（Azure IoT の deviceId に合わせやすい）
+// 3) IMSI
+// 4) IMEI
+// 永続セッションのため ClientID は起動中固定とし、決定（タグ取得を含む）は初回のみ行う
+static void resolveMqttClientId() {
+  if (mqttClientId.length() > 0) return;
 
-  // CLIENTID 優先順:
-  // 1) メタデータ clientid=タグ名 → そのタグ値（metadata-tag:KEY）
-  //    （後方互換）client_id / clientId のリテラル
-  // 2) SIMタグ name（Azure IoT の deviceId に合わせやすい）
-  // 3) IMSI
-  // 4) IMEI
   String clientIdSource = "";
   String clientId = "";
 
@@ -1149,57 +2531,124 @@ bool mqttConfigure() {
     sanitized = modem.getIMEI();
     clientIdSource = "imei";
   }
-  modem.sendAT("+SMCONF=\"CLIENTID\",\"" + sanitized + "\"");
-  if (modem.waitResponse(5000L) != 1) {
-    SerialMon.println("SMCONF CLIENTID failed");
+  mqttClientId = sanitized;
+  SerialMon.printf("MQTT ClientID resolved: %s (source=%s)\n", sanitized.c_str(), clientIdSource.c_str());
+}
+
+// 汎用バックエンドに渡す接続設定（SMCONF の代わり）
+static MqttSettings genericMqttSettings() {
+  MqttSettings settings;
+  settings.host = MQTT_BROKER;
+  settings.port = MQTT_BROKER_PORT;
+  settings.clientId = mqttClientId.c_str();
+  settings.keepAliveSec = (uint16_t)mqttKeepAliveSec();
+  settings.cleanSession = !mqttPersistentSession;
+  return settings;
+}
+
+bool mqttConfigure() {
+  if (!modemBackend->has(MODEM_CAP_NATIVE_MQTT)) {
+    resolveMqttClientId();
+    modemBackend->setMqttSettings(genericMqttSettings());
+    mqttConfigApplied = true;
+    return true;
+  }
+  bool ok = true;
+
+  // URL
+  if (!mqttConfUrlWithFallback()) ok = false;
+  // Force MQTT to use PDP context ID 0
+  // Note: Some SIM7080 firmware variants use CONTEXTID instead of CONNID
+  if (!smconfCached("CONNID") && !smconfSet("CONNID", "0")) {
+    SerialMon.println("SMCONF CONNID failed, trying CONTEXTID...");
+    modem.sendAT("+SMCONF=\"CONTEXTID\",0");
+    mqttSession.smconfSent++;
+    if (modem.waitResponse(5000L) != 1) {
+      SerialMon.println("SMCONF CONTEXTID failed");
+      ok = false;
+    } else {
+      smconfEntry("CONNID")->value = "0";
+    }
+  }
+
+  resolveMqttClientId();
+  if (!smconfSet("CLIENTID", "\"" + mqttClientId + "\"")) {
     ok = false;
   } else {
-    // 保存: 実際に使用するClientID（後続のトピック構築に使用）
-    mqttClientId = sanitized;
-    SerialMon.printf("SMCONF CLIENTID set to: %s (source=%s)\n", sanitized.c_str(), clientIdSource.c_str());
+    SerialMon.printf("SMCONF CLIENTID set to: %s\n", mqttClientId.c_str());
   }
 
   // セッション/キープ/同期モード
-  modem.sendAT("+SMCONF=\"CLEANSS\",1");
-  if (modem.waitResponse(5000L) != 1) { SerialMon.println("SMCONF CLEANSS failed"); ok = false; }
-  modem.sendAT("+SMCONF=\"KEEPTIME\",60");
-  if (modem.waitResponse(5000L) != 1) { SerialMon.println("SMCONF KEEPTIME failed"); ok = false; }
-  modem.sendAT("+SMCONF=\"ASYNCMODE\",0");
-  if (modem.waitResponse(5000L) != 1) { SerialMon.println("SMCONF ASYNCMODE failed"); ok = false; }
+  // 永続セッションではブローカー側のセッション（QoS1 の未完了メッセージ等）を再接続後も引き継ぐ
+  if (!smconfSet("CLEANSS", mqttPersistentSession ? "0" : "1")) ok = false;
+  if (!smconfSet("KEEPTIME", String(mqttKeepAliveSec()))) ok = false;
+  if (!smconfSet("ASYNCMODE", "0")) ok = false;
 
   // 認証なし
-  modem.sendAT("+SMCONF=\"USERNAME\",\"\"");
-  if (modem.waitResponse(5000L) != 1) { SerialMon.println("SMCONF USERNAME failed"); ok = false; }
-  modem.sendAT("+SMCONF=\"PASSWORD\",\"\"");
-  if (modem.waitResponse(5000L) != 1) { SerialMon.println("SMCONF PASSWORD failed"); ok = false; }
+  if (!smconfSet("USERNAME", "\"\"")) ok = false;
+  if (!smconfSet("PASSWORD", "\"\"")) ok = false;
 
   // 既定QOSの設定（実送信はSMPUBの引数も使用）
-  modem.sendAT("+SMCONF=\"QOS\"," + String(mqttQos));
-  if (modem.waitResponse(5000L) != 1) { SerialMon.println("SMCONF QOS failed"); ok = false; }
+  if (!smconfSet("QOS", String(mqttQos))) ok = false;
 
+  mqttConfigApplied = ok;
   return ok;
 }
 
-bool isMqttOnline() {
-  String resp = "";
-  modem.sendAT("+SMSTATE?");
-  if (modem.waitResponse(5000L, resp) != 1) {
-    mqttConnected = false;
-    return false;
+// 送信周期から決めるキープアライブ（秒）
+// 周期の1.5倍とし、周期毎の PUBLISH がキープアライブ内に収まるようにする。
+// 上限を超える長周期では送信間にブローカー側で切断されるが、永続セッションにより再接続は SMCONN のみで済む
+uint32_t mqttKeepAliveSec() {
+  uint32_t k = (uint32_t)(INTERVAL / 1000) * 3 / 2;
+  if (k < MQTT_MIN_KEEPALIVE_S) k = MQTT_MIN_KEEPALIVE_S;
+  if (k > MQTT_MAX_KEEPALIVE_S) k = MQTT_MAX_KEEPALIVE_S;
+  return k;
+}
+
+// 適用済みの SMCONF と現在の設定が異なるか（送信周期やQoSの変更で張り直しが必要）
+bool mqttConfigChanged() {
+  if (!modemBackend->has(MODEM_CAP_NATIVE_MQTT)) {
+    return !modemBackend->mqttSettingsApplied(genericMqttSettings());
   }
-  bool online = (resp.indexOf("+SMSTATE: 1") != -1 || resp.indexOf("+SMSTATE: 2") != -1);
+  return !smconfCachedAs("CLEANSS", mqttPersistentSession ? "0" : "1")
+      || !smconfCachedAs("KEEPTIME", String(mqttKeepAliveSec()))
+      || !smconfCachedAs("QOS", String(mqttQos));
+}
+
+
+bool isMqttOnline() {
+  bool online = modemBackend->mqttConnected();
   if (!online) {
     // 瞬断対策: 短い待機後に再確認して二重でオフラインなら確定
-    delay(150);
-    resp = "";
-    modem.sendAT("+SMSTATE?");
-    modem.waitResponse(5000L, resp);
-    online = (resp.indexOf("+SMSTATE: 1") != -1 || resp.indexOf("+SMSTATE: 2") != -1);
+    sleepMs(150);
+    online = modemBackend->mqttConnected();
   }
   mqttConnected = online;
   return online;
 }
 
+// SMCONN の所要時間と接続/再接続回数を記録する
+static void recordMqttHandshake(unsigned long startMs, bool ok) {
+  if (!ok) {
+    mqttSession.connectFailures++;
+    return;
+  }
+  uint32_t ms = nowMs() - startMs;
+  if (mqttSession.connects > 0) mqttSession.reconnects++;
+  mqttSession.connects++;
+  mqttSession.lastHandshakeMs = ms;
+  mqttSession.totalHandshakeMs += ms;
+  if (ms > mqttSession.maxHandshakeMs) mqttSession.maxHandshakeMs = ms;
+}
+
+// MQTT 接続前にデータ通信を使える状態にする
+// 内蔵スタックは PDP#0（+CNACT）を使い、汎用バックエンドは TinyGSM の GPRS 接続を使う
+static bool ensureDataBearer() {
+  if (modemBackend->has(MODEM_CAP_NATIVE_MQTT)) return ensurePdp0Active();
+  if (modem.isGprsConnected()) return true;
+  return modem.gprsConnect("soracom.io", "sora", "sora");
+}
+
 bool mqttConnect() {
   const int maxRetries = 3;
   const int baseDelay = 1000;
@@ -1209,41 +2658,35 @@ bool mqttConnect() {
     if (isMqttOnline()) return true;
 
     // PDP#0 が非アクティブなら再活性化を試行
-    if (!ensurePdp0Active()) {
+    if (!ensureDataBearer()) {
       int jitter = rand() % 1000;
       int delayTime = baseDelay * (1 << attempt) + jitter;
-      SerialMon.printf("PDP#0 activation failed, retry %d/%d after %d ms\n", attempt + 1, maxRetries, delayTime);
-      delay(delayTime);
+      LOGW(LF_MQTT_PDP_RETRY, attempt + 1, maxRetries, delayTime);
+      sleepMs(delayTime);
       continue;
     }
 
     // 接続前の診断ログ: PDP と MQTT 状態
-    {
-      String pdp = "";
-      modem.sendAT("+CNACT?");
-      modem.waitResponse(5000L, pdp);
-      SerialMon.println("PDP status before SMCONN:");
-      SerialMon.println(pdp);
-
-      String stBefore = "";
-      modem.sendAT("+SMSTATE?");
-      modem.waitResponse(5000L, stBefore);
-      SerialMon.println("SMSTATE before SMCONN:");
-      SerialMon.println(stBefore);
-    }
-
-    SerialMon.println("MQTT connecting (AT+SMCONN)...");
-    modem.sendAT("+SMCONN");
-    if (modem.waitResponse(60000L) == 1) {
+    bool native = modemBackend->has(MODEM_CAP_NATIVE_MQTT);
+    if (native && logRing.enabled(LOG_LEVEL_DEBUG)) {
+      char summary[96];
+      LOGD(LF_MQTT_PDP_BEFORE, atQuerySummary("+CNACT?", summary, sizeof(summary)));
+      LOGD(LF_MQTT_STATE_BEFORE, atQuerySummary("+SMSTATE?", summary, sizeof(summary)));
+    }
+
+    LOGI(LF_MQTT_CONNECTING);
+    unsigned long handshakeStart = nowMs();
+    bool connOk = modemBackend->mqttConnect(60000);
+    recordMqttHandshake(handshakeStart, connOk);
+    if (connOk) {
       // 接続後の状態を確認
-      String stAfter = "";
-      modem.sendAT("+SMSTATE?");
-      modem.waitResponse(5000L, stAfter);
-      SerialMon.println("SMSTATE after SMCONN:");
-      SerialMon.println(stAfter);
+      if (native && logRing.enabled(LOG_LEVEL_DEBUG)) {
+        char summary[96];
+        LOGD(LF_MQTT_STATE_AFTER, atQuerySummary("+SMSTATE?", summary, sizeof(summary)));
+      }
 
       if (isMqttOnline()) {
-        SerialMon.println("MQTT connected");
+        LOGI(LF_MQTT_CONNECTED);
         return true;
       }
     }
@@ -1251,47 +2694,43 @@ bool mqttConnect() {
     // リトライ待機（指数バックオフ + ジッター）
     int jitter = rand() % 1000;
     int delayTime = baseDelay * (1 << attempt) + jitter;
-    SerialMon.printf("MQTT connect retry %d/%d, waiting %d ms\n", attempt + 1, maxRetries, delayTime);
-    delay(delayTime);
+    LOGW(LF_MQTT_CONNECT_RETRY, attempt + 1, maxRetries, delayTime);
+    sleepMs(delayTime);
   }
 
   // 既定回数失敗時のフォールバック: MQTTスタック再初期化
   SerialMon.println("MQTT connect failed after retries - resetting MQTT stack (SMDISC + SMCONF reapply)");
   mqttDisconnect();
+  // 適用済みの値も含めて SMCONF 一式を送り直す
+  clearSmconfCache();
   // 再度SMCONF一式を適用（失敗しても続行）
   if (!mqttConfigure()) {
     SerialMon.println("Reapply SMCONF returned error, proceeding anyway");
   }
 
   // PDP#0を再確認・再活性化
-  if (!ensurePdp0Active()) {
+  if (!ensureDataBearer()) {
     SerialMon.println("PDP#0 still inactive after reconfigure");
     return false;
   }
 
   // 最終接続試行（1ラウンド）
-  {
-    String pdp = "";
-    modem.sendAT("+CNACT?");
-    modem.waitResponse(5000L, pdp);
-    SerialMon.println("PDP status before SMCONN (final):");
-    SerialMon.println(pdp);
-
-    String stBefore = "";
-    modem.sendAT("+SMSTATE?");
-    modem.waitResponse(5000L, stBefore);
-    SerialMon.println("SMSTATE before SMCONN (final):");
-    SerialMon.println(stBefore);
-  }
-
-  SerialMon.println("MQTT connecting (AT+SMCONN) final attempt...");
-  modem.sendAT("+SMCONN");
-  if (modem.waitResponse(60000L) == 1) {
-    String stAfter = "";
-    modem.sendAT("+SMSTATE?");
-    modem.waitResponse(5000L, stAfter);
-    SerialMon.println("SMSTATE after SMCONN (final):");
-    SerialMon.println(stAfter);
+  bool native = modemBackend->has(MODEM_CAP_NATIVE_MQTT);
+  if (native) {
+    char summary[96];
+    SerialMon.printf("PDP status before SMCONN (final): %s\n", atQuerySummary("+CNACT?", summary, sizeof(summary)));
+    SerialMon.printf("SMSTATE before SMCONN (final): %s\n", atQuerySummary("+SMSTATE?", summary, sizeof(summary)));
+  }
+
+  SerialMon.printf("MQTT connecting (%s) final attempt...\n", modemBackend->name());
+  unsigned long handshakeStart = nowMs();
+  bool connOk = modemBackend->mqttConnect(60000);
+  recordMqttHandshake(handshakeStart, connOk);
+  if (connOk) {
+    if (native) {
+      char summary[96];
+      SerialMon.printf("SMSTATE after SMCONN (final): %s\n", atQuerySummary("+SMSTATE?", summary, sizeof(summary)));
+    }
 
     if (isMqttOnline()) {
       SerialMon.println("MQTT connected (after stack reset)");
@@ -1304,15 +2743,15 @@ bool mqttConnect() {
 }
 
 void mqttDisconnect() {
-  SerialMon.println("MQTT disconnecting (AT+SMDISC)...");
-  modem.sendAT("+SMDISC");
-  modem.waitResponse(10000L);
+  SerialMon.printf("MQTT disconnecting (%s)...\n", modemBackend->name());
+  modemBackend->mqttDisconnect();
   mqttConnected = false;
 }
 
-bool mqttPublish(const String& topic, const String& json, int qos) {
-  if (!mqttEnabled || !mqttConfigValid) {
-    SerialMon.println("MQTT publish skipped: MQTT disabled or config invalid");
+bool mqttPublish(const String& topic, const uint8_t* payload, size_t payloadLen, int qos) {
+  // mqtt=false でもフェイルオーバー先として使う場合があるため、設定の有効性のみ確認
+  if (!mqttConfigValid) {
+    SerialMon.println("MQTT publish skipped: MQTT config invalid");
     return false;
   }
 
@@ -1321,7 +2760,8 @@ bool mqttPublish(const String& topic, const String& json, int qos) {
     return false;
   }
 
-  if (!isMqttOnline()) {
+  // 接続済みなら SMSTATE? を省き、PUBLISH 1回だけで済ませる（失敗時に状態を確認する）
+  if (!mqttConnected && !isMqttOnline()) {
     SerialMon.println("MQTT not online, trying to reconnect...");
     if (!mqttConnect()) {
       SerialMon.println("MQTT reconnect failed, cannot publish");
@@ -1334,40 +2774,2202 @@ bool mqttPublish(const String& topic, const String& json, int qos) {
   //   Azure IoT Hub 既定のイベントトピックに置換:
   //     devices/{clientId}/messages/events/
   //   ここで clientId は SMCONF で設定したもの（mqttClientId）と一致させる
-  String finalTopic = topic;
+  char azureTopic[160];
+  const char* finalTopic = topic.c_str();
   if (topic.equalsIgnoreCase("azure_default")) {
     if (mqttClientId.length() == 0) {
       SerialMon.println("azure_default requested but mqttClientId is empty. Aborting publish.");
       return false;
     }
-    finalTopic = "devices/" + mqttClientId + "/messages/events/";
-    SerialMon.printf("Using Azure default topic mapping: %s\n", finalTopic.c_str());
+    snprintf(azureTopic, sizeof(azureTopic), "devices/%s/messages/events/", mqttClientId.c_str());
+    finalTopic = azureTopic;
+    SerialMon.printf("Using Azure default topic mapping: %s\n", finalTopic);
+  }
+
+  // トピックが長すぎる・引用符を含む場合は SMPUB を組み立てられず、送らずに諦める
+  if (modemBackend->has(MODEM_CAP_NATIVE_MQTT)) {
+    char cmd[300];
+    AtCommandWriter w(cmd, sizeof(cmd), "+SMPUB=");
+    w.quoted(finalTopic).arg((unsigned long)payloadLen).arg(qos).arg(0);
+    if (!w.ok()) {
+      SerialMon.println("MQTT publish skipped: SMPUB command could not be built");
+      return false;
+    }
   }
 
-  int length = json.length();
-  SerialMon.printf("Publishing via MQTT: topic=%s len=%d qos=%d\n", finalTopic.c_str(), length, qos);
+  int length = (int)payloadLen;
+  for (int attempt = 0; ; ++attempt) {
+    LOGI(LF_MQTT_PUBLISHING, finalTopic, length, qos);
 
-  modem.sendAT("+SMPUB=\"" + finalTopic + "\"," + String(length) + "," + String(qos) + ",0");
-  if (modem.waitResponse(">") != 1) {
-    SerialMon.println("SMPUB prompt not received");
-    return false;
+    ModemSendResult result = modemBackend->mqttPublish(finalTopic, payload, payloadLen, qos);
+    if (result == MODEM_SEND_NOT_STARTED) {
+      LOGW(LF_MQTT_PUB_NO_PROMPT);
+    } else {
+      // 本文は送出済み
+      chargeUplink(estimateMqttWireBytes(strlen(finalTopic), payloadLen, qos));
+      if (result != MODEM_SEND_OK) LOGW(LF_MQTT_PUB_FAILED);
+    }
+    if (result == MODEM_SEND_OK) break;
+
+    // セッションが切れていた場合のみ再接続して1回だけ再送
+    if (attempt > 0 || isMqttOnline()) return false;
+    SerialMon.println("MQTT session lost, reconnecting before retrying publish...");
+    if (!mqttConnect()) return false;
+  }
+
+  mqttSession.publishes++;
+  LOGI(LF_MQTT_PUB_OK);
+  if (modemBackend->has(MODEM_CAP_NATIVE_MQTT) && logRing.enabled(LOG_LEVEL_DEBUG)) {
+    char summary[96];
+    LOGD(LF_MQTT_STATE_AFTER_PUB, atQuerySummary("+SMSTATE?", summary, sizeof(summary)));
   }
+  return true;
+}
+
+// 接続/再接続回数・SMCONN 所要時間・省略した SMCONF 数を出力する
+void printMqttSessionStats() {
+  if (mqttSession.connects == 0 && mqttSession.connectFailures == 0) return;
+  unsigned long avgMs = mqttSession.connects > 0 ? (unsigned long)(mqttSession.totalHandshakeMs / mqttSession.connects) : 0;
+  SerialMon.printf("MQTT session: pub=%lu connects=%lu reconnects=%lu fails=%lu handshake last=%lu avg=%lu max=%lu ms smconf sent=%lu skipped=%lu\n",
+                   (unsigned long)mqttSession.publishes, (unsigned long)mqttSession.connects,
+                   (unsigned long)mqttSession.reconnects, (unsigned long)mqttSession.connectFailures,
+                   (unsigned long)mqttSession.lastHandshakeMs, avgMs, (unsigned long)mqttSession.maxHandshakeMs,
+                   (unsigned long)mqttSession.smconfSent, (unsigned long)mqttSession.smconfSkipped);
+}
 
-  // 本文送出
-  SerialAT.print(json);
+// ==== Deferred logger drain task ====
 
-  if (modem.waitResponse(10000L) != 1) {
-    SerialMon.println("SMPUB publish failed");
+// リングバッファのレコードを整形してシリアルへ出力する低優先度タスク
+// -DLOG_RAW_DUMP ではデバイス上で整形せず、レコードを "LOGREC <16進>" 行のまま出力する
+// （tools/log_decode.py でテキストに戻す）
+static void logDrainTask(void* arg) {
+  (void)arg;
+  uint8_t record[LogRing::MAX_RECORD];
+#ifdef LOG_RAW_DUMP
+  char line[8 + LogRing::MAX_RECORD * 2];
+#else
+  char line[256];
+#endif
+  for (;;) {
+    // 破棄数はリング自体に記録し、他のレコードと同じ経路（LOG_RAW_DUMP ではホスト側で復号）で出力する
+    // リングが一杯で書けなかった場合は、その1件も次の破棄数に含まれる
+    uint32_t dropped = logRing.takeDropped();
+    if (dropped > 0) {
+      LOGW(LF_LOG_DROPPED, (unsigned long)dropped);
+    }
+    size_t len;
+    bool any = false;
+    while ((len = logRing.read(record, sizeof(record))) > 0) {
+#ifdef LOG_RAW_DUMP
+      static const char HEX[] = "0123456789abcdef";
+      memcpy(line, "LOGREC ", 7);
+      size_t n = 7;
+      for (size_t i = 0; i < len; i++) {
+        line[n++] = HEX[record[i] >> 4];
+        line[n++] = HEX[record[i] & 0x0F];
+      }
+      line[n] = '\0';
+#else
+      LogRing::format(record, len, line, sizeof(line));
+#endif
+      SerialMon.println(line);
+      any = true;
+    }
+    // 空の間は周期的に確認（出力中はCPUを譲りつつ続行）
+    vTaskDelay(pdMS_TO_TICKS(any ? 5 : 50));
+  }
+}
+
+void startLogDrainTask() {
+  // loop() はコア1で動作するため、ドレインはコア0・低優先度で実行する
+  xTaskCreatePinnedToCore(logDrainTask, "logDrain", 4096, NULL, tskIDLE_PRIORITY + 1, &logDrainTaskHandle, 0);
+}
+
+// ==== Button / UI task ====
+
+// 押下されたボタンの操作を反映する（uiMutex を保持して呼ぶ）
+static void handleButton(ButtonId id) {
+  ScreenMode prev = screenMode;
+  if (id == BUTTON_A) {
+    // 現在値 → 1時間 → 24時間 → 現在値（診断画面からは現在値へ）
+    if (screenMode == SCREEN_MAIN) {
+      screenMode = SCREEN_TREND_1H;
+    } else if (screenMode == SCREEN_TREND_1H) {
+      screenMode = SCREEN_TREND_24H;
+    } else {
+      screenMode = SCREEN_MAIN;
+    }
+  } else if (id == BUTTON_B) {
+    uiForceSend = true;
+    snprintf(uiToast, sizeof(uiToast), "%s", modemRecovering ? "Send queued (modem recovering)" : "Send requested");
+    uiToastUntil = nowMs() + UI_TOAST_MS;
+  } else if (id == BUTTON_C) {
+    screenMode = screenMode == SCREEN_DIAG ? SCREEN_MAIN : SCREEN_DIAG;
+  }
+  if (screenMode != prev) {
+    // グラフ画面は見出し行と描画領域の全面を塗り直すため、画面全体の消去は不要
+    trendNeedsRedraw = true;
+  }
+}
+
+// ボタンをポーリングし、押下から画面反映までをこのタスク内で行う（ループ側の通信処理を待たない）
+static void uiTask(void* arg) {
+  (void)arg;
+  const uint8_t pins[BUTTON_COUNT] = { BUTTON_A_PIN, BUTTON_B_PIN, BUTTON_C_PIN };
+  for (int i = 0; i < BUTTON_COUNT; i++) {
+    pinMode(pins[i], INPUT_PULLUP);
+  }
+  for (;;) {
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+      if (!buttons[i].update(digitalRead(pins[i]) == LOW, nowUs())) continue;
+
+      uint32_t waitStart = nowUs();
+      xSemaphoreTake(uiMutex, portMAX_DELAY);
+      uint32_t waitUs = nowUs() - waitStart;
+      handleButton((ButtonId)i);
+      renderScreen();
+      uint32_t latencyUs = nowUs() - buttons[i].edgeUs();
+      inputLatency.record(latencyUs, waitUs, UI_LATENCY_BUDGET_US);
+      xSemaphoreGive(uiMutex);
+    }
+    vTaskDelay(pdMS_TO_TICKS(UI_POLL_MS));
+  }
+}
+
+void startUiTask() {
+  // loop() より高い優先度で動かし、ループ側がモデム応答待ちで止まっていても入力を取りこぼさない
+  xTaskCreatePinnedToCore(uiTask, "ui", 4096, NULL, tskIDLE_PRIORITY + 2, &uiTaskHandle, 0);
+}
+
+// ==== SD card logging task ====
+
+static bool mountSdCard() {
+  // M5.begin() でマウント済みならそのまま使う。抜き差し後は再初期化する
+  if (SD.cardType() != CARD_NONE) return true;
+  SD.end();
+  return SD.begin(TFCARD_CS_PIN, SPI, 40000000);
+}
+
+// バッファのレコードを SD へ書き出す（サンプリングとは独立して動き、書き込みの遅れはバッファで吸収する）
+static void sdLogTask(void* arg) {
+  (void)arg;
+  unsigned long lastMountTry = 0;
+  bool triedMount = false;
+  for (;;) {
+    unsigned long now = nowMs();
+    if (!sdMounted) {
+      if (!triedMount || now - lastMountTry >= SD_MOUNT_RETRY_MS) {
+        triedMount = true;
+        lastMountTry = now;
+        xSemaphoreTake(uiMutex, portMAX_DELAY);
+        sdMounted = mountSdCard();
+        xSemaphoreGive(uiMutex);
+        SerialMon.printf("SD card %s\n", sdMounted ? "mounted" : "not available, retrying later");
+      }
+    } else {
+      // 1回の保持で書き出すのは1ブロックまで（LCD の描画を長く待たせない）
+      bool wrote;
+      do {
+        xSemaphoreTake(uiMutex, portMAX_DELAY);
+        uint32_t errorsBefore = sdLogger.stats().errors;
+        wrote = sdLogger.service(nowMs());
+        bool failed = sdLogger.stats().errors != errorsBefore;
+        if (failed && SD.cardType() == CARD_NONE) sdMounted = false;
+        xSemaphoreGive(uiMutex);
+      } while (wrote && sdMounted);
+    }
+    vTaskDelay(pdMS_TO_TICKS(SD_LOG_POLL_MS));
+  }
+}
+
+// 再起動（ESP.restart）の直前にバッファの残りを書き出す
+static void sdLogShutdown() {
+  if (!sdMounted) return;
+  if (xSemaphoreTake(uiMutex, pdMS_TO_TICKS(500)) != pdTRUE) return;
+  sdLogger.flushAll(nowMs());
+  xSemaphoreGive(uiMutex);
+}
+
+void startSdLogTask() {
+  sdLogger.configure(SD_LOG_MAX_FILE_BYTES, SD_LOG_MAX_AGE_MS);
+  esp_register_shutdown_handler(sdLogShutdown);
+  xTaskCreatePinnedToCore(sdLogTask, "sdLog", 4096, NULL, tskIDLE_PRIORITY + 1, &sdLogTaskHandle, 0);
+}
+
+// SD への書き込みスループットと1ブロックの書き出し時間を計測する（-DSD_BENCHMARK 指定時のみ）
+// /bench に 1MB 分のレコードを書き、append() 側の所要時間（サンプリングへの影響）も併せて出力する
+void benchmarkSdLogging() {
+  if (!mountSdCard()) {
+    SerialMon.println("SD BENCH: no card");
+    return;
+  }
+  static SdLogger bench(sdStore, "/bench");
+  bench.configure(2UL * 1024 * 1024, SD_LOG_MAX_AGE_MS);
+  const uint32_t N = 65536;  // 1MB
+  SdLogRecord r = { 1760000000UL, true, 612.0f, 24.5f, 48.2f, 0.8f, true, true, true };
+  uint32_t maxAppendUs = 0;
+  unsigned long t0 = nowUs();
+  for (uint32_t i = 0; i < N; i++) {
+    r.time++;
+    unsigned long a0 = nowUs();
+    bench.append(r, nowMs());
+    uint32_t appendUs = nowUs() - a0;
+    if (appendUs > maxAppendUs) maxAppendUs = appendUs;
+    while (bench.buffered() >= SdLogger::BLOCK_SIZE && bench.service(nowMs())) {
+    }
+  }
+  bench.flushAll(nowMs());
+  unsigned long totalUs = nowUs() - t0;
+  SdLogStats s = bench.stats();
+  SerialMon.printf("SD BENCH: %lu bytes in %lu ms = %lu KB/s, block write avg %lu us max %lu us, "
+                   "append max %lu us, errors %lu\n",
+                   (unsigned long)s.bytesWritten, totalUs / 1000,
+                   (unsigned long)((uint64_t)s.bytesWritten * 1000000ULL / 1024 / (totalUs > 0 ? totalUs : 1)),
+                   (unsigned long)(s.blocks > 0 ? s.totalFlushUs / s.blocks : 0), (unsigned long)s.maxFlushUs,
+                   (unsigned long)maxAppendUs, (unsigned long)s.errors);
+}
+
+void printSdLogStats() {
+  char path[40];
+  xSemaphoreTake(uiMutex, portMAX_DELAY);
+  SdLogStats s = sdLogger.stats();
+  snprintf(path, sizeof(path), "%s", sdLogger.fileOpen() ? sdLogger.currentPath() : "-");
+  xSemaphoreGive(uiMutex);
+  SerialMon.printf("SD log: %s %s, %lu records, %lu dropped, %lu bytes in %lu writes (%lu partial), "
+                   "write avg %lu us max %lu us, buffer max %lu/%u, rotations %lu, errors %lu, "
+                   "trend deferred %lu dropped %lu\n",
+                   sdMounted ? "mounted" : "no card", path,
+                   (unsigned long)s.records, (unsigned long)s.dropped, (unsigned long)s.bytesWritten,
+                   (unsigned long)s.blocks, (unsigned long)s.partialBlocks,
+                   (unsigned long)(s.blocks > 0 ? s.totalFlushUs / s.blocks : 0), (unsigned long)s.maxFlushUs,
+                   (unsigned long)s.maxBuffered, (unsigned)SdLogger::BUFFER_SIZE, (unsigned long)s.rotations,
+                   (unsigned long)s.errors, (unsigned long)co2HistoryDeferred, (unsigned long)co2HistoryDropped);
+}
+
+// 入力遅延の統計を出力する
+void printUiStats() {
+  xSemaphoreTake(uiMutex, portMAX_DELAY);
+  InputLatencyStats s = inputLatency;
+  xSemaphoreGive(uiMutex);
+  if (s.count == 0) return;
+  SerialMon.printf("UI input: %lu presses, latency avg %lu ms p95 %lu ms max %lu ms (lock wait max %lu ms), over %lu ms: %lu\n",
+                   (unsigned long)s.count, (unsigned long)(s.averageUs() / 1000),
+                   (unsigned long)(s.percentileUs(95) / 1000), (unsigned long)(s.maxUs / 1000),
+                   (unsigned long)(s.maxWaitUs / 1000), UI_LATENCY_BUDGET_US / 1000, (unsigned long)s.overBudget);
+}
+
+// 同期 printf と遅延ロガーのホットパスコストを比較する（-DLOG_BENCHMARK 指定時のみ）
+void benchmarkLogging() {
+  const int N = 200;
+  const char* sample = "+CNACT: 0,1,\"10.123.45.67\"\r\n+CNACT: 1,0,\"0.0.0.0\"\r\nOK";
+
+  unsigned long t0 = nowUs();
+  for (int i = 0; i < N; i++) {
+    SerialMon.printf("ensurePdp0Active(): +CNACT? %s\n", sample);
+  }
+  unsigned long printUs = nowUs() - t0;
+
+  LogLevel prev = logRing.level();
+  logRing.setLevel(LOG_LEVEL_DEBUG);
+  t0 = nowUs();
+  for (int i = 0; i < N; i++) {
+    LOGD(LF_PDP_STATE, sample);
+  }
+  unsigned long ringUs = nowUs() - t0;
+  logRing.setLevel(prev);
+
+  SerialMon.printf("LOG BENCH: printf %lu us/rec, ring %lu.%02lu us/rec (%d records, dropped %lu)\n",
+                   printUs / N, ringUs / N, (ringUs * 100 / N) % 100, N, (unsigned long)logRing.dropped());
+}
+
+// AT 応答の解析とコマンド組み立てを、従来の String + indexOf と比較し、壊れた応答で不変条件を確かめる
+// （-DAT_BENCHMARK 指定時のみ。モデムは使わず、記録した応答列を流し込む）
+void benchmarkAtLayer() {
+  const int N = 2000;
+  static const char* const TRANSCRIPTS[] = {
+    "AT+CNACT?\r\r\n+CNACT: 0,1,\"10.123.45.67\"\r\n+CNACT: 1,0,\"0.0.0.0\"\r\n\r\nOK\r\n",
+    "\r\n+SMSTATE: 1\r\n\r\nOK\r\n",
+    "\r\n+CGATT: 1\r\n\r\nOK\r\n",
+    "\r\n+CAOPEN: 0,0\r\n\r\nOK\r\n",
+    "\r\n+APP PDP: 0,DEACTIVE\r\n\r\n+CME ERROR: 3\r\n",
+    "\r\n> ",
+  };
+  const size_t T = sizeof(TRANSCRIPTS) / sizeof(TRANSCRIPTS[0]);
+  AtTokenizer tok;
+  AtReply reply;
+  AtEvent ev;
+
+  // 解析: 受信を String に溜めて indexOf（TinyGSM の waitResponse 相当）/ トークナイザで1バイトずつ
+  const char* cnact = TRANSCRIPTS[0];
+  size_t cnactLen = strlen(cnact);
+  bool legacyActive = false;
+  unsigned long t0 = nowUs();
+  for (int i = 0; i < N; i++) {
+    String resp = "";
+    for (size_t k = 0; k < cnactLen; k++) resp += cnact[k];
+    legacyActive = resp.indexOf("+CNACT: 0,1") != -1;
+  }
+  unsigned long legacyUs = nowUs() - t0;
+  t0 = nowUs();
+  for (int i = 0; i < N; i++) {
+    reply.clear();
+    for (size_t k = 0; k < cnactLen; k++) {
+      if (tok.push((uint8_t)cnact[k], ev)) reply.apply(ev);
+    }
+  }
+  unsigned long tokUs = nowUs() - t0;
+  SerialMon.printf("AT BENCH: parse +CNACT? String+indexOf %lu.%02lu us, tokenizer %lu.%02lu us (%u bytes), agree %s\n",
+                   legacyUs / N, (legacyUs * 100 / N) % 100, tokUs / N, (tokUs * 100 / N) % 100,
+                   (unsigned)cnactLen, legacyActive == reply.pdpIsActive(0) && reply.ok() ? "yes" : "NO");
+
+  // 組み立て: SMPUB / CASEND
+  String topic = "devices/m5stack-co2-000001/messages/events/";
+  size_t legacyCmdLen = 0;
+  t0 = nowUs();
+  for (int i = 0; i < N; i++) {
+    String cmd = "+SMPUB=\"" + topic + "\"," + String(i & 0xFF) + "," + String(1) + ",0";
+    String send = "+CASEND=0," + String(i & 0xFF);
+    legacyCmdLen = cmd.length() + send.length();
+  }
+  legacyUs = nowUs() - t0;
+  size_t writerCmdLen = 0;
+  t0 = nowUs();
+  for (int i = 0; i < N; i++) {
+    char cmd[96];
+    char send[24];
+    AtCommandWriter pub(cmd, sizeof(cmd), "+SMPUB=");
+    pub.quoted(topic.c_str()).arg(i & 0xFF).arg(1).arg(0);
+    AtCommandWriter cas(send, sizeof(send), "+CASEND=");
+    cas.arg(0).arg(i & 0xFF);
+    writerCmdLen = pub.length() + cas.length();
+  }
+  unsigned long writerUs = nowUs() - t0;
+  SerialMon.printf("AT BENCH: build SMPUB+CASEND String %lu.%02lu us, writer %lu.%02lu us, same length %s\n",
+                   legacyUs / N, (legacyUs * 100 / N) % 100, writerUs / N, (writerUs * 100 / N) % 100,
+                   legacyCmdLen == writerCmdLen ? "yes" : "NO");
+
+  // ファジング: 応答列をランダムに壊して（置換・欠落・挿入・長い行）流し込み、不変条件を確かめる
+  // - 行は MAX_LINE 以下で終端されている / 要約はバッファに収まる / 壊していない応答は正しく解析される
+  const int FUZZ = 20000;
+  uint32_t seed = 0x5EED1234;
+  auto rnd = [&seed]() -> uint32_t {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+  };
+  uint32_t violations = 0;
+  uint32_t events = 0;
+  uint32_t bytes = 0;
+  char summary[48];
+  tok.reset();
+  t0 = nowUs();
+  for (int i = 0; i < FUZZ; i++) {
+    const char* src = TRANSCRIPTS[rnd() % T];
+    size_t len = strlen(src);
+    reply.clear();
+    bool mutated = (i % 4) != 0;
+    for (size_t k = 0; k < len; k++) {
+      uint8_t c = (uint8_t)src[k];
+      uint32_t r = mutated ? rnd() % 64 : 63;
+      int repeat = 1;
+      if (r == 0) c = (uint8_t)rnd();              // 置換
+      else if (r == 1) continue;                   // 欠落
+      else if (r == 2) repeat = 1 + rnd() % 300;   // 同じ文字の連続（長い行）
+      for (int n = 0; n < repeat; n++) {
+        bytes++;
+        if (!tok.push(c, ev)) continue;
+        events++;
+        if (ev.lineLen > AtTokenizer::MAX_LINE || ev.line == nullptr || strlen(ev.line) > ev.lineLen) violations++;
+        reply.apply(ev);
+      }
+    }
+    if (reply.summarize(summary, sizeof(summary)) >= sizeof(summary) || strlen(summary) >= sizeof(summary)) violations++;
+    if (!mutated) {
+      // 壊していない応答は途中で区切られない（各応答は行末または "> " で終わる）
+      bool expected = (src == TRANSCRIPTS[0] && reply.ok() && reply.pdpIsActive(0) && !reply.pdpIsActive(1)
+                       && strcmp(reply.pdpIp0, "10.123.45.67") == 0)
+                   || (src == TRANSCRIPTS[1] && reply.ok() && reply.smstate == 1)
+                   || (src == TRANSCRIPTS[2] && reply.ok() && reply.cgatt == 1)
+                   || (src == TRANSCRIPTS[3] && reply.ok() && reply.caopenResult == 0)
+                   || (src == TRANSCRIPTS[4] && reply.final == AT_EVENT_CME_ERROR && reply.errorCode == 3
+                       && (reply.pdpSeen & 1) && !reply.pdpIsActive(0))
+                   || (src == TRANSCRIPTS[5] && reply.prompt);
+      if (!expected) violations++;
+    } else {
+      // 壊した応答の途中で終わった行は次の応答へ持ち越さない
+      tok.push('\r', ev);
+    }
+  }
+  unsigned long fuzzUs = nowUs() - t0;
+
+  // コマンド組み立て: ランダムな引数と容量で、ok() なら終端と長さが一致し、失敗なら空文字列
+  for (int i = 0; i < FUZZ; i++) {
+    char arg[40];
+    size_t argLen = rnd() % sizeof(arg);
+    for (size_t k = 0; k < argLen; k++) arg[k] = (char)(1 + rnd() % 126);
+    arg[argLen] = '\0';
+    char buf[48];
+    size_t cap = 1 + rnd() % sizeof(buf);
+    AtCommandWriter w(buf, cap, "+SMCONF=");
+    w.quoted(arg).arg((long)(int32_t)rnd());
+    bool clean = strpbrk(arg, "\"") == nullptr;
+    for (size_t k = 0; k < argLen && clean; k++) clean = (uint8_t)arg[k] >= 0x20 && arg[k] != 0x7F;
+    if (w.ok() ? (w.length() >= cap || strlen(w.c_str()) != w.length() || !clean) : w.c_str()[0] != '\0') violations++;
+  }
+
+  SerialMon.printf("AT BENCH: fuzz %d transcripts (%lu bytes, %lu events, %lu truncated lines) %lu us, writer %d cases, violations %lu\n",
+                   FUZZ, (unsigned long)bytes, (unsigned long)events, (unsigned long)tok.truncatedLines(), fuzzUs, FUZZ,
+                   (unsigned long)violations);
+}
+
+// 送信経路のバックエンド（SIM7080 内蔵スタック / TinyGSM のソケット上の汎用実装）を、
+// SIM7080 エミュレータ上で操作毎に比較する（-DMODEM_BENCHMARK 指定時のみ。モデムは使わない）
+// 1操作あたりの AT コマンド数・UART の送受信バイト数・回線の往復回数と、115200bps・RTT 300ms での所要時間を出す
+void benchmarkModemBackends() {
+  static const char* const OPS[] = { "udp_send", "mqtt_connect", "mqtt_publish", "http_get" };
+  static const char* const HTTP_BODY = "{\"imsi\":\"440103123456789\",\"tags\":{\"name\":\"m5stack-co2-000001\"}}";
+  const int N = 20;
+  uint8_t reading[24];
+  uint8_t message[160];
+  memset(reading, 0x5A, sizeof(reading));
+  memset(message, '0', sizeof(message));
+  char body[128];
+
+  // エミュレータは応答・ソケットのバッファを持ち大きいため静的に置く
+  static VirtualClock clock;
+  static Sim7080Emulator emulator(clock);
+  static AtClient at(emulator, &clock);
+  static Sim7080Backend native(at);
+  static EmulatedTinyGsmSocket mqttSocket(at, 1);
+  static EmulatedTinyGsmSocket httpSocket(at, 2);
+  static GenericBackend generic(mqttSocket, httpSocket, &clock);
+  ModemBackend* const BACKENDS[] = { &native, &generic };
+  emulator.setHttpBody(HTTP_BODY);
+  MqttSettings settings = { "beam.soracom.io", 1883, "m5stack-co2-000001", 60, true };
+
+  for (ModemBackend* backend : BACKENDS) {
+    backend->setMqttSettings(settings);
+    if (backend->has(MODEM_CAP_UDP)) backend->udpOpen(udpServer, udpPort, 10000);
+
+    for (size_t op = 0; op < sizeof(OPS) / sizeof(OPS[0]); op++) {
+      if (op == 0 && !backend->has(MODEM_CAP_UDP)) {
+        SerialMon.printf("MODEM BENCH: %-15s %-12s unsupported\n", backend->name(), OPS[op]);
+        continue;
+      }
+      // 接続は1回だけ計測する（発行は接続済みのセッションで行う）
+      int n = op == 1 ? 1 : N;
+      emulator.resetStats();
+      at.resetStats();
+      uint64_t start = clock.elapsedUs();
+      int ok = 0;
+      for (int i = 0; i < n; i++) {
+        if (op == 0) {
+          ok += backend->udpSend(reading, sizeof(reading)) == MODEM_SEND_OK;
+        } else if (op == 1) {
+          ok += backend->mqttConnect(60000);
+        } else if (op == 2) {
+          ok += backend->mqttPublish("devices/m5stack-co2-000001/messages/events/", message, sizeof(message), 1) == MODEM_SEND_OK;
+        } else {
+          ok += backend->httpGet("metadata.soracom.io", 80, "/v1/subscriber", body, sizeof(body)) == 200;
+        }
+      }
+      const EmulatorStats& es = emulator.stats();
+      unsigned long ms = (unsigned long)((clock.elapsedUs() - start) / 1000);
+      SerialMon.printf("MODEM BENCH: %-15s %-12s cmds %lu.%02lu, uart tx %lu rx %lu B, rtt %lu.%02lu, %lu ms/op, ok %d/%d\n",
+                       backend->name(), OPS[op], (unsigned long)(es.commands / n), (unsigned long)(es.commands * 100 / n % 100),
+                       (unsigned long)(es.hostToModemBytes / n), (unsigned long)(es.modemToHostBytes / n),
+                       (unsigned long)(es.networkRoundTrips / n), (unsigned long)(es.networkRoundTrips * 100 / n % 100),
+                       ms / n, ok, n);
+    }
+    backend->mqttDisconnect();
+  }
+}
+
+// 読み取り値の MQTT ペイロードを形式毎にエンコードし、サイズと所要時間を比較する（-DPAYLOAD_BENCHMARK 指定時のみ）
+// 従来の String 連結による JSON も併せて計測し、CBOR/MessagePack はデコードして往復を確認する
+void benchmarkPayloadFormats() {
+  const int N = 500;
+  ReadingValues values = { 612.0f, 26.13f, 54.21f, 0.72f, 1714566896UL };
+  uint8_t buf[96];
+
+  unsigned long t0 = nowUs();
+  size_t stringLen = 0;
+  for (int i = 0; i < N; i++) {
+    String json = String("{\"co2\":") + String(values.co2, 1)
+                + ",\"temp\":" + String(values.temp, 1)
+                + ",\"humi\":" + String(values.humi, 1)
+                + ",\"wind\":" + String(values.wind, 2)
+                + ",\"ts\":" + String(values.ts) + "}";
+    stringLen = json.length();
+  }
+  unsigned long stringUs = nowUs() - t0;
+  SerialMon.printf("PAYLOAD BENCH: json(String) %u bytes, %lu.%02lu us/msg, wire %u bytes\n",
+                   (unsigned)stringLen, stringUs / N, (stringUs * 100 / N) % 100,
+                   (unsigned)estimateMqttWireBytes(mqttTopic.length(), stringLen, mqttQos));
+
+  const PayloadFormat formats[] = { FORMAT_JSON, FORMAT_CBOR, FORMAT_MSGPACK };
+  for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+    size_t len = 0;
+    t0 = nowUs();
+    for (int i = 0; i < N; i++) {
+      len = encodeReading(formats[f], values, buf, sizeof(buf));
+    }
+    unsigned long us = nowUs() - t0;
+    const char* roundTrip = "-";
+    if (formats[f] != FORMAT_JSON) {
+      ReadingValues decoded = {};
+      bool ok = decodeReading(formats[f], buf, len, decoded)
+                && fabsf(decoded.co2 - values.co2) < 0.05f && fabsf(decoded.temp - values.temp) < 0.06f
+                && fabsf(decoded.humi - values.humi) < 0.06f && fabsf(decoded.wind - values.wind) < 0.006f
+                && decoded.ts == values.ts;
+      roundTrip = ok ? "ok" : "MISMATCH";
+    }
+    SerialMon.printf("PAYLOAD BENCH: %s %u bytes, %lu.%02lu us/msg, wire %u bytes, decode %s\n",
+                     payloadFormatName(formats[f]), (unsigned)len, us / N, (us * 100 / N) % 100,
+                     (unsigned)estimateMqttWireBytes(mqttTopic.length(), len, mqttQos), roundTrip);
+  }
+
+  // UDP: float x4 と固定小数点フレームの大きさ、センサーの測定範囲全体での量子化誤差の最大
+  // （許容はセンサー精度の下限: SCD40 ±50 ppm / ±0.8 °C / ±6 %RH, FS3000-1005 ±5% FS = ±0.36 m/s）
+  float maxErr[4] = { 0, 0, 0, 0 };
+  const int STEPS = 20000;
+  size_t compactLen = 0;
+  t0 = nowUs();
+  for (int i = 0; i <= STEPS; i++) {
+    float f = (float)i / STEPS;
+    ReadingValues v = { 400.0f + f * 39600.0f, -10.0f + f * 70.0f, f * 100.0f, f * 7.23f, values.ts };
+    compactLen = encodeCompactReading(v, READING_STATUS_SCD40_OK | READING_STATUS_FS3000_OK, buf, sizeof(buf));
+    ReadingValues d = {};
+    uint8_t status = 0;
+    if (!decodeCompactReading(buf, compactLen, d, status) || d.ts != v.ts) {
+      maxErr[0] = INFINITY;
+      break;
+    }
+    maxErr[0] = fmaxf(maxErr[0], fabsf(d.co2 - v.co2));
+    maxErr[1] = fmaxf(maxErr[1], fabsf(d.temp - v.temp));
+    maxErr[2] = fmaxf(maxErr[2], fabsf(d.humi - v.humi));
+    maxErr[3] = fmaxf(maxErr[3], fabsf(d.wind - v.wind));
+  }
+  unsigned long compactUs = nowUs() - t0;
+  bool withinAccuracy = maxErr[0] <= 50.0f && maxErr[1] <= 0.8f && maxErr[2] <= 6.0f && maxErr[3] <= 0.36f;
+  SerialMon.printf("PAYLOAD BENCH: udp float %u bytes (wire %u), compact %u bytes (wire %u), encode+decode %lu us/msg\n",
+                   (unsigned)FLOAT_READING_FRAME_SIZE, (unsigned)estimateUdpWireBytes(FLOAT_READING_FRAME_SIZE),
+                   (unsigned)compactLen,
+                   (unsigned)estimateUdpWireBytes(compactLen), compactUs / (STEPS + 1));
+  SerialMon.printf("PAYLOAD BENCH: compact max error co2 %.2f ppm temp %.4f C humi %.4f %% wind %.4f m/s: %s\n",
+                   maxErr[0], maxErr[1], maxErr[2], maxErr[3], withinAccuracy ? "within sensor accuracy" : "EXCEEDS");
+}
+
+// 推移グラフの履歴メモリと描画時間を計測する（-DTREND_BENCHMARK 指定時のみ）
+// 24時間分の合成データ（10秒周期）で履歴を埋め、全体の再描画と1点の追記描画の所要時間を比較する
+void benchmarkTrendChart() {
+  static TrendHistory history;
+  const uint32_t STEP_S = 10;
+  const uint32_t N = 86400 / STEP_S;
+  uint32_t maxAddUs = 0;
+  unsigned long t0 = nowUs();
+  for (uint32_t i = 0; i < N; i++) {
+    uint32_t t = i * STEP_S;
+    // 在室時間帯に上昇・換気で減衰するような波形
+    uint16_t v = (uint16_t)(450 + (i % 720) * 2 - ((i % 720) > 360 ? ((i % 720) - 360) * 4 : 0));
+    unsigned long a0 = nowUs();
+    history.add(t, v);
+    uint32_t addUs = nowUs() - a0;
+    if (addUs > maxAddUs) maxAddUs = addUs;
+  }
+  unsigned long addTotalUs = nowUs() - t0;
+
+  uint32_t nowSec = N * STEP_S;
+  TrendSpan spans[] = { TREND_SPAN_1H, TREND_SPAN_24H };
+  for (TrendSpan span : spans) {
+    trendChart.configure(span, 1500);
+    t0 = nowUs();
+    trendChart.redraw(history, nowSec);
+    unsigned long redrawUs = nowUs() - t0;
+
+    const int M = 30;
+    t0 = nowUs();
+    for (int i = 0; i < M; i++) {
+      uint32_t t = nowSec + (i + 1) * (span == TREND_SPAN_24H ? TrendHistory::COARSE_BUCKET_S : STEP_S);
+      TrendPoint p = { t, (uint16_t)(800 + i * 10) };
+      trendChart.append(p);
+    }
+    unsigned long appendUs = (nowUs() - t0) / M;
+    SerialMon.printf("TREND BENCH: %s redraw %lu us, append %lu us/point\n",
+                     span == TREND_SPAN_24H ? "24h" : "1h", redrawUs, appendUs);
+  }
+  SerialMon.printf("TREND BENCH: history %u bytes (raw %u + coarse %u pts), add avg %lu us max %lu us, coarse %u pts\n",
+                   (unsigned)TrendHistory::memoryBytes(), (unsigned)TrendHistory::RAW_CAPACITY,
+                   (unsigned)TrendHistory::COARSE_CAPACITY, addTotalUs / N, (unsigned long)maxAddUs,
+                   (unsigned)history.coarseCount());
+  trendNeedsRedraw = true;
+  M5.Lcd.clear(BLACK);
+}
+
+// ==== Health telemetry ====
+
+void initHealthCounters() {
+  esp_reset_reason_t reason = esp_reset_reason();
+  // 電源投入時や RTC 領域が未初期化の場合はカウンタをクリア
+  if (reason == ESP_RST_POWERON || healthCounters.magic != HEALTH_COUNTERS_MAGIC) {
+    memset(&healthCounters, 0, sizeof(healthCounters));
+    healthCounters.magic = HEALTH_COUNTERS_MAGIC;
+  } else {
+    countRecovery(RECOVERY_DEVICE_RESTART);
+  }
+  SerialMon.printf("Reset reason: %d, restarts: %u, modem resets: %u, hard resets: %u\n",
+                   (int)reason,
+                   healthCounters.recoveries[RECOVERY_DEVICE_RESTART],
+                   healthCounters.recoveries[RECOVERY_MODEM_RESET],
+                   healthCounters.recoveries[RECOVERY_HARD_RESET]);
+}
+
+void initSoakStats() {
+  if (esp_reset_reason() == ESP_RST_POWERON || !soakValid(soakStats)) {
+    soakReset(soakStats);
+  } else {
+    soakStats.restarts++;
+  }
+  soakUpdatedMs = nowMs();
+  soakAtCommandsSeen = modemStream.commands();
+}
+
+// 稼働時間と AT コマンド数を集計に反映する
+void updateSoakStats() {
+  unsigned long now = nowMs();
+  soakStats.elapsedMs += now - soakUpdatedMs;
+  soakUpdatedMs = now;
+  uint32_t commands = modemStream.commands();
+  soakStats.atCommands += commands - soakAtCommandsSeen;
+  soakAtCommandsSeen = commands;
+}
+
+void printSoakReport() {
+  updateSoakStats();
+  char report[384];
+  if (formatSoakReport(soakStats, report, sizeof(report)) > 0) {
+    SerialMon.printf("SOAK: %s\n", report);
+  }
+}
+
+void countRecovery(RecoveryLevel level) {
+  if (level < RECOVERY_LEVEL_COUNT && healthCounters.recoveries[level] < 0xFFFF) {
+    healthCounters.recoveries[level]++;
+  }
+}
+
+void sampleHealth(HealthSample& sample) {
+  sample.resetReason = (uint8_t)esp_reset_reason();
+  sample.uptimeSec = nowMs() / 1000;
+  sample.freeHeap = ESP.getFreeHeap();
+  sample.minFreeHeap = ESP.getMinFreeHeap();
+  sample.largestFreeBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  // ESP32 の FreeRTOS ではスタック残量はバイト単位で返る
+  sample.loopStackHwm = uxTaskGetStackHighWaterMark(NULL);
+  sample.logTaskStackHwm = logDrainTaskHandle ? uxTaskGetStackHighWaterMark(logDrainTaskHandle) : 0;
+  sample.maxLoopMs = loopTimer.takeMaxUs() / 1000;
+  memcpy(sample.recoveries, healthCounters.recoveries, sizeof(sample.recoveries));
+}
+
+// ヘルスフレームを現在の送信経路で送る関数
+bool sendHealthFrame() {
+  unsigned long t0 = nowUs();
+  HealthSample sample;
+  sampleHealth(sample);
+  uint8_t frame[HEALTH_FRAME_SIZE];
+  size_t frameSize = encodeHealthFrame(sample, frame, sizeof(frame));
+  char json[256];
+  size_t jsonSize = formatHealthJson(sample, json, sizeof(json));
+  unsigned long costUs = nowUs() - t0;
+
+  SerialMon.printf("Health: heap=%lu min=%lu maxblk=%lu stk=%lu logstk=%lu loop=%lums (sample+encode %lu us)\n",
+                   (unsigned long)sample.freeHeap, (unsigned long)sample.minFreeHeap,
+                   (unsigned long)sample.largestFreeBlock, (unsigned long)sample.loopStackHwm,
+                   (unsigned long)sample.logTaskStackHwm, (unsigned long)sample.maxLoopMs, costUs);
+  SerialMon.printf("Modem UART: baud=%lu overflows=%lu errors=%lu\n",
+                   (unsigned long)modemBaud, (unsigned long)modemUartOverflows, (unsigned long)modemUartErrors);
+
+  if (uplinkBudget.admit(UPLINK_HEALTH, estimateUplinkBytes(frameSize, jsonSize), timeSync.epochAt(nowMs())) != BUDGET_SEND) {
+    SerialMon.println("Budget: health frame deferred (daily/monthly budget exhausted)");
     return false;
   }
+  SerialMon.printf("Sending health frame (UDP %u bytes / MQTT %u bytes)\n", (unsigned)frameSize, (unsigned)jsonSize);
+  currentUplinkClass = UPLINK_HEALTH;
+  return sendUplinkFrame(frame, frameSize, json);
+}
 
-  SerialMon.println("SMPUB OK");
-  {
-    String stAfterPub = "";
-    modem.sendAT("+SMSTATE?");
-    modem.waitResponse(5000L, stAfterPub);
-    SerialMon.println("SMSTATE after publish:");
-    SerialMon.println(stAfterPub);
+// 補助フレームを現在の送信経路で送る関数（UDPはバイナリ、MQTTはJSON）
+bool sendUplinkFrame(uint8_t* frame, size_t frameSize, const char* json) {
+  if (!transportUsable()) return false;
+  return sendViaTransport(frame, frameSize, (const uint8_t*)json, strlen(json));
+}
+
+// ==== Uplink data budget ====
+
+// 選択される経路で送った場合の推定バイト数（予算の判定用）
+size_t estimateUplinkBytes(size_t frameSize, size_t mqttLen) {
+  if (transports.select(nowMs()) == TRANSPORT_MQTT) {
+    return estimateMqttWireBytes(mqttTopic.length(), mqttLen, mqttQos);
   }
-  return true;
-}
\ No newline at end of file
+  return estimateUdpWireBytes(frameSize);
+}
+
+// 本文をモデムへ書き出した時点で計上する（応答待ちで失敗した再送分も回線上には出ているため含める）
+void chargeUplink(size_t wireBytes) {
+  uplinkBudget.charge(currentUplinkClass, wireBytes);
+}
+
+void loadBudgetCounters() {
+  Preferences prefs;
+  BudgetCounters saved = {};
+  if (prefs.begin("budget", true)) {
+    prefs.getBytes("counters", &saved, sizeof(saved));
+    prefs.end();
+  }
+  uplinkBudget.restore(saved);
+  const BudgetCounters& c = uplinkBudget.counters();
+  SerialMon.printf("Budget: restored day %lu %lu bytes, month %lu bytes\n", (unsigned long)c.day,
+                   (unsigned long)c.dayBytes, (unsigned long)c.monthBytes);
+}
+
+// 変化があれば一定間隔で保存する（日付・月が切り替わった場合と force 指定時は即時）
+void saveBudgetCounters(bool force) {
+  bool rolled = uplinkBudget.rollover(timeSync.epochAt(nowMs()));
+  if (!uplinkBudget.dirty()) return;
+  if (!force && !rolled && lastBudgetSave != 0 && nowMs() - lastBudgetSave < BUDGET_SAVE_INTERVAL) return;
+  Preferences prefs;
+  if (!prefs.begin("budget", false)) return;
+  prefs.putBytes("counters", &uplinkBudget.counters(), sizeof(BudgetCounters));
+  prefs.end();
+  uplinkBudget.markSaved();
+  lastBudgetSave = nowMs();
+}
+
+// 今日・今月の使用量と枠、クラス別の内訳、間引き件数を出力する
+void printBudgetStats() {
+  const BudgetCounters& c = uplinkBudget.counters();
+  const BudgetConfig& cfg = uplinkBudget.config();
+  uint32_t allowance = uplinkBudget.dayAllowance(timeSync.epochAt(nowMs()));
+  SerialMon.printf("Budget: day %lu/%lu bytes, month %lu/%lu bytes (alarm %lu health %lu routine %lu), "
+                   "thinned %lu, deferred %lu%s\n",
+                   (unsigned long)c.dayBytes, (unsigned long)allowance, (unsigned long)c.monthBytes,
+                   (unsigned long)cfg.monthlyBytes, (unsigned long)c.classBytes[UPLINK_ALARM],
+                   (unsigned long)c.classBytes[UPLINK_HEALTH], (unsigned long)c.classBytes[UPLINK_ROUTINE],
+                   (unsigned long)c.thinnedToday, (unsigned long)c.blockedToday,
+                   uplinkBudget.limited() ? "" : " (unlimited)");
+}
+
+// ==== GNSS ====
+
+// 測位のため LTE を止めて GNSS を起動する
+static void gnssStartWindow(unsigned long now);
+// GNSS を止めて LTE を再接続する（fix が nullptr なら測位失敗）
+static void gnssEndWindow(const GnssFix* fix, unsigned long acquiredAtMs);
+
+// 測位の開始判定と、測位中の +CGNSINF 読み取り（GNSS タイマーから呼ばれる）
+void gnssStep() {
+  unsigned long now = nowMs();
+  if (!gnssRadioOff) {
+    if (modemRecovering || !gnss.shouldStart(now, scheduler.msUntil(timerUplink, now), INTERVAL)) return;
+    gnssStartWindow(now);
+    return;
+  }
+  String resp = "";
+  modem.sendAT("+CGNSINF");
+  GnssFix fix;
+  if (modem.waitResponse(1000L, resp) == 1 && parseCgnsinf(resp.c_str(), fix)) {
+    fix.monoMs = now;
+    gnssEndWindow(&fix, now);
+  } else if (gnss.expired(now)) {
+    gnssEndWindow(nullptr, now);
+  }
+}
+
+static void gnssStartWindow(unsigned long now) {
+  uint32_t timeout = gnss.start(now);
+  gnssWindowStartMs = now;
+  gnssRadioOff = true;
+  SerialMon.printf("GNSS: pausing LTE for a %s fix (timeout %lu s)\n",
+                   timeout == gnss.config().hotTimeoutMs ? "hot" : "cold", (unsigned long)(timeout / 1000));
+
+  // セッションを閉じてから無線を止める（CFUN=0 で PDP も切れる）
+  if (mqttConnected) mqttDisconnect();
+  modem.sendAT("+CACLOSE=0");
+  modem.waitResponse(5000L);
+  udpSocketOpen = false;
+  modem.sendAT("+CFUN=0");
+  if (modem.waitResponse(10000L) != 1) {
+    SerialMon.println("GNSS: AT+CFUN=0 failed, skipping this fix");
+    gnssEndWindow(nullptr, now);
+    return;
+  }
+  modem.sendAT("+CGNSPWR=1");
+  if (modem.waitResponse(5000L) != 1) {
+    SerialMon.println("GNSS: AT+CGNSPWR=1 failed, skipping this fix");
+    gnssEndWindow(nullptr, now);
+  }
+}
+
+static void gnssEndWindow(const GnssFix* fix, unsigned long acquiredAtMs) {
+  modem.sendAT("+CGNSPWR=0");
+  modem.waitResponse(5000L);
+
+  unsigned long reattachStart = nowMs();
+  modem.sendAT("+CFUN=1");
+  modem.waitResponse(10000L);
+  bool attached = registerNetwork(true, 60000L) && ensurePdp0Active();
+  unsigned long now = nowMs();
+  uint32_t reattachMs = now - reattachStart;
+  uint32_t offMs = now - gnssWindowStartMs;
+  gnss.finish(acquiredAtMs, fix, reattachMs, now);
+  gnssRadioOff = false;
+  mqttConnected = false;  // 次の送信で接続し直す（UDP ソケットも同様）
+  // LTE を止めていた間は通信タイムアウトの経過に含めない
+  if (lastSuccessfulSend > 0) lastSuccessfulSend += offMs;
+
+  if (fix != nullptr) {
+    SerialMon.printf("GNSS: fix %.6f,%.6f hdop %.1f sats %u, TTFF %lu ms, %s, next in %lu s\n",
+                     fix->latE6 / 1e6, fix->lonE6 / 1e6, fix->hdop, (unsigned)fix->satsUsed,
+                     (unsigned long)gnss.stats().lastTtffMs, gnss.moving() ? "moving" : "stationary",
+                     (unsigned long)(gnss.currentIntervalMs() / 1000));
+  } else {
+    SerialMon.printf("GNSS: no fix, retry in %lu s\n", (unsigned long)(gnss.currentIntervalMs() / 1000));
+  }
+  SerialMon.printf("GNSS: LTE %s after %lu ms (off %lu ms)\n", attached ? "reattached" : "NOT reattached",
+                   (unsigned long)reattachMs, (unsigned long)offMs);
+
+  // 測位中に遅らせた処理を再開する
+  if (gnssDeferredSince != 0) {
+    gnss.recordDeferredUplink(now - gnssDeferredSince);
+    gnssDeferredSince = 0;
+    scheduler.trigger(timerUplink, now);
+  }
+  if (gnssDeferredMetadata) {
+    gnssDeferredMetadata = false;
+    scheduler.trigger(timerMetadata, now);
+  }
+  if (gnssDeferredOta) {
+    gnssDeferredOta = false;
+    scheduler.trigger(timerOta, now);
+  }
+}
+
+// 測位中に期限の来たタイマーを記録する（再接続後に発火させる）
+void gnssDefer(int timer, unsigned long now) {
+  if (timer == timerUplink) {
+    if (gnssDeferredSince == 0) gnssDeferredSince = now;
+  } else if (timer == timerMetadata) {
+    gnssDeferredMetadata = true;
+  } else if (timer == timerOta) {
+    gnssDeferredOta = true;
+  }
+}
+
+void printGnssStats() {
+  if (!gnssEnabled) return;
+  const GnssStats& st = gnss.stats();
+  SerialMon.printf("GNSS: %lu windows, %lu fixes, %lu timeouts, TTFF last %lu avg %lu max %lu ms, "
+                   "reattach avg %lu max %lu ms, LTE off %lu s, deferred uplinks %lu (avg +%lu max +%lu ms)\n",
+                   (unsigned long)st.windows, (unsigned long)st.fixes, (unsigned long)st.timeouts,
+                   (unsigned long)st.lastTtffMs,
+                   (unsigned long)(st.fixes > 0 ? st.totalTtffMs / st.fixes : 0), (unsigned long)st.maxTtffMs,
+                   (unsigned long)(st.windows > 0 ? st.totalReattachMs / st.windows : 0),
+                   (unsigned long)st.maxReattachMs, (unsigned long)(st.radioOffMs / 1000),
+                   (unsigned long)st.deferredUplinks,
+                   (unsigned long)(st.deferredUplinks > 0 ? st.totalUplinkDelayMs / st.deferredUplinks : 0),
+                   (unsigned long)st.maxUplinkDelayMs);
+}
+
+// 擬似的な +CGNSINF 応答で1日分の測位と送信を模擬し、測位時間（TTFF）と送信の遅れを測る
+// 静止 → 2時間の移動（時速5km）→ 静止 の経路で、屋内想定の測位失敗（約1割）を含む。
+// LTE の再接続は 6〜12 秒とみなす。送信周期は 10 秒・1分・10分の3通り
+void benchmarkGnss() {
+  static const uint32_t PERIODS[] = { 10000, 60000, 600000 };
+  static const uint32_t DAY_MS = 86400000UL;
+  for (size_t k = 0; k < sizeof(PERIODS) / sizeof(PERIODS[0]); k++) {
+    uint32_t period = PERIODS[k];
+    GnssScheduler sim;
+    uint32_t seed = 12345;
+    auto rnd = [&seed](uint32_t n) {
+      seed = seed * 1103515245UL + 12345UL;
+      return (seed >> 16) % n;
+    };
+    uint32_t uplinkDue = period;
+    uint32_t deferredSince = 0;
+    bool deferred = false;
+    uint32_t fixAtMs = 0;      // 今回の窓で測位できる時刻（0 = 測位できない）
+    uint32_t uplinks = 0;
+    uint32_t parseCalls = 0;
+    uint32_t parseUs = 0;
+    uint32_t movingFixes = 0;
+    char resp[160];
+    for (uint32_t t = 0; t < DAY_MS; t += GNSS_POLL_MS) {
+      // 10:00〜12:00 は北東へ時速5km（約1.39 m/s）で移動
+      uint32_t movingMs = t < 36000000UL ? 0 : (t < 43200000UL ? t - 36000000UL : 7200000UL);
+      bool movingNow = t >= 36000000UL && t < 43200000UL;
+      int32_t latE6 = 35681236 + (int32_t)(movingMs / 1000 * 9);   // 約 1 m/s
+      int32_t lonE6 = 139767125 + (int32_t)(movingMs / 1000 * 11);
+      if (sim.phase() == GnssScheduler::PHASE_IDLE) {
+        if ((int32_t)(t - uplinkDue) >= 0) {
+          uplinks++;
+          uplinkDue += period;
+        }
+        uint32_t untilUplink = uplinkDue - t;
+        if (sim.shouldStart(t, untilUplink, period)) {
+          uint32_t timeout = sim.start(t);
+          bool hot = timeout == sim.config().hotTimeoutMs;
+          // 1割は屋内等で測位できない。ホットスタートは 2〜10 秒, コールドは 25〜60 秒
+          fixAtMs = rnd(10) == 0 ? 0 : t + (hot ? 2000 + rnd(8000) : 25000 + rnd(35000));
+        }
+        continue;
+      }
+      // 測位中: 期限の来た送信は遅らせる
+      if (!deferred && (int32_t)(t - uplinkDue) >= 0) {
+        deferred = true;
+        deferredSince = uplinkDue;
+      }
+      bool fixed = fixAtMs != 0 && (int32_t)(t - fixAtMs) >= 0;
+      if (fixed) {
+        snprintf(resp, sizeof(resp), "+CGNSINF: 1,1,20240501%02lu%02lu%02lu.000,%ld.%06ld,%ld.%06ld,40.1,%.2f,0.0,1,,1.1,1.4,0.9,,14,9,,,38,,\r\n\r\nOK\r\n",
+                 (unsigned long)(t / 3600000UL), (unsigned long)(t / 60000UL % 60), (unsigned long)(t / 1000 % 60),
+                 (long)(latE6 / 1000000), (long)(latE6 % 1000000), (long)(lonE6 / 1000000), (long)(lonE6 % 1000000),
+                 movingNow ? 5.0 : 0.0);
+      } else {
+        snprintf(resp, sizeof(resp), "+CGNSINF: 1,0,20240501000000.000,,,,,,1,,,,,,12,0,,,,,\r\n\r\nOK\r\n");
+      }
+      GnssFix fix;
+      unsigned long p0 = nowUs();
+      bool ok = parseCgnsinf(resp, fix);
+      parseUs += nowUs() - p0;
+      parseCalls++;
+      if (!ok && !sim.expired(t)) continue;
+      uint32_t reattach = 6000 + rnd(6000);
+      uint32_t end = t + reattach;
+      if (ok) fix.monoMs = t;
+      sim.finish(t, ok ? &fix : nullptr, reattach, end);
+      if (ok && movingNow) movingFixes++;
+      // 再接続までの間も送信は遅れる
+      while ((int32_t)(end - uplinkDue) >= 0) {
+        if (!deferred) {
+          deferred = true;
+          deferredSince = uplinkDue;
+        }
+        uplinkDue += period;
+      }
+      if (deferred) {
+        sim.recordDeferredUplink(end - deferredSince);
+        uplinks++;
+        deferred = false;
+      }
+      t = end - end % GNSS_POLL_MS;
+    }
+    const GnssStats& st = sim.stats();
+    SerialMon.printf("GNSS BENCH: report %lu s: %lu windows, %lu fixes (%lu while moving), %lu timeouts, "
+                     "TTFF avg %lu max %lu ms, reattach avg %lu ms, LTE off %.2f%% of the day\n",
+                     (unsigned long)(period / 1000), (unsigned long)st.windows, (unsigned long)st.fixes,
+                     (unsigned long)movingFixes, (unsigned long)st.timeouts,
+                     (unsigned long)(st.fixes > 0 ? st.totalTtffMs / st.fixes : 0), (unsigned long)st.maxTtffMs,
+                     (unsigned long)(st.windows > 0 ? st.totalReattachMs / st.windows : 0),
+                     st.radioOffMs * 100.0 / DAY_MS);
+    SerialMon.printf("GNSS BENCH: report %lu s: uplinks %lu, deferred %lu, added latency avg %lu max %lu ms, parse %.1f us/call\n",
+                     (unsigned long)(period / 1000), (unsigned long)uplinks, (unsigned long)st.deferredUplinks,
+                     (unsigned long)(st.deferredUplinks > 0 ? st.totalUplinkDelayMs / st.deferredUplinks : 0),
+                     (unsigned long)st.maxUplinkDelayMs, parseCalls > 0 ? (float)parseUs / parseCalls : 0.0f);
+  }
+}
+
+// ==== Signal-aware uplink ====
+
+// 送信前に電波品質を測る（+CSQ と +CESQ を1回で問い合わせ、RSRP が取れればそれで判定する）
+static void sampleSignal() {
+  AtReply reply;
+  SignalSample s = { 99, 0 };
+  // +CESQ を受け付けないファームウェアでは +CSQ だけで判定する
+  if ((atClient.query("+CSQ;+CESQ", 2000, reply) && reply.ok()) ||
+      (atClient.query("+CSQ", 2000, reply) && reply.ok())) {
+    s.csq = reply.rssi;
+    s.rsrpDbm = reply.rsrpDbm();
+    lastCsq = (int8_t)reply.rssi;
+  }
+  signalGate.update(s);
+}
+
+// 電波品質を測り、弱電界なら読み取り値をキューへ遅らせる（遅らせたら true）
+bool signalDeferReading(UplinkClass c, const ReadingValues& values, const ReadingPosition* pos, unsigned long now) {
+  sampleSignal();
+  if (!signalGate.shouldDefer(c, now)) return false;
+  signalGate.recordDeferred(now);
+  DeferredReading r;
+  r.values = values;
+  r.hasPosition = pos != nullptr;
+  if (pos != nullptr) r.position = *pos;
+  r.scd40Ok = latestReading.scd40Ok;
+  r.fs3000Ok = latestReading.fs3000Ok;
+  r.sampledAtMs = latestReading.sampledAtMs;
+  const SignalSample& sig = signalGate.last();
+  if (deferredReadings.push(r)) {
+    SerialMon.printf("Signal: weak (RSRP %d dBm, CSQ %u), reading deferred (%u queued, %lu s)\n",
+                     sig.rsrpDbm, (unsigned)sig.csq, (unsigned)deferredReadings.size(),
+                     (unsigned long)(signalGate.deferredForMs(now) / 1000));
+  } else {
+    // キューが満杯: 間引きと同様に次に送る値へ平均として合算する
+    thinnedReadings.add(values, latestReading.scd40Ok, latestReading.fs3000Ok);
+    SerialMon.printf("Signal: weak (RSRP %d dBm, CSQ %u), queue full, reading merged into the next send\n",
+                     sig.rsrpDbm, (unsigned)sig.csq);
+  }
+  return true;
+}
+
+// 遅らせた読み取り値を古い順に続けて送る（回復した、または遅れの上限を過ぎた場合）
+// 失敗したら残りは次の送信で再試行する。1件ずつ通常の読み取り値として予算の判定を通し、
+// 間引かれたらそれ以降は全て次に送る値へ平均として合算する
+void flushDeferredReadings(unsigned long now) {
+  if (deferredReadings.empty()) return;
+  if (signalGate.enabled() && signalGate.weak() &&
+      signalGate.deferredForMs(now) < signalGate.config().maxDeferMs) {
+    return;
+  }
+  SerialMon.printf("Signal: %s, sending %u deferred readings\n",
+                   signalGate.weak() ? "still weak at max defer" : "recovered", (unsigned)deferredReadings.size());
+  uint16_t sent = 0;
+  while (!deferredReadings.empty()) {
+    const DeferredReading& r = deferredReadings.front();
+    const ReadingPosition* pos = r.hasPosition ? &r.position : nullptr;
+    uint8_t mqttPayload[160];
+    size_t mqttLen = encodeReading(mqttFormat, r.values, mqttPayload, sizeof(mqttPayload), pos);
+    size_t frameSize = udpReadingFrameSize(udpFrameFormat, pos != nullptr);
+    if (uplinkBudget.admit(UPLINK_ROUTINE, estimateUplinkBytes(frameSize, mqttLen), timeSync.epochAt(nowMs())) !=
+        BUDGET_SEND) {
+      uint16_t merged = 0;
+      while (!deferredReadings.empty()) {
+        const DeferredReading& d = deferredReadings.front();
+        thinnedReadings.add(d.values, d.scd40Ok, d.fs3000Ok);
+        deferredReadings.pop();
+        merged++;
+      }
+      SerialMon.printf("Budget: %u deferred readings thinned (%u pending)\n", (unsigned)merged,
+                       (unsigned)thinnedReadings.pending());
+      break;
+    }
+    uint8_t status = (r.scd40Ok ? READING_STATUS_SCD40_OK : 0) | (r.fs3000Ok ? READING_STATUS_FS3000_OK : 0);
+    currentUplinkClass = UPLINK_ROUTINE;
+    bool ok = sendReadingFrame(r.values, status, pos, mqttPayload, mqttLen);
+    soakRecordSend(soakStats, ok, nowMs() - r.sampledAtMs);
+    if (!ok) break;
+    deferredReadings.pop();
+    sent++;
+  }
+  signalGate.recordFlush(sent, deferredReadings.empty(), nowMs());
+}
+
+// 読み取り値を経路毎の形式で送る（MQTT は組み立て済みの mqttPayload、UDP はここで組み立てる）
+bool sendReadingFrame(const ReadingValues& values, uint8_t status, const ReadingPosition* pos,
+                      const uint8_t* mqttPayload, size_t mqttLen) {
+  uint8_t payload[COMPACT_POSITION_FRAME_SIZE];
+  size_t payloadLen;
+  if (udpFrameFormat == UDP_FRAME_COMPACT) {
+    // 固定小数点の14バイト（センサーの成否と送信理由を状態ビットで送る。位置付きは24バイト）
+    payloadLen = encodeCompactReading(values, status, payload, sizeof(payload), pos);
+  } else {
+    // float 16バイト + サンプル時刻4バイト（float_v2 は先頭に種別 0xF1 を付けた21バイト）
+    payloadLen = encodeFloatReading(values, udpFrameFormat == UDP_FRAME_FLOAT_V2, payload, sizeof(payload));
+    // co2::float:32:little-endian Temp::float:32:little-endian Humi::float:32:little-endian Wind::float:32:little-endian ts::uint:32:little-endian
+  }
+
+  // 失敗時は代替経路で再送
+  if (mqttFormat == FORMAT_JSON) {
+    SerialMon.printf("Reading JSON: %.*s\n", (int)mqttLen, (const char*)mqttPayload);
+  } else {
+    SerialMon.printf("Reading %s: %u bytes\n", payloadFormatName(mqttFormat), (unsigned)mqttLen);
+  }
+  return sendViaTransport(payload, payloadLen, mqttPayload, mqttLen);
+}
+
+void printSignalStats() {
+  const SignalGateStats& st = signalGate.stats();
+  if (!signalGate.enabled() || st.samples == 0) return;
+  const SignalSample& sig = signalGate.last();
+  SerialMon.printf("Signal: RSRP %d dBm CSQ %u (%s), weak %lu/%lu samples, deferred %lu, flushed %lu in %lu bursts "
+                   "(%lu at max defer, max burst %lu), delay avg %lu max %lu s, queued %u\n",
+                   sig.rsrpDbm, (unsigned)sig.csq, signalGate.weak() ? "weak" : "ok",
+                   (unsigned long)st.weakSamples, (unsigned long)st.samples, (unsigned long)st.deferred,
+                   (unsigned long)st.flushedReadings, (unsigned long)st.flushes, (unsigned long)st.forcedFlushes,
+                   (unsigned long)st.maxBurst,
+                   (unsigned long)(st.flushes > 0 ? st.totalDelayMs / st.flushes / 1000 : 0),
+                   (unsigned long)(st.maxDelayMs / 1000), (unsigned)deferredReadings.size());
+}
+
+// 電波品質に応じた送信の延期を SIM7080 エミュレータ上で1日分動かし、延期なしと比べる
+// （-DSIGNAL_BENCHMARK 指定時のみ。モデムは使わない）
+// 電波は RSRP -95 dBm に、1日12回・5〜60分の落ち込み（-108〜-122 dBm）を重ねる。落ち込みの間は
+// エミュレータに、回線を使うコマンドの失敗（-115 dBm 以下で2回に1回、それ以外は4回に1回の ERROR）と
+// 応答の遅れ（同 1500ms / 600ms。1500ms は +CASEND のプロンプト待ちを超える）を注入する。
+// 失敗と遅れは与えたシナリオで実測ではないが、電波の測定（AT+CSQ;+CESQ）・延期の判定・キュー・
+// 再送（5回まで, 指数バックオフ）・ソケットの開き直しはファームウェアと同じ手順で AT のやり取りとして行い、
+// 送信の試行・失敗・AT コマンド数・タイムアウトと、AT のやり取りに費やした時間（モデムが送受信している時間）を比べる
+void benchmarkSignalGate() {
+  static const uint32_t DAY_S = 86400;
+  static const uint32_t PERIODS[] = { 60000, 300000 };
+  static const uint32_t DEFERS[] = { 0, 900000, 1800000, 3600000 };
+  static const int MAX_ATTEMPTS = 5;
+  uint8_t frame[FLOAT_READING_FRAME_SIZE];
+  memset(frame, 0x5A, sizeof(frame));
+
+  // 全ての設定で同じ落ち込みを使う（開始[秒]・長さ[秒]・深さ[dBm]）
+  uint32_t dipStart[12];
+  uint32_t dipLen[12];
+  int dipDepth[12];
+  uint32_t seed = 0xC0FFEE;
+  auto rnd = [&seed](uint32_t n) {
+    seed = seed * 1103515245UL + 12345UL;
+    return (seed >> 16) % n;
+  };
+  for (int i = 0; i < 12; i++) {
+    dipStart[i] = i * (DAY_S / 12) + rnd(60) * 60;
+    dipLen[i] = (5 + rnd(56)) * 60;
+    dipDepth[i] = -108 - (int)rnd(15);
+  }
+
+  // エミュレータは応答・ソケットのバッファを持ち大きいため静的に置く。設定毎に1日ずつ進めて使う
+  static VirtualClock clock;
+  static Sim7080Emulator emulator(clock);
+  static AtClient at(emulator, &clock);
+  static Sim7080Backend backend(at);
+  static EmulatorFault faults[36];
+  uint32_t day = 0;
+
+  for (size_t k = 0; k < sizeof(PERIODS) / sizeof(PERIODS[0]); k++) {
+    uint32_t period = PERIODS[k];
+    uint64_t baselineBusyUs = 0;
+    uint32_t baselineAttempts = 0;
+    for (size_t d = 0; d < sizeof(DEFERS) / sizeof(DEFERS[0]); d++, day++) {
+      uint32_t base = day * DAY_S;
+      for (int i = 0; i < 12; i++) {
+        bool deep = dipDepth[i] <= -115;
+        faults[i * 3] = { base + dipStart[i], dipLen[i], FAULT_WEAK_SIGNAL, (uint32_t)-dipDepth[i] };
+        faults[i * 3 + 1] = { base + dipStart[i], dipLen[i], FAULT_ERROR, deep ? 2u : 4u };
+        faults[i * 3 + 2] = { base + dipStart[i], dipLen[i], FAULT_SLOW, deep ? 1500u : 600u };
+      }
+      emulator.setFaults(faults, 36);
+      if (clock.elapsedUs() < (uint64_t)base * 1000000ULL) clock.sleepUs((uint64_t)base * 1000000ULL - clock.elapsedUs());
+      emulator.resetStats();
+      at.resetStats();
+      backend.udpClose();
+      bool socketOpen = backend.udpOpen(udpServer, udpPort, 20000);
+
+      SignalGate gate;
+      SignalGateConfig cfg;
+      cfg.maxDeferMs = DEFERS[d];
+      gate.setConfig(cfg);
+      DeferredReadingQueue queue;
+      uint64_t busyUs = 0;
+      uint32_t attempts = 0, failures = 0, delivered = 0, merged = 0;
+
+      // sendDataWithStatus と同じく、プロンプトが出なければソケットを開き直して最大5回まで送る
+      auto sendOne = [&]() -> bool {
+        for (int a = 0; a < MAX_ATTEMPTS; a++) {
+          if (a > 0) clock.sleepMs(1000u << (a - 1));
+          uint64_t t0 = clock.elapsedUs();
+          if (!socketOpen) {
+            backend.udpClose();
+            socketOpen = backend.udpOpen(udpServer, udpPort, 20000);
+          }
+          ModemSendResult r = socketOpen ? backend.udpSend(frame, sizeof(frame)) : MODEM_SEND_NOT_STARTED;
+          busyUs += clock.elapsedUs() - t0;
+          attempts++;
+          if (r == MODEM_SEND_OK) {
+            delivered++;
+            return true;
+          }
+          if (r == MODEM_SEND_NOT_STARTED) socketOpen = false;
+        }
+        failures++;
+        return false;
+      };
+
+      for (uint32_t t = period; t <= DAY_S * 1000UL; t += period) {
+        uint64_t dueUs = ((uint64_t)base * 1000 + t) * 1000ULL;
+        if (clock.elapsedUs() < dueUs) clock.sleepUs(dueUs - clock.elapsedUs());
+        // 前の周期に遅れて届いた応答を読み捨てる
+        AtEvent ev;
+        while (at.next(ev, 0)) {
+        }
+        uint32_t now = clock.nowMs();
+        if (gate.enabled()) {
+          AtReply reply;
+          uint64_t t0 = clock.elapsedUs();
+          SignalSample s = { 99, 0 };
+          if (at.query("+CSQ;+CESQ", 2000, reply) && reply.ok()) {
+            s.csq = reply.rssi;
+            s.rsrpDbm = reply.rsrpDbm();
+          }
+          busyUs += clock.elapsedUs() - t0;
+          gate.update(s);
+          if (gate.shouldDefer(UPLINK_ROUTINE, now)) {
+            gate.recordDeferred(now);
+            DeferredReading r = {};
+            r.sampledAtMs = now;
+            if (!queue.push(r)) merged++;
+            continue;
+          }
+          if (!queue.empty() && (!gate.weak() || gate.deferredForMs(now) >= cfg.maxDeferMs)) {
+            uint16_t sent = 0;
+            while (!queue.empty() && sendOne()) {
+              queue.pop();
+              sent++;
+            }
+            gate.recordFlush(sent, queue.empty(), clock.nowMs());
+          }
+        }
+        sendOne();
+      }
+
+      const SignalGateStats& st = gate.stats();
+      if (d == 0) {
+        baselineBusyUs = busyUs;
+        baselineAttempts = attempts;
+      }
+      SerialMon.printf("SIGNAL BENCH: period %lu s, max defer %lu min: sends %lu attempts %lu failed %lu, "
+                       "at cmds %lu timeouts %lu, at busy %lu s (saved %.1f%%, attempts avoided %ld), "
+                       "deferred %lu merged %lu, bursts %lu (max %lu), delay avg %lu max %lu s\n",
+                       (unsigned long)(period / 1000), (unsigned long)(DEFERS[d] / 60000), (unsigned long)delivered,
+                       (unsigned long)attempts, (unsigned long)failures, (unsigned long)at.stats().commands,
+                       (unsigned long)at.stats().timeouts, (unsigned long)(busyUs / 1000000ULL),
+                       baselineBusyUs > 0 ? (double)((int64_t)baselineBusyUs - (int64_t)busyUs) * 100.0 / baselineBusyUs : 0.0,
+                       (long)baselineAttempts - (long)attempts, (unsigned long)st.deferred, (unsigned long)merged,
+                       (unsigned long)st.flushes, (unsigned long)st.maxBurst,
+                       (unsigned long)(st.flushes > 0 ? st.totalDelayMs / st.flushes / 1000 : 0),
+                       (unsigned long)(st.maxDelayMs / 1000));
+    }
+  }
+  emulator.setFaults(nullptr, 0);
+}
+
+// ==== Transport failover ====
+
+// 選択される経路で送信できる設定か（MQTT設定不正で代替経路もない場合は false）
+bool transportUsable() {
+  return transports.select(nowMs()) != TRANSPORT_MQTT || mqttConfigValid;
+}
+
+// 選択した経路で送信し、失敗して経路が切替わった場合は同じ内容を代替経路で再送する
+// UDP はバイナリ（バイナリパーサーでデコード）、MQTT は JSON のため、どちらに届いてもデコードできる
+bool sendViaTransport(uint8_t* frame, size_t frameSize, const uint8_t* mqttPayload, size_t mqttLen) {
+  TransportId t = transports.select(nowMs());
+  if (sendOnTransport(t, frame, frameSize, mqttPayload, mqttLen)) return true;
+  TransportId next = transports.select(nowMs());
+  if (next == t) return false;
+  SerialMon.printf("Transport: %s failed, resending via %s\n", transportName(t), transportName(next));
+  return sendOnTransport(next, frame, frameSize, mqttPayload, mqttLen);
+}
+
+bool sendOnTransport(TransportId t, uint8_t* frame, size_t frameSize, const uint8_t* mqttPayload, size_t mqttLen) {
+  unsigned long t0 = nowMs();
+  bool ok = false;
+  size_t wireBytes = 0;
+  if (t == TRANSPORT_MQTT) {
+    if (!mqttConfigValid) return false;
+    if (mqttConfigApplied && mqttConfigChanged()) {
+      // SMCONF は切断中のみ変更できるため、送信周期等の変更時だけ張り直す
+      SerialMon.println("MQTT session parameters changed, reconnecting...");
+      mqttDisconnect();
+      mqttConfigure();
+    } else if (!mqttConfigApplied && !mqttConfigure()) {
+      SerialMon.println("MQTT configure failed, trying to connect anyway");
+    }
+    // 未接続なら mqttPublish() 内で接続する
+    ok = mqttLen > 0 && mqttPublish(mqttTopic, mqttPayload, mqttLen, mqttQos);
+    wireBytes = estimateMqttWireBytes(mqttTopic.length(), mqttLen, mqttQos);
+  } else {
+    SerialMon.println("Sending data via UDP...");
+    if (!udpSocketOpen && !openUdpSocket()) {
+      ok = false;
+    } else {
+      ok = sendDataWithStatus(frame, frameSize);
+    }
+    wireBytes = estimateUdpWireBytes(frameSize);
+  }
+  unsigned long now = nowMs();
+  if (transports.report(t, ok, now - t0, wireBytes, now)) {
+    if (transports.failedOver()) {
+      SerialMon.printf("Transport: %s degraded, failing over to %s for %lu s\n",
+                       transportName(t), transportName(transports.select(now)),
+                       (unsigned long)(transports.cooldownRemainingMs(now) / 1000));
+    } else {
+      SerialMon.printf("Transport: %s recovered, switching back\n", transportName(t));
+    }
+  }
+  return ok;
+}
+
+// 経路毎の成功率・遅延・配信1件あたりのバイト数とリンクコストを出力する
+void printTransportStats() {
+  for (int i = 0; i < TRANSPORT_COUNT; i++) {
+    TransportId t = (TransportId)i;
+    const TransportStats& s = transports.stats(t);
+    if (s.attempts == 0) continue;
+    SerialMon.printf("Transport %s: sent=%lu/%lu rate=%.2f latency=%.0f ms bytes/reading=%.0f cost=%.0f%s\n",
+                     transportName(t), (unsigned long)s.delivered, (unsigned long)s.attempts,
+                     s.successRate, s.latencyMs, transports.bytesPerDelivered(t), transports.linkCost(t),
+                     t == transports.select(nowMs()) ? " [active]" : "");
+  }
+  if (transports.failedOver()) {
+    SerialMon.printf("Transport: failed over (%lu times), retry %s in %lu s\n",
+                     (unsigned long)transports.failovers(), transportName(transports.preferred()),
+                     (unsigned long)(transports.cooldownRemainingMs(nowMs()) / 1000));
+  }
+}
+
+// 送信が途絶えたとみなすまでの時間（解析モードでは送信周期が長いため延長）
+unsigned long connectionTimeout() {
+  unsigned long timeout = CONNECTION_TIMEOUT;
+  if (analyticsMode && ANALYTICS_INTERVAL * 2 > timeout) {
+    timeout = ANALYTICS_INTERVAL * 2;
+  }
+  return timeout;
+}
+
+// ==== Modem UART (baud negotiation / flow control) ====
+
+void setupModemUart() {
+  // RXバッファは begin() より前に設定する必要がある
+  SerialAT.setRxBufferSize(MODEM_RX_BUFFER_SIZE);
+  SerialAT.begin(MODEM_DEFAULT_BAUD, SERIAL_8N1, MODEM_RX, MODEM_TX);
+  modemBaud = MODEM_DEFAULT_BAUD;
+
+#if defined(ESP_ARDUINO_VERSION) && ESP_ARDUINO_VERSION >= ESP_ARDUINO_VERSION_VAL(2, 0, 6)
+  // RXバッファ/FIFOのオーバーフローを計数
+  SerialAT.onReceiveError([](hardwareSerial_error_t err) {
+    if (err == UART_BUFFER_FULL_ERROR || err == UART_FIFO_OVF_ERROR) {
+      modemUartOverflows++;
+    } else {
+      modemUartErrors++;
+    }
+  });
+#endif
+
+#if defined(MODEM_RTS_PIN) && defined(MODEM_CTS_PIN)
+  SerialAT.setPins(-1, -1, MODEM_CTS_PIN, MODEM_RTS_PIN);
+  SerialAT.setHwFlowCtrlMode(UART_HW_FLOWCTRL_CTS_RTS, 64);
+  SerialMon.printf("Modem UART: RTS/CTS flow control on RTS=%d CTS=%d\n", MODEM_RTS_PIN, MODEM_CTS_PIN);
+#endif
+  SerialMon.printf("Modem UART: RX buffer %d bytes\n", MODEM_RX_BUFFER_SIZE);
+}
+
+// 指定ボーレートでモデムが AT に応答するか確認する
+static bool modemAnswersAt(uint32_t baud) {
+  SerialAT.updateBaudRate(baud);
+  sleepMs(20);
+  while (SerialAT.available()) {
+    SerialAT.read();
+  }
+  for (int i = 0; i < 3; i++) {
+    if (modem.testAT(300)) return true;
+  }
+  return false;
+}
+
+// モデムの現在のボーレートを検出し、MODEM_TARGET_BAUD へ切替える
+// 切替後に応答がなければ元のレート（最終的には 115200）へ戻す
+bool negotiateModemBaud() {
+  // MODEM_TARGET_BAUD / MODEM_DEFAULT_BAUD は変更できるため、一覧と重なるレートは2度試さない
+  static const uint32_t candidates[] = { MODEM_TARGET_BAUD, MODEM_DEFAULT_BAUD, 921600, 460800, 230400, 57600, 9600 };
+  static const size_t N = sizeof(candidates) / sizeof(candidates[0]);
+  uint32_t current = 0;
+  for (size_t i = 0; i < N; i++) {
+    bool tried = false;
+    for (size_t k = 0; k < i; k++) {
+      if (candidates[k] == candidates[i]) tried = true;
+    }
+    if (tried) continue;
+    if (modemAnswersAt(candidates[i])) {
+      current = candidates[i];
+      break;
+    }
+  }
+  if (current == 0) {
+    SerialMon.println("Modem UART: no AT response at any baud rate, staying at 115200");
+    SerialAT.updateBaudRate(MODEM_DEFAULT_BAUD);
+    modemBaud = MODEM_DEFAULT_BAUD;
+    return false;
+  }
+  SerialMon.printf("Modem UART: modem answers at %lu baud\n", (unsigned long)current);
+  modemBaud = current;
+
+#if defined(MODEM_RTS_PIN) && defined(MODEM_CTS_PIN)
+  // モデム側もハードウェアフロー制御に設定
+  modem.sendAT("+IFC=2,2");
+  modem.waitResponse(1000L);
+#endif
+
+  if (current == MODEM_TARGET_BAUD) {
+    return true;
+  }
+
+  // OK は旧レートで返るため、応答を待ってからESP32側を切替える
+  modem.sendAT("+IPR=", MODEM_TARGET_BAUD);
+  modem.waitResponse(1000L);
+  if (modemAnswersAt(MODEM_TARGET_BAUD)) {
+    modemBaud = MODEM_TARGET_BAUD;
+    SerialMon.printf("Modem UART: switched to %lu baud\n", (unsigned long)modemBaud);
+    return true;
+  }
+
+  SerialMon.printf("Modem UART: no response at %lu baud, falling back\n", (unsigned long)MODEM_TARGET_BAUD);
+  if (modemAnswersAt(current)) {
+    modemBaud = current;
+  } else {
+    // どちらのレートでも応答しない: 受け取れないコマンドは送らず、元のレートのまま次の
+    // モデムのリセット時の ensureModemBaud() で全レートを走査し直す
+    SerialMon.printf("Modem UART: no response at %lu or %lu baud, leaving the modem as is\n",
+                     (unsigned long)MODEM_TARGET_BAUD, (unsigned long)current);
+    SerialAT.updateBaudRate(current);
+    modemBaud = current;
+  }
+  return false;
+}
+
+// 現在のボーレートで応答がなければ再ネゴシエーションする
+bool ensureModemBaud() {
+  if (modemAnswersAt(modemBaud)) return true;
+  SerialMon.println("Modem UART: lost AT response, renegotiating baud rate...");
+  return negotiateModemBaud();
+}
+
+// 長い応答（AT+CLAC のコマンド一覧）を受信してUART実効スループットを計測する（-DUART_BENCHMARK 指定時のみ）
+void benchmarkModemUart() {
+  while (SerialAT.available()) {
+    SerialAT.read();
+  }
+  uint32_t overflowsBefore = modemUartOverflows;
+  unsigned long t0 = nowMs();
+  unsigned long firstByte = 0;
+  unsigned long lastByte = 0;
+  size_t bytes = 0;
+  char tail[4] = {0, 0, 0, 0};
+  modem.sendAT("+CLAC");
+  while (nowMs() - t0 < 10000) {
+    while (SerialAT.available()) {
+      char c = (char)SerialAT.read();
+      if (bytes == 0) firstByte = nowMs();
+      lastByte = nowMs();
+      bytes++;
+      tail[0] = tail[1];
+      tail[1] = tail[2];
+      tail[2] = tail[3];
+      tail[3] = c;
+    }
+    if (tail[0] == 'O' && tail[1] == 'K' && tail[2] == '\r' && tail[3] == '\n') break;
+    sleepMs(1);
+  }
+  unsigned long elapsed = lastByte > firstByte ? lastByte - firstByte : 1;
+  SerialMon.printf("UART BENCH: baud=%lu bytes=%u time=%lu ms rate=%lu B/s (line max %lu B/s) overflows=%lu errors=%lu\n",
+                   (unsigned long)modemBaud, (unsigned)bytes, elapsed,
+                   (unsigned long)(bytes * 1000UL / elapsed), (unsigned long)(modemBaud / 10),
+                   (unsigned long)(modemUartOverflows - overflowsBefore), (unsigned long)modemUartErrors);
+}
+
+// ==== Time sync (modem network clock / NTP) ====
+
+// モデムの時計を NTP（失敗時はネットワーク時刻 NITZ）で合わせ、+CCLK? で millis() との対応を更新する
+bool syncModemTime() {
+  lastTimeSyncAttempt = nowMs();
+
+  // ネットワーク時刻による RTC 更新を有効化（NTP が使えない場合のフォールバック）
+  modem.sendAT("+CLTS=1");
+  modem.waitResponse(2000L);
+
+  // NTP で同期（PDP#0 を使用, モード0: ローカル時刻を設定）
+  modem.sendAT("+CNTP=\"" NTP_SERVER "\",0,0,0");
+  if (modem.waitResponse(5000L) == 1) {
+    modem.sendAT("+CNTP");
+    if (modem.waitResponse(5000L) == 1) {
+      int r = modem.waitResponse(20000L, "+CNTP: 1", "+CNTP:");
+      if (r != 1) {
+        SerialMon.println("Time sync: NTP failed, using network time");
+      }
+    }
+  }
+
+  String resp = "";
+  modem.sendAT("+CCLK?");
+  int r = modem.waitResponse(2000L, resp);
+  uint32_t mono = nowMs();
+  uint32_t epoch = 0;
+  if (r != 1 || !parseCclk(resp.c_str(), epoch)) {
+    SerialMon.println("Time sync: +CCLK? invalid or not yet set");
+    return false;
+  }
+
+  timeSync.sync(mono, epoch);
+  SerialMon.printf("Time sync: epoch=%lu offset=%ld ms drift=%.1f ppm (sync #%lu)\n",
+                   (unsigned long)epoch, (long)timeSync.lastOffsetMs(), timeSync.driftPpm(),
+                   (unsigned long)timeSync.syncCount());
+  return true;
+}
+
+// ==== Network registration accelerator ====
+
+void loadRegistrationHint() {
+  Preferences prefs;
+  size_t n = 0;
+  if (prefs.begin("regcache", true)) {
+    n = prefs.getBytes("hint", &registrationHint, sizeof(registrationHint));
+    prefs.end();
+  }
+  if (n != sizeof(registrationHint) || !registrationHintValid(registrationHint)) {
+    clearRegistrationHint(registrationHint);
+    SerialMon.println("Registration: no cached operator/bands");
+    return;
+  }
+  char bands[64];
+  formatBandList(registrationHint, bands, sizeof(bands));
+  SerialMon.printf("Registration: cached %s PLMN %s bands %s (%u successes)\n",
+                   radioAccessName((RadioAccess)registrationHint.rat), registrationHint.plmn, bands,
+                   (unsigned)registrationHint.successes);
+}
+
+void saveRegistrationHint() {
+  Preferences prefs;
+  if (!prefs.begin("regcache", false)) return;
+  prefs.putBytes("hint", &registrationHint, sizeof(registrationHint));
+  prefs.end();
+}
+
+// 探索条件をモデムに設定する（CFUN=0 の間に変更し、CFUN=1 で探索を再開）
+// restrict=true: キャッシュした方式・バンド・事業者に限定 / false: 全方式・全バンド・自動選択
+// +CNMP/+CMNB/+CBANDCFG はモデムの不揮発領域に保存されるため、広げる場合も明示的に設定する
+static void applyRadioSearch(bool restrict) {
+  modem.sendAT("+CFUN=0");
+  modem.waitResponse(10000L);
+  modem.sendAT("+CNMP=38"); // LTE のみ
+  modem.waitResponse(2000L);
+  if (restrict) {
+    char bands[64];
+    formatBandList(registrationHint, bands, sizeof(bands));
+    RadioAccess rat = (RadioAccess)registrationHint.rat;
+    modem.sendAT("+CMNB=", rat == RAT_NBIOT ? 2 : 1);
+    modem.waitResponse(2000L);
+    modem.sendAT("+CBANDCFG=\"", radioAccessBandCfgName(rat), "\",", bands);
+    modem.waitResponse(2000L);
+  } else {
+    modem.sendAT("+CMNB=3"); // Cat-M と NB-IoT の両方
+    modem.waitResponse(2000L);
+    modem.sendAT("+CBANDCFG=\"CAT-M\"," CATM_BANDS_ALL);
+    modem.waitResponse(2000L);
+    modem.sendAT("+CBANDCFG=\"NB-IOT\"," NBIOT_BANDS_ALL);
+    modem.waitResponse(2000L);
+  }
+  modem.sendAT("+CFUN=1");
+  modem.waitResponse(10000L);
+  if (restrict) {
+    // 手動選択（失敗時は自動選択に切替わる）
+    modem.sendAT("+COPS=4,2,\"", registrationHint.plmn, "\"");
+  } else {
+    modem.sendAT("+COPS=0");
+  }
+  modem.waitResponse(10000L);
+  radioSearchMode = restrict ? SEARCH_RESTRICTED : SEARCH_WIDE;
+}
+
+// 登録できた方式・事業者・バンドを +CPSI? で取得し、変化があれば NVS に保存する
+static void learnRegistration() {
+  String resp = "";
+  modem.sendAT("+CPSI?");
+  if (modem.waitResponse(2000L, resp) != 1) return;
+  RadioAccess rat;
+  char plmn[8];
+  uint8_t band;
+  if (!parseCpsi(resp.c_str(), rat, plmn, sizeof(plmn), band)) {
+    SerialMon.println("Registration: +CPSI? not parsable, hint not updated");
+    return;
+  }
+  if (updateRegistrationHint(registrationHint, rat, plmn, band)) {
+    saveRegistrationHint();
+    // 次回の登録時に新しいバンド集合で設定し直す
+    radioSearchMode = SEARCH_UNKNOWN;
+    SerialMon.printf("Registration: saved %s PLMN %s band %u\n", radioAccessName(rat), plmn, (unsigned)band);
+  }
+}
+
+// ネットワーク登録を待つ。キャッシュがあれば絞り込んだ条件で短時間試し、だめなら全体に広げる
+bool registerNetwork(bool recovery, uint32_t timeoutMs) {
+  unsigned long t0 = nowMs();
+  bool ok = false;
+  bool fast = false;
+  bool widened = false;
+  bool cached = registrationHintValid(registrationHint);
+  if (cached) {
+    if (radioSearchMode != SEARCH_RESTRICTED) applyRadioSearch(true);
+    ok = modem.waitForNetwork(REGISTRATION_FAST_TIMEOUT);
+    fast = ok;
+    if (!ok) {
+      SerialMon.println("Registration: cached operator/bands did not register, widening search...");
+    }
+  } else if (radioSearchMode != SEARCH_WIDE) {
+    // 以前の絞り込み設定がモデムに残っている可能性があるため解除してから探索
+    applyRadioSearch(false);
+  }
+  if (!ok) {
+    if (cached) {
+      applyRadioSearch(false);
+      widened = true;
+    }
+    ok = modem.waitForNetwork(timeoutMs);
+  }
+  uint32_t ms = nowMs() - t0;
+
+  RegistrationStats& st = recovery ? recoveryRegistration : bootRegistration;
+  st.record(ms, ok, fast, widened);
+  SerialMon.printf("Registration (%s): %s in %lu ms via %s (avg %lu ms, best %lu, worst %lu, cached hits %lu/%lu)\n",
+                   recovery ? "recovery" : "boot", ok ? "registered" : "failed", (unsigned long)ms,
+                   fast ? "cached operator/bands" : (widened ? "widened search" : "full search"),
+                   (unsigned long)st.averageMs(), (unsigned long)st.bestMs, (unsigned long)st.worstMs,
+                   (unsigned long)st.fastHits, (unsigned long)st.attempts);
+  if (ok) learnRegistration();
+  return ok;
+}
+
+// ==== Deadline scheduler ====
+
+void setupScheduler() {
+  unsigned long now = nowMs();
+  // 初回は setup() 末尾の readAndSendData() で実行するため、各タイマーは1周期後から開始
+  timerSample = scheduler.add("sample", INTERVAL, MISS_SKIP, now, INTERVAL);
+  timerUplink = scheduler.add("uplink", INTERVAL, MISS_SKIP, now, INTERVAL);
+  timerDisplay = scheduler.add("display", DISPLAY_INTERVAL, MISS_SKIP, now, DISPLAY_INTERVAL);
+  timerMetadata = scheduler.add("metadata", METADATA_INTERVAL, MISS_SKIP, now, METADATA_INTERVAL);
+  // OTAのチャンク取得（ダウンロード中のみ有効）
+  timerOta = scheduler.add("ota", OTA_STEP_INTERVAL, MISS_SKIP, now, OTA_STEP_INTERVAL);
+  scheduler.setEnabled(timerOta, false);
+  timerSoak = scheduler.add("soak", SOAK_REPORT_INTERVAL, MISS_SKIP, now, SOAK_REPORT_INTERVAL);
+  // GNSS 測位の開始判定と測位中の +CGNSINF 読み取り（メタデータ gnss=true の場合のみ有効）
+  timerGnss = scheduler.add("gnss", GNSS_POLL_MS, MISS_SKIP, now, GNSS_POLL_MS);
+  scheduler.setEnabled(timerGnss, false);
+}
+
+// 各タイマーの発火数・スキップ数・遅れ（ジッタ）を出力する
+void printSchedulerStats() {
+  for (size_t i = 0; i < scheduler.count(); i++) {
+    const TimerStats* t = scheduler.stats((int)i);
+    unsigned long avgLate = t->fired > 0 ? (unsigned long)(t->totalLateMs / t->fired) : 0;
+    SerialMon.printf("Timer %s: fired=%lu skipped=%lu late last=%lu avg=%lu max=%lu ms\n",
+                     t->name, (unsigned long)t->fired, (unsigned long)t->skipped,
+                     (unsigned long)t->lastLateMs, avgLate, (unsigned long)t->maxLateMs);
+  }
+}
+
+// ==== Delta OTA ====
+
+// Arduino コアに起動時の自動確定をさせず、最初の送信成功で確定する（confirmOtaImage）
+extern "C" bool verifyRollbackLater() {
+  return true;
+}
+
+// 実行中パーティションを旧イメージとして読み、非実行側へ新イメージを書く
+// 消去は書き込み位置に合わせてセクタ単位で行う（再開時は書き込み済みのセクタを消さない）
+class OtaPartitionIo : public DeltaIo {
+public:
+  OtaPartitionIo(const esp_partition_t* running, const esp_partition_t* target, uint32_t outputOffset)
+    : running_(running), target_(target),
+      erasedEnd_((outputOffset + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE) {}
+
+  bool readOld(uint32_t offset, uint8_t* buf, size_t len) override {
+    return esp_partition_read(running_, offset, buf, len) == ESP_OK;
+  }
+
+  bool writeNew(uint32_t offset, const uint8_t* data, size_t len) override {
+    while (offset + len > erasedEnd_) {
+      if (erasedEnd_ + SPI_FLASH_SEC_SIZE > target_->size) return false;
+      if (esp_partition_erase_range(target_, erasedEnd_, SPI_FLASH_SEC_SIZE) != ESP_OK) return false;
+      erasedEnd_ += SPI_FLASH_SEC_SIZE;
+    }
+    return esp_partition_write(target_, offset, data, len) == ESP_OK;
+  }
+
+private:
+  const esp_partition_t* running_;
+  const esp_partition_t* target_;
+  uint32_t erasedEnd_;
+};
+
+static bool sha256Partition(const esp_partition_t* part, uint32_t size, uint8_t out[32]) {
+  if (size > part->size) return false;
+  uint8_t buf[512];
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts_ret(&ctx, 0);
+  bool ok = true;
+  for (uint32_t off = 0; off < size && ok; off += sizeof(buf)) {
+    size_t n = size - off < sizeof(buf) ? size - off : sizeof(buf);
+    ok = esp_partition_read(part, off, buf, n) == ESP_OK;
+    if (ok) mbedtls_sha256_update_ret(&ctx, buf, n);
+  }
+  if (ok) mbedtls_sha256_finish_ret(&ctx, out);
+  mbedtls_sha256_free(&ctx);
+  return ok;
+}
+
+// ヘッダ先頭76バイトの ECDSA P-256 署名を検証する
+static bool verifyOtaSignature(const uint8_t* header, const DeltaHeader& h) {
+#ifdef OTA_SIGNING_KEY_AVAILABLE
+  uint8_t hash[32];
+  mbedtls_sha256_ret(header, DELTA_SIGNED_SIZE, hash, 0);
+  mbedtls_pk_context pk;
+  mbedtls_pk_init(&pk);
+  int rc = mbedtls_pk_parse_public_key(&pk, (const unsigned char*)OTA_PUBLIC_KEY_PEM, sizeof(OTA_PUBLIC_KEY_PEM));
+  if (rc == 0) rc = mbedtls_pk_verify(&pk, MBEDTLS_MD_SHA256, hash, sizeof(hash), h.sig, h.sigLen);
+  mbedtls_pk_free(&pk);
+  return rc == 0;
+#else
+  (void)header;
+  (void)h;
+  return false;
+#endif
+}
+
+static void saveOtaProgress() {
+  Preferences prefs;
+  if (!prefs.begin("ota", false)) return;
+  prefs.putBytes("progress", &otaProgress, sizeof(otaProgress));
+  prefs.end();
+}
+
+static void clearOtaProgress() {
+  memset(&otaProgress, 0, sizeof(otaProgress));
+  Preferences prefs;
+  if (!prefs.begin("ota", false)) return;
+  prefs.remove("progress");
+  prefs.end();
+}
+
+static String otaPref(const char* key) {
+  Preferences prefs;
+  String value = "";
+  if (prefs.begin("ota", true)) {
+    value = prefs.getString(key, "");
+    prefs.end();
+  }
+  return value;
+}
+
+static void setOtaPref(const char* key, const char* value) {
+  Preferences prefs;
+  if (!prefs.begin("ota", false)) return;
+  if (value[0] == '\0') {
+    prefs.remove(key);
+  } else {
+    prefs.putString(key, value);
+  }
+  prefs.end();
+}
+
+// 確定前の起動回数を1つ増やして返す
+static uint8_t countUnconfirmedBoot() {
+  Preferences prefs;
+  if (!prefs.begin("ota", false)) return 0;
+  uint8_t boots = prefs.getUChar("boots", 0);
+  if (boots < 255) boots++;
+  prefs.putUChar("boots", boots);
+  prefs.end();
+  return boots;
+}
+
+// 確定待ちの記録（版・切替前のパーティション・起動回数）を消す
+static void clearOtaPending() {
+  Preferences prefs;
+  if (!prefs.begin("ota", false)) return;
+  prefs.remove("pending");
+  prefs.remove("previous");
+  prefs.remove("boots");
+  prefs.end();
+}
+
+// 適用できないパッチ（署名・基準イメージ・ハッシュの不一致など）。同じ版は再取得しない
+static void abortOta(const char* reason) {
+  SerialMon.printf("OTA: %s failed: %s\n", otaProgress.version, reason);
+  setOtaPref("failed", otaProgress.version);
+  clearOtaProgress();
+  otaPhase = OTA_IDLE;
+  scheduler.setEnabled(timerOta, false);
+}
+
+void initOta() {
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  esp_ota_img_states_t state;
+  otaBootloaderRollback =
+    esp_ota_get_state_partition(running, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY;
+
+  // otaFinish で記録した版が動いていて、切替前のパーティションでなければ確定待ちの新イメージ
+  String pending = otaPref("pending");
+  String previous = otaPref("previous");
+  bool onNewImage = pending.length() > 0 && pending == FIRMWARE_VERSION && previous != running->label;
+  otaPendingVerify = otaBootloaderRollback || onNewImage;
+  uint8_t boots = otaPendingVerify ? countUnconfirmedBoot() : 0;
+
+  // 差分の基準になる実行中イメージのハッシュ（パッチ作成に使った旧イメージと照合できるよう出力）
+  uint32_t imageSize = ESP.getSketchSize();
+  uint8_t sha[32];
+  char shaHex[65] = "?";
+  if (sha256Partition(running, imageSize, sha)) formatHex(sha, sizeof(sha), shaHex);
+  SerialMon.printf("Firmware %s on %s, image %lu bytes sha256 %s", FIRMWARE_VERSION, running->label,
+                   (unsigned long)imageSize, shaHex);
+  if (otaPendingVerify) {
+    SerialMon.printf(" (pending verify, boot %u)\n", (unsigned)boots);
+  } else {
+    SerialMon.println();
+  }
+
+  // 旧イメージで起動した（ブートローダーまたは前回の起動で戻した）なら、戻った版を失敗として記録する
+  if (pending.length() > 0 && !onNewImage) {
+    if (pending != FIRMWARE_VERSION) {
+      SerialMon.printf("OTA: %s did not confirm and was rolled back\n", pending.c_str());
+      setOtaPref("failed", pending.c_str());
+    }
+    clearOtaPending();
+  }
+
+  // 確定前に再起動した（起動直後のクラッシュ・ハングによるウォッチドッグ等）
+  if (otaPendingVerify && boots > OTA_MAX_UNCONFIRMED_BOOTS) {
+    rollBackOtaImage("new image restarted before confirmation");
+  }
+
+  Preferences prefs;
+  size_t n = 0;
+  if (prefs.begin("ota", true)) {
+    n = prefs.getBytes("progress", &otaProgress, sizeof(otaProgress));
+    prefs.end();
+  }
+  if (n != sizeof(otaProgress) || otaProgress.magic != OTA_PROGRESS_MAGIC) {
+    memset(&otaProgress, 0, sizeof(otaProgress));
+  } else if (otaProgress.patchSize > 0) {
+    SerialMon.printf("OTA: %s download at %lu/%lu bytes, resumes after metadata\n", otaProgress.version,
+                     (unsigned long)otaProgress.state.patchOffset, (unsigned long)otaProgress.patchSize);
+  }
+}
+
+void startOta(const char* url, const char* version) {
+  if (url == nullptr || version == nullptr || version[0] == '\0') return;
+  if (strcmp(version, FIRMWARE_VERSION) == 0) {
+    if (otaPhase == OTA_DOWNLOADING) {
+      SerialMon.println("OTA: target is the running version, cancelling download");
+      clearOtaProgress();
+      otaPhase = OTA_IDLE;
+      scheduler.setEnabled(timerOta, false);
+    }
+    return;
+  }
+  if (otaPhase == OTA_REBOOT_PENDING) return;
+#ifndef OTA_SIGNING_KEY_AVAILABLE
+  SerialMon.println("OTA: no signing key built in (include/ota_pubkey.h), ignoring ota_version");
+  return;
+#endif
+  if (otaPref("failed") == version) {
+    SerialMon.printf("OTA: %s failed previously, skipping\n", version);
+    return;
+  }
+  char host[64];
+  char path[160];
+  uint16_t port;
+  if (strlen(version) >= sizeof(otaProgress.version) ||
+      !parseHttpUrl(url, host, sizeof(host), port, path, sizeof(path))) {
+    SerialMon.printf("OTA: invalid ota_url/ota_version in metadata: %s %s\n", url, version);
+    return;
+  }
+
+  uint32_t urlHash = fnv1a32(url);
+  bool sameJob = otaProgress.magic == OTA_PROGRESS_MAGIC && otaProgress.urlHash == urlHash &&
+                 strcmp(otaProgress.version, version) == 0;
+  if (!sameJob) {
+    memset(&otaProgress, 0, sizeof(otaProgress));
+    otaProgress.magic = OTA_PROGRESS_MAGIC;
+    strncpy(otaProgress.version, version, sizeof(otaProgress.version) - 1);
+    otaProgress.urlHash = urlHash;
+    saveOtaProgress();
+    SerialMon.printf("OTA: %s -> %s from %s\n", FIRMWARE_VERSION, version, url);
+  } else if (otaPhase != OTA_DOWNLOADING && otaProgress.patchSize > 0) {
+    otaProgress.resumes++;
+    SerialMon.printf("OTA: resuming %s at %lu/%lu bytes\n", version,
+                     (unsigned long)otaProgress.state.patchOffset, (unsigned long)otaProgress.patchSize);
+  }
+  otaUrl = url;
+  otaPhase = OTA_DOWNLOADING;
+  otaChunkFailures = 0;
+  scheduler.setEnabled(timerOta, true);
+  scheduler.trigger(timerOta, nowMs());
+}
+
+// Range 要求を送り、206 と Content-Range を確認する。パッチ全体のサイズを total に、本文の長さを bodyLength に返す
+static bool otaRequestRange(HttpClient& http, const char* path, uint32_t first, uint32_t last,
+                            uint32_t& total, int& bodyLength) {
+  char range[40];
+  snprintf(range, sizeof(range), "bytes=%lu-%lu", (unsigned long)first, (unsigned long)last);
+  http.beginRequest();
+  int err = http.get(path);
+  if (err != 0) {
+    SerialMon.printf("OTA: HTTP GET failed (error code: %d)\n", err);
+    return false;
+  }
+  http.sendHeader("Range", range);
+  http.endRequest();
+  int status = http.responseStatusCode();
+  if (status != 206) {
+    SerialMon.printf("OTA: HTTP status %d for %s\n", status, range);
+    return false;
+  }
+  bool rangeOk = false;
+  while (http.headerAvailable()) {
+    String name = http.readHeaderName();
+    String value = http.readHeaderValue();
+    if (name.equalsIgnoreCase("Content-Range")) {
+      uint32_t a, b;
+      rangeOk = parseContentRange(value.c_str(), a, b, total) && a == first;
+    }
+  }
+  bodyLength = http.contentLength();
+  if (!rangeOk || bodyLength <= 0) {
+    SerialMon.printf("OTA: unexpected Content-Range/length for %s\n", range);
+    return false;
+  }
+  return true;
+}
+
+// 本文を読み、受け取った断片毎に sink を呼ぶ。受信したバイト数を返す（途中で切れたら期待より小さい）
+template <typename Sink>
+static int otaReadBody(HttpClient& http, int bodyLength, Sink sink) {
+  uint8_t buf[512];
+  int received = 0;
+  unsigned long lastData = nowMs();
+  while (received < bodyLength && nowMs() - lastData < 10000) {
+    int avail = http.available();
+    if (avail <= 0) {
+      if (!http.connected()) break;
+      sleepMs(5);
+      continue;
+    }
+    int want = bodyLength - received;
+    if (want > (int)sizeof(buf)) want = sizeof(buf);
+    if (want > avail) want = avail;
+    int n = http.read(buf, want);
+    if (n <= 0) continue;
+    if (!sink(buf, (size_t)n)) return -1;
+    received += n;
+    lastData = nowMs();
+  }
+  return received;
+}
+
+// ヘッダを取得し、署名と基準イメージを確認してから適用を始める
+static bool otaFetchHeader(HttpClient& http, const char* path) {
+  uint32_t total;
+  int bodyLength;
+  if (!otaRequestRange(http, path, 0, DELTA_HEADER_MAX - 1, total, bodyLength)) return false;
+  uint8_t header[DELTA_HEADER_MAX];
+  size_t got = 0;
+  otaReadBody(http, bodyLength, [&](const uint8_t* data, size_t len) {
+    if (len > sizeof(header) - got) len = sizeof(header) - got;
+    memcpy(header + got, data, len);
+    got += len;
+    return true;
+  });
+  otaProgress.downloaded += got;
+
+  DeltaHeader& h = otaProgress.header;
+  if (!parseDeltaHeader(header, got, h)) {
+    if (got < (size_t)bodyLength) return false;  // 途中で切れただけなら再試行
+    abortOta("malformed patch header");
+    return false;
+  }
+  if (!verifyOtaSignature(header, h)) {
+    abortOta("signature verification failed");
+    return false;
+  }
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  const esp_partition_t* target = esp_ota_get_next_update_partition(NULL);
+  uint8_t sha[32];
+  if (!sha256Partition(running, h.oldSize, sha) || memcmp(sha, h.oldSha256, sizeof(sha)) != 0) {
+    abortOta("patch was not made against the running image");
+    return false;
+  }
+  if (target == NULL || h.newSize > target->size) {
+    abortOta("new image does not fit the OTA partition");
+    return false;
+  }
+
+  OtaPartitionIo io(running, target, 0);
+  DeltaPatcher patcher(io);
+  patcher.begin(h);
+  otaProgress.state = patcher.state();
+  otaProgress.patchSize = total;
+  saveOtaProgress();
+  SerialMon.printf("OTA: %s patch %lu bytes for %lu-byte image, writing to %s\n", otaProgress.version,
+                   (unsigned long)otaProgress.patchSize, (unsigned long)h.newSize, target->label);
+  return true;
+}
+
+// 書き込んだイメージを検証して起動パーティションを切り替える
+static void otaFinish(const DeltaPatcher& patcher) {
+  const esp_partition_t* target = esp_ota_get_next_update_partition(NULL);
+  uint8_t sha[32];
+  if (!sha256Partition(target, otaProgress.header.newSize, sha) ||
+      memcmp(sha, otaProgress.header.newSha256, sizeof(sha)) != 0) {
+    abortOta("patched image hash mismatch");
+    return;
+  }
+  esp_err_t err = esp_ota_set_boot_partition(target);
+  if (err != ESP_OK) {
+    abortOta(esp_err_to_name(err));
+    return;
+  }
+
+  // 帯域と中断の計測結果（差分のサイズ・所要時間・実効速度・再開回数）
+  uint32_t patchSize = otaProgress.patchSize;
+  uint32_t newSize = otaProgress.header.newSize;
+  SerialMon.printf("OTA: %s ready: patch %lu bytes = %.1f%% of the %lu-byte image "
+                   "(copied %lu, inserted %lu this run)\n",
+                   otaProgress.version, (unsigned long)patchSize, 100.0f * patchSize / newSize,
+                   (unsigned long)newSize, (unsigned long)patcher.copiedBytes(),
+                   (unsigned long)patcher.insertedBytes());
+  SerialMon.printf("OTA: downloaded %lu bytes in %lu ms (%.2f kbit/s), %lu resumes, %.1f%% re-fetched\n",
+                   (unsigned long)otaProgress.downloaded, (unsigned long)otaProgress.elapsedMs,
+                   otaProgress.elapsedMs > 0 ? otaProgress.downloaded * 8.0f / otaProgress.elapsedMs : 0.0f,
+                   (unsigned long)otaProgress.resumes,
+                   patchSize > 0 && otaProgress.downloaded > patchSize
+                     ? 100.0f * (otaProgress.downloaded - patchSize) / patchSize : 0.0f);
+
+  clearOtaPending();
+  setOtaPref("pending", otaProgress.version);
+  setOtaPref("previous", esp_ota_get_running_partition()->label);
+  clearOtaProgress();
+  otaPhase = OTA_REBOOT_PENDING;
+  scheduler.setEnabled(timerOta, false);
+  SerialMon.println("OTA: rebooting into the new image");
+  SerialMon.flush();
+  sleepMs(1000);
+  ESP.restart();
+}
+
+// 1チャンク分を取得して適用する（OTAタイマーから呼ばれる）
+void otaStep() {
+  if (otaPhase != OTA_DOWNLOADING) return;
+  if (!modem.isGprsConnected()) {
+    SerialMon.println("OTA: waiting for data connection");
+    return;
+  }
+  char host[64];
+  char path[160];
+  uint16_t port;
+  if (!parseHttpUrl(otaUrl.c_str(), host, sizeof(host), port, path, sizeof(path))) {
+    abortOta("invalid ota_url");
+    return;
+  }
+
+  TinyGsmClient client(modem);
+  HttpClient http(client, host, port);
+  unsigned long start = nowMs();
+  bool ok;
+  if (otaProgress.patchSize == 0) {
+    ok = otaFetchHeader(http, path);
+  } else {
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    const esp_partition_t* target = esp_ota_get_next_update_partition(NULL);
+    DeltaPatchState& st = otaProgress.state;
+    OtaPartitionIo io(running, target, st.outputOffset);
+    DeltaPatcher patcher(io);
+    patcher.resume(otaProgress.header, st);
+    if (patcher.done()) {
+      otaFinish(patcher);
+      return;
+    }
+
+    uint32_t first = st.patchOffset;
+    uint32_t last = first + OTA_CHUNK_SIZE - 1;
+    if (last >= otaProgress.patchSize) last = otaProgress.patchSize - 1;
+    uint32_t total;
+    int bodyLength;
+    ok = otaRequestRange(http, path, first, last, total, bodyLength);
+    if (ok && total != otaProgress.patchSize) {
+      // 配信中のファイルが差し替えられたため、ヘッダから取り直す
+      SerialMon.println("OTA: patch changed on the server, restarting download");
+      http.stop();
+      otaProgress.patchSize = 0;
+      memset(&otaProgress.state, 0, sizeof(otaProgress.state));
+      saveOtaProgress();
+      return;
+    }
+    if (ok) {
+      int received = otaReadBody(http, bodyLength, [&](const uint8_t* data, size_t len) {
+        return patcher.feed(data, len);
+      });
+      // 途中で切れても適用済みの位置までは保存し、次回はその位置から要求する
+      otaProgress.state = patcher.state();
+      if (received > 0) otaProgress.downloaded += received;
+      if (patcher.failed()) {
+        http.stop();
+        abortOta(patcher.error());
+        return;
+      }
+      ok = received == bodyLength;
+      unsigned long ms = nowMs() - start;
+      SerialMon.printf("OTA: %lu-%lu %d/%d bytes in %lu ms (%.2f kbit/s), image %lu/%lu\n",
+                       (unsigned long)first, (unsigned long)last, received, bodyLength, ms,
+                       ms > 0 ? received * 8.0f / ms : 0.0f, (unsigned long)patcher.state().outputOffset,
+                       (unsigned long)otaProgress.header.newSize);
+      if (!ok) otaProgress.resumes++;
+    }
+    if (patcher.done()) {
+      http.stop();
+      otaProgress.elapsedMs += nowMs() - start;
+      otaFinish(patcher);
+      return;
+    }
+  }
+  http.stop();
+  if (otaPhase != OTA_DOWNLOADING) return;
+  otaProgress.elapsedMs += nowMs() - start;
+  saveOtaProgress();
+
+  if (ok) {
+    otaChunkFailures = 0;
+  } else if (++otaChunkFailures >= OTA_MAX_CHUNK_FAILURES) {
+    SerialMon.printf("OTA: %u consecutive failures, pausing until next metadata fetch\n",
+                     (unsigned)otaChunkFailures);
+    otaPhase = OTA_IDLE;
+    scheduler.setEnabled(timerOta, false);
+  }
+}
+
+// OTA直後のイメージを確定する（送信に成功した時点で呼ぶ）
+void confirmOtaImage() {
+  if (!otaPendingVerify) return;
+  if (otaBootloaderRollback && esp_ota_mark_app_valid_cancel_rollback() != ESP_OK) return;
+  SerialMon.printf("OTA: firmware %s confirmed\n", FIRMWARE_VERSION);
+  otaPendingVerify = false;
+  otaBootloaderRollback = false;
+  clearOtaPending();
+}
+
+// 未確定の新イメージを捨てて切替前のイメージで再起動する
+// （旧イメージ側の initOta が戻った版を失敗として記録する）
+void rollBackOtaImage(const char* reason) {
+  SerialMon.printf("OTA: %s, rolling back\n", reason);
+  SerialMon.flush();
+  if (otaBootloaderRollback) {
+    esp_ota_mark_app_invalid_rollback_and_reboot();  // 成功すれば戻らない
+  }
+  String previous = otaPref("previous");
+  const esp_partition_t* target =
+    previous.length() > 0
+      ? esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, previous.c_str())
+      : esp_ota_get_next_update_partition(NULL);
+  esp_err_t err = target != NULL ? esp_ota_set_boot_partition(target) : ESP_ERR_NOT_FOUND;
+  if (err != ESP_OK) {
+    // 戻り先が無い・壊れている場合は現在のイメージで動作を続ける（毎周回の再試行はしない）
+    SerialMon.printf("OTA: rollback failed (%s), keeping the running image\n", esp_err_to_name(err));
+    otaPendingVerify = false;
+    return;
+  }
+  sleepMs(100);
+  ESP.restart();
+}
@@ -0,0 +1,481 @@
+#include "modem_backend.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// ==== AT クライアント ====
+
+AtClient::AtClient(AtChannel& channel, SystemClock* clock)
+  : channel_(channel), clock_(clock), dataPending_(0), closed_(0) {
+  resetStats();
+}
+
+void AtClient::resetStats() {
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+bool AtClient::send(const char* cmd) {
+  if (cmd[0] == '\0') return false;
+  size_t len = strlen(cmd);
+  channel_.write((const uint8_t*)"AT", 2);
+  channel_.write((const uint8_t*)cmd, len);
+  channel_.write((const uint8_t*)"\r\n", 2);
+  stats_.commands++;
+  stats_.txBytes += len + 4;
+  return true;
+}
+
+void AtClient::writeRaw(const uint8_t* data, size_t len) {
+  channel_.write(data, len);
+  stats_.txBytes += len;
+}
+
+int AtClient::readByte(uint32_t startMs, uint32_t timeoutMs) {
+  for (;;) {
+    int c = channel_.read();
+    if (c >= 0) {
+      stats_.rxBytes++;
+      return c;
+    }
+    if (clock_->nowMs() - startMs >= timeoutMs) return -1;
+    clock_->sleepMs(1);
+  }
+}
+
+void AtClient::note(const AtEvent& ev) {
+  if (ev.type == AT_EVENT_CADATAIND && ev.socket.cid < 16) {
+    dataPending_ |= (uint16_t)(1u << ev.socket.cid);
+  } else if (ev.type == AT_EVENT_CASTATE && ev.socket.cid < 16 && ev.socket.state == 0) {
+    closed_ |= (uint16_t)(1u << ev.socket.cid);
+  }
+}
+
+bool AtClient::next(AtEvent& ev, uint32_t timeoutMs) {
+  uint32_t start = clock_->nowMs();
+  for (;;) {
+    int c = readByte(start, timeoutMs);
+    if (c < 0) return false;
+    if (tokenizer_.push((uint8_t)c, ev)) {
+      note(ev);
+      return true;
+    }
+  }
+}
+
+bool AtClient::await(uint32_t timeoutMs, AtReply& reply, bool stopOnPrompt) {
+  reply.clear();
+  AtEvent ev;
+  uint32_t start = clock_->nowMs();
+  for (;;) {
+    int c = readByte(start, timeoutMs);
+    if (c < 0) {
+      stats_.timeouts++;
+      return false;
+    }
+    if (!tokenizer_.push((uint8_t)c, ev)) continue;
+    note(ev);
+    if (reply.apply(ev)) return true;
+    if (stopOnPrompt && ev.type == AT_EVENT_PROMPT) return true;
+  }
+}
+
+bool AtClient::query(const char* cmd, uint32_t timeoutMs, AtReply& reply, bool stopOnPrompt) {
+  reply.clear();
+  if (!send(cmd)) return false;
+  return await(timeoutMs, reply, stopOnPrompt);
+}
+
+int32_t AtClient::readPayload(const char* prefix, char sep, uint8_t* out, size_t outSize, size_t& stored,
+                              uint32_t timeoutMs) {
+  stored = 0;
+  uint32_t start = clock_->nowMs();
+  size_t prefixLen = strlen(prefix);
+  size_t matched = 0;
+  int c;
+  while (matched < prefixLen) {
+    if ((c = readByte(start, timeoutMs)) < 0) break;
+    if (c == prefix[matched]) {
+      matched++;
+    } else {
+      matched = c == prefix[0] ? 1 : 0;
+    }
+  }
+  int32_t len = 0;
+  if (matched == prefixLen) {
+    while ((c = readByte(start, timeoutMs)) >= '0' && c <= '9') {
+      if (len < 1000000) len = len * 10 + (c - '0');
+    }
+    while (c >= 0 && c != sep) c = readByte(start, timeoutMs);
+    for (int32_t i = 0; c >= 0 && i < len; i++) {
+      if ((c = readByte(start, timeoutMs)) < 0) break;
+      if (stored < outSize) out[stored++] = (uint8_t)c;
+    }
+    if (c >= 0) return len;
+  }
+  stats_.timeouts++;
+  return -1;
+}
+
+bool AtClient::takeDataIndication(uint8_t cid) {
+  uint16_t bit = (uint16_t)(1u << cid);
+  bool pending = (dataPending_ & bit) != 0;
+  dataPending_ &= (uint16_t)~bit;
+  return pending;
+}
+
+bool AtClient::takeSocketClosed(uint8_t cid) {
+  uint16_t bit = (uint16_t)(1u << cid);
+  bool closed = (closed_ & bit) != 0;
+  closed_ &= (uint16_t)~bit;
+  return closed;
+}
+
+// ==== SIM7080 内蔵スタック ====
+
+Sim7080Backend::Sim7080Backend(AtClient& at) : at_(at), httpConfigured_(false) {
+  reply_.clear();
+  httpUrl_[0] = '\0';
+}
+
+bool Sim7080Backend::udpOpen(const char* host, uint16_t port, uint32_t timeoutMs) {
+  char cmd[96];
+  AtCommandWriter w(cmd, sizeof(cmd), "+CAOPEN=");
+  w.arg(0).arg(0).quoted("UDP").quoted(host).arg(port);
+  at_.query(w.c_str(), timeoutMs, reply_);
+  // OK に加えて +CAOPEN の結果が 0（成功）であること
+  return reply_.ok() && reply_.caopenResult <= 0;
+}
+
+ModemSendResult Sim7080Backend::udpSend(const uint8_t* data, size_t len) {
+  char cmd[24];
+  AtCommandWriter w(cmd, sizeof(cmd), "+CASEND=");
+  w.arg(0).arg((unsigned long)len);
+  if (!at_.query(w.c_str(), 1000, reply_, true) || !reply_.prompt) return MODEM_SEND_NOT_STARTED;
+  at_.writeRaw(data, len);
+  if (!at_.await(1000, reply_) || !reply_.ok()) return MODEM_SEND_FAILED;
+  return MODEM_SEND_OK;
+}
+
+void Sim7080Backend::udpClose() {
+  at_.query("+CACLOSE=0", 10000, reply_);
+}
+
+bool Sim7080Backend::mqttConnect(uint32_t timeoutMs) {
+  return at_.query("+SMCONN", timeoutMs, reply_) && reply_.ok();
+}
+
+bool Sim7080Backend::mqttConnected() {
+  if (!at_.query("+SMSTATE?", 5000, reply_) || !reply_.ok()) return false;
+  return reply_.smstate == 1 || reply_.smstate == 2;
+}
+
+ModemSendResult Sim7080Backend::mqttPublish(const char* topic, const uint8_t* payload, size_t len, int qos) {
+  // トピックが長すぎる・引用符を含む場合は組み立てに失敗し、送らない
+  char cmd[300];
+  AtCommandWriter w(cmd, sizeof(cmd), "+SMPUB=");
+  w.quoted(topic).arg((unsigned long)len).arg(qos).arg(0);
+  if (!at_.query(w.c_str(), 1000, reply_, true) || !reply_.prompt) return MODEM_SEND_NOT_STARTED;
+  at_.writeRaw(payload, len);
+  if (!at_.await(10000, reply_) || !reply_.ok()) return MODEM_SEND_FAILED;
+  return MODEM_SEND_OK;
+}
+
+void Sim7080Backend::mqttDisconnect() {
+  at_.query("+SMDISC", 10000, reply_);
+}
+
+int Sim7080Backend::httpGet(const char* host, uint16_t port, const char* path, char* body, size_t bodySize) {
+  if (bodySize > 0) body[0] = '\0';
+  char url[sizeof(httpUrl_)];
+  int n = snprintf(url, sizeof(url), "http://%s:%u", host, (unsigned)port);
+  if (n <= 0 || (size_t)n >= sizeof(url)) return -1;
+
+  char cmd[160];
+  // 設定は切断中のみ変更できる。同じ値は送り直さない
+  if (!httpConfigured_) {
+    httpConfigured_ = at_.query("+SHCONF=\"BODYLEN\",1024", 5000, reply_) && reply_.ok() &&
+                      at_.query("+SHCONF=\"HEADERLEN\",350", 5000, reply_) && reply_.ok();
+  }
+  if (strcmp(url, httpUrl_) != 0) {
+    AtCommandWriter w(cmd, sizeof(cmd), "+SHCONF=");
+    w.quoted("URL").quoted(url);
+    if (!at_.query(w.c_str(), 5000, reply_) || !reply_.ok()) return -1;
+    memcpy(httpUrl_, url, sizeof(httpUrl_));
+  }
+  if (!at_.query("+SHCONN", 30000, reply_) || !reply_.ok()) {
+    at_.query("+SHDISC", 5000, reply_);
+    return -1;
+  }
+
+  // +SHREQ の OK の後、応答の到着を URC（+SHREQ: "GET",<status>,<length>）で受ける
+  int status = -1;
+  int32_t length = 0;
+  AtCommandWriter req(cmd, sizeof(cmd), "+SHREQ=");
+  req.quoted(path).arg(1);
+  if (at_.query(req.c_str(), 5000, reply_) && reply_.ok()) {
+    uint32_t start = at_.clock()->nowMs();
+    AtEvent ev;
+    while (at_.clock()->nowMs() - start < 30000) {
+      if (!at_.next(ev, 30000 - (at_.clock()->nowMs() - start))) break;
+      if (ev.type != AT_EVENT_INFO || strncmp(ev.line, "+SHREQ:", 7) != 0) continue;
+      const char* p = strchr(ev.line, ',');
+      if (p == nullptr) break;
+      status = atoi(p + 1);
+      p = strchr(p + 1, ',');
+      length = p != nullptr ? atol(p + 1) : 0;
+      break;
+    }
+  }
+  if (status > 0 && length > 0 && bodySize > 0) {
+    AtCommandWriter rd(cmd, sizeof(cmd), "+SHREAD=");
+    rd.arg(0).arg((long)length);
+    size_t stored = 0;
+    if (at_.query(rd.c_str(), 5000, reply_) && reply_.ok() &&
+        at_.readPayload("+SHREAD: ", '\n', (uint8_t*)body, bodySize - 1, stored, 10000) >= 0) {
+      body[stored] = '\0';
+    } else {
+      status = -1;
+    }
+  }
+  at_.query("+SHDISC", 5000, reply_);
+  return status;
+}
+
+// ==== MQTT 3.1.1 のパケット ====
+
+static size_t putRemainingLength(uint8_t* out, size_t value) {
+  size_t n = 0;
+  do {
+    uint8_t b = value % 128;
+    value /= 128;
+    if (value > 0) b |= 0x80;
+    out[n++] = b;
+  } while (value > 0 && n < 4);
+  return n;
+}
+
+static size_t putString(uint8_t* out, const char* s, size_t len) {
+  out[0] = (uint8_t)(len >> 8);
+  out[1] = (uint8_t)len;
+  memcpy(out + 2, s, len);
+  return len + 2;
+}
+
+size_t mqttEncodeConnect(uint8_t* out, size_t outSize, const char* clientId, uint16_t keepAliveSec, bool cleanSession) {
+  size_t idLen = strlen(clientId);
+  size_t remaining = 10 + 2 + idLen;
+  if (idLen > 0xFFFF || 1 + 4 + remaining > outSize) return 0;
+  size_t n = 0;
+  out[n++] = 0x10;
+  n += putRemainingLength(out + n, remaining);
+  n += putString(out + n, "MQTT", 4);
+  out[n++] = 4;                              // プロトコルレベル（3.1.1）
+  out[n++] = cleanSession ? 0x02 : 0x00;     // 認証なし
+  out[n++] = (uint8_t)(keepAliveSec >> 8);
+  out[n++] = (uint8_t)keepAliveSec;
+  n += putString(out + n, clientId, idLen);
+  return n;
+}
+
+size_t mqttEncodePublishHeader(uint8_t* out, size_t outSize, const char* topic, size_t payloadLen, int qos,
+                               uint16_t packetId) {
+  size_t topicLen = strlen(topic);
+  size_t remaining = 2 + topicLen + (qos > 0 ? 2 : 0) + payloadLen;
+  if (topicLen > 0xFFFF || remaining > 268435455UL || 1 + 4 + remaining - payloadLen > outSize) return 0;
+  size_t n = 0;
+  out[n++] = (uint8_t)(0x30 | ((qos > 0 ? 1 : 0) << 1));
+  n += putRemainingLength(out + n, remaining);
+  n += putString(out + n, topic, topicLen);
+  if (qos > 0) {
+    out[n++] = (uint8_t)(packetId >> 8);
+    out[n++] = (uint8_t)packetId;
+  }
+  return n;
+}
+
+// ==== 汎用（TCP ソケット）====
+
+GenericBackend::GenericBackend(ModemSocket& mqttSocket, ModemSocket& httpSocket, SystemClock* clock)
+  : mqtt_(mqttSocket),
+    http_(httpSocket),
+    clock_(clock),
+    port_(0),
+    keepAliveSec_(0),
+    cleanSession_(true),
+    session_(false),
+    packetId_(0),
+    lastTxMs_(0) {
+  host_[0] = '\0';
+  clientId_[0] = '\0';
+}
+
+static void copyString(char* out, size_t outSize, const char* s) {
+  size_t n = strlen(s);
+  if (n >= outSize) n = outSize - 1;
+  memcpy(out, s, n);
+  out[n] = '\0';
+}
+
+void GenericBackend::setMqttSettings(const MqttSettings& settings) {
+  copyString(host_, sizeof(host_), settings.host);
+  copyString(clientId_, sizeof(clientId_), settings.clientId);
+  port_ = settings.port;
+  keepAliveSec_ = settings.keepAliveSec;
+  cleanSession_ = settings.cleanSession;
+}
+
+bool GenericBackend::mqttSettingsApplied(const MqttSettings& settings) const {
+  return strncmp(host_, settings.host, sizeof(host_) - 1) == 0 &&
+         strncmp(clientId_, settings.clientId, sizeof(clientId_) - 1) == 0 && port_ == settings.port &&
+         keepAliveSec_ == settings.keepAliveSec && cleanSession_ == settings.cleanSession;
+}
+
+int GenericBackend::readByte(ModemSocket& s, uint32_t startMs, uint32_t timeoutMs) {
+  for (;;) {
+    if (s.available() > 0) return s.read();
+    if (!s.connected()) return -1;
+    if (clock_->nowMs() - startMs >= timeoutMs) return -1;
+    clock_->sleepMs(1);
+  }
+}
+
+// expectedType のパケットが届くまで読み、可変ヘッダ以降を out に入れる（他の種別は読み捨てる）
+bool GenericBackend::readPacket(uint8_t expectedType, uint8_t* out, size_t outSize, uint32_t timeoutMs) {
+  uint32_t start = clock_->nowMs();
+  for (;;) {
+    int type = readByte(mqtt_, start, timeoutMs);
+    if (type < 0) return false;
+    size_t remaining = 0;
+    for (int shift = 0; shift < 28; shift += 7) {
+      int b = readByte(mqtt_, start, timeoutMs);
+      if (b < 0) return false;
+      remaining |= (size_t)(b & 0x7F) << shift;
+      if ((b & 0x80) == 0) break;
+    }
+    for (size_t i = 0; i < remaining; i++) {
+      int b = readByte(mqtt_, start, timeoutMs);
+      if (b < 0) return false;
+      if (i < outSize) out[i] = (uint8_t)b;
+    }
+    // 可変ヘッダが短すぎるパケットは不正として扱う
+    if (((uint8_t)type & 0xF0) == expectedType) return remaining >= outSize;
+  }
+}
+
+bool GenericBackend::mqttConnect(uint32_t timeoutMs) {
+  mqtt_.stop();
+  session_ = false;
+  if (host_[0] == '\0' || !mqtt_.connect(host_, port_, timeoutMs)) return false;
+  uint8_t pkt[96];
+  size_t n = mqttEncodeConnect(pkt, sizeof(pkt), clientId_, keepAliveSec_, cleanSession_);
+  uint8_t ack[2];
+  // CONNACK: セッション有無フラグ, リターンコード（0 = 受理）
+  if (n == 0 || mqtt_.write(pkt, n) != n || !readPacket(0x20, ack, sizeof(ack), timeoutMs) || ack[1] != 0) {
+    mqtt_.stop();
+    return false;
+  }
+  lastTxMs_ = clock_->nowMs();
+  session_ = true;
+  return true;
+}
+
+bool GenericBackend::mqttConnected() {
+  if (!session_) return false;
+  // キープアライブの1.5倍送らなければブローカー側で切断されている
+  if (!mqtt_.connected() ||
+      (keepAliveSec_ > 0 && clock_->nowMs() - lastTxMs_ >= (uint32_t)keepAliveSec_ * 1500u)) {
+    mqtt_.stop();
+    session_ = false;
+  }
+  return session_;
+}
+
+ModemSendResult GenericBackend::mqttPublish(const char* topic, const uint8_t* payload, size_t len, int qos) {
+  if (!mqttConnected()) return MODEM_SEND_NOT_STARTED;
+  // QoS 2 は扱わず QoS 1 で送る
+  if (qos > 1) qos = 1;
+  if (++packetId_ == 0) packetId_ = 1;
+  uint8_t header[300];
+  size_t n = mqttEncodePublishHeader(header, sizeof(header), topic, len, qos, packetId_);
+  if (n == 0) return MODEM_SEND_NOT_STARTED;
+  bool ok = mqtt_.write(header, n) == n && mqtt_.write(payload, len) == len;
+  lastTxMs_ = clock_->nowMs();
+  uint8_t ack[2];
+  if (ok && qos > 0) {
+    ok = readPacket(0x40, ack, sizeof(ack), 10000) && ack[0] == (uint8_t)(packetId_ >> 8) &&
+         ack[1] == (uint8_t)packetId_;
+  }
+  if (!ok) {
+    mqtt_.stop();
+    session_ = false;
+    return MODEM_SEND_FAILED;
+  }
+  return MODEM_SEND_OK;
+}
+
+void GenericBackend::mqttDisconnect() {
+  if (session_ && mqtt_.connected()) {
+    static const uint8_t DISCONNECT[2] = { 0xE0, 0x00 };
+    mqtt_.write(DISCONNECT, sizeof(DISCONNECT));
+  }
+  mqtt_.stop();
+  session_ = false;
+}
+
+int GenericBackend::httpGet(const char* host, uint16_t port, const char* path, char* body, size_t bodySize) {
+  if (bodySize > 0) body[0] = '\0';
+  char req[256];
+  int n = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", path, host);
+  if (n <= 0 || (size_t)n >= sizeof(req)) return -1;
+  http_.stop();
+  if (!http_.connect(host, port, 30000)) return -1;
+  if (http_.write((const uint8_t*)req, (size_t)n) != (size_t)n) {
+    http_.stop();
+    return -1;
+  }
+
+  // ステータス行とヘッダ（長い行は先頭だけ見る）
+  const uint32_t timeoutMs = 30000;
+  uint32_t start = clock_->nowMs();
+  int status = -1;
+  long contentLength = -1;
+  char line[96];
+  size_t lineLen = 0;
+  bool first = true;
+  for (;;) {
+    int c = readByte(http_, start, timeoutMs);
+    if (c < 0) {
+      http_.stop();
+      return -1;
+    }
+    if (c == '\r') continue;
+    if (c != '\n') {
+      if (lineLen + 1 < sizeof(line)) line[lineLen++] = (char)c;
+      continue;
+    }
+    line[lineLen] = '\0';
+    if (first) {
+      const char* sp = strchr(line, ' ');
+      status = sp != nullptr ? atoi(sp + 1) : -1;
+      first = false;
+    } else if (lineLen == 0) {
+      break;
+    } else if (strncasecmp(line, "Content-Length:", 15) == 0) {
+      contentLength = atol(line + 15);
+    }
+    lineLen = 0;
+  }
+
+  // 本文（Content-Length が無ければ切断まで）
+  size_t stored = 0;
+  for (long i = 0; contentLength < 0 || i < contentLength; i++) {
+    int c = readByte(http_, start, timeoutMs);
+    if (c < 0) break;
+    if (stored + 1 < bodySize) body[stored++] = (char)c;
+  }
+  if (bodySize > 0) body[stored] = '\0';
+  http_.stop();
+  return status;
+}
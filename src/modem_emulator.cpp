@@ -0,0 +1,457 @@
+#include "modem_emulator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool startsWith(const char* s, const char* prefix) {
+  return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+// "=" 以降のカンマ区切りの n 番目（0始まり）の数値
+static long argAt(const char* line, int index) {
+  const char* p = strchr(line, '=');
+  if (p == nullptr) return 0;
+  p++;
+  for (int i = 0; i < index && p != nullptr; i++) {
+    p = strchr(p, ',');
+    if (p != nullptr) p++;
+  }
+  return p != nullptr ? atol(p) : 0;
+}
+
+Sim7080Emulator::Sim7080Emulator(VirtualClock& clock, const EmulatorConfig& config)
+  : clock_(clock),
+    config_(config),
+    httpBody_(""),
+    lineLen_(0),
+    skipLf_(false),
+    pending_(PAYLOAD_NONE),
+    pendingCid_(0),
+    pendingQos_(0),
+    payloadRemaining_(0),
+    payloadLen_(0),
+    hostTxDoneUs_(0),
+    outLen_(0),
+    chunkHead_(0),
+    chunkCount_(0),
+    chunkPos_(0),
+    lastReadyUs_(0),
+    mqttConnected_(false),
+    httpLength_(0),
+    faults_(nullptr),
+    faultCount_(0),
+    networkCommands_(0) {
+  memset(sockets_, 0, sizeof(sockets_));
+  resetStats();
+}
+
+void Sim7080Emulator::resetStats() {
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+void Sim7080Emulator::setFaults(const EmulatorFault* faults, size_t count) {
+  faults_ = faults;
+  faultCount_ = faults != nullptr ? count : 0;
+  networkCommands_ = 0;
+}
+
+bool Sim7080Emulator::faultActive(EmulatorFaultKind kind, uint32_t* value) const {
+  uint64_t nowS = clock_.elapsedUs() / 1000000ULL;
+  for (size_t i = 0; i < faultCount_; i++) {
+    const EmulatorFault& f = faults_[i];
+    if (f.kind != kind || nowS < f.startS || nowS - f.startS >= f.durationS) continue;
+    if (value != nullptr) *value = f.value;
+    return true;
+  }
+  return false;
+}
+
+bool Sim7080Emulator::rejectNetworkCommand() {
+  bool reject = false;
+  if (faultActive(FAULT_OUTAGE)) {
+    // PDP が落ちるとソケットと MQTT のセッションも切れる（復旧後は張り直しが必要）
+    for (size_t i = 0; i < SOCKETS; i++) sockets_[i].open = false;
+    mqttConnected_ = false;
+    reject = true;
+  }
+  uint32_t every = 0;
+  if (!reject && faultActive(FAULT_ERROR, &every) && every > 0) {
+    reject = ++networkCommands_ % every == 0;
+  }
+  if (!reject) return false;
+  stats_.faultErrors++;
+  respond(config_.commandMs, "\r\nERROR\r\n");
+  return true;
+}
+
+void Sim7080Emulator::write(const uint8_t* data, size_t len) {
+  uint64_t now = clock_.elapsedUs();
+  hostTxDoneUs_ = (hostTxDoneUs_ > now ? hostTxDoneUs_ : now) + len * byteUs();
+  stats_.hostToModemBytes += len;
+  for (size_t i = 0; i < len; i++) {
+    uint8_t c = data[i];
+    if (skipLf_) {
+      skipLf_ = false;
+      if (c == '\n') continue;
+    }
+    if (payloadRemaining_ > 0) {
+      if (payloadLen_ < sizeof(payload_)) payload_[payloadLen_++] = c;
+      if (--payloadRemaining_ == 0) handlePayload();
+      continue;
+    }
+    if (c == '\r') {
+      line_[lineLen_] = '\0';
+      if (lineLen_ > 0) handleLine(line_);
+      lineLen_ = 0;
+      skipLf_ = true;
+    } else if (c != '\n' && lineLen_ + 1 < sizeof(line_)) {
+      line_[lineLen_++] = (char)c;
+    }
+  }
+}
+
+int Sim7080Emulator::read() {
+  if (chunkCount_ == 0) return -1;
+  Chunk& c = chunks_[chunkHead_];
+  if (clock_.elapsedUs() < c.readyUs + (chunkPos_ + 1) * byteUs()) return -1;
+  uint8_t b = out_[c.start + chunkPos_++];
+  if (chunkPos_ == c.len) {
+    chunkHead_ = (chunkHead_ + 1) % (sizeof(chunks_) / sizeof(chunks_[0]));
+    chunkCount_--;
+    chunkPos_ = 0;
+    if (chunkCount_ == 0) outLen_ = 0;
+  }
+  return b;
+}
+
+void Sim7080Emulator::respond(uint32_t delayMs, const char* text) {
+  respondBytes(delayMs, (const uint8_t*)text, strlen(text));
+}
+
+// 応答はコマンドがモデムに届き終わった時刻から delayMs 後に、前の応答の後ろへ続けて出る
+void Sim7080Emulator::respondBytes(uint32_t delayMs, const uint8_t* data, size_t len) {
+  const size_t maxChunks = sizeof(chunks_) / sizeof(chunks_[0]);
+  if (len == 0 || chunkCount_ == maxChunks) return;
+  if (outLen_ + len > sizeof(out_) && chunkCount_ > 0) {
+    // 読み終わった分を詰める
+    size_t offset = chunks_[chunkHead_].start;
+    memmove(out_, out_ + offset, outLen_ - offset);
+    outLen_ -= offset;
+    for (size_t i = 0; i < chunkCount_; i++) chunks_[(chunkHead_ + i) % maxChunks].start -= (uint16_t)offset;
+  }
+  if (outLen_ + len > sizeof(out_)) return;
+  uint64_t now = clock_.elapsedUs();
+  uint64_t ready = (hostTxDoneUs_ > now ? hostTxDoneUs_ : now) + (uint64_t)delayMs * 1000;
+  if (ready < lastReadyUs_) ready = lastReadyUs_;
+  Chunk& c = chunks_[(chunkHead_ + chunkCount_) % maxChunks];
+  c.readyUs = ready;
+  c.start = (uint16_t)outLen_;
+  c.len = (uint16_t)len;
+  memcpy(out_ + outLen_, data, len);
+  outLen_ += len;
+  chunkCount_++;
+  lastReadyUs_ = ready + len * byteUs();
+  stats_.modemToHostBytes += len;
+}
+
+void Sim7080Emulator::handleLine(const char* line) {
+  if (!startsWith(line, "AT")) return;
+  stats_.commands++;
+  char buf[96];
+  const uint32_t cmdMs = config_.commandMs;
+  uint32_t slowMs = 0;
+  if (faultActive(FAULT_SLOW, &slowMs) && slowMs > 0) {
+    // このコマンドへの応答を全てまとめて遅らせる
+    stats_.slowResponses++;
+    uint64_t now = clock_.elapsedUs();
+    hostTxDoneUs_ = (hostTxDoneUs_ > now ? hostTxDoneUs_ : now) + (uint64_t)slowMs * 1000;
+  }
+  bool network = startsWith(line, "AT+CAOPEN=") || startsWith(line, "AT+CASEND=") ||
+                 startsWith(line, "AT+SMCONN") || startsWith(line, "AT+SMPUB=") ||
+                 startsWith(line, "AT+SHCONN") || startsWith(line, "AT+SHREQ=");
+  if (network && rejectNetworkCommand()) return;
+
+  if (startsWith(line, "AT+CAOPEN=")) {
+    uint8_t cid = (uint8_t)argAt(line, 0);
+    if (cid >= SOCKETS) {
+      respond(cmdMs, "\r\nERROR\r\n");
+      return;
+    }
+    Socket& s = sockets_[cid];
+    s.open = true;
+    s.tcp = strstr(line, "\"TCP\"") != nullptr;
+    s.port = (uint16_t)atol(strrchr(line, ',') + 1);
+    s.inLen = 0;
+    s.rxLen = 0;
+    if (s.tcp) stats_.networkRoundTrips++;
+    snprintf(buf, sizeof(buf), "\r\n+CAOPEN: %u,0\r\n\r\nOK\r\n", (unsigned)cid);
+    respond(cmdMs + (s.tcp ? config_.rttMs : 0), buf);
+  } else if (startsWith(line, "AT+CACLOSE=")) {
+    uint8_t cid = (uint8_t)argAt(line, 0);
+    if (cid < SOCKETS) sockets_[cid].open = false;
+    respond(cmdMs, "\r\nOK\r\n");
+  } else if (startsWith(line, "AT+CASEND=")) {
+    uint8_t cid = (uint8_t)argAt(line, 0);
+    if (cid >= SOCKETS || !sockets_[cid].open) {
+      respond(cmdMs, "\r\nERROR\r\n");
+      return;
+    }
+    pending_ = PAYLOAD_CASEND;
+    pendingCid_ = cid;
+    payloadRemaining_ = (size_t)argAt(line, 1);
+    payloadLen_ = 0;
+    stats_.prompts++;
+    respond(cmdMs, "\r\n> ");
+  } else if (startsWith(line, "AT+CARECV=")) {
+    uint8_t cid = (uint8_t)argAt(line, 0);
+    size_t max = (size_t)argAt(line, 1);
+    Socket* s = cid < SOCKETS ? &sockets_[cid] : nullptr;
+    size_t n = s != nullptr ? (s->rxLen < max ? s->rxLen : max) : 0;
+    snprintf(buf, sizeof(buf), "\r\n+CARECV: %u,", (unsigned)n);
+    respond(cmdMs, buf);
+    if (n > 0) {
+      respondBytes(0, s->rx, n);
+      memmove(s->rx, s->rx + n, s->rxLen - n);
+      s->rxLen -= n;
+    }
+    respond(0, "\r\n\r\nOK\r\n");
+  } else if (startsWith(line, "AT+SMCONN")) {
+    // TCP 接続 + CONNECT/CONNACK
+    stats_.networkRoundTrips += 2;
+    mqttConnected_ = true;
+    respond(cmdMs + 2 * config_.rttMs, "\r\nOK\r\n");
+  } else if (startsWith(line, "AT+SMSTATE?")) {
+    if (faultActive(FAULT_OUTAGE)) mqttConnected_ = false;
+    snprintf(buf, sizeof(buf), "\r\n+SMSTATE: %d\r\n\r\nOK\r\n", mqttConnected_ ? 1 : 0);
+    respond(cmdMs, buf);
+  } else if (startsWith(line, "AT+SMDISC")) {
+    mqttConnected_ = false;
+    respond(cmdMs, "\r\nOK\r\n");
+  } else if (startsWith(line, "AT+SMPUB=")) {
+    const char* q = strchr(line, '"');
+    q = q != nullptr ? strchr(q + 1, '"') : nullptr;
+    if (q == nullptr || !mqttConnected_) {
+      respond(cmdMs, "\r\nERROR\r\n");
+      return;
+    }
+    pending_ = PAYLOAD_SMPUB;
+    payloadRemaining_ = (size_t)atol(q + 2);
+    const char* qos = strchr(q + 2, ',');
+    pendingQos_ = qos != nullptr ? (uint8_t)atoi(qos + 1) : 0;
+    payloadLen_ = 0;
+    stats_.prompts++;
+    respond(cmdMs, "\r\n> ");
+  } else if (startsWith(line, "AT+SHCONN")) {
+    stats_.networkRoundTrips++;
+    respond(cmdMs + config_.rttMs, "\r\nOK\r\n");
+  } else if (startsWith(line, "AT+SHREQ=")) {
+    stats_.networkRoundTrips++;
+    stats_.httpRequests++;
+    httpLength_ = strlen(httpBody_);
+    respond(cmdMs, "\r\nOK\r\n");
+    snprintf(buf, sizeof(buf), "\r\n+SHREQ: \"GET\",200,%u\r\n", (unsigned)httpLength_);
+    respond(config_.rttMs, buf);
+  } else if (startsWith(line, "AT+SHREAD=")) {
+    size_t n = (size_t)argAt(line, 1);
+    if (n > httpLength_) n = httpLength_;
+    respond(cmdMs, "\r\nOK\r\n");
+    snprintf(buf, sizeof(buf), "\r\n+SHREAD: %u\r\n", (unsigned)n);
+    respond(0, buf);
+    respondBytes(0, (const uint8_t*)httpBody_, n);
+    respond(0, "\r\n");
+  } else if (startsWith(line, "AT+CSQ") || startsWith(line, "AT+CESQ")) {
+    // RSRP の索引は dBm + 141（0..97）。CSQ は 6RB（LTE-M）の RSSI ≒ RSRP + 19 dB から (RSSI + 113) / 2
+    uint32_t weak = 0;
+    int rsrp = faultActive(FAULT_WEAK_SIGNAL, &weak) ? -(int)weak : config_.rsrpDbm;
+    int rsrpIndex = rsrp + 141 < 0 ? 0 : (rsrp + 141 > 97 ? 97 : rsrp + 141);
+    int csq = (rsrp + 19 + 113) / 2;
+    csq = csq < 0 ? 0 : (csq > 31 ? 31 : csq);
+    size_t n = 0;
+    n += snprintf(buf + n, sizeof(buf) - n, "\r\n");
+    if (startsWith(line, "AT+CSQ")) n += snprintf(buf + n, sizeof(buf) - n, "+CSQ: %d,99\r\n", csq);
+    if (strstr(line, "+CESQ") != nullptr) {
+      n += snprintf(buf + n, sizeof(buf) - n, "+CESQ: 99,99,255,255,20,%d\r\n", rsrpIndex);
+    }
+    snprintf(buf + n, sizeof(buf) - n, "\r\nOK\r\n");
+    respond(cmdMs, buf);
+  } else if (startsWith(line, "AT+CNACT?")) {
+    if (faultActive(FAULT_OUTAGE)) {
+      respond(cmdMs, "\r\n+CNACT: 0,0,\"0.0.0.0\"\r\n+CNACT: 1,0,\"0.0.0.0\"\r\n\r\nOK\r\n");
+    } else {
+      respond(cmdMs, "\r\n+CNACT: 0,1,\"10.0.0.1\"\r\n+CNACT: 1,0,\"0.0.0.0\"\r\n\r\nOK\r\n");
+    }
+  } else {
+    respond(cmdMs, "\r\nOK\r\n");
+  }
+}
+
+void Sim7080Emulator::handlePayload() {
+  PendingPayload kind = pending_;
+  pending_ = PAYLOAD_NONE;
+  if (kind == PAYLOAD_SMPUB) {
+    stats_.mqttMessages++;
+    if (pendingQos_ > 0) stats_.networkRoundTrips++;
+    respond(config_.commandMs + (pendingQos_ > 0 ? config_.rttMs : 0), "\r\nOK\r\n");
+    return;
+  }
+  Socket& s = sockets_[pendingCid_];
+  respond(config_.commandMs, "\r\nOK\r\n");
+  if (!s.tcp) {
+    stats_.udpDatagrams++;
+    return;
+  }
+  serverReceive(pendingCid_, payload_, payloadLen_);
+}
+
+void Sim7080Emulator::serverReply(uint8_t cid, const uint8_t* data, size_t len) {
+  Socket& s = sockets_[cid];
+  if (s.rxLen + len > sizeof(s.rx)) len = sizeof(s.rx) - s.rxLen;
+  memcpy(s.rx + s.rxLen, data, len);
+  s.rxLen += len;
+  stats_.networkRoundTrips++;
+  char buf[32];
+  snprintf(buf, sizeof(buf), "\r\n+CADATAIND: %u\r\n", (unsigned)cid);
+  respond(config_.rttMs, buf);
+}
+
+void Sim7080Emulator::serverReceive(uint8_t cid, const uint8_t* data, size_t len) {
+  Socket& s = sockets_[cid];
+  if (s.inLen + len > sizeof(s.in)) len = sizeof(s.in) - s.inLen;
+  memcpy(s.in + s.inLen, data, len);
+  s.inLen += len;
+
+  if (s.port != 1883) {
+    // HTTP: リクエストヘッダが揃ったら本文を返す
+    s.in[s.inLen < sizeof(s.in) ? s.inLen : sizeof(s.in) - 1] = '\0';
+    if (strstr((const char*)s.in, "\r\n\r\n") == nullptr) return;
+    stats_.httpRequests++;
+    char header[160];
+    size_t bodyLen = strlen(httpBody_);
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %u\r\nConnection: close\r\n\r\n",
+                     (unsigned)bodyLen);
+    uint8_t resp[sizeof(s.rx)];
+    size_t total = (size_t)n + bodyLen < sizeof(resp) ? (size_t)n + bodyLen : sizeof(resp);
+    memcpy(resp, header, (size_t)n);
+    memcpy(resp + n, httpBody_, total - (size_t)n);
+    s.inLen = 0;
+    serverReply(cid, resp, total);
+    return;
+  }
+
+  // MQTT ブローカー: 揃ったパケットから順に処理する
+  for (;;) {
+    if (s.inLen < 2) return;
+    size_t remaining = 0;
+    size_t h = 1;
+    for (int shift = 0; h < s.inLen && shift < 28; shift += 7) {
+      uint8_t b = s.in[h++];
+      remaining |= (size_t)(b & 0x7F) << shift;
+      if ((b & 0x80) == 0) break;
+    }
+    if (s.inLen < h + remaining) return;
+    uint8_t type = s.in[0] & 0xF0;
+    if (type == 0x10) {
+      static const uint8_t CONNACK[] = { 0x20, 0x02, 0x00, 0x00 };
+      serverReply(cid, CONNACK, sizeof(CONNACK));
+    } else if (type == 0x30) {
+      stats_.mqttMessages++;
+      uint8_t qos = (s.in[0] >> 1) & 0x03;
+      if (qos > 0) {
+        size_t topicLen = ((size_t)s.in[h] << 8) | s.in[h + 1];
+        const uint8_t* id = s.in + h + 2 + topicLen;
+        uint8_t puback[] = { 0x40, 0x02, id[0], id[1] };
+        serverReply(cid, puback, sizeof(puback));
+      }
+    } else if (type == 0xC0) {
+      static const uint8_t PINGRESP[] = { 0xD0, 0x00 };
+      serverReply(cid, PINGRESP, sizeof(PINGRESP));
+    } else if (type == 0xE0) {
+      s.open = false;
+    }
+    memmove(s.in, s.in + h + remaining, s.inLen - h - remaining);
+    s.inLen -= h + remaining;
+  }
+}
+
+// ==== TinyGSM のソケットを模したもの ====
+
+EmulatedTinyGsmSocket::EmulatedTinyGsmSocket(AtClient& at, uint8_t mux)
+  : at_(at), mux_(mux), connected_(false), rxLen_(0), rxPos_(0) {}
+
+bool EmulatedTinyGsmSocket::connect(const char* host, uint16_t port, uint32_t timeoutMs) {
+  char cmd[96];
+  AtReply reply;
+  rxLen_ = rxPos_ = 0;
+  at_.takeDataIndication(mux_);
+  at_.takeSocketClosed(mux_);
+  AtCommandWriter close(cmd, sizeof(cmd), "+CACLOSE=");
+  close.arg(mux_);
+  at_.query(close.c_str(), 1000, reply);
+  AtCommandWriter ssl(cmd, sizeof(cmd), "+CASSLCFG=");
+  ssl.arg(mux_).quoted("SSL").arg(0);
+  at_.query(ssl.c_str(), 1000, reply);
+  AtCommandWriter open(cmd, sizeof(cmd), "+CAOPEN=");
+  open.arg(mux_).arg(0).quoted("TCP").quoted(host).arg(port);
+  connected_ = at_.query(open.c_str(), timeoutMs, reply) && reply.ok() && reply.caopenResult == 0;
+  return connected_;
+}
+
+size_t EmulatedTinyGsmSocket::write(const uint8_t* data, size_t len) {
+  if (!connected_) return 0;
+  char cmd[24];
+  AtReply reply;
+  AtCommandWriter w(cmd, sizeof(cmd), "+CASEND=");
+  w.arg(mux_).arg((unsigned long)len);
+  if (!at_.query(w.c_str(), 10000, reply, true) || !reply.prompt) return 0;
+  at_.writeRaw(data, len);
+  if (!at_.await(10000, reply) || !reply.ok()) return 0;
+  return len;
+}
+
+// 受信済みの URC を見て、データ到着の通知があれば +CARECV で読む
+void EmulatedTinyGsmSocket::poll() {
+  AtEvent ev;
+  while (at_.next(ev, 0)) {
+  }
+  if (at_.takeSocketClosed(mux_)) connected_ = false;
+  if (rxPos_ < rxLen_ || !at_.takeDataIndication(mux_)) return;
+  char cmd[24];
+  AtCommandWriter w(cmd, sizeof(cmd), "+CARECV=");
+  w.arg(mux_).arg((unsigned long)sizeof(rx_));
+  if (!at_.send(w.c_str())) return;
+  size_t stored = 0;
+  at_.readPayload("+CARECV: ", ',', rx_, sizeof(rx_), stored, 5000);
+  AtReply reply;
+  at_.await(1000, reply);
+  rxLen_ = stored;
+  rxPos_ = 0;
+}
+
+int EmulatedTinyGsmSocket::available() {
+  if (rxPos_ >= rxLen_) poll();
+  return (int)(rxLen_ - rxPos_);
+}
+
+int EmulatedTinyGsmSocket::read() {
+  if (available() <= 0) return -1;
+  return rx_[rxPos_++];
+}
+
+bool EmulatedTinyGsmSocket::connected() {
+  if (rxPos_ < rxLen_) return true;
+  poll();
+  return connected_;
+}
+
+void EmulatedTinyGsmSocket::stop() {
+  if (!connected_) return;
+  char cmd[24];
+  AtReply reply;
+  AtCommandWriter w(cmd, sizeof(cmd), "+CACLOSE=");
+  w.arg(mux_);
+  at_.query(w.c_str(), 1000, reply);
+  connected_ = false;
+  rxLen_ = rxPos_ = 0;
+}
@@ -0,0 +1,197 @@
+#include "ota_delta.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t COPY_BLOCK = 256;
+
+static uint32_t readLe32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool parseDeltaHeader(const uint8_t* data, size_t len, DeltaHeader& h) {
+  if (len < DELTA_SIGNED_SIZE + 2) return false;
+  if (memcmp(data, DELTA_MAGIC, 4) != 0) return false;
+  h.oldSize = readLe32(data + 4);
+  memcpy(h.oldSha256, data + 8, 32);
+  h.newSize = readLe32(data + 40);
+  memcpy(h.newSha256, data + 44, 32);
+  h.sigLen = (uint16_t)(data[76] | (data[77] << 8));
+  if (h.sigLen == 0 || h.sigLen > DELTA_SIGNATURE_MAX) return false;
+  if (len < DELTA_SIGNED_SIZE + 2 + (size_t)h.sigLen) return false;
+  memcpy(h.sig, data + DELTA_SIGNED_SIZE + 2, h.sigLen);
+  h.size = DELTA_SIGNED_SIZE + 2 + h.sigLen;
+  return h.newSize > 0;
+}
+
+DeltaPatcher::DeltaPatcher(DeltaIo& io)
+  : io_(io), oldSize_(0), newSize_(0), copied_(0), inserted_(0), error_(nullptr) {
+  memset(&state_, 0, sizeof(state_));
+  state_.phase = DELTA_PHASE_ERROR;
+}
+
+void DeltaPatcher::begin(const DeltaHeader& h) {
+  DeltaPatchState st;
+  memset(&st, 0, sizeof(st));
+  st.patchOffset = h.size;
+  st.phase = DELTA_PHASE_OPCODE;
+  resume(h, st);
+}
+
+void DeltaPatcher::resume(const DeltaHeader& h, const DeltaPatchState& state) {
+  state_ = state;
+  oldSize_ = h.oldSize;
+  newSize_ = h.newSize;
+  copied_ = 0;
+  inserted_ = 0;
+  error_ = nullptr;
+  if (state_.phase == DELTA_PHASE_OPCODE && state_.outputOffset == newSize_) state_.phase = DELTA_PHASE_DONE;
+}
+
+bool DeltaPatcher::fail(const char* reason) {
+  state_.phase = DELTA_PHASE_ERROR;
+  error_ = reason;
+  return false;
+}
+
+bool DeltaPatcher::write(const uint8_t* data, size_t len) {
+  if (len > newSize_ - state_.outputOffset) return fail("output exceeds new image size");
+  if (!io_.writeNew(state_.outputOffset, data, len)) return fail("write failed");
+  state_.outputOffset += len;
+  return true;
+}
+
+// 引数がそろった命令を実行する
+bool DeltaPatcher::execute() {
+  if (state_.opcode == DELTA_OP_INSERT) {
+    state_.remaining = readLe32(state_.args);
+    if (state_.remaining > newSize_ - state_.outputOffset) return fail("insert exceeds new image size");
+    state_.phase = state_.remaining > 0 ? DELTA_PHASE_INSERT : DELTA_PHASE_OPCODE;
+    return true;
+  }
+
+  uint32_t src = readLe32(state_.args);
+  uint32_t len = readLe32(state_.args + 4);
+  if (src > oldSize_ || len > oldSize_ - src) return fail("copy source out of range");
+  if (len > newSize_ - state_.outputOffset) return fail("copy exceeds new image size");
+  uint8_t buf[COPY_BLOCK];
+  while (len > 0) {
+    size_t n = len < COPY_BLOCK ? len : COPY_BLOCK;
+    if (!io_.readOld(src, buf, n)) return fail("read failed");
+    if (!write(buf, n)) return false;
+    src += n;
+    len -= n;
+    copied_ += n;
+  }
+  state_.phase = DELTA_PHASE_OPCODE;
+  return true;
+}
+
+bool DeltaPatcher::feed(const uint8_t* data, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    switch (state_.phase) {
+      case DELTA_PHASE_OPCODE: {
+        uint8_t op = data[i++];
+        state_.patchOffset++;
+        if (op != DELTA_OP_COPY && op != DELTA_OP_INSERT) return fail("unknown opcode");
+        state_.opcode = op;
+        state_.argFill = 0;
+        state_.phase = DELTA_PHASE_ARGS;
+        break;
+      }
+      case DELTA_PHASE_ARGS: {
+        uint8_t need = state_.opcode == DELTA_OP_COPY ? 8 : 4;
+        while (i < len && state_.argFill < need) {
+          state_.args[state_.argFill++] = data[i++];
+          state_.patchOffset++;
+        }
+        if (state_.argFill == need && !execute()) return false;
+        break;
+      }
+      case DELTA_PHASE_INSERT: {
+        size_t n = len - i;
+        if (n > state_.remaining) n = state_.remaining;
+        if (!write(data + i, n)) return false;
+        i += n;
+        state_.patchOffset += n;
+        state_.remaining -= n;
+        inserted_ += n;
+        if (state_.remaining == 0) state_.phase = DELTA_PHASE_OPCODE;
+        break;
+      }
+      case DELTA_PHASE_DONE:
+        return fail("trailing data after end of image");
+      default:
+        return false;
+    }
+    if (state_.phase == DELTA_PHASE_OPCODE && state_.outputOffset == newSize_) state_.phase = DELTA_PHASE_DONE;
+  }
+  return true;
+}
+
+uint32_t fnv1a32(const char* s) {
+  uint32_t h = 2166136261UL;
+  while (*s) {
+    h ^= (uint8_t)*s++;
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+bool parseHttpUrl(const char* url, char* host, size_t hostSize, uint16_t& port, char* path, size_t pathSize) {
+  if (url == nullptr || strncmp(url, "http://", 7) != 0) return false;
+  const char* p = url + 7;
+  const char* hostEnd = p;
+  while (*hostEnd != '\0' && *hostEnd != ':' && *hostEnd != '/') hostEnd++;
+  size_t hostLen = (size_t)(hostEnd - p);
+  if (hostLen == 0 || hostLen >= hostSize) return false;
+  memcpy(host, p, hostLen);
+  host[hostLen] = '\0';
+
+  port = 80;
+  p = hostEnd;
+  if (*p == ':') {
+    char* end;
+    long v = strtol(p + 1, &end, 10);
+    if (end == p + 1 || v <= 0 || v > 65535) return false;
+    port = (uint16_t)v;
+    p = end;
+  }
+  if (*p == '\0') p = "/";
+  if (*p != '/') return false;
+  size_t pathLen = strlen(p);
+  if (pathLen >= pathSize) return false;
+  memcpy(path, p, pathLen + 1);
+  return true;
+}
+
+bool parseContentRange(const char* value, uint32_t& first, uint32_t& last, uint32_t& total) {
+  if (value == nullptr) return false;
+  while (*value == ' ') value++;
+  if (strncmp(value, "bytes", 5) != 0) return false;
+  value += 5;
+  char* end;
+  unsigned long a = strtoul(value, &end, 10);
+  if (end == value || *end != '-') return false;
+  value = end + 1;
+  unsigned long b = strtoul(value, &end, 10);
+  if (end == value || *end != '/') return false;
+  value = end + 1;
+  unsigned long t = strtoul(value, &end, 10);
+  if (end == value || b < a || b >= t) return false;
+  first = (uint32_t)a;
+  last = (uint32_t)b;
+  total = (uint32_t)t;
+  return true;
+}
+
+void formatHex(const uint8_t* data, size_t len, char* out) {
+  static const char HEX_DIGITS[] = "0123456789abcdef";
+  for (size_t i = 0; i < len; ++i) {
+    out[2 * i] = HEX_DIGITS[data[i] >> 4];
+    out[2 * i + 1] = HEX_DIGITS[data[i] & 0x0F];
+  }
+  out[2 * len] = '\0';
+}
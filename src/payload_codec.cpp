@@ -0,0 +1,498 @@
+#include "payload_codec.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "le_codec.h"
+
+static const float POW10[] = { 1.0f, 10.0f, 100.0f, 1000.0f, 10000.0f };
+
+const char* payloadFormatName(PayloadFormat f) {
+  switch (f) {
+    case FORMAT_CBOR: return "cbor";
+    case FORMAT_MSGPACK: return "msgpack";
+    default: return "json";
+  }
+}
+
+bool parsePayloadFormat(const char* name, PayloadFormat& f) {
+  if (name == nullptr) return false;
+  if (strcasecmp(name, "json") == 0) {
+    f = FORMAT_JSON;
+  } else if (strcasecmp(name, "cbor") == 0) {
+    f = FORMAT_CBOR;
+  } else if (strcasecmp(name, "msgpack") == 0 || strcasecmp(name, "messagepack") == 0) {
+    f = FORMAT_MSGPACK;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+uint16_t floatToHalf(float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+  uint32_t rawExp = (x >> 23) & 0xFF;
+  uint32_t mant = x & 0x7FFFFF;
+  if (rawExp == 0xFF) return sign | 0x7C00 | (mant ? 0x200 : 0);
+  int32_t exp = (int32_t)rawExp - 127 + 15;
+  if (exp >= 31) return sign | 0x7C00;
+  if (exp <= 0) {
+    // 非正規化数
+    if (exp < -10) return sign;
+    mant |= 0x800000;
+    uint32_t shift = (uint32_t)(14 - exp);
+    uint16_t h = (uint16_t)(mant >> shift);
+    uint32_t rem = mant & ((1UL << shift) - 1);
+    uint32_t halfway = 1UL << (shift - 1);
+    if (rem > halfway || (rem == halfway && (h & 1))) h++;
+    return sign | h;
+  }
+  uint16_t h = (uint16_t)(sign | ((uint32_t)exp << 10) | (mant >> 13));
+  uint32_t rem = mant & 0x1FFF;
+  // 桁上がりは指数部に伝播し、最大値を超えれば無限大になる
+  if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+  return h;
+}
+
+float halfToFloat(uint16_t h) {
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1F;
+  uint32_t mant = h & 0x3FF;
+  if (exp == 0) {
+    float v = ldexpf((float)mant, -24);
+    return sign ? -v : v;
+  }
+  uint32_t bits = exp == 31 ? (sign | 0x7F800000 | (mant << 13))
+                            : (sign | ((exp - 15 + 127) << 23) | (mant << 13));
+  float v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+const char* udpFrameFormatName(UdpFrameFormat f) {
+  switch (f) {
+    case UDP_FRAME_COMPACT: return "compact";
+    case UDP_FRAME_FLOAT_V2: return "float_v2";
+    default: return "float";
+  }
+}
+
+bool parseUdpFrameFormat(const char* name, UdpFrameFormat& f) {
+  if (name == nullptr) return false;
+  if (strcasecmp(name, "float") == 0) {
+    f = UDP_FRAME_FLOAT;
+  } else if (strcasecmp(name, "compact") == 0) {
+    f = UDP_FRAME_COMPACT;
+  } else if (strcasecmp(name, "float_v2") == 0) {
+    f = UDP_FRAME_FLOAT_V2;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+size_t udpReadingFrameSize(UdpFrameFormat f, bool withPosition) {
+  switch (f) {
+    case UDP_FRAME_COMPACT: return withPosition ? COMPACT_POSITION_FRAME_SIZE : COMPACT_READING_FRAME_SIZE;
+    case UDP_FRAME_FLOAT_V2: return FLOAT_V2_READING_FRAME_SIZE;
+    default: return FLOAT_READING_FRAME_SIZE;
+  }
+}
+
+static void putF32(uint8_t* p, float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  putU32(p, bits);
+}
+
+static float getF32(const uint8_t* p) {
+  uint32_t bits = getU32(p);
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+size_t encodeFloatReading(const ReadingValues& r, bool typed, uint8_t* out, size_t outSize) {
+  size_t size = typed ? FLOAT_V2_READING_FRAME_SIZE : FLOAT_READING_FRAME_SIZE;
+  if (outSize < size) return 0;
+  if (typed) *out++ = FLOAT_V2_READING_FRAME_TYPE;
+  putF32(out, r.co2);
+  putF32(out + 4, r.temp);
+  putF32(out + 8, r.humi);
+  putF32(out + 12, r.wind);
+  putU32(out + 16, r.ts);
+  return size;
+}
+
+bool decodeFloatReading(const uint8_t* in, size_t len, ReadingValues& r) {
+  if (len == FLOAT_V2_READING_FRAME_SIZE && in[0] == FLOAT_V2_READING_FRAME_TYPE) {
+    in++;
+  } else if (len != FLOAT_READING_FRAME_SIZE) {
+    return false;
+  }
+  r.co2 = getF32(in);
+  r.temp = getF32(in + 4);
+  r.humi = getF32(in + 8);
+  r.wind = getF32(in + 12);
+  r.ts = getU32(in + 16);
+  return true;
+}
+
+size_t encodeCompactReading(const ReadingValues& r, uint8_t status, uint8_t* out, size_t outSize,
+                            const ReadingPosition* pos) {
+  size_t size = pos != nullptr ? COMPACT_POSITION_FRAME_SIZE : COMPACT_READING_FRAME_SIZE;
+  if (outSize < size) return 0;
+  out[0] = pos != nullptr ? COMPACT_POSITION_VERSION : COMPACT_READING_VERSION;
+  out[1] = status;
+  putU16(out + 2, scaleU(r.co2, 1.0f));
+  putI16(out + 4, isfinite(r.temp) ? (int32_t)lroundf(fmaxf(fminf(r.temp, 400.0f), -400.0f) * 100.0f) : 0);
+  putU16(out + 6, scaleU(r.humi, 100.0f));
+  putU16(out + 8, scaleU(r.wind, 100.0f));
+  putU32(out + 10, r.ts);
+  if (pos != nullptr) {
+    putU32(out + 14, pos->valid ? (uint32_t)pos->latE6 : 0);
+    putU32(out + 18, pos->valid ? (uint32_t)pos->lonE6 : 0);
+    out[22] = pos->valid ? (uint8_t)scaleU(fminf(pos->hdop, 25.5f), 10.0f) : 0;
+    out[23] = pos->valid ? (uint8_t)(pos->ageS / 60 < 254 ? pos->ageS / 60 : 254) : 255;
+  }
+  return size;
+}
+
+bool decodeCompactReading(const uint8_t* in, size_t len, ReadingValues& r, uint8_t& status,
+                          ReadingPosition* pos) {
+  bool withPosition = len == COMPACT_POSITION_FRAME_SIZE && in[0] == COMPACT_POSITION_VERSION;
+  if (!withPosition && (len != COMPACT_READING_FRAME_SIZE || in[0] != COMPACT_READING_VERSION)) return false;
+  status = in[1];
+  r.co2 = getU16(in + 2);
+  r.temp = getI16(in + 4) / 100.0f;
+  r.humi = getU16(in + 6) / 100.0f;
+  r.wind = getU16(in + 8) / 100.0f;
+  r.ts = getU32(in + 10);
+  if (pos != nullptr) {
+    memset(pos, 0, sizeof(*pos));
+    if (withPosition && in[23] != 255) {
+      pos->valid = true;
+      pos->latE6 = (int32_t)getU32(in + 14);
+      pos->lonE6 = (int32_t)getU32(in + 18);
+      pos->hdop = in[22] / 10.0f;
+      pos->ageS = (uint32_t)in[23] * 60;
+    }
+  }
+  return true;
+}
+
+CompactWriter::CompactWriter(PayloadFormat format, uint8_t* buf, size_t capacity)
+  : format_(format), buf_(buf), cap_(capacity), len_(0), ok_(format != FORMAT_JSON) {}
+
+void CompactWriter::put(uint8_t b) {
+  if (!ok_ || len_ >= cap_) {
+    ok_ = false;
+    return;
+  }
+  buf_[len_++] = b;
+}
+
+void CompactWriter::putBE(uint32_t v, uint8_t bytes) {
+  for (int i = bytes - 1; i >= 0; --i) put((uint8_t)(v >> (8 * i)));
+}
+
+void CompactWriter::cborHead(uint8_t major, uint32_t v) {
+  uint8_t m = (uint8_t)(major << 5);
+  if (v < 24) {
+    put(m | (uint8_t)v);
+  } else if (v <= 0xFF) {
+    put(m | 24);
+    put((uint8_t)v);
+  } else if (v <= 0xFFFF) {
+    put(m | 25);
+    putBE(v, 2);
+  } else {
+    put(m | 26);
+    putBE(v, 4);
+  }
+}
+
+void CompactWriter::beginMap(uint8_t entries) {
+  if (format_ == FORMAT_CBOR) {
+    cborHead(5, entries);
+  } else if (entries < 16) {
+    put(0x80 | entries);
+  } else {
+    put(0xDE);
+    putBE(entries, 2);
+  }
+}
+
+void CompactWriter::key(const char* k) {
+  size_t n = strlen(k);
+  if (format_ == FORMAT_CBOR) {
+    cborHead(3, (uint32_t)n);
+  } else if (n < 32) {
+    put(0xA0 | (uint8_t)n);
+  } else {
+    put(0xD9);
+    put((uint8_t)n);
+  }
+  for (size_t i = 0; i < n; ++i) put((uint8_t)k[i]);
+}
+
+void CompactWriter::uintValue(uint32_t v) {
+  if (format_ == FORMAT_CBOR) {
+    cborHead(0, v);
+  } else if (v < 128) {
+    put((uint8_t)v);
+  } else if (v <= 0xFF) {
+    put(0xCC);
+    put((uint8_t)v);
+  } else if (v <= 0xFFFF) {
+    put(0xCD);
+    putBE(v, 2);
+  } else {
+    put(0xCE);
+    putBE(v, 4);
+  }
+}
+
+void CompactWriter::intValue(int32_t v) {
+  if (v >= 0) {
+    uintValue((uint32_t)v);
+    return;
+  }
+  if (format_ == FORMAT_CBOR) {
+    cborHead(1, (uint32_t)(-1 - v));
+  } else if (v >= -32) {
+    put((uint8_t)(int8_t)v);
+  } else if (v >= -128) {
+    put(0xD0);
+    put((uint8_t)(int8_t)v);
+  } else if (v >= -32768) {
+    put(0xD1);
+    putBE((uint16_t)(int16_t)v, 2);
+  } else {
+    put(0xD2);
+    putBE((uint32_t)v, 4);
+  }
+}
+
+void CompactWriter::floatValue(float v, uint8_t decimals) {
+  if (decimals >= sizeof(POW10) / sizeof(POW10[0])) decimals = sizeof(POW10) / sizeof(POW10[0]) - 1;
+  float scale = POW10[decimals];
+  if (isfinite(v)) {
+    float scaled = roundf(v * scale);
+    if (fabsf(scaled) < 2.0e9f) {
+      v = scaled / scale;
+      if ((float)(int32_t)v == v) {
+        intValue((int32_t)v);
+        return;
+      }
+    }
+  }
+  if (format_ == FORMAT_CBOR) {
+    uint16_t h = floatToHalf(v);
+    float back = halfToFloat(h);
+    // 半精度の誤差が丸め幅の半分以内（テキストの精度を損なわない）なら3バイトで送る
+    if (!isfinite(v) || fabsf(back - v) <= 0.5f / scale) {
+      put(0xF9);
+      putBE(h, 2);
+      return;
+    }
+    put(0xFA);
+  } else {
+    put(0xCA);
+  }
+  uint32_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  putBE(bits, 4);
+}
+
+size_t encodeReading(PayloadFormat f, const ReadingValues& r, uint8_t* out, size_t outSize,
+                     const ReadingPosition* pos) {
+  bool withPosition = pos != nullptr && pos->valid;
+  if (f == FORMAT_JSON) {
+    int n = snprintf((char*)out, outSize, "{\"co2\":%.1f,\"temp\":%.1f,\"humi\":%.1f,\"wind\":%.2f,\"ts\":%lu",
+                     r.co2, r.temp, r.humi, r.wind, (unsigned long)r.ts);
+    if (n <= 0 || (size_t)n >= outSize) return 0;
+    int m = withPosition
+              ? snprintf((char*)out + n, outSize - n, ",\"lat_e6\":%ld,\"lon_e6\":%ld,\"fix_age\":%lu}",
+                         (long)pos->latE6, (long)pos->lonE6, (unsigned long)pos->ageS)
+              : snprintf((char*)out + n, outSize - n, "}");
+    if (m <= 0 || (size_t)(n + m) >= outSize) return 0;
+    return (size_t)(n + m);
+  }
+  CompactWriter w(f, out, outSize);
+  w.beginMap(withPosition ? 8 : 5);
+  w.key("co2");
+  w.floatValue(r.co2, 1);
+  w.key("temp");
+  w.floatValue(r.temp, 1);
+  w.key("humi");
+  w.floatValue(r.humi, 1);
+  w.key("wind");
+  w.floatValue(r.wind, 2);
+  w.key("ts");
+  w.uintValue(r.ts);
+  if (withPosition) {
+    w.key("lat_e6");
+    w.intValue(pos->latE6);
+    w.key("lon_e6");
+    w.intValue(pos->lonE6);
+    w.key("fix_age");
+    w.uintValue(pos->ageS);
+  }
+  return w.size();
+}
+
+// ==== Decoder ====
+
+namespace {
+
+struct Reader {
+  const uint8_t* p;
+  const uint8_t* end;
+  bool ok;
+
+  uint8_t u8() {
+    if (p >= end) {
+      ok = false;
+      return 0;
+    }
+    return *p++;
+  }
+  uint32_t be(uint8_t bytes) {
+    uint32_t v = 0;
+    for (uint8_t i = 0; i < bytes; ++i) v = (v << 8) | u8();
+    return v;
+  }
+  uint64_t be64() {
+    uint64_t hi = be(4);
+    return (hi << 32) | be(4);
+  }
+  const char* bytes(size_t n) {
+    if ((size_t)(end - p) < n) {
+      ok = false;
+      return nullptr;
+    }
+    const char* s = (const char*)p;
+    p += n;
+    return s;
+  }
+};
+
+float bitsToFloat(uint32_t bits) {
+  float v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+double bitsToDouble(uint64_t bits) {
+  double v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+// CBOR: 先頭バイトの追加情報から値を読む
+uint32_t cborArg(Reader& r, uint8_t ai) {
+  if (ai < 24) return ai;
+  if (ai == 24) return r.u8();
+  if (ai == 25) return r.be(2);
+  if (ai == 26) return r.be(4);
+  r.ok = false;
+  return 0;
+}
+
+bool cborNumber(Reader& r, double& v) {
+  uint8_t ib = r.u8();
+  uint8_t major = ib >> 5;
+  uint8_t ai = ib & 0x1F;
+  if (major == 0) {
+    v = cborArg(r, ai);
+  } else if (major == 1) {
+    v = -1.0 - (double)cborArg(r, ai);
+  } else if (major == 7 && ai == 25) {
+    v = halfToFloat((uint16_t)r.be(2));
+  } else if (major == 7 && ai == 26) {
+    v = bitsToFloat(r.be(4));
+  } else if (major == 7 && ai == 27) {
+    v = bitsToDouble(r.be64());
+  } else {
+    return false;
+  }
+  return r.ok;
+}
+
+bool msgpackNumber(Reader& r, double& v) {
+  uint8_t b = r.u8();
+  if (b < 0x80) v = b;
+  else if (b >= 0xE0) v = (int8_t)b;
+  else if (b == 0xCC) v = r.u8();
+  else if (b == 0xCD) v = r.be(2);
+  else if (b == 0xCE) v = r.be(4);
+  else if (b == 0xD0) v = (int8_t)r.u8();
+  else if (b == 0xD1) v = (int16_t)r.be(2);
+  else if (b == 0xD2) v = (int32_t)r.be(4);
+  else if (b == 0xCA) v = bitsToFloat(r.be(4));
+  else if (b == 0xCB) v = bitsToDouble(r.be64());
+  else return false;
+  return r.ok;
+}
+
+void assignField(ReadingValues& out, ReadingPosition* pos, const char* key, size_t keyLen, double v) {
+  if (keyLen == 3 && memcmp(key, "co2", 3) == 0) out.co2 = (float)v;
+  else if (keyLen == 4 && memcmp(key, "temp", 4) == 0) out.temp = (float)v;
+  else if (keyLen == 4 && memcmp(key, "humi", 4) == 0) out.humi = (float)v;
+  else if (keyLen == 4 && memcmp(key, "wind", 4) == 0) out.wind = (float)v;
+  else if (keyLen == 2 && memcmp(key, "ts", 2) == 0) out.ts = (uint32_t)v;
+  else if (pos == nullptr) return;
+  else if (keyLen == 6 && memcmp(key, "lat_e6", 6) == 0) {
+    pos->latE6 = (int32_t)v;
+    pos->valid = true;
+  }
+  else if (keyLen == 6 && memcmp(key, "lon_e6", 6) == 0) pos->lonE6 = (int32_t)v;
+  else if (keyLen == 7 && memcmp(key, "fix_age", 7) == 0) pos->ageS = (uint32_t)v;
+}
+
+}  // namespace
+
+bool decodeReading(PayloadFormat f, const uint8_t* data, size_t len, ReadingValues& out,
+                   ReadingPosition* pos) {
+  if (f == FORMAT_JSON) return false;
+  if (pos != nullptr) memset(pos, 0, sizeof(*pos));
+  Reader r = { data, data + len, true };
+  uint32_t entries;
+  uint8_t b = r.u8();
+  if (f == FORMAT_CBOR) {
+    if ((b >> 5) != 5) return false;
+    entries = cborArg(r, b & 0x1F);
+  } else if ((b & 0xF0) == 0x80) {
+    entries = b & 0x0F;
+  } else if (b == 0xDE) {
+    entries = r.be(2);
+  } else {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < entries && r.ok; ++i) {
+    size_t keyLen;
+    b = r.u8();
+    if (f == FORMAT_CBOR) {
+      if ((b >> 5) != 3) return false;
+      keyLen = cborArg(r, b & 0x1F);
+    } else if ((b & 0xE0) == 0xA0) {
+      keyLen = b & 0x1F;
+    } else if (b == 0xD9) {
+      keyLen = r.u8();
+    } else {
+      return false;
+    }
+    const char* key = r.bytes(keyLen);
+    double v;
+    bool isNumber = f == FORMAT_CBOR ? cborNumber(r, v) : msgpackNumber(r, v);
+    if (!isNumber) return false;
+    assignField(out, pos, key, keyLen, v);
+  }
+  return r.ok && r.p == r.end;
+}
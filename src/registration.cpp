@@ -0,0 +1,127 @@
+#include "registration.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char* radioAccessName(RadioAccess rat) {
+  switch (rat) {
+    case RAT_CATM: return "Cat-M";
+    case RAT_NBIOT: return "NB-IoT";
+    default: return "unknown";
+  }
+}
+
+const char* radioAccessBandCfgName(RadioAccess rat) {
+  return rat == RAT_NBIOT ? "NB-IOT" : "CAT-M";
+}
+
+void clearRegistrationHint(RegistrationHint& hint) {
+  memset(&hint, 0, sizeof(hint));
+  hint.magic = REGISTRATION_HINT_MAGIC;
+}
+
+bool registrationHintValid(const RegistrationHint& hint) {
+  if (hint.magic != REGISTRATION_HINT_MAGIC) return false;
+  if (hint.rat != RAT_CATM && hint.rat != RAT_NBIOT) return false;
+  return hint.bands[0] != 0 || hint.bands[1] != 0 || hint.bands[2] != 0;
+}
+
+void addRegistrationBand(RegistrationHint& hint, uint8_t band) {
+  if (band == 0 || band > REGISTRATION_MAX_BAND) return;
+  hint.bands[band / 32] |= 1UL << (band % 32);
+}
+
+bool hasRegistrationBand(const RegistrationHint& hint, uint8_t band) {
+  if (band == 0 || band > REGISTRATION_MAX_BAND) return false;
+  return (hint.bands[band / 32] >> (band % 32)) & 1;
+}
+
+size_t formatBandList(const RegistrationHint& hint, char* out, size_t outSize) {
+  if (outSize == 0) return 0;
+  size_t len = 0;
+  out[0] = '\0';
+  for (uint8_t band = 1; band <= REGISTRATION_MAX_BAND; ++band) {
+    if (!hasRegistrationBand(hint, band)) continue;
+    int n = snprintf(out + len, outSize - len, len == 0 ? "%u" : ",%u", (unsigned)band);
+    if (n < 0 || (size_t)n >= outSize - len) {
+      out[len] = '\0';
+      break;
+    }
+    len += (size_t)n;
+  }
+  return len;
+}
+
+bool parseCpsi(const char* response, RadioAccess& rat, char* plmn, size_t plmnSize, uint8_t& band) {
+  const char* p = strstr(response, "+CPSI:");
+  if (p == nullptr) return false;
+  p += 6;
+  while (*p == ' ') p++;
+
+  if (strncmp(p, "LTE CAT-M1", 10) == 0) {
+    rat = RAT_CATM;
+  } else if (strncmp(p, "LTE NB-IOT", 10) == 0) {
+    rat = RAT_NBIOT;
+  } else {
+    return false;  // NO SERVICE / GSM など
+  }
+
+  // 3番目のフィールドが MCC-MNC（"440-10"）
+  const char* field = p;
+  for (int i = 0; i < 2 && field != nullptr; ++i) {
+    field = strchr(field, ',');
+    if (field != nullptr) field++;
+  }
+  if (field == nullptr || plmnSize < 2) return false;
+  size_t n = 0;
+  for (const char* c = field; *c != ',' && *c != '\0' && *c != '\r' && *c != '\n'; ++c) {
+    if (*c >= '0' && *c <= '9' && n + 1 < plmnSize) plmn[n++] = *c;
+  }
+  plmn[n] = '\0';
+  if (n < 5) return false;
+
+  const char* b = strstr(p, "EUTRAN-BAND");
+  if (b == nullptr) return false;
+  long v = strtol(b + 11, nullptr, 10);
+  if (v <= 0 || v > REGISTRATION_MAX_BAND) return false;
+  band = (uint8_t)v;
+  return true;
+}
+
+bool updateRegistrationHint(RegistrationHint& hint, RadioAccess rat, const char* plmn, uint8_t band) {
+  bool changed = false;
+  if (hint.magic != REGISTRATION_HINT_MAGIC || hint.rat != rat || strncmp(hint.plmn, plmn, sizeof(hint.plmn)) != 0) {
+    // 事業者や方式が変わったら、以前のバンド集合は使わない
+    clearRegistrationHint(hint);
+    hint.rat = rat;
+    strncpy(hint.plmn, plmn, sizeof(hint.plmn) - 1);
+    changed = true;
+  }
+  if (!hasRegistrationBand(hint, band)) {
+    addRegistrationBand(hint, band);
+    changed = true;
+  }
+  if (hint.successes < 0xFFFF) hint.successes++;
+  return changed;
+}
+
+void RegistrationStats::record(uint32_t ms, bool ok, bool fast, bool widenedSearch) {
+  attempts++;
+  lastMs = ms;
+  if (widenedSearch) widened++;
+  if (!ok) {
+    failures++;
+    return;
+  }
+  if (fast) fastHits++;
+  uint32_t successes = attempts - failures;
+  if (successes == 1 || ms < bestMs) bestMs = ms;
+  if (ms > worstMs) worstMs = ms;
+  totalMs += ms;
+}
+
+uint32_t RegistrationStats::averageMs() const {
+  uint32_t successes = attempts - failures;
+  return successes > 0 ? (uint32_t)(totalMs / successes) : 0;
+}
@@ -0,0 +1,109 @@
+#include "scheduler.h"
+
+#include <string.h>
+
+DeadlineScheduler::DeadlineScheduler() : count_(0) {
+  memset(timers_, 0, sizeof(timers_));
+}
+
+int DeadlineScheduler::add(const char* name, uint32_t periodMs, MissPolicy policy, uint32_t nowMs,
+                           uint32_t firstDelayMs, uint8_t maxCatchUp) {
+  if (count_ >= MAX_TIMERS || periodMs == 0) return -1;
+  Timer& t = timers_[count_];
+  memset(&t, 0, sizeof(t));
+  t.periodMs = periodMs;
+  t.dueMs = nowMs + firstDelayMs;
+  t.policy = policy;
+  t.maxCatchUp = maxCatchUp;
+  t.enabled = true;
+  t.stats.name = name;
+  return (int)count_++;
+}
+
+void DeadlineScheduler::setPeriod(int id, uint32_t periodMs, uint32_t nowMs) {
+  if (!valid(id) || periodMs == 0) return;
+  Timer& t = timers_[id];
+  if (t.periodMs == periodMs) return;
+  t.periodMs = periodMs;
+  t.dueMs = nowMs + periodMs;
+  t.pendingCatchUp = 0;
+}
+
+uint32_t DeadlineScheduler::period(int id) const {
+  return valid(id) ? timers_[id].periodMs : 0;
+}
+
+void DeadlineScheduler::setEnabled(int id, bool enabled) {
+  if (valid(id)) timers_[id].enabled = enabled;
+}
+
+void DeadlineScheduler::trigger(int id, uint32_t nowMs) {
+  if (valid(id)) timers_[id].dueMs = nowMs;
+}
+
+int DeadlineScheduler::poll(uint32_t nowMs) {
+  int best = -1;
+  int32_t bestLate = -1;
+  for (size_t i = 0; i < count_; ++i) {
+    const Timer& t = timers_[i];
+    if (!t.enabled || !reached(nowMs, t.dueMs)) continue;
+    int32_t late = (int32_t)(nowMs - t.dueMs);
+    if (late > bestLate) {
+      best = (int)i;
+      bestLate = late;
+    }
+  }
+  if (best < 0) return -1;
+
+  Timer& t = timers_[best];
+  uint32_t late = (uint32_t)bestLate;
+  t.stats.fired++;
+  t.stats.lastLateMs = late;
+  t.stats.totalLateMs += late;
+  if (late > t.stats.maxLateMs) t.stats.maxLateMs = late;
+
+  // 期限は前回期限基準で進める（ドリフトなし）
+  uint32_t missed = late / t.periodMs; // 今回の期限以降に過ぎた周期数
+  if (missed == 0) {
+    t.dueMs += t.periodMs;
+  } else if (t.policy == MISS_CATCH_UP && t.pendingCatchUp < t.maxCatchUp) {
+    // 逃した期限を1つずつ発火させる
+    uint32_t allowed = t.maxCatchUp - t.pendingCatchUp;
+    if (missed > allowed) {
+      // 上限を超える分は捨てて、直近 allowed 個だけ追いつく
+      t.stats.skipped += missed - allowed;
+      t.dueMs += (missed - allowed) * t.periodMs;
+    }
+    t.dueMs += t.periodMs;
+    t.pendingCatchUp++;
+  } else {
+    t.stats.skipped += missed;
+    t.dueMs += (missed + 1) * t.periodMs;
+  }
+  if (reached(nowMs, t.dueMs) == false || t.policy != MISS_CATCH_UP) {
+    t.pendingCatchUp = 0;
+  }
+  return best;
+}
+
+uint32_t DeadlineScheduler::msUntilNext(uint32_t nowMs) const {
+  uint32_t best = UINT32_MAX;
+  for (size_t i = 0; i < count_; ++i) {
+    const Timer& t = timers_[i];
+    if (!t.enabled) continue;
+    if (reached(nowMs, t.dueMs)) return 0;
+    uint32_t d = t.dueMs - nowMs;
+    if (d < best) best = d;
+  }
+  return best;
+}
+
+uint32_t DeadlineScheduler::msUntil(int id, uint32_t nowMs) const {
+  if (!valid(id) || !timers_[id].enabled) return UINT32_MAX;
+  const Timer& t = timers_[id];
+  return reached(nowMs, t.dueMs) ? 0 : t.dueMs - nowMs;
+}
+
+const TimerStats* DeadlineScheduler::stats(int id) const {
+  return valid(id) ? &timers_[id].stats : nullptr;
+}
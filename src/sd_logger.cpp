@@ -0,0 +1,402 @@
+#include "sd_logger.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "le_codec.h"
+#include "time_sync.h"
+
+static const uint8_t FLAG_SCD40_OK = 0x01;
+static const uint8_t FLAG_FS3000_OK = 0x02;
+static const uint8_t FLAG_UPTIME = 0x08;
+
+uint16_t crc16Ccitt(const uint8_t* data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; ++i) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int b = 0; b < 8; ++b) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+size_t encodeSdLogHeader(uint32_t epoch, uint32_t uptimeSec, const char* deviceId, uint16_t fileIndex,
+                         uint8_t* out, size_t outSize) {
+  if (outSize < SD_LOG_HEADER_SIZE) return 0;
+  memset(out, 0, SD_LOG_HEADER_SIZE);
+  putU32(out, SD_LOG_MAGIC);
+  out[4] = SD_LOG_VERSION;
+  out[5] = (uint8_t)SD_LOG_RECORD_SIZE;
+  putU16(out + 6, SD_LOG_HEADER_SIZE);
+  putU32(out + 8, epoch);
+  putU32(out + 12, uptimeSec);
+  if (deviceId != nullptr) strncpy((char*)out + 16, deviceId, 12);
+  putU16(out + 28, fileIndex);
+  putU16(out + 30, crc16Ccitt(out, 30));
+  return SD_LOG_HEADER_SIZE;
+}
+
+bool validSdLogHeader(const uint8_t* in, size_t len) {
+  return len >= SD_LOG_HEADER_SIZE && getU32(in) == SD_LOG_MAGIC && in[5] == SD_LOG_RECORD_SIZE &&
+         getU16(in + 30) == crc16Ccitt(in, 30);
+}
+
+size_t encodeSdLogRecord(const SdLogRecord& r, uint8_t seq, uint8_t* out, size_t outSize) {
+  if (outSize < SD_LOG_RECORD_SIZE) return 0;
+  uint8_t flags = 0;
+  if (r.scd40Ok) flags |= FLAG_SCD40_OK;
+  if (r.fs3000Ok) flags |= FLAG_FS3000_OK;
+  if (!r.epochTime) flags |= FLAG_UPTIME;
+  putU32(out, r.time);
+  putU16(out + 4, scaleU(r.co2, 1.0f));
+  putI16(out + 6, (int32_t)lroundf(r.temp * 100.0f));
+  putU16(out + 8, scaleU(r.humidity, 100.0f));
+  putU16(out + 10, scaleU(r.windSpeed, 100.0f));
+  out[12] = flags;
+  out[13] = seq;
+  putU16(out + 14, crc16Ccitt(out, 14));
+  return SD_LOG_RECORD_SIZE;
+}
+
+bool decodeSdLogRecord(const uint8_t* in, SdLogRecord& r, uint8_t& seq) {
+  if (getU16(in + 14) != crc16Ccitt(in, 14)) return false;
+  uint8_t flags = in[12];
+  r.time = getU32(in);
+  r.epochTime = (flags & FLAG_UPTIME) == 0;
+  r.co2 = getU16(in + 4);
+  r.temp = getI16(in + 6) / 100.0f;
+  r.humidity = getU16(in + 8) / 100.0f;
+  r.windSpeed = getU16(in + 10) / 100.0f;
+  r.scd40Ok = (flags & FLAG_SCD40_OK) != 0;
+  r.fs3000Ok = (flags & FLAG_FS3000_OK) != 0;
+  seq = in[13];
+  return true;
+}
+
+SdLogger::SdLogger(LogFileStore& store, const char* dir)
+  : store_(store),
+    dir_(dir),
+    maxFileBytes_(4UL * 1024 * 1024),
+    maxAgeMs_(60000),
+    head_(0),
+    tail_(0),
+    count_(0),
+    oldestMs_(0),
+    seq_(0),
+    open_(false),
+    fileDay_(0),
+    fileIndex_(0),
+    fileBytes_(0),
+    retryAtMs_(0),
+    retryPending_(false) {
+  deviceId_[0] = '\0';
+  path_[0] = '\0';
+  memset(&stats_, 0, sizeof(stats_));
+#ifdef ARDUINO
+  portMUX_INITIALIZE(&mux_);
+#endif
+}
+
+void SdLogger::lock() {
+#ifdef ARDUINO
+  portENTER_CRITICAL(&mux_);
+#endif
+}
+
+void SdLogger::unlock() {
+#ifdef ARDUINO
+  portEXIT_CRITICAL(&mux_);
+#endif
+}
+
+void SdLogger::configure(uint32_t maxFileBytes, uint32_t maxAgeMs) {
+  // 1ファイルにヘッダと少なくとも1ブロックが入る大きさにする
+  if (maxFileBytes < 2 * BLOCK_SIZE) maxFileBytes = 2 * BLOCK_SIZE;
+  maxFileBytes_ = maxFileBytes;
+  maxAgeMs_ = maxAgeMs;
+}
+
+void SdLogger::setDeviceId(const char* id) {
+  snprintf(deviceId_, sizeof(deviceId_), "%s", id != nullptr ? id : "");
+}
+
+bool SdLogger::append(const SdLogRecord& r, uint32_t nowMs) {
+  uint8_t rec[SD_LOG_RECORD_SIZE];
+  lock();
+  if (count_ + SD_LOG_RECORD_SIZE > BUFFER_SIZE) {
+    stats_.dropped++;
+    unlock();
+    return false;
+  }
+  encodeSdLogRecord(r, seq_++, rec, sizeof(rec));
+  // BUFFER_SIZE はレコード長の倍数なので、レコードがリングの端で分かれることはない
+  memcpy(buf_ + head_, rec, SD_LOG_RECORD_SIZE);
+  head_ = (head_ + SD_LOG_RECORD_SIZE) % BUFFER_SIZE;
+  if (count_ == 0) oldestMs_ = nowMs;
+  count_ += SD_LOG_RECORD_SIZE;
+  stats_.records++;
+  if (count_ > stats_.maxBuffered) stats_.maxBuffered = (uint32_t)count_;
+  unlock();
+  return true;
+}
+
+SdLogStats SdLogger::stats() const {
+  const_cast<SdLogger*>(this)->lock();
+  SdLogStats s = stats_;
+  const_cast<SdLogger*>(this)->unlock();
+  return s;
+}
+
+bool SdLogger::openFile(uint32_t nowMs, uint32_t day, uint32_t createdEpoch) {
+  store_.makeDir(dir_);
+  uint16_t first = day == fileDay_ ? fileIndex_ : 0;
+  for (uint16_t idx = first; idx < 100; ++idx) {
+    snprintf(path_, sizeof(path_), "%s/%08lu_%02u.bin", dir_, (unsigned long)day, (unsigned)idx);
+    int32_t size = store_.fileSize(path_);
+    if (size < 0) {
+      // 新規作成: ヘッダを書いて確定してからレコードを追記する
+      uint8_t header[SD_LOG_HEADER_SIZE];
+      encodeSdLogHeader(createdEpoch, nowMs / 1000, deviceId_, idx, header, sizeof(header));
+      if (!store_.openAppend(path_)) return false;
+      if (store_.write(header, sizeof(header)) != sizeof(header) || !store_.flush()) {
+        store_.close();
+        return false;
+      }
+      fileBytes_ = SD_LOG_HEADER_SIZE;
+    } else {
+      // 途中で切れた（電源断）・一杯のファイルには追記せず次の番号へ
+      if ((size_t)size < SD_LOG_HEADER_SIZE || (size - SD_LOG_HEADER_SIZE) % SD_LOG_RECORD_SIZE != 0) continue;
+      if ((uint32_t)size + BLOCK_SIZE > maxFileBytes_) continue;
+      if (!store_.openAppend(path_)) return false;
+      fileBytes_ = (uint32_t)size;
+    }
+    open_ = true;
+    fileDay_ = day;
+    fileIndex_ = idx;
+    retryPending_ = false;
+    return true;
+  }
+  path_[0] = '\0';
+  return false;
+}
+
+void SdLogger::closeFile() {
+  if (open_) store_.close();
+  open_ = false;
+}
+
+// リングの先頭から offset バイト目のレコードの日付（起動からの秒数のレコードは0）。ロックを保持して呼ぶ
+uint32_t SdLogger::recordDayAt(size_t offset, uint32_t* epoch) const {
+  const uint8_t* rec = buf_ + (tail_ + offset) % BUFFER_SIZE;
+  if (rec[12] & FLAG_UPTIME) return 0;
+  uint32_t t = getU32(rec);
+  if (epoch != nullptr) *epoch = t;
+  return epochToDayStamp(t);
+}
+
+// リングの先頭 len バイトを書き出して確定し、成功したらリングから取り除く
+bool SdLogger::writeChunk(size_t len) {
+  lock();
+  size_t first = BUFFER_SIZE - tail_;
+  if (first > len) first = len;
+  memcpy(stage_, buf_ + tail_, first);
+  if (len > first) memcpy(stage_ + first, buf_, len - first);
+  unlock();
+
+  uint32_t t0 = store_.nowUs();
+  size_t written = store_.write(stage_, len);
+  bool ok = written == len && store_.flush();
+  uint32_t us = store_.nowUs() - t0;
+
+  lock();
+  stats_.lastFlushUs = us;
+  if (us > stats_.maxFlushUs) stats_.maxFlushUs = us;
+  stats_.totalFlushUs += us;
+  if (ok) {
+    tail_ = (tail_ + len) % BUFFER_SIZE;
+    count_ -= len;
+    stats_.bytesWritten += (uint32_t)len;
+    stats_.blocks++;
+  } else {
+    stats_.errors++;
+  }
+  unlock();
+
+  if (ok) {
+    fileBytes_ += (uint32_t)len;
+  } else {
+    // 書きかけのファイルは以後使わない（再オープン時に端数のサイズで判別される）
+    closeFile();
+    fileIndex_++;
+  }
+  return ok;
+}
+
+bool SdLogger::service(uint32_t nowMs) {
+  return writeNext(nowMs, false);
+}
+
+void SdLogger::flushAll(uint32_t nowMs) {
+  while (buffered() > 0 && writeNext(nowMs, true)) {
+  }
+  closeFile();
+}
+
+// 次のブロックを書き出す（force なら滞留時間を待たずに端数も書き出す）。進捗があれば true
+bool SdLogger::writeNext(uint32_t nowMs, bool force) {
+  lock();
+  size_t avail = count_;
+  uint32_t oldest = oldestMs_;
+  uint32_t createdEpoch = 0;
+  uint32_t day = avail > 0 ? recordDayAt(0, &createdEpoch) : 0;
+  unlock();
+  if (avail == 0) return false;  // 記録が来るまでファイルを作らない
+
+  if (open_ && day != 0 && day != fileDay_) {
+    // 次のレコードから日付が変わる（前日分は書き出し済み）
+    closeFile();
+    lock();
+    stats_.rotations++;
+    unlock();
+  }
+
+  if (!open_) {
+    if (!force && retryPending_ && (int32_t)(nowMs - retryAtMs_) < 0) return false;
+    // 起動直後で時刻が未同期のレコードは直前に使っていた日付のファイルへ続ける
+    if (day == 0 && fileDay_ != 0) day = fileDay_;
+    if (!openFile(nowMs, day, createdEpoch)) {
+      lock();
+      stats_.errors++;
+      unlock();
+      retryPending_ = true;
+      retryAtMs_ = nowMs + RETRY_MS;
+      return false;
+    }
+  }
+
+  // ファイル上のオフセットが次のブロック境界に揃うまでの長さ（ヘッダ・レコード長とも16の倍数）
+  size_t room = BLOCK_SIZE - fileBytes_ % BLOCK_SIZE;
+  if (fileBytes_ + room > maxFileBytes_) {
+    closeFile();
+    fileIndex_++;
+    lock();
+    stats_.rotations++;
+    unlock();
+    return true;
+  }
+
+  // このファイルの日付のレコードだけをまとめる（日付の変わり目では端数でも書き出して切り替える）
+  size_t len = 0;
+  bool dayBoundary = false;
+  lock();
+  while (len < avail && len < room) {
+    uint32_t d = recordDayAt(len, nullptr);
+    if (d != 0 && d != fileDay_) {
+      dayBoundary = true;
+      break;
+    }
+    len += SD_LOG_RECORD_SIZE;
+  }
+  unlock();
+
+  bool partial = len < room;
+  if (partial && !force && !dayBoundary && nowMs - oldest < maxAgeMs_) return false;
+  if (partial) {
+    lock();
+    stats_.partialBlocks++;
+    unlock();
+  }
+  if (!writeChunk(len)) {
+    retryPending_ = true;
+    retryAtMs_ = nowMs + RETRY_MS;
+    return false;
+  }
+  return true;
+}
+
+#ifdef ARDUINO
+bool SdFileStore::makeDir(const char* path) {
+  return fs_.exists(path) || fs_.mkdir(path);
+}
+
+int32_t SdFileStore::fileSize(const char* path) {
+  if (!fs_.exists(path)) return -1;
+  fs::File f = fs_.open(path, FILE_READ);
+  if (!f) return -1;
+  int32_t size = (int32_t)f.size();
+  f.close();
+  return size;
+}
+
+bool SdFileStore::openAppend(const char* path) {
+  file_ = fs_.open(path, FILE_APPEND);
+  return (bool)file_;
+}
+
+size_t SdFileStore::write(const uint8_t* data, size_t len) {
+  return file_ ? file_.write(data, len) : 0;
+}
+
+bool SdFileStore::flush() {
+  if (!file_) return false;
+  file_.flush();
+  return true;
+}
+
+void SdFileStore::close() {
+  if (file_) file_.close();
+}
+#else
+#include <chrono>
+#include <sys/stat.h>
+#include <unistd.h>
+
+StdioFileStore::StdioFileStore(const char* root, bool sync)
+  : root_(root), sync_(sync), file_(nullptr) {
+  path_[0] = '\0';
+}
+
+const char* StdioFileStore::fullPath(const char* path) {
+  snprintf(path_, sizeof(path_), "%s%s", root_, path);
+  return path_;
+}
+
+bool StdioFileStore::makeDir(const char* path) {
+  struct stat st;
+  const char* p = fullPath(path);
+  return stat(p, &st) == 0 || mkdir(p, 0755) == 0;
+}
+
+int32_t StdioFileStore::fileSize(const char* path) {
+  struct stat st;
+  if (stat(fullPath(path), &st) != 0) return -1;
+  return (int32_t)st.st_size;
+}
+
+bool StdioFileStore::openAppend(const char* path) {
+  close();
+  file_ = fopen(fullPath(path), "ab");
+  return file_ != nullptr;
+}
+
+size_t StdioFileStore::write(const uint8_t* data, size_t len) {
+  return file_ != nullptr ? fwrite(data, 1, len, file_) : 0;
+}
+
+bool StdioFileStore::flush() {
+  if (file_ == nullptr || fflush(file_) != 0) return false;
+  return !sync_ || fsync(fileno(file_)) == 0;
+}
+
+void StdioFileStore::close() {
+  if (file_ != nullptr) fclose(file_);
+  file_ = nullptr;
+}
+
+uint32_t StdioFileStore::nowUs() {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
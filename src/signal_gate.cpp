@@ -0,0 +1,68 @@
+#include "signal_gate.h"
+
+#include <string.h>
+
+SignalGate::SignalGate() : weak_(false), deferring_(false), oldestDeferredMs_(0) {
+  memset(&stats_, 0, sizeof(stats_));
+  last_.csq = 99;
+  last_.rsrpDbm = 0;
+}
+
+void SignalGate::update(const SignalSample& s) {
+  last_ = s;
+  stats_.samples++;
+  if (s.rsrpDbm != 0) {
+    weak_ = s.rsrpDbm < (weak_ ? config_.recoverRsrpDbm : config_.weakRsrpDbm);
+  } else if (s.csq != 99) {
+    weak_ = s.csq < (weak_ ? config_.recoverCsq : config_.weakCsq);
+  } else {
+    weak_ = false;
+  }
+  if (weak_) stats_.weakSamples++;
+}
+
+bool SignalGate::shouldDefer(UplinkClass c, uint32_t nowMs) {
+  if (!enabled() || !weak_) return false;
+  if (c != UPLINK_ROUTINE) {
+    stats_.urgentWhileWeak++;
+    return false;
+  }
+  return !deferring_ || nowMs - oldestDeferredMs_ < config_.maxDeferMs;
+}
+
+void SignalGate::recordDeferred(uint32_t nowMs) {
+  stats_.deferred++;
+  if (!deferring_) {
+    deferring_ = true;
+    oldestDeferredMs_ = nowMs;
+  }
+}
+
+void SignalGate::recordFlush(uint16_t count, bool complete, uint32_t nowMs) {
+  stats_.flushedReadings += count;
+  if (count > stats_.maxBurst) stats_.maxBurst = count;
+  if (!complete || !deferring_) return;
+  uint32_t delay = nowMs - oldestDeferredMs_;
+  deferring_ = false;
+  stats_.flushes++;
+  if (weak_) stats_.forcedFlushes++;
+  if (delay > stats_.maxDelayMs) stats_.maxDelayMs = delay;
+  stats_.totalDelayMs += delay;
+}
+
+uint32_t SignalGate::deferredForMs(uint32_t nowMs) const {
+  return deferring_ ? nowMs - oldestDeferredMs_ : 0;
+}
+
+bool DeferredReadingQueue::push(const DeferredReading& r) {
+  if (full()) return false;
+  items_[(head_ + count_) % CAPACITY] = r;
+  count_++;
+  return true;
+}
+
+void DeferredReadingQueue::pop() {
+  if (count_ == 0) return;
+  head_ = (head_ + 1) % CAPACITY;
+  count_--;
+}
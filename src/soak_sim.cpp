@@ -0,0 +1,223 @@
+// ホストでのソーク（長期運用）のシミュレーション（-DSOAK_SIM 指定時のみ。pio run -e soak）
+// SIM7080 エミュレータと VirtualClock の上で、ファームウェアと同じ送信経路（Sim7080Backend +
+// TransportManager のフェイルオーバー）を指定の期間だけ回し、回線断・応答の遅れ・ERROR を
+// 毎日同じ時刻に注入した結果を実機と同じ SOAK レポート（JSON 1行）で出力する。
+//   .pio/build/soak/program 30d [--interval <秒>] [--mqtt] [--no-faults]
+// 期間は s/m/h/d の単位付き（単位なしは秒）。レポートは標準出力、1日毎の経過は標準エラーへ出す。
+// 空きヒープはホストでは測れないため heap は0のまま（ヒープの傾向は実機のレポートで見る）
+#ifdef SOAK_SIM
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modem_backend.h"
+#include "modem_emulator.h"
+#include "soak_stats.h"
+#include "system_clock.h"
+#include "transport.h"
+
+namespace {
+
+const uint32_t DAY_S = 86400;
+const uint32_t MAX_DURATION_S = 366 * DAY_S;
+const uint32_t RESTART_AFTER_FAILED_CYCLES = 10;  // 連続して送れなかった周期がこれに達したら再起動とみなす
+const uint32_t BOOT_MS = 30000;                   // 再起動からモデムの登録までの時間
+
+// 毎日繰り返す障害（時刻は 0:00 からの秒）
+const EmulatorFault DAILY_FAULTS[] = {
+  {  2 * 3600, 45 * 60,  FAULT_OUTAGE, 0 },     // 深夜の回線断 45分
+  {  9 * 3600, 30 * 60,  FAULT_SLOW,   3000 },  // 朝の混雑: +CASEND のプロンプト待ち（1秒）を超える遅れ
+  { 13 * 3600, 2 * 3600, FAULT_SLOW,   400 },   // 昼の緩い遅れ（タイムアウトには至らない）
+  { 18 * 3600, 3 * 3600, FAULT_ERROR,  7 },     // 夕方: 回線を使うコマンドの7回に1回が ERROR
+};
+const size_t DAILY_FAULT_COUNT = sizeof(DAILY_FAULTS) / sizeof(DAILY_FAULTS[0]);
+
+const char* const UDP_HOST = "uni.soracom.io";
+const uint16_t UDP_PORT = 23080;
+const char* const MQTT_TOPIC = "devices/m5stack-co2-000001/messages/events/";
+
+// "30d" / "12h" / "90m" / "3600s" / "3600" を秒に変換する（不正なら0）
+uint32_t parseDuration(const char* text) {
+  char* end = nullptr;
+  unsigned long value = strtoul(text, &end, 10);
+  if (end == text) return 0;
+  uint64_t unit = 1;
+  if (*end == 'm') unit = 60;
+  else if (*end == 'h') unit = 3600;
+  else if (*end == 'd') unit = DAY_S;
+  else if (*end != 's' && *end != '\0') return 0;
+  if (*end != '\0' && end[1] != '\0') return 0;
+  uint64_t seconds = (uint64_t)value * unit;
+  return seconds > MAX_DURATION_S ? 0 : (uint32_t)seconds;
+}
+
+// ファームウェアの送信経路（sendViaTransport / sendOnTransport）と同じ手順を
+// Sim7080Backend の上で行う。ソケット・セッションは失敗時に閉じ、次の送信で張り直す
+class SoakDevice {
+public:
+  SoakDevice(VirtualClock& clock, AtClient& at, Sim7080Backend& backend, TransportManager& transports)
+    : clock_(clock), at_(at), backend_(backend), transports_(transports),
+      udpOpen_(false), mqttSession_(false) {}
+
+  bool sendViaTransport(const uint8_t* frame, size_t frameSize, const uint8_t* json, size_t jsonLen) {
+    TransportId t = transports_.select(clock_.nowMs());
+    if (sendOnTransport(t, frame, frameSize, json, jsonLen)) return true;
+    TransportId next = transports_.select(clock_.nowMs());
+    if (next == t) return false;
+    return sendOnTransport(next, frame, frameSize, json, jsonLen);
+  }
+
+  // 遅れて届いた前の周期の応答を読み捨てる（ファームウェアの SerialAT の読み捨てに相当）
+  void drain() {
+    AtEvent ev;
+    while (at_.next(ev, 0)) {
+    }
+  }
+
+  // ESP.restart() 相当: セッションを失い、起動の間は何も送らない
+  void restart() {
+    udpOpen_ = false;
+    mqttSession_ = false;
+    clock_.sleepMs(BOOT_MS);
+    drain();
+  }
+
+private:
+  bool sendOnTransport(TransportId t, const uint8_t* frame, size_t frameSize, const uint8_t* json, size_t jsonLen) {
+    uint32_t t0 = clock_.nowMs();
+    bool ok;
+    size_t wireBytes;
+    if (t == TRANSPORT_MQTT) {
+      // 接続済みなら SMSTATE? を省き、失敗時だけ状態を確認して張り直す
+      if (!mqttSession_) {
+        mqttSession_ = backend_.mqttConnected() || backend_.mqttConnect(30000);
+      }
+      ok = mqttSession_ && backend_.mqttPublish(MQTT_TOPIC, json, jsonLen, 1) == MODEM_SEND_OK;
+      if (!ok) mqttSession_ = false;
+      wireBytes = estimateMqttWireBytes(strlen(MQTT_TOPIC), jsonLen, 1);
+    } else {
+      if (!udpOpen_) {
+        backend_.udpClose();
+        udpOpen_ = backend_.udpOpen(UDP_HOST, UDP_PORT, 20000);
+      }
+      ok = udpOpen_ && backend_.udpSend(frame, frameSize) == MODEM_SEND_OK;
+      if (!ok) udpOpen_ = false;
+      wireBytes = estimateUdpWireBytes(frameSize);
+    }
+    uint32_t now = clock_.nowMs();
+    transports_.report(t, ok, now - t0, wireBytes, now);
+    return ok;
+  }
+
+  VirtualClock& clock_;
+  AtClient& at_;
+  Sim7080Backend& backend_;
+  TransportManager& transports_;
+  bool udpOpen_;
+  bool mqttSession_;
+};
+
+void usage(const char* prog) {
+  fprintf(stderr, "usage: %s <duration: 3600s|90m|12h|30d> [--interval <s>] [--mqtt] [--no-faults]\n", prog);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint32_t durationS = argc > 1 ? parseDuration(argv[1]) : 0;
+  uint32_t intervalS = 60;
+  bool preferMqtt = false;
+  bool faults = true;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+      intervalS = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--mqtt") == 0) {
+      preferMqtt = true;
+    } else if (strcmp(argv[i], "--no-faults") == 0) {
+      faults = false;
+    } else {
+      durationS = 0;
+    }
+  }
+  if (durationS == 0 || intervalS == 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  // エミュレータは応答・ソケットのバッファを持ち大きいため静的に置く
+  static VirtualClock clock;
+  static Sim7080Emulator emulator(clock);
+  static AtClient at(emulator, &clock);
+  static Sim7080Backend backend(at);
+  static TransportManager transports;
+  static SoakStats stats;
+  SoakDevice device(clock, at, backend, transports);
+  MqttSettings settings = { "beam.soracom.io", 1883, "m5stack-co2-000001", 60, true };
+  backend.setMqttSettings(settings);
+  transports.setPreferred(preferMqtt ? TRANSPORT_MQTT : TRANSPORT_UDP);
+  soakReset(stats);
+
+  // 20バイトの float フレームと JSON（中身は送信の成否に影響しない）
+  uint8_t frame[20];
+  memset(frame, 0x5A, sizeof(frame));
+  static const char JSON[] = "{\"co2\":612.3,\"temp\":26.1,\"humi\":54.2,\"wind\":0.72,\"ts\":1714566896}";
+
+  EmulatorFault schedule[DAILY_FAULT_COUNT];
+  uint32_t day = UINT32_MAX;
+  uint32_t failedCycles = 0;
+  uint32_t atSeen = 0;
+  uint64_t nextUs = 0;
+  const uint64_t endUs = (uint64_t)durationS * 1000000ULL;
+
+  while (nextUs < endUs) {
+    if (clock.elapsedUs() < nextUs) clock.sleepUs(nextUs - clock.elapsedUs());
+    uint32_t nowS = (uint32_t)(clock.elapsedUs() / 1000000ULL);
+    if (nowS / DAY_S != day) {
+      if (day != UINT32_MAX) {
+        fprintf(stderr, "day %lu: sampled %lu delivered %lu restarts %lu failovers %lu\n",
+                (unsigned long)(day + 1), (unsigned long)stats.sampled, (unsigned long)stats.delivered,
+                (unsigned long)stats.restarts, (unsigned long)transports.failovers());
+      }
+      // 障害の予定を今日の時刻へずらす
+      day = nowS / DAY_S;
+      for (size_t i = 0; i < DAILY_FAULT_COUNT; i++) {
+        schedule[i] = DAILY_FAULTS[i];
+        schedule[i].startS += day * DAY_S;
+      }
+      emulator.setFaults(faults ? schedule : nullptr, DAILY_FAULT_COUNT);
+    }
+
+    device.drain();
+    soakRecordSample(stats);
+    uint32_t sampledAtMs = clock.nowMs();
+    bool ok = device.sendViaTransport(frame, sizeof(frame), (const uint8_t*)JSON, sizeof(JSON) - 1);
+    soakRecordSend(stats, ok, clock.nowMs() - sampledAtMs);
+
+    failedCycles = ok ? 0 : failedCycles + 1;
+    if (failedCycles >= RESTART_AFTER_FAILED_CYCLES) {
+      stats.restarts++;
+      failedCycles = 0;
+      device.restart();
+    }
+
+    // 送信が周期を超えた場合は次の周期に合わせる（スケジューラの MISS_SKIP と同じ）
+    nextUs += (uint64_t)intervalS * 1000000ULL;
+    while (nextUs < clock.elapsedUs()) nextUs += (uint64_t)intervalS * 1000000ULL;
+    stats.elapsedMs = clock.elapsedUs() / 1000;
+    stats.atCommands += at.stats().commands - atSeen;
+    atSeen = at.stats().commands;
+  }
+  stats.elapsedMs = endUs / 1000;
+
+  const EmulatorStats& es = emulator.stats();
+  fprintf(stderr, "emulator: commands %lu, fault errors %lu, slow responses %lu, AT timeouts %lu, failovers %lu\n",
+          (unsigned long)es.commands, (unsigned long)es.faultErrors, (unsigned long)es.slowResponses,
+          (unsigned long)at.stats().timeouts, (unsigned long)transports.failovers());
+  char report[384];
+  if (formatSoakReport(stats, report, sizeof(report)) == 0) return 1;
+  printf("SOAK: %s\n", report);
+  return 0;
+}
+
+#endif  // SOAK_SIM
@@ -0,0 +1,102 @@
+#include "soak_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void soakReset(SoakStats& s) {
+  memset(&s, 0, sizeof(s));
+  s.magic = SOAK_STATS_MAGIC;
+}
+
+bool soakValid(const SoakStats& s) {
+  return s.magic == SOAK_STATS_MAGIC && s.delivered <= s.attempted;
+}
+
+void soakRecordSample(SoakStats& s) {
+  s.sampled++;
+}
+
+void soakRecordSend(SoakStats& s, bool delivered, uint32_t latencyMs) {
+  s.attempted++;
+  if (!delivered) return;
+  s.delivered++;
+  size_t bucket = latencyMs / SOAK_LATENCY_BUCKET_MS;
+  if (bucket >= SOAK_LATENCY_BUCKETS) bucket = SOAK_LATENCY_BUCKETS - 1;
+  s.latency[bucket]++;
+  s.latencyTotalMs += latencyMs;
+  if (latencyMs > s.latencyMaxMs) s.latencyMaxMs = latencyMs;
+}
+
+void soakRecordHeap(SoakStats& s, uint32_t freeHeap) {
+  double x = (double)s.elapsedMs / 3600000.0;
+  double y = (double)freeHeap;
+  if (s.heapSamples == 0) {
+    s.heapFirst = freeHeap;
+    s.heapMin = freeHeap;
+  }
+  if (freeHeap < s.heapMin) s.heapMin = freeHeap;
+  s.heapLast = freeHeap;
+  s.heapSamples++;
+  s.heapSumX += x;
+  s.heapSumY += y;
+  s.heapSumXX += x * x;
+  s.heapSumXY += x * y;
+}
+
+uint32_t soakLatencyPercentile(const SoakStats& s, float percentile) {
+  if (s.delivered == 0) return 0;
+  // 順位 ceil(p/100 * n) のサンプルを含むバケット
+  uint64_t rank = (uint64_t)(percentile / 100.0f * s.delivered + 0.999f);
+  if (rank < 1) rank = 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < SOAK_LATENCY_BUCKETS; ++i) {
+    seen += s.latency[i];
+    if (seen >= rank) {
+      uint32_t upper = (uint32_t)(i + 1) * SOAK_LATENCY_BUCKET_MS;
+      return upper < s.latencyMaxMs ? upper : s.latencyMaxMs;
+    }
+  }
+  return s.latencyMaxMs;
+}
+
+float soakHeapSlope(const SoakStats& s) {
+  if (s.heapSamples < 2) return 0.0f;
+  double n = s.heapSamples;
+  double denom = n * s.heapSumXX - s.heapSumX * s.heapSumX;
+  if (denom <= 0.0) return 0.0f;
+  return (float)((n * s.heapSumXY - s.heapSumX * s.heapSumY) / denom);
+}
+
+float soakDeliveryRatio(const SoakStats& s) {
+  return s.sampled > 0 ? (float)s.delivered / s.sampled : 0.0f;
+}
+
+size_t formatSoakReport(const SoakStats& s, char* out, size_t outSize) {
+  float perReading = s.delivered > 0 ? (float)s.atCommands / s.delivered : 0.0f;
+  unsigned long avg = s.delivered > 0 ? (unsigned long)(s.latencyTotalMs / s.delivered) : 0;
+  int n = snprintf(out, outSize,
+                   "{\"elapsed_s\":%lu,\"restarts\":%lu,\"sampled\":%lu,\"attempted\":%lu,\"delivered\":%lu,"
+                   "\"delivery_ratio\":%.4f,\"latency_ms\":{\"p50\":%lu,\"p95\":%lu,\"p99\":%lu,\"max\":%lu,\"avg\":%lu},"
+                   "\"at_per_reading\":%.2f,\"heap\":{\"first\":%lu,\"last\":%lu,\"min\":%lu,\"slope_per_h\":%.1f}}",
+                   (unsigned long)(s.elapsedMs / 1000), (unsigned long)s.restarts, (unsigned long)s.sampled,
+                   (unsigned long)s.attempted, (unsigned long)s.delivered, soakDeliveryRatio(s),
+                   (unsigned long)soakLatencyPercentile(s, 50), (unsigned long)soakLatencyPercentile(s, 95),
+                   (unsigned long)soakLatencyPercentile(s, 99), (unsigned long)s.latencyMaxMs, avg,
+                   perReading, (unsigned long)s.heapFirst, (unsigned long)s.heapLast, (unsigned long)s.heapMin,
+                   soakHeapSlope(s));
+  return n > 0 && (size_t)n < outSize ? (size_t)n : 0;
+}
+
+void AtCommandCounter::feed(const uint8_t* data, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    uint8_t c = data[i];
+    if (c == '\r' || c == '\n') {
+      state_ = 0;
+    } else if (state_ == 0) {
+      state_ = (c == 'A' || c == 'a') ? 1 : 2;
+    } else if (state_ == 1) {
+      if (c == 'T' || c == 't') count_++;
+      state_ = 2;
+    }
+  }
+}
@@ -0,0 +1,65 @@
+#include "system_clock.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+VirtualClock::VirtualClock(uint64_t startUs)
+  : nowUs_(startUs), count_(0), seq_(0), sleeps_(0), sleptUs_(0), eventsRun_(0) {}
+
+bool VirtualClock::schedule(uint32_t delayMs, EventFn fn, void* ctx) {
+  if (count_ >= MAX_EVENTS || fn == nullptr) return false;
+  Event e = { nowUs_ + (uint64_t)delayMs * 1000, seq_++, fn, ctx };
+  // 挿入ソート（同時刻は後ろへ）
+  size_t i = count_;
+  while (i > 0 && events_[i - 1].atUs > e.atUs) {
+    events_[i] = events_[i - 1];
+    --i;
+  }
+  events_[i] = e;
+  count_++;
+  return true;
+}
+
+void VirtualClock::runDue(uint64_t untilUs) {
+  // イベントの中から新たに予約されたイベントも、期限内なら同じ待機の中で実行する
+  while (count_ > 0 && events_[0].atUs <= untilUs) {
+    Event e = events_[0];
+    for (size_t i = 1; i < count_; ++i) events_[i - 1] = events_[i];
+    count_--;
+    nowUs_ = e.atUs;
+    eventsRun_++;
+    e.fn(e.ctx, nowMs());
+  }
+}
+
+void VirtualClock::sleepUs(uint64_t us) {
+  uint64_t until = nowUs_ + us;
+  sleeps_++;
+  sleptUs_ += us;
+  runDue(until);
+  // イベント内の待機で既に先へ進んでいれば戻さない
+  if (nowUs_ < until) nowUs_ = until;
+}
+
+bool VirtualClock::runNext() {
+  if (count_ == 0) return false;
+  runDue(events_[0].atUs);
+  return true;
+}
+
+#ifdef ARDUINO
+
+uint32_t ArduinoClock::nowMs() {
+  return millis();
+}
+
+uint32_t ArduinoClock::nowUs() {
+  return micros();
+}
+
+void ArduinoClock::sleepMs(uint32_t ms) {
+  delay(ms);
+}
+
+#endif
@@ -0,0 +1,116 @@
+#include "time_sync.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// 1970-01-01 からの日数（proleptic グレゴリオ暦）
+static int64_t daysFromCivil(int y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  const int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = (unsigned)(y - era * 400);
+  const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t)doe - 719468;
+}
+
+uint32_t civilToEpoch(int year, int month, int day, int hour, int minute, int second, int tzQuarterHours) {
+  int64_t days = daysFromCivil(year, (unsigned)month, (unsigned)day);
+  int64_t secs = days * 86400 + hour * 3600 + minute * 60 + second;
+  secs -= (int64_t)tzQuarterHours * 15 * 60;
+  return secs < 0 ? 0 : (uint32_t)secs;
+}
+
+// 1970-01-01 からの日数 → 暦日（proleptic Gregorian）
+uint32_t epochToDayStamp(uint32_t epoch) {
+  if (epoch == 0) return 0;
+  int32_t z = (int32_t)(epoch / 86400) + 719468;
+  int32_t era = z / 146097;
+  uint32_t doe = (uint32_t)(z - era * 146097);
+  uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  int32_t y = (int32_t)yoe + era * 400;
+  uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  uint32_t mp = (5 * doy + 2) / 153;
+  uint32_t d = doy - (153 * mp + 2) / 5 + 1;
+  uint32_t m = mp < 10 ? mp + 3 : mp - 9;
+  if (m <= 2) y++;
+  return (uint32_t)y * 10000 + m * 100 + d;
+}
+
+bool parseCclk(const char* response, uint32_t& epochSec) {
+  const char* p = strstr(response, "+CCLK:");
+  if (p == nullptr) return false;
+  p = strchr(p, '"');
+  if (p == nullptr) return false;
+  int yy, mo, dd, hh, mi, ss, tz = 0;
+  char sign = '+';
+  int n = sscanf(p + 1, "%d/%d/%d,%d:%d:%d%c%d", &yy, &mo, &dd, &hh, &mi, &ss, &sign, &tz);
+  if (n < 6) return false;
+  if (n == 8 && sign == '-') tz = -tz;
+  if (n < 8) tz = 0;
+  int year = yy < 100 ? 2000 + yy : yy;
+  // モデム未同期時の既定値（80/01/06 など）は無効とする
+  if (year < 2020 || mo < 1 || mo > 12 || dd < 1 || dd > 31 || hh > 23 || mi > 59 || ss > 60) return false;
+  epochSec = civilToEpoch(year, mo, dd, hh, mi, ss, tz);
+  return true;
+}
+
+TimeSync::TimeSync()
+  : synced_(false),
+    refMono_(0),
+    refEpochMs_(0),
+    driftPpm_(0),
+    lastOffsetMs_(0),
+    syncCount_(0),
+    anchorMono_(0),
+    anchorEpochMs_(0),
+    driftEstimates_(0) {}
+
+void TimeSync::sync(uint32_t monoMs, uint32_t epochSec) {
+  uint64_t epochMs = (uint64_t)epochSec * 1000;
+  bool reanchor = !synced_;
+  if (synced_) {
+    int64_t predicted = (int64_t)epochMsAt(monoMs);
+    lastOffsetMs_ = (int32_t)((int64_t)epochMs - predicted);
+
+    // 基準点からの経過（millis() の生の値）と UTC の進みを比べる。
+    // 接続のたびに行う短い間隔の同期は時刻合わせにのみ使い、ドリフトには使わない
+    uint32_t elapsed = monoMs - anchorMono_;
+    if (elapsed >= MIN_DRIFT_BASELINE_MS) {
+      int64_t rawOffset = (int64_t)epochMs - (int64_t)anchorEpochMs_ - (int64_t)elapsed;
+      if (rawOffset > MIN_DRIFT_OFFSET_MS || rawOffset < -MIN_DRIFT_OFFSET_MS) {
+        float observed = (float)((double)rawOffset * 1e6 / (double)elapsed);
+        // 平滑化（指数移動平均）
+        float next = driftEstimates_ > 0 ? driftPpm_ * 0.5f + observed * 0.5f : observed;
+        if (next > MAX_DRIFT_PPM) next = MAX_DRIFT_PPM;
+        if (next < -MAX_DRIFT_PPM) next = -MAX_DRIFT_PPM;
+        driftPpm_ = next;
+        driftEstimates_++;
+        reanchor = true;
+      } else if (elapsed >= MAX_DRIFT_BASELINE_MS) {
+        // 1週間でも分解能に届かない＝実質ドリフトなし。基準点を更新して推定をやり直す
+        reanchor = true;
+      }
+    }
+  }
+  if (reanchor) {
+    anchorMono_ = monoMs;
+    anchorEpochMs_ = epochMs;
+  }
+  refMono_ = monoMs;
+  refEpochMs_ = epochMs;
+  synced_ = true;
+  syncCount_++;
+}
+
+uint64_t TimeSync::epochMsAt(uint32_t monoMs) const {
+  if (!synced_) return 0;
+  // 同期点より前の時刻（サンプル時刻が同期直前など）は符号付きで扱う
+  int32_t delta = (int32_t)(monoMs - refMono_);
+  double corrected = (double)delta * (1.0 + driftPpm_ * 1e-6);
+  int64_t ms = (int64_t)refEpochMs_ + (int64_t)corrected;
+  return ms < 0 ? 0 : (uint64_t)ms;
+}
+
+uint32_t TimeSync::epochAt(uint32_t monoMs) const {
+  return (uint32_t)(epochMsAt(monoMs) / 1000);
+}
@@ -0,0 +1,137 @@
+#include "transport.h"
+
+#include <string.h>
+
+static const float SUCCESS_EWMA_ALPHA = 0.2f;
+static const float LATENCY_EWMA_ALPHA = 0.25f;
+static const size_t IPV4_HEADER = 20;
+static const size_t UDP_HEADER = 8;
+static const size_t TCP_HEADER = 20;
+
+const char* transportName(TransportId t) {
+  return t == TRANSPORT_MQTT ? "MQTT" : "UDP";
+}
+
+size_t estimateUdpWireBytes(size_t payloadSize) {
+  return payloadSize + UDP_HEADER + IPV4_HEADER;
+}
+
+size_t estimateMqttWireBytes(size_t topicLen, size_t payloadSize, int qos) {
+  // PUBLISH: 固定ヘッダ(1) + 残り長(1..4) + トピック長(2) + トピック + パケットID(QoS1以上) + 本文
+  size_t remaining = 2 + topicLen + (qos > 0 ? 2 : 0) + payloadSize;
+  size_t lengthBytes = remaining < 128 ? 1 : remaining < 16384 ? 2 : remaining < 2097152 ? 3 : 4;
+  size_t bytes = 1 + lengthBytes + remaining + TCP_HEADER + IPV4_HEADER;
+  // サーバーからの TCP ACK
+  bytes += TCP_HEADER + IPV4_HEADER;
+  if (qos > 0) {
+    // PUBACK(4) とそれに対する ACK
+    bytes += 4 + 2 * (TCP_HEADER + IPV4_HEADER);
+  }
+  return bytes;
+}
+
+TransportManager::TransportManager(const TransportConfig& config)
+  : config_(config),
+    preferred_(TRANSPORT_UDP),
+    failedOver_(false),
+    failoverUntilMs_(0),
+    currentCooldownMs_(config.cooldownMs),
+    failovers_(0) {
+  memset(stats_, 0, sizeof(stats_));
+  for (int i = 0; i < TRANSPORT_COUNT; ++i) {
+    available_[i] = true;
+    stats_[i].successRate = 1.0f;
+  }
+}
+
+void TransportManager::setPreferred(TransportId t) {
+  if (t == preferred_) return;
+  preferred_ = t;
+  failedOver_ = false;
+  currentCooldownMs_ = config_.cooldownMs;
+}
+
+void TransportManager::setAvailable(TransportId t, bool available) {
+  available_[t] = available;
+}
+
+bool TransportManager::degraded(TransportId t) const {
+  const TransportStats& s = stats_[t];
+  return s.consecutiveFailures >= config_.failoverAfter
+      || (s.attempts >= config_.failoverAfter && s.successRate < config_.minSuccessRate);
+}
+
+TransportId TransportManager::select(uint32_t nowMs) {
+  if (!config_.failoverEnabled) return preferred_;
+  TransportId alt = alternate(preferred_);
+  if (!available_[preferred_]) {
+    return available_[alt] ? alt : preferred_;
+  }
+  if (!failedOver_) return preferred_;
+
+  // クールダウン経過: 優先経路を試す（プローブ）
+  if ((int32_t)(nowMs - failoverUntilMs_) >= 0) return preferred_;
+
+  // 代替経路も劣化している場合はリンクコストの小さい方を使う
+  if (!available_[alt]) return preferred_;
+  if (degraded(alt) && linkCost(preferred_) < linkCost(alt)) return preferred_;
+  return alt;
+}
+
+bool TransportManager::report(TransportId t, bool ok, uint32_t latencyMs, size_t wireBytes, uint32_t nowMs) {
+  TransportStats& s = stats_[t];
+  s.attempts++;
+  s.wireBytes += wireBytes;
+  s.lastUsedMs = nowMs;
+  s.successRate += SUCCESS_EWMA_ALPHA * ((ok ? 1.0f : 0.0f) - s.successRate);
+  if (ok) {
+    s.delivered++;
+    s.consecutiveFailures = 0;
+    s.latencyMs = s.delivered == 1 ? (float)latencyMs
+                                   : s.latencyMs + LATENCY_EWMA_ALPHA * ((float)latencyMs - s.latencyMs);
+  } else if (s.consecutiveFailures < 0xFFFF) {
+    s.consecutiveFailures++;
+  }
+
+  if (!config_.failoverEnabled || t != preferred_) return false;
+
+  if (!failedOver_) {
+    if (!ok && degraded(t) && available_[alternate(t)]) {
+      failedOver_ = true;
+      currentCooldownMs_ = config_.cooldownMs;
+      failoverUntilMs_ = nowMs + currentCooldownMs_;
+      failovers_++;
+      return true;
+    }
+    return false;
+  }
+
+  // フェイルオーバー中の優先経路の結果（プローブ）
+  if (ok) {
+    failedOver_ = false;
+    currentCooldownMs_ = config_.cooldownMs;
+    return true;
+  }
+  uint32_t next = currentCooldownMs_ * 2;
+  currentCooldownMs_ = next > config_.maxCooldownMs || next < currentCooldownMs_ ? config_.maxCooldownMs : next;
+  failoverUntilMs_ = nowMs + currentCooldownMs_;
+  return false;
+}
+
+float TransportManager::bytesPerDelivered(TransportId t) const {
+  const TransportStats& s = stats_[t];
+  if (s.delivered == 0) return (float)s.wireBytes;
+  return (float)((double)s.wireBytes / s.delivered);
+}
+
+float TransportManager::linkCost(TransportId t) const {
+  const TransportStats& s = stats_[t];
+  float rate = s.successRate < 0.05f ? 0.05f : s.successRate;
+  return (s.latencyMs + bytesPerDelivered(t) * config_.msPerByte) / rate;
+}
+
+uint32_t TransportManager::cooldownRemainingMs(uint32_t nowMs) const {
+  if (!failedOver_) return 0;
+  int32_t left = (int32_t)(failoverUntilMs_ - nowMs);
+  return left > 0 ? (uint32_t)left : 0;
+}
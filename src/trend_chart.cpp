@@ -0,0 +1,111 @@
+#include "trend_chart.h"
+
+// これより離れた点は欠測として線で結ばない
+static const int16_t MAX_CONNECT_COLUMNS = 16;
+
+TrendChart::TrendChart(TrendCanvas& canvas, int16_t x, int16_t y, int16_t w, int16_t h)
+  : canvas_(canvas), x_(x), y_(y), w_(w), h_(h),
+    span_(TREND_SPAN_1H), alarmPpm_(1500), yMax_(Y_MAX_PPM),
+    hasLast_(false), lastT_(0), lastCol_(0), lastRow_(0), appended_(0) {}
+
+void TrendChart::configure(TrendSpan span, uint16_t alarmPpm) {
+  span_ = span;
+  alarmPpm_ = alarmPpm;
+  hasLast_ = false;
+}
+
+int16_t TrendChart::columnOf(uint32_t t) const {
+  return (int16_t)(((uint64_t)t * w_ / spanSeconds()) % w_);
+}
+
+int16_t TrendChart::rowOf(uint16_t v) const {
+  if (v < Y_MIN_PPM) v = Y_MIN_PPM;
+  if (v > yMax_) v = yMax_;
+  return (int16_t)(y_ + h_ - 1 - (int32_t)(v - Y_MIN_PPM) * (h_ - 1) / (yMax_ - Y_MIN_PPM));
+}
+
+uint16_t TrendChart::colorOf(uint16_t v) const {
+  if (v >= alarmPpm_) return COLOR_ALARM;
+  if (v >= WARN_PPM) return COLOR_WARN;
+  return COLOR_OK;
+}
+
+// 列を背景で塗り、目盛り線（1000ppm と警報しきい値の点線）を描き直す
+void TrendChart::eraseColumns(int16_t from, int16_t count) {
+  if (count > w_) count = w_;
+  int16_t warnRow = rowOf(WARN_PPM);
+  int16_t alarmRow = alarmPpm_ > WARN_PPM && alarmPpm_ < yMax_ ? rowOf(alarmPpm_) : -1;
+  while (count > 0) {
+    from %= w_;
+    int16_t n = count < w_ - from ? count : w_ - from;
+    canvas_.fillRect(x_ + from, y_, n, h_, COLOR_BG);
+    for (int16_t c = from; c < from + n; ++c) {
+      if (c % 4 != 0) continue;
+      canvas_.drawPixel(x_ + c, warnRow, COLOR_GRID);
+      if (alarmRow >= 0) canvas_.drawPixel(x_ + c, alarmRow, COLOR_GRID);
+    }
+    count -= n;
+    from += n;
+  }
+}
+
+void TrendChart::plot(TrendPoint p, bool erase) {
+  int16_t col = columnOf(p.t);
+  int16_t row = rowOf(p.value);
+  uint16_t color = colorOf(p.value);
+  if (!hasLast_ || p.t < lastT_) {
+    if (erase) eraseColumns(col, 1 + ERASE_AHEAD);
+    canvas_.drawPixel(x_ + col, row, color);
+  } else {
+    uint64_t advance = (uint64_t)(p.t - lastT_) * w_ / spanSeconds();
+    bool lapped = advance >= (uint64_t)(w_ - ERASE_AHEAD);
+    int16_t steps = (int16_t)((col - lastCol_ + w_) % w_);
+    if (erase) {
+      if (lapped) {
+        eraseColumns(0, w_);
+      } else if (steps > 0) {
+        // 前回の点で ERASE_AHEAD 列先まで消してあるので、新たに先頭へ入る列だけ消す
+        eraseColumns(lastCol_ + 1 + ERASE_AHEAD, steps);
+      }
+    }
+    if (!lapped && col >= lastCol_ && steps <= MAX_CONNECT_COLUMNS) {
+      canvas_.drawLine(x_ + lastCol_, lastRow_, x_ + col, row, color);
+    } else {
+      canvas_.drawPixel(x_ + col, row, color);
+    }
+  }
+  hasLast_ = true;
+  lastT_ = p.t;
+  lastCol_ = col;
+  lastRow_ = row;
+}
+
+void TrendChart::redraw(const TrendHistory& history, uint32_t nowSec) {
+  uint32_t span = spanSeconds();
+  uint32_t from = nowSec > span ? nowSec - span : 0;
+  bool coarse = span_ == TREND_SPAN_24H;
+  size_t n = coarse ? history.coarseCount() : history.rawCount();
+
+  uint16_t maxValue = 0;
+  for (size_t i = 0; i < n; ++i) {
+    TrendPoint p = coarse ? history.coarse(i) : history.raw(i);
+    if (p.t > from && p.value > maxValue) maxValue = p.value;
+  }
+  yMax_ = Y_MAX_PPM;
+  if (maxValue > yMax_) yMax_ = (uint16_t)((maxValue + 499) / 500 * 500);
+
+  hasLast_ = false;
+  eraseColumns(0, w_);
+  for (size_t i = 0; i < n; ++i) {
+    TrendPoint p = coarse ? history.coarse(i) : history.raw(i);
+    if (p.t > from) plot(p, false);
+  }
+  if (hasLast_) eraseColumns(lastCol_ + 1, ERASE_AHEAD);
+}
+
+bool TrendChart::append(TrendPoint p) {
+  if (p.value > yMax_) return false;
+  plot(p, true);
+  appended_++;
+  return true;
+}
@@ -0,0 +1,128 @@
+#include "trend_history.h"
+
+// 三角形 ABC の面積の2倍
+static int64_t triangleArea2(int64_t ax, int64_t ay, int64_t bx, int64_t by, int64_t cx, int64_t cy) {
+  int64_t a = (ax - cx) * (by - ay) - (ax - bx) * (cy - ay);
+  return a < 0 ? -a : a;
+}
+
+TrendHistory::TrendHistory() {
+  clear();
+}
+
+void TrendHistory::clear() {
+  rawHead_ = 0;
+  rawCount_ = 0;
+  coarseHead_ = 0;
+  coarseCount_ = 0;
+  pendingBucket_ = 0;
+  hasPending_ = false;
+}
+
+TrendPoint TrendHistory::raw(size_t i) const {
+  size_t idx = (rawHead_ + i) % RAW_CAPACITY;
+  TrendPoint p = { rawT_[idx], rawV_[idx] };
+  return p;
+}
+
+TrendPoint TrendHistory::coarse(size_t i) const {
+  size_t idx = (coarseHead_ + i) % COARSE_CAPACITY;
+  TrendPoint p = { coarseT_[idx], coarseV_[idx] };
+  return p;
+}
+
+// pendingBucket_ の代表点を、前回の代表点 A と次のバケットの平均 C から選ぶ
+bool TrendHistory::finalizeBucket(uint32_t bucket) {
+  int64_t sumT = 0;
+  int64_t sumV = 0;
+  uint32_t n = 0;
+  size_t first = rawCount_;
+  size_t end = rawCount_;
+  uint32_t nextBucket = 0;
+  for (size_t i = 0; i < rawCount_; ++i) {
+    TrendPoint p = raw(i);
+    uint32_t b = p.t / COARSE_BUCKET_S;
+    if (b < bucket) continue;
+    if (b == bucket) {
+      if (first == rawCount_) first = i;
+      end = i + 1;
+      continue;
+    }
+    // 次にデータのあるバケット（欠測で空ならさらに後ろ）の平均を C とする
+    if (n == 0) nextBucket = b;
+    if (b != nextBucket) break;
+    sumT += p.t;
+    sumV += p.value;
+    n++;
+  }
+  if (first == rawCount_ || n == 0) return false;  // 詳細履歴から既に押し出された
+
+  int64_t cx = sumT / n;
+  int64_t cy = sumV / n;
+  size_t best = first;
+  if (coarseCount_ > 0) {
+    TrendPoint a = coarse(coarseCount_ - 1);
+    int64_t bestArea = -1;
+    for (size_t i = first; i < end; ++i) {
+      TrendPoint p = raw(i);
+      int64_t area = triangleArea2(a.t, a.value, p.t, p.value, cx, cy);
+      if (area > bestArea) {
+        bestArea = area;
+        best = i;
+      }
+    }
+  }
+
+  TrendPoint p = raw(best);
+  size_t idx;
+  if (coarseCount_ < COARSE_CAPACITY) {
+    idx = (coarseHead_ + coarseCount_) % COARSE_CAPACITY;
+    coarseCount_++;
+  } else {
+    idx = coarseHead_;
+    coarseHead_ = (coarseHead_ + 1) % COARSE_CAPACITY;
+  }
+  coarseT_[idx] = p.t;
+  coarseV_[idx] = p.value;
+  return true;
+}
+
+bool TrendHistory::add(uint32_t t, uint16_t value) {
+  if (rawCount_ > 0 && t < raw(rawCount_ - 1).t) return false;  // 時刻の逆行は捨てる
+
+  size_t idx;
+  if (rawCount_ < RAW_CAPACITY) {
+    idx = (rawHead_ + rawCount_) % RAW_CAPACITY;
+    rawCount_++;
+  } else {
+    idx = rawHead_;
+    rawHead_ = (rawHead_ + 1) % RAW_CAPACITY;
+  }
+  rawT_[idx] = t;
+  rawV_[idx] = value;
+
+  uint32_t bucket = t / COARSE_BUCKET_S;
+  if (!hasPending_) {
+    pendingBucket_ = bucket;
+    hasPending_ = true;
+    return false;
+  }
+
+  bool finalized = false;
+  // 次のバケットが完了している（さらに後のバケットのサンプルが来た）間は確定を進める
+  while (bucket >= pendingBucket_ + 2) {
+    if (finalizeBucket(pendingBucket_)) finalized = true;
+
+    // 次にデータのあるバケットへ（欠測があれば飛ばす）
+    uint32_t next = bucket;
+    for (size_t i = 0; i < rawCount_; ++i) {
+      uint32_t b = raw(i).t / COARSE_BUCKET_S;
+      if (b > pendingBucket_) {
+        next = b;
+        break;
+      }
+    }
+    pendingBucket_ = next;
+  }
+  return finalized;
+}
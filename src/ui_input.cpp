@@ -0,0 +1,41 @@
+#include "ui_input.h"
+
+bool ButtonDebouncer::update(bool pressed, uint32_t nowUs) {
+  // 確定直後のチャタリング期間はレベルの変化を無視する
+  if (nowUs - edgeUs_ < LOCKOUT_US) return false;
+  bool edge = pressed && !pressed_;
+  pressed_ = pressed;
+  if (edge) edgeUs_ = nowUs;
+  return edge;
+}
+
+void InputLatencyStats::record(uint32_t latencyUs, uint32_t waitUs, uint32_t budgetUs) {
+  count++;
+  lastUs = latencyUs;
+  totalUs += latencyUs;
+  if (latencyUs > maxUs) maxUs = latencyUs;
+  if (waitUs > maxWaitUs) maxWaitUs = waitUs;
+  if (latencyUs > budgetUs) overBudget++;
+  size_t bucket = latencyUs / BUCKET_US;
+  if (bucket >= BUCKETS) bucket = BUCKETS - 1;
+  histogram[bucket]++;
+}
+
+uint32_t InputLatencyStats::averageUs() const {
+  return count > 0 ? (uint32_t)(totalUs / count) : 0;
+}
+
+uint32_t InputLatencyStats::percentileUs(float percentile) const {
+  if (count == 0) return 0;
+  uint64_t rank = (uint64_t)(percentile / 100.0f * count + 0.999f);
+  if (rank < 1) rank = 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < BUCKETS; ++i) {
+    seen += histogram[i];
+    if (seen >= rank) {
+      uint32_t upper = (uint32_t)(i + 1) * BUCKET_US;
+      return upper < maxUs ? upper : maxUs;
+    }
+  }
+  return maxUs;
+}
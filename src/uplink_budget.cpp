@@ -0,0 +1,167 @@
+#include "uplink_budget.h"
+
+#include <string.h>
+
+#include "time_sync.h"
+
+const char* uplinkClassName(UplinkClass c) {
+  switch (c) {
+    case UPLINK_ALARM: return "alarm";
+    case UPLINK_HEALTH: return "health";
+    case UPLINK_ROUTINE: return "routine";
+    default: return "?";
+  }
+}
+
+static uint32_t daysInMonth(uint32_t dayStamp) {
+  uint32_t y = dayStamp / 10000;
+  uint32_t m = (dayStamp / 100) % 100;
+  static const uint8_t DAYS[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  if (m < 1 || m > 12) return 30;
+  if (m == 2 && ((y % 4 == 0 && y % 100 != 0) || y % 400 == 0)) return 29;
+  return DAYS[m - 1];
+}
+
+UplinkBudget::UplinkBudget() : dirty_(false) {
+  memset(&counters_, 0, sizeof(counters_));
+  counters_.magic = BUDGET_COUNTERS_MAGIC;
+}
+
+void UplinkBudget::restore(const BudgetCounters& saved) {
+  if (saved.magic == BUDGET_COUNTERS_MAGIC) {
+    counters_ = saved;
+  } else {
+    memset(&counters_, 0, sizeof(counters_));
+    counters_.magic = BUDGET_COUNTERS_MAGIC;
+  }
+  dirty_ = false;
+}
+
+bool UplinkBudget::rollover(uint32_t epoch) {
+  uint32_t today = epochToDayStamp(epoch);
+  if (today == 0 || today == counters_.day) return false;
+  if (counters_.day == 0) {
+    // 時刻未同期の間に使った分はそのまま今日・今月の分とする
+    counters_.day = today;
+    dirty_ = true;
+    return false;
+  }
+  if (counters_.day / 100 != today / 100) {
+    counters_.monthBytes = 0;
+    memset(counters_.classBytes, 0, sizeof(counters_.classBytes));
+  }
+  counters_.day = today;
+  counters_.dayBytes = 0;
+  counters_.thinnedToday = 0;
+  counters_.blockedToday = 0;
+  dirty_ = true;
+  return true;
+}
+
+uint32_t UplinkBudget::dayAllowance(uint32_t epoch) const {
+  if (!limited()) return 0;
+  uint32_t allowance = config_.dailyBytes > 0 ? config_.dailyBytes : UINT32_MAX;
+  if (config_.monthlyBytes > 0) {
+    // 今日の使用分を除いた月の残りを、今日を含む残り日数で均等に割る
+    uint32_t usedBefore = counters_.monthBytes - counters_.dayBytes;
+    if (counters_.dayBytes > counters_.monthBytes) usedBefore = 0;
+    uint32_t remaining = config_.monthlyBytes > usedBefore ? config_.monthlyBytes - usedBefore : 0;
+    uint32_t today = epochToDayStamp(epoch);
+    uint32_t perDay = remaining;
+    if (today != 0) {
+      uint32_t daysLeft = daysInMonth(today) - today % 100 + 1;
+      perDay = remaining / daysLeft;
+    }
+    if (perDay < allowance) allowance = perDay;
+  }
+  return allowance;
+}
+
+uint32_t UplinkBudget::routineLine(uint32_t allowance, uint32_t epoch) const {
+  uint32_t cap = (uint32_t)((uint64_t)allowance * (100 - config_.priorityReservePct) / 100);
+  if (epoch == 0) return cap;
+  uint32_t elapsed = epoch % 86400 + config_.paceSlackSec;
+  if (elapsed >= 86400) return cap;
+  return (uint32_t)((uint64_t)cap * elapsed / 86400);
+}
+
+BudgetDecision UplinkBudget::admit(UplinkClass c, size_t estimatedBytes, uint32_t epoch) {
+  rollover(epoch);
+  if (c == UPLINK_ALARM || !limited()) return BUDGET_SEND;
+
+  uint32_t est = (uint32_t)estimatedBytes;
+  bool monthFull = config_.monthlyBytes > 0 && counters_.monthBytes + est > config_.monthlyBytes;
+  uint32_t allowance = dayAllowance(epoch);
+  if (c == UPLINK_HEALTH) {
+    if (monthFull || counters_.dayBytes + est > allowance) {
+      counters_.blockedToday++;
+      dirty_ = true;
+      return BUDGET_BLOCK;
+    }
+    return BUDGET_SEND;
+  }
+  if (monthFull || counters_.dayBytes + est > routineLine(allowance, epoch)) {
+    counters_.thinnedToday++;
+    dirty_ = true;
+    return BUDGET_THIN;
+  }
+  return BUDGET_SEND;
+}
+
+void UplinkBudget::charge(UplinkClass c, size_t wireBytes) {
+  if (wireBytes == 0) return;
+  if (c >= UPLINK_CLASS_COUNT) c = UPLINK_ROUTINE;
+  counters_.dayBytes += (uint32_t)wireBytes;
+  counters_.monthBytes += (uint32_t)wireBytes;
+  counters_.classBytes[c] += (uint32_t)wireBytes;
+  dirty_ = true;
+}
+
+bool UplinkBudget::applyMonthUsage(uint32_t usedKb) {
+  if (counters_.appliedUsedKb == usedKb + 1) return false;
+  counters_.monthBytes = usedKb * 1024;
+  if (counters_.dayBytes > counters_.monthBytes) counters_.dayBytes = counters_.monthBytes;
+  counters_.appliedUsedKb = usedKb + 1;
+  dirty_ = true;
+  return true;
+}
+
+void ReadingCoalescer::clear() {
+  co2_ = temp_ = humi_ = wind_ = 0;
+  scdCount_ = fsCount_ = count_ = 0;
+}
+
+void ReadingCoalescer::add(const ReadingValues& v, bool scd40Ok, bool fs3000Ok) {
+  if (scd40Ok) {
+    co2_ += v.co2;
+    temp_ += v.temp;
+    humi_ += v.humi;
+    scdCount_++;
+  }
+  if (fs3000Ok) {
+    wind_ += v.wind;
+    fsCount_++;
+  }
+  count_++;
+}
+
+ReadingValues ReadingCoalescer::takeMean(const ReadingValues& latest, bool scd40Ok, bool fs3000Ok) {
+  ReadingValues out = latest;
+  if (scd40Ok) {
+    float n = (float)(scdCount_ + 1);
+    out.co2 = (co2_ + latest.co2) / n;
+    out.temp = (temp_ + latest.temp) / n;
+    out.humi = (humi_ + latest.humi) / n;
+  } else if (scdCount_ > 0) {
+    out.co2 = co2_ / scdCount_;
+    out.temp = temp_ / scdCount_;
+    out.humi = humi_ / scdCount_;
+  }
+  if (fs3000Ok) {
+    out.wind = (wind_ + latest.wind) / (float)(fsCount_ + 1);
+  } else if (fsCount_ > 0) {
+    out.wind = wind_ / fsCount_;
+  }
+  clear();
+  return out;
+}
@@ -0,0 +1,275 @@
+#include "ventilation.h"
+#include "le_codec.h"
+
+#include <math.h>
+#include <stdio.h>
+
+void DecayFit::reset() {
+  n_ = 0;
+  st_ = sy_ = stt_ = sty_ = syy_ = 0.0;
+}
+
+void DecayFit::add(float t, float excessPpm) {
+  if (!(excessPpm > 0.0f)) return;
+  double y = log((double)excessPpm);
+  n_++;
+  st_ += t;
+  sy_ += y;
+  stt_ += (double)t * t;
+  sty_ += (double)t * y;
+  syy_ += y * y;
+}
+
+bool DecayFit::solve(float& lambda, float& r2) const {
+  if (n_ < 3) return false;
+  double n = n_;
+  double vt = stt_ - st_ * st_ / n;
+  double vy = syy_ - sy_ * sy_ / n;
+  double cov = sty_ - st_ * sy_ / n;
+  if (vt <= 0.0) return false;
+  double slope = cov / vt;
+  lambda = (float)(-slope);
+  r2 = vy > 0.0 ? (float)((cov * cov) / (vt * vy)) : 1.0f;
+  return true;
+}
+
+VentilationAnalyzer::VentilationAnalyzer(const VentilationConfig& config)
+  : config_(config),
+    state_(STATE_IDLE),
+    alarm_(false),
+    primed_(false),
+    peakPpm_(0),
+    peakSec_(0),
+    troughPpm_(0),
+    startSec_(0),
+    startPpm_(0),
+    minPpm_(0),
+    lastPpm_(0),
+    lastSec_(0),
+    windSum_(0),
+    windCount_(0),
+    last_(),
+    episodes_(0),
+    corrN_(0),
+    cx_(0), cy_(0), cxx_(0), cyy_(0), cxy_(0),
+    ivN_(0),
+    ivSum_(0),
+    ivMax_(0),
+    ivWindSum_(0),
+    ivWindN_(0) {}
+
+void VentilationAnalyzer::startEpisode(uint32_t tSec, float co2) {
+  state_ = STATE_DECAYING;
+  fit_.reset();
+  // 減衰はピーク時点から始まっているとみなす
+  startSec_ = peakSec_;
+  startPpm_ = peakPpm_;
+  fit_.add(0.0f, peakPpm_ - config_.outdoorPpm);
+  fit_.add((float)(tSec - startSec_), co2 - config_.outdoorPpm);
+  minPpm_ = co2;
+  lastPpm_ = co2;
+  lastSec_ = tSec;
+  windSum_ = 0;
+  windCount_ = 0;
+}
+
+bool VentilationAnalyzer::finishEpisode(uint32_t tSec) {
+  (void)tSec;
+  state_ = STATE_IDLE;
+  float lambda = 0, r2 = 0;
+  uint32_t duration = lastSec_ - startSec_;
+  bool ok = fit_.solve(lambda, r2)
+            && lambda > 0.0f
+            && fit_.count() >= config_.minSamples
+            && duration >= config_.minDurationSec
+            && r2 >= config_.minR2;
+  // 次の減衰検出はエピソード終了時点の値から
+  peakPpm_ = lastPpm_;
+  peakSec_ = lastSec_;
+  troughPpm_ = lastPpm_;
+  if (!ok) return false;
+
+  last_.startSec = startSec_;
+  last_.endSec = lastSec_;
+  last_.startPpm = startPpm_;
+  last_.endPpm = lastPpm_;
+  last_.ach = lambda * 3600.0f;
+  last_.r2 = r2;
+  last_.meanWind = windCount_ > 0 ? (float)(windSum_ / windCount_) : -1.0f;
+  last_.samples = fit_.count();
+  if (episodes_ < 0xFFFF) episodes_++;
+
+  if (windCount_ > 0) {
+    double x = last_.meanWind;
+    double y = last_.ach;
+    corrN_++;
+    cx_ += x;
+    cy_ += y;
+    cxx_ += x * x;
+    cyy_ += y * y;
+    cxy_ += x * y;
+  }
+  return true;
+}
+
+uint8_t VentilationAnalyzer::update(uint32_t tSec, float co2, bool co2Valid, float wind, bool windValid) {
+  uint8_t events = EVENT_NONE;
+
+  if (windValid) {
+    ivWindSum_ += wind;
+    ivWindN_++;
+  }
+  if (!co2Valid) return events;
+
+  // 送信周期の集計
+  ivN_++;
+  ivSum_ += co2;
+  if (ivN_ == 1 || co2 > ivMax_) ivMax_ = co2;
+
+  // しきい値判定（ヒステリシス付き）
+  if (!alarm_ && co2 >= config_.alarmPpm) {
+    alarm_ = true;
+    events |= EVENT_ALARM_ON;
+  } else if (alarm_ && co2 < config_.alarmPpm - config_.alarmHysteresisPpm) {
+    alarm_ = false;
+    events |= EVENT_ALARM_OFF;
+  }
+
+  if (state_ == STATE_IDLE) {
+    if (!primed_) {
+      primed_ = true;
+      peakPpm_ = troughPpm_ = co2;
+      peakSec_ = tSec;
+      return events;
+    }
+    if (co2 >= peakPpm_) {
+      peakPpm_ = troughPpm_ = co2;
+      peakSec_ = tSec;
+    } else {
+      if (co2 < troughPpm_) troughPpm_ = co2;
+      // 谷から再上昇したら新しい上昇局面としてピークを取り直す
+      if (co2 > troughPpm_ + config_.noisePpm) {
+        peakPpm_ = troughPpm_ = co2;
+        peakSec_ = tSec;
+      } else if (peakPpm_ - co2 >= config_.startDropPpm
+                 && peakPpm_ - config_.outdoorPpm >= config_.minExcessPpm) {
+        startEpisode(tSec, co2);
+        if (windValid) {
+          windSum_ += wind;
+          windCount_++;
+        }
+      }
+    }
+    return events;
+  }
+
+  // STATE_DECAYING
+  bool rising = co2 > minPpm_ + config_.noisePpm;
+  bool tooLow = co2 - config_.outdoorPpm < config_.endExcessPpm;
+  bool tooLong = tSec - startSec_ > config_.maxDurationSec;
+  if (rising || tooLow || tooLong) {
+    if (!rising) {
+      // 低濃度到達/時間超過の場合は最後の点もフィットに含める
+      fit_.add((float)(tSec - startSec_), co2 - config_.outdoorPpm);
+      lastPpm_ = co2;
+      lastSec_ = tSec;
+    }
+    if (finishEpisode(tSec)) events |= EVENT_EPISODE;
+    if (rising) {
+      peakPpm_ = troughPpm_ = co2;
+      peakSec_ = tSec;
+    }
+    return events;
+  }
+
+  fit_.add((float)(tSec - startSec_), co2 - config_.outdoorPpm);
+  if (co2 < minPpm_) minPpm_ = co2;
+  lastPpm_ = co2;
+  lastSec_ = tSec;
+  if (windValid) {
+    windSum_ += wind;
+    windCount_++;
+  }
+  return events;
+}
+
+float VentilationAnalyzer::windAchCorrelation() const {
+  if (corrN_ < 2) return 0.0f;
+  double n = corrN_;
+  double vx = cxx_ - cx_ * cx_ / n;
+  double vy = cyy_ - cy_ * cy_ / n;
+  double cov = cxy_ - cx_ * cy_ / n;
+  if (vx <= 0.0 || vy <= 0.0) return 0.0f;
+  return (float)(cov / sqrt(vx * vy));
+}
+
+VentilationIntervalStats VentilationAnalyzer::intervalStats() const {
+  VentilationIntervalStats st;
+  st.samples = ivN_;
+  st.meanPpm = ivN_ > 0 ? (float)(ivSum_ / ivN_) : 0.0f;
+  st.maxPpm = ivMax_;
+  st.meanWind = ivWindN_ > 0 ? (float)(ivWindSum_ / ivWindN_) : -1.0f;
+  return st;
+}
+
+VentilationIntervalStats VentilationAnalyzer::takeIntervalStats() {
+  VentilationIntervalStats st = intervalStats();
+  ivN_ = 0;
+  ivSum_ = 0;
+  ivMax_ = 0;
+  ivWindSum_ = 0;
+  ivWindN_ = 0;
+  return st;
+}
+
+size_t encodeEpisodeFrame(const VentilationEpisode& e, uint8_t* out, size_t outSize) {
+  if (outSize < VENTILATION_EPISODE_FRAME_SIZE) return 0;
+  out[0] = VENTILATION_EPISODE_FRAME_TYPE;
+  out[1] = 0;
+  putU16(out + 2, e.endSec - e.startSec);
+  putU16(out + 4, scaleU(e.startPpm, 1.0f));
+  putU16(out + 6, scaleU(e.endPpm, 1.0f));
+  putU16(out + 8, scaleU(e.ach, 100.0f));
+  putU16(out + 10, scaleU(e.r2, 1000.0f));
+  putU16(out + 12, e.meanWind < 0 ? 0xFFFF : scaleU(e.meanWind, 100.0f));
+  putU16(out + 14, e.samples);
+  putU32(out + 16, e.endSec);
+  return VENTILATION_EPISODE_FRAME_SIZE;
+}
+
+size_t encodeMetricsFrame(const VentilationAnalyzer& a, const VentilationIntervalStats& st,
+                          uint8_t* out, size_t outSize) {
+  if (outSize < VENTILATION_METRICS_FRAME_SIZE) return 0;
+  out[0] = VENTILATION_METRICS_FRAME_TYPE;
+  out[1] = (a.alarmActive() ? 0x01 : 0) | (a.decaying() ? 0x02 : 0);
+  putU16(out + 2, st.samples);
+  putU16(out + 4, scaleU(st.meanPpm, 1.0f));
+  putU16(out + 6, scaleU(st.maxPpm, 1.0f));
+  putU16(out + 8, scaleU(a.lastAch(), 100.0f));
+  putI16(out + 10, (int32_t)lroundf(a.windAchCorrelation() * 1000.0f));
+  putU16(out + 12, st.meanWind < 0 ? 0xFFFF : scaleU(st.meanWind, 100.0f));
+  putU16(out + 14, a.episodeCount());
+  return VENTILATION_METRICS_FRAME_SIZE;
+}
+
+static size_t clampSnprintf(int n, size_t outSize) {
+  if (n < 0) return 0;
+  return (size_t)n < outSize ? (size_t)n : outSize - 1;
+}
+
+size_t formatEpisodeJson(const VentilationEpisode& e, char* out, size_t outSize) {
+  int n = snprintf(out, outSize,
+                   "{\"episode\":{\"dur\":%lu,\"c0\":%.0f,\"c1\":%.0f,\"ach\":%.2f,\"r2\":%.3f,\"wind\":%.2f,\"n\":%u,\"end\":%lu}}",
+                   (unsigned long)(e.endSec - e.startSec), e.startPpm, e.endPpm, e.ach, e.r2,
+                   e.meanWind, (unsigned)e.samples, (unsigned long)e.endSec);
+  return clampSnprintf(n, outSize);
+}
+
+size_t formatMetricsJson(const VentilationAnalyzer& a, const VentilationIntervalStats& st,
+                         char* out, size_t outSize) {
+  int n = snprintf(out, outSize,
+                   "{\"vent\":{\"n\":%u,\"co2\":%.0f,\"co2max\":%.0f,\"ach\":%.2f,\"corr\":%.3f,\"wind\":%.2f,\"episodes\":%u,\"alarm\":%s}}",
+                   (unsigned)st.samples, st.meanPpm, st.maxPpm, a.lastAch(), a.windAchCorrelation(),
+                   st.meanWind, (unsigned)a.episodeCount(), a.alarmActive() ? "true" : "false");
+  return clampSnprintf(n, outSize);
+}
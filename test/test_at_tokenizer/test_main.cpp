@@ -0,0 +1,322 @@
+// AT コマンドの組み立てと応答トークナイザのテスト（既知の応答・URC と乱数による破損入力）
+#include <unity.h>
+
+#include <string.h>
+
+#include "at_command.h"
+
+void setUp() {}
+void tearDown() {}
+
+// 決定的な擬似乱数（0..n-1）
+static uint32_t seed;
+static uint32_t rnd(uint32_t n) {
+  seed = seed * 1103515245UL + 12345UL;
+  return (seed >> 8) % n;
+}
+
+// 受信バイト列をトークナイザに流し、完成した応答を reply に集約する。最終結果コードの数を返す
+static int feed(AtTokenizer& tok, AtReply& reply, const char* data, size_t len) {
+  int finals = 0;
+  AtEvent ev;
+  for (size_t i = 0; i < len; i++) {
+    if (tok.push((uint8_t)data[i], ev) && reply.apply(ev)) finals++;
+  }
+  return finals;
+}
+
+static int feed(AtTokenizer& tok, AtReply& reply, const char* data) {
+  return feed(tok, reply, data, strlen(data));
+}
+
+// 最初に完成した応答を返す
+static AtEvent first(AtTokenizer& tok, const char* data) {
+  AtEvent ev;
+  memset(&ev, 0, sizeof(ev));
+  for (const char* p = data; *p != '\0'; p++) {
+    if (tok.push((uint8_t)*p, ev)) return ev;
+  }
+  TEST_FAIL_MESSAGE("no event");
+  return ev;
+}
+
+void test_command_writer() {
+  char buf[64];
+  AtCommandWriter w(buf, sizeof(buf), "+CAOPEN=");
+  w.arg(0).arg(0).quoted("UDP").quoted("uni.soracom.io").arg(23080);
+  TEST_ASSERT_TRUE(w.ok());
+  TEST_ASSERT_EQUAL_STRING("+CAOPEN=0,0,\"UDP\",\"uni.soracom.io\",23080", w.c_str());
+  TEST_ASSERT_EQUAL(strlen(w.c_str()), w.length());
+
+  AtCommandWriter neg(buf, sizeof(buf), "+X=");
+  neg.arg(-5).arg((unsigned long)4000000000UL).raw("\"host\",1883");
+  TEST_ASSERT_EQUAL_STRING("+X=-5,4000000000,\"host\",1883", neg.c_str());
+
+  // 引用符・改行を含む引数は送らない
+  AtCommandWriter bad(buf, sizeof(buf), "+SMPUB=");
+  bad.quoted("topic\"injected").arg(1);
+  TEST_ASSERT_FALSE(bad.ok());
+  TEST_ASSERT_EQUAL_STRING("", bad.c_str());
+  AtCommandWriter crlf(buf, sizeof(buf), "+X=");
+  crlf.raw("1\r\nAT+CFUN=0");
+  TEST_ASSERT_FALSE(crlf.ok());
+
+  // バッファ不足（終端NULを含めて収まらない）
+  char small[13];
+  AtCommandWriter full(small, sizeof(small), "+CASEND=");
+  full.arg(0).arg(1200);
+  TEST_ASSERT_FALSE(full.ok());
+  TEST_ASSERT_EQUAL(0, full.length());
+  AtCommandWriter fits(small, sizeof(small), "+CASEND=");
+  fits.arg(0).arg(12);
+  TEST_ASSERT_TRUE(fits.ok());
+  TEST_ASSERT_EQUAL_STRING("+CASEND=0,12", fits.c_str());
+}
+
+void test_result_codes_and_echo() {
+  AtTokenizer tok;
+  TEST_ASSERT_EQUAL(AT_EVENT_OK, first(tok, "\r\nOK\r\n").type);
+  TEST_ASSERT_EQUAL(AT_EVENT_ERROR, first(tok, "ERROR\r\n").type);
+  TEST_ASSERT_EQUAL(AT_EVENT_ECHO, first(tok, "AT+CSQ\r").type);
+
+  AtEvent ev = first(tok, "+CME ERROR: 50\r\n");
+  TEST_ASSERT_EQUAL(AT_EVENT_CME_ERROR, ev.type);
+  TEST_ASSERT_EQUAL_INT32(50, ev.code);
+  ev = first(tok, "+CMS ERROR: unknown\r\n");
+  TEST_ASSERT_EQUAL(AT_EVENT_CME_ERROR, ev.type);
+  TEST_ASSERT_EQUAL_INT32(-1, ev.code);
+
+  // "OK" を含むだけの行は結果コードではない
+  TEST_ASSERT_EQUAL(AT_EVENT_INFO, first(tok, "OKAY\r\n").type);
+}
+
+void test_pdp_responses_and_urcs() {
+  AtTokenizer tok;
+  AtReply reply;
+  reply.clear();
+  TEST_ASSERT_EQUAL(1, feed(tok, reply, "AT+CNACT?\r\r\n+CNACT: 0,1,\"10.160.12.34\"\r\n"
+                                        "+CNACT: 1,0,\"0.0.0.0\"\r\n\r\nOK\r\n"));
+  TEST_ASSERT_TRUE(reply.ok());
+  TEST_ASSERT_TRUE(reply.pdpIsActive(0));
+  TEST_ASSERT_FALSE(reply.pdpIsActive(1));
+  TEST_ASSERT_EQUAL_HEX8(0x03, reply.pdpSeen);
+  TEST_ASSERT_EQUAL_STRING("10.160.12.34", reply.pdpIp0);
+
+  // URC による切断
+  AtEvent ev = first(tok, "+APP PDP: 0,DEACTIVE\r\n");
+  TEST_ASSERT_EQUAL(AT_EVENT_APP_PDP, ev.type);
+  TEST_ASSERT_EQUAL_UINT8(0, ev.pdp.cid);
+  TEST_ASSERT_EQUAL_UINT8(0, ev.pdp.status);
+  reply.apply(ev);
+  TEST_ASSERT_FALSE(reply.pdpIsActive(0));
+  ev = first(tok, "+APP PDP: 0,ACTIVE\r\n");
+  TEST_ASSERT_EQUAL_UINT8(1, ev.pdp.status);
+
+  // 長すぎる IP は切り捨てて終端する
+  ev = first(tok, "+CNACT: 0,1,\"1234:5678:9abc:def0:1234\"\r\n");
+  TEST_ASSERT_EQUAL(AT_EVENT_CNACT, ev.type);
+  TEST_ASSERT_EQUAL(15, strlen(ev.pdp.ip));
+}
+
+void test_state_and_signal_responses() {
+  AtTokenizer tok;
+  AtReply reply;
+  reply.clear();
+  TEST_ASSERT_EQUAL(1, feed(tok, reply, "+SMSTATE: 1\r\n+CGATT: 1\r\n+CSQ: 18,99\r\n"
+                                        "+CESQ: 99,99,255,255,20,45\r\nOK\r\n"));
+  TEST_ASSERT_EQUAL_INT8(1, reply.smstate);
+  TEST_ASSERT_EQUAL_INT8(1, reply.cgatt);
+  TEST_ASSERT_EQUAL_UINT8(18, reply.rssi);
+  TEST_ASSERT_EQUAL_UINT8(20, reply.rsrq);
+  TEST_ASSERT_EQUAL_UINT8(45, reply.rsrp);
+  TEST_ASSERT_EQUAL_INT16(-96, reply.rsrpDbm());
+
+  char summary[96];
+  reply.summarize(summary, sizeof(summary));
+  TEST_ASSERT_EQUAL_STRING("OK cgatt=1 smstate=1 csq=18 rsrp=-96", summary);
+
+  // 引数が足りない行は種別を付けない
+  TEST_ASSERT_EQUAL(AT_EVENT_INFO, first(tok, "+CESQ: 99,99,255\r\n").type);
+  TEST_ASSERT_EQUAL(AT_EVENT_INFO, first(tok, "+CSQ: \r\n").type);
+}
+
+void test_socket_responses_and_prompt() {
+  AtTokenizer tok;
+  AtEvent ev = first(tok, "+CAOPEN: 0,0\r\n");
+  TEST_ASSERT_EQUAL(AT_EVENT_CAOPEN, ev.type);
+  TEST_ASSERT_EQUAL_UINT8(0, ev.socket.cid);
+  TEST_ASSERT_EQUAL_UINT8(0, ev.socket.state);
+  ev = first(tok, "+CASTATE: 1,0\r\n");
+  TEST_ASSERT_EQUAL(AT_EVENT_CASTATE, ev.type);
+  TEST_ASSERT_EQUAL_UINT8(1, ev.socket.cid);
+  ev = first(tok, "+CADATAIND: 0\r\n");
+  TEST_ASSERT_EQUAL(AT_EVENT_CADATAIND, ev.type);
+
+  // "> " は改行を待たずに通知し、続く空白は読み捨てる
+  AtReply reply;
+  reply.clear();
+  TEST_ASSERT_EQUAL(0, feed(tok, reply, "AT+CASEND=0,21\r\r\n> "));
+  TEST_ASSERT_TRUE(reply.prompt);
+  TEST_ASSERT_EQUAL(1, feed(tok, reply, "\r\nOK\r\n"));
+
+  // 行の途中の '>' はプロンプトではない
+  ev = first(tok, "a>b\r\n");
+  TEST_ASSERT_EQUAL(AT_EVENT_INFO, ev.type);
+  TEST_ASSERT_EQUAL_STRING("a>b", ev.line);
+
+  reply.clear();
+  TEST_ASSERT_EQUAL(1, feed(tok, reply, "+CAOPEN: 0,4\r\nOK\r\n"));
+  TEST_ASSERT_EQUAL_INT8(4, reply.caopenResult);
+}
+
+// 応答の途中に URC が割り込んでも両方を集約する
+void test_interleaved_urc() {
+  AtTokenizer tok;
+  AtReply reply;
+  reply.clear();
+  TEST_ASSERT_EQUAL(1, feed(tok, reply, "+CSQ: 20,0\r\n+APP PDP: 0,ACTIVE\r\n+CADATAIND: 0\r\n"
+                                        "+SMSTATE: 0\r\nOK\r\n"));
+  TEST_ASSERT_EQUAL_UINT8(20, reply.rssi);
+  TEST_ASSERT_TRUE(reply.pdpIsActive(0));
+  TEST_ASSERT_EQUAL_INT8(0, reply.smstate);
+}
+
+// 行バッファを超える行は末尾を捨て、次の行から正常に戻る
+void test_long_line_truncated() {
+  AtTokenizer tok;
+  AtEvent ev;
+  char longLine[AtTokenizer::MAX_LINE * 2];
+  memset(longLine, 'x', sizeof(longLine));
+  bool got = false;
+  for (size_t i = 0; i < sizeof(longLine); i++) got |= tok.push((uint8_t)longLine[i], ev);
+  TEST_ASSERT_FALSE(got);
+  TEST_ASSERT_TRUE(tok.push('\n', ev));
+  TEST_ASSERT_TRUE(ev.truncated);
+  TEST_ASSERT_EQUAL(AtTokenizer::MAX_LINE, ev.lineLen);
+  TEST_ASSERT_EQUAL(AtTokenizer::MAX_LINE, strlen(ev.line));
+  TEST_ASSERT_EQUAL_UINT32(1, tok.truncatedLines());
+
+  ev = first(tok, "OK\r\n");
+  TEST_ASSERT_EQUAL(AT_EVENT_OK, ev.type);
+  TEST_ASSERT_FALSE(ev.truncated);
+}
+
+// 応答を1バイトずつ・任意の位置で分割して渡しても結果は同じ
+void test_split_delivery() {
+  const char* stream = "AT+SMSTATE?\r\r\n+SMSTATE: 1\r\n\r\nOK\r\n";
+  seed = 5;
+  for (int trial = 0; trial < 200; trial++) {
+    AtTokenizer tok;
+    AtReply reply;
+    reply.clear();
+    size_t len = strlen(stream);
+    size_t pos = 0;
+    int finals = 0;
+    while (pos < len) {
+      size_t chunk = 1 + rnd(8);
+      if (chunk > len - pos) chunk = len - pos;
+      finals += feed(tok, reply, stream + pos, chunk);
+      pos += chunk;
+    }
+    TEST_ASSERT_EQUAL(1, finals);
+    TEST_ASSERT_EQUAL_INT8(1, reply.smstate);
+  }
+}
+
+// 既知の応答を乱数で壊して流し込み、クラッシュせず各フィールドが範囲内に収まることを確かめる
+// （ASan/UBSan 付きでビルドすると範囲外アクセス・未定義動作も検出できる）
+void test_fuzz_corrupted_stream() {
+  static const char* const corpus[] = {
+    "+CNACT: 0,1,\"10.160.12.34\"\r\n", "+APP PDP: 0,ACTIVE\r\n", "+SMSTATE: 1\r\n", "+CGATT: 1\r\n",
+    "+CSQ: 18,99\r\n", "+CESQ: 99,99,255,255,20,45\r\n", "+CAOPEN: 0,0\r\n", "+CASTATE: 0,1\r\n",
+    "+CADATAIND: 0\r\n", "+CME ERROR: 3\r\n", "OK\r\n", "ERROR\r\n", "> ", "AT+CASEND=0,21\r\r\n",
+  };
+  static const char noise[] = "+,:\"\r\n> 0123456789-ACEOPRST \x00\xff";
+  const size_t corpusSize = sizeof(corpus) / sizeof(corpus[0]);
+
+  seed = 42;
+  AtTokenizer tok;
+  AtReply reply;
+  reply.clear();
+  uint32_t events = 0;
+  for (int iter = 0; iter < 200000; iter++) {
+    char buf[64];
+    const char* src = corpus[rnd(corpusSize)];
+    size_t len = strlen(src);
+    memcpy(buf, src, len);
+    // 置換・挿入・削除・重複のいずれかで壊す
+    int edits = (int)rnd(4);
+    for (int e = 0; e < edits; e++) {
+      size_t at = len > 0 ? rnd((uint32_t)len) : 0;
+      switch (rnd(4)) {
+        case 0:
+          if (len > 0) buf[at] = rnd(2) ? (char)rnd(256) : noise[rnd(sizeof(noise) - 1)];
+          break;
+        case 1:
+          if (len + 1 < sizeof(buf)) {
+            memmove(buf + at + 1, buf + at, len - at);
+            buf[at] = noise[rnd(sizeof(noise) - 1)];
+            len++;
+          }
+          break;
+        case 2:
+          if (len > 0) {
+            memmove(buf + at, buf + at + 1, len - at - 1);
+            len--;
+          }
+          break;
+        default:
+          if (len * 2 < sizeof(buf)) {
+            memcpy(buf + len, buf, len);
+            len *= 2;
+          }
+          break;
+      }
+    }
+
+    AtEvent ev;
+    for (size_t i = 0; i < len; i++) {
+      if (!tok.push((uint8_t)buf[i], ev)) continue;
+      events++;
+      TEST_ASSERT_TRUE(ev.type <= AT_EVENT_INFO);
+      TEST_ASSERT_NOT_NULL(ev.line);
+      TEST_ASSERT_TRUE(ev.lineLen <= AtTokenizer::MAX_LINE);
+      TEST_ASSERT_EQUAL_UINT8(0, (uint8_t)ev.line[ev.lineLen]);
+      if (ev.type == AT_EVENT_CNACT) TEST_ASSERT_TRUE(strlen(ev.pdp.ip) < sizeof(ev.pdp.ip));
+      if (ev.type == AT_EVENT_APP_PDP) TEST_ASSERT_TRUE(ev.pdp.status <= 1);
+      if (reply.apply(ev)) {
+        char summary[48];
+        size_t n = reply.summarize(summary, sizeof(summary));
+        TEST_ASSERT_TRUE(n < sizeof(summary));
+        TEST_ASSERT_EQUAL(n, strlen(summary));
+        TEST_ASSERT_TRUE(strlen(reply.pdpIp0) < sizeof(reply.pdpIp0));
+        reply.clear();
+      }
+    }
+    // 時々、壊れた行の途中で打ち切って次の応答に移る
+    if (rnd(16) == 0) tok.push('\n', ev);
+  }
+  TEST_ASSERT_TRUE(events > 100000);
+  TEST_ASSERT_TRUE(tok.lines() <= events);
+
+  // 壊れた入力の後でも、行の区切りを1つ受ければ正常な応答を正しく解析できる
+  reply.clear();
+  TEST_ASSERT_EQUAL(1, feed(tok, reply, "\r\n+SMSTATE: 1\r\nOK\r\n"));
+  TEST_ASSERT_EQUAL_INT8(1, reply.smstate);
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_command_writer);
+  RUN_TEST(test_result_codes_and_echo);
+  RUN_TEST(test_pdp_responses_and_urcs);
+  RUN_TEST(test_state_and_signal_responses);
+  RUN_TEST(test_socket_responses_and_prompt);
+  RUN_TEST(test_interleaved_urc);
+  RUN_TEST(test_long_line_truncated);
+  RUN_TEST(test_split_delivery);
+  RUN_TEST(test_fuzz_corrupted_stream);
+  return UNITY_END();
+}
@@ -0,0 +1,319 @@
+// I2C バスマネージャのフェイクバスによるテスト（バス復旧・デバイス毎のバックオフ・クロックの切替）
+#include <unity.h>
+
+#include "i2c_bus.h"
+
+void setUp() {}
+void tearDown() {}
+
+// 登録したアドレスだけが ACK するバス
+// fastOk = false のデバイスは 400kHz では応答しない（長い配線・弱いプルアップを模擬）
+class FakeI2cDriver : public I2cBusDriver {
+public:
+  struct Device {
+    uint8_t address;
+    bool present;
+    bool fastOk;
+  };
+
+  FakeI2cDriver()
+    : clock(0), begun(false), begins(0), stuckPulses(0), hung(false), pulses(0), stops(0), ms(1000), us(0),
+      count_(0) {}
+
+  void add(uint8_t address, bool present, bool fastOk) {
+    Device d = { address, present, fastOk };
+    devices_[count_++] = d;
+  }
+  Device* device(uint8_t address) {
+    for (size_t i = 0; i < count_; ++i) {
+      if (devices_[i].address == address) return &devices_[i];
+    }
+    return nullptr;
+  }
+
+  bool begin(uint32_t clockHz) override {
+    clock = clockHz;
+    begun = true;
+    begins++;
+    return true;
+  }
+  void end() override { begun = false; }
+  uint8_t probe(uint8_t address) override {
+    if (!begun || hung) return 5;  // タイムアウト
+    Device* d = device(address);
+    if (d == nullptr || !d->present) return 2;
+    if (clock > I2cBusManager::STANDARD_MODE_HZ && !d->fastOk) return 2;
+    return 0;
+  }
+  bool sdaIsLow() override { return stuckPulses > 0; }
+  void pulseScl() override {
+    pulses++;
+    if (stuckPulses > 0) stuckPulses--;
+  }
+  void generateStop() override {
+    stops++;
+    if (stuckPulses == 0) hung = false;
+  }
+  uint32_t nowMs() override { return ms; }
+  uint32_t nowUs() override { return us; }
+
+  // 読み取り1回（500us かかる）
+  bool read(uint8_t address) {
+    us += 500;
+    return probe(address) == 0;
+  }
+
+  uint32_t clock;
+  bool begun;
+  int begins;
+  int stuckPulses;  // SDA を保持し続ける残りクロック数
+  bool hung;        // バスハング（SDA が解放されるまで全ての転送がタイムアウト）
+  int pulses;
+  int stops;
+  uint32_t ms;
+  uint32_t us;
+
+private:
+  Device devices_[4];
+  size_t count_;
+};
+
+static bool readVia(I2cBusManager& bus, FakeI2cDriver& fake, int handle, uint8_t address) {
+  return bus.transact(handle, [&]() { return fake.read(address); });
+}
+
+void test_begin_clears_stuck_sda() {
+  FakeI2cDriver fake;
+  fake.stuckPulses = 3;
+  I2cBusManager bus(fake);
+  TEST_ASSERT_TRUE(bus.begin());
+  TEST_ASSERT_EQUAL(3, fake.pulses);
+  TEST_ASSERT_EQUAL(1, fake.stops);
+  TEST_ASSERT_EQUAL_UINT32(I2cBusManager::FAST_MODE_HZ, fake.clock);
+}
+
+// 未接続のセンサーだけがバックオフし、他のデバイスの読み取りは止まらない。バスは Fast-mode のまま
+void test_backoff_is_per_device() {
+  FakeI2cDriver fake;
+  fake.add(0x62, true, true);
+  fake.add(0x28, false, true);  // 抜けたセンサー（どのクロックでも NACK）
+  I2cBusManager bus(fake);
+  bus.begin();
+  int scd = bus.addDevice(0x62, "SCD40");
+  int fs = bus.addDevice(0x28, "FS3000");
+
+  uint32_t expectedBackoff = I2cBusManager::BACKOFF_BASE_MS;
+  int attempts = 0;
+  for (int step = 0; step < 2000; step++) {
+    fake.ms += 1000;
+    TEST_ASSERT_TRUE(readVia(bus, fake, scd, 0x62));
+    if (!bus.inBackoff(fs)) {
+      TEST_ASSERT_FALSE(readVia(bus, fake, fs, 0x28));
+      attempts++;
+      const I2cDeviceStats* st = bus.stats(fs);
+      if (attempts >= I2cBusManager::ERRORS_BEFORE_BACKOFF) {
+        TEST_ASSERT_EQUAL_UINT32(expectedBackoff, st->backoffMs);
+        TEST_ASSERT_EQUAL_UINT32(fake.ms + expectedBackoff, st->backoffUntilMs);
+        expectedBackoff = expectedBackoff * 2 > I2cBusManager::BACKOFF_MAX_MS ? I2cBusManager::BACKOFF_MAX_MS
+                                                                               : expectedBackoff * 2;
+      } else {
+        TEST_ASSERT_EQUAL_UINT32(0, st->backoffMs);
+      }
+    }
+  }
+  const I2cDeviceStats* s = bus.stats(scd);
+  TEST_ASSERT_EQUAL_UINT32(2000, s->transactions);
+  TEST_ASSERT_EQUAL_UINT32(0, s->errors);
+  TEST_ASSERT_EQUAL_UINT32(0, s->skipped);
+  TEST_ASSERT_EQUAL_UINT32(500, s->lastLatencyUs);
+
+  const I2cDeviceStats* f = bus.stats(fs);
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)attempts, f->errors);
+  TEST_ASSERT_EQUAL_UINT32(2000 - attempts, f->skipped);
+  TEST_ASSERT_EQUAL_UINT32(I2cBusManager::BACKOFF_MAX_MS, f->backoffMs);
+  TEST_ASSERT_TRUE(attempts < 20);  // 上限300秒の指数バックオフで試行は十数回に収まる
+  // NACK だけでは 100kHz に落とさず、連続失敗の回数も残る
+  TEST_ASSERT_EQUAL_UINT32(I2cBusManager::FAST_MODE_HZ, bus.clockHz());
+  TEST_ASSERT_EQUAL_UINT32(I2cBusManager::FAST_MODE_HZ, fake.clock);
+  TEST_ASSERT_EQUAL_UINT32(0, bus.clockFallbacks());
+  TEST_ASSERT_EQUAL_UINT8(attempts > 255 ? 255 : attempts, f->consecutiveErrors);
+  TEST_ASSERT_EQUAL_UINT32(0, bus.recoveries());
+}
+
+// 成功すればバックオフは解除され、次の失敗はまた基準値から始まる
+void test_success_resets_backoff() {
+  FakeI2cDriver fake;
+  fake.add(0x62, false, true);
+  I2cBusManager bus(fake);
+  bus.begin();
+  int h = bus.addDevice(0x62, "SCD40");
+  for (int i = 0; i < I2cBusManager::ERRORS_BEFORE_BACKOFF; i++) readVia(bus, fake, h, 0x62);
+  TEST_ASSERT_TRUE(bus.inBackoff(h));
+
+  fake.device(0x62)->present = true;  // 挿し直し
+  fake.ms += I2cBusManager::BACKOFF_BASE_MS;
+  TEST_ASSERT_TRUE(readVia(bus, fake, h, 0x62));
+  const I2cDeviceStats* st = bus.stats(h);
+  TEST_ASSERT_EQUAL_UINT8(0, st->consecutiveErrors);
+  TEST_ASSERT_EQUAL_UINT32(0, st->backoffMs);
+  TEST_ASSERT_FALSE(bus.inBackoff(h));
+}
+
+// バックオフの期限は millis() のラップアラウンドをまたいでも正しく判定する
+void test_backoff_across_wraparound() {
+  FakeI2cDriver fake;
+  fake.add(0x62, false, true);
+  fake.ms = 0xFFFFFFFFUL - 1000;
+  I2cBusManager bus(fake);
+  bus.begin();
+  int h = bus.addDevice(0x62, "SCD40");
+  for (int i = 0; i < I2cBusManager::ERRORS_BEFORE_BACKOFF; i++) readVia(bus, fake, h, 0x62);
+  fake.ms += 4999;  // 折り返し後、期限の 1ms 前
+  TEST_ASSERT_TRUE(bus.inBackoff(h));
+  fake.ms += 1;
+  TEST_ASSERT_FALSE(bus.inBackoff(h));
+}
+
+// Fast-mode では応答せず 100kHz なら応答するデバイスがあれば 100kHz に落とす（バックオフはしない）
+void test_clock_fallback_when_standard_mode_helps() {
+  FakeI2cDriver fake;
+  fake.add(0x62, true, false);
+  fake.add(0x28, true, true);
+  I2cBusManager bus(fake);
+  bus.begin();
+  int scd = bus.addDevice(0x62, "SCD40");
+  int fs = bus.addDevice(0x28, "FS3000");
+
+  for (int i = 0; i < I2cBusManager::ERRORS_BEFORE_FALLBACK; i++) {
+    TEST_ASSERT_FALSE(readVia(bus, fake, scd, 0x62));
+    TEST_ASSERT_TRUE(readVia(bus, fake, fs, 0x28));
+  }
+  TEST_ASSERT_EQUAL_UINT32(I2cBusManager::STANDARD_MODE_HZ, bus.clockHz());
+  TEST_ASSERT_EQUAL_UINT32(I2cBusManager::STANDARD_MODE_HZ, fake.clock);
+  TEST_ASSERT_EQUAL_UINT32(1, bus.clockFallbacks());
+  TEST_ASSERT_FALSE(bus.inBackoff(scd));
+
+  TEST_ASSERT_TRUE(readVia(bus, fake, scd, 0x62));
+  TEST_ASSERT_TRUE(readVia(bus, fake, fs, 0x28));
+  TEST_ASSERT_EQUAL_UINT8(0, bus.stats(scd)->consecutiveErrors);
+}
+
+// 落とした後も失敗が続けば、そのデバイスは通常どおりバックオフする（再度の切替はしない）
+void test_failures_after_fallback_back_off() {
+  FakeI2cDriver fake;
+  fake.add(0x62, true, false);
+  I2cBusManager bus(fake);
+  bus.begin();
+  int h = bus.addDevice(0x62, "SCD40");
+  for (int i = 0; i < I2cBusManager::ERRORS_BEFORE_FALLBACK; i++) readVia(bus, fake, h, 0x62);
+  TEST_ASSERT_EQUAL_UINT32(1, bus.clockFallbacks());
+
+  fake.device(0x62)->present = false;
+  TEST_ASSERT_FALSE(readVia(bus, fake, h, 0x62));
+  TEST_ASSERT_TRUE(bus.inBackoff(h));
+  TEST_ASSERT_EQUAL_UINT32(I2cBusManager::BACKOFF_BASE_MS, bus.stats(h)->backoffMs);
+  TEST_ASSERT_EQUAL_UINT32(1, bus.clockFallbacks());
+}
+
+// verifyClock: 100kHz で応答が増えるときだけ落とし、未接続のデバイスでは 400kHz に戻す
+void test_verify_clock() {
+  FakeI2cDriver fake;
+  fake.add(0x62, true, true);
+  fake.add(0x28, false, true);
+  I2cBusManager bus(fake);
+  bus.begin();
+  bus.addDevice(0x62, "SCD40");
+  bus.addDevice(0x28, "FS3000");
+  TEST_ASSERT_FALSE(bus.verifyClock());
+  TEST_ASSERT_EQUAL_UINT32(I2cBusManager::FAST_MODE_HZ, bus.clockHz());
+  TEST_ASSERT_EQUAL_UINT32(I2cBusManager::FAST_MODE_HZ, fake.clock);
+  TEST_ASSERT_EQUAL_UINT32(0, bus.clockFallbacks());
+
+  fake.device(0x28)->present = true;
+  fake.device(0x28)->fastOk = false;
+  TEST_ASSERT_TRUE(bus.verifyClock());
+  TEST_ASSERT_EQUAL_UINT32(I2cBusManager::STANDARD_MODE_HZ, fake.clock);
+  TEST_ASSERT_EQUAL_UINT32(1, bus.clockFallbacks());
+  TEST_ASSERT_FALSE(bus.verifyClock());  // 既に 100kHz
+}
+
+// バスハング（SDA 張り付き）は2回目の失敗でクロックを送って解放し、再初期化する
+void test_bus_hang_recovery() {
+  FakeI2cDriver fake;
+  fake.add(0x62, true, true);
+  I2cBusManager bus(fake);
+  bus.begin();
+  int h = bus.addDevice(0x62, "SCD40");
+  fake.hung = true;
+  fake.stuckPulses = 4;
+
+  TEST_ASSERT_FALSE(readVia(bus, fake, h, 0x62));
+  TEST_ASSERT_EQUAL_UINT32(0, bus.recoveries());
+  TEST_ASSERT_FALSE(readVia(bus, fake, h, 0x62));
+  TEST_ASSERT_EQUAL_UINT32(1, bus.recoveries());
+  TEST_ASSERT_EQUAL(4, fake.pulses);
+  TEST_ASSERT_FALSE(fake.hung);
+  TEST_ASSERT_EQUAL_UINT32(I2cBusManager::FAST_MODE_HZ, fake.clock);
+
+  TEST_ASSERT_TRUE(readVia(bus, fake, h, 0x62));
+  TEST_ASSERT_EQUAL_UINT8(0, bus.stats(h)->consecutiveErrors);
+  TEST_ASSERT_EQUAL_UINT32(0, bus.clockFallbacks());
+}
+
+// 9クロックで解放されなければ復旧失敗として数え、バックオフで再試行間隔を空ける
+void test_failed_recovery() {
+  FakeI2cDriver fake;
+  fake.add(0x62, true, true);
+  I2cBusManager bus(fake);
+  bus.begin();
+  int h = bus.addDevice(0x62, "SCD40");
+  fake.hung = true;
+  fake.stuckPulses = 100;
+
+  readVia(bus, fake, h, 0x62);
+  readVia(bus, fake, h, 0x62);
+  TEST_ASSERT_EQUAL_UINT32(1, bus.failedRecoveries());
+  TEST_ASSERT_EQUAL(I2cBusManager::CLEAR_PULSES, fake.pulses);
+  readVia(bus, fake, h, 0x62);
+  TEST_ASSERT_TRUE(bus.inBackoff(h));
+  // 100kHz でも応答しないので Fast-mode のまま
+  TEST_ASSERT_EQUAL_UINT32(I2cBusManager::FAST_MODE_HZ, bus.clockHz());
+}
+
+void test_scan_and_limits() {
+  FakeI2cDriver fake;
+  fake.add(0x28, true, true);
+  fake.add(0x62, true, true);
+  fake.add(0x70, false, true);
+  I2cBusManager bus(fake);
+  bus.begin();
+  uint8_t found[1];
+  TEST_ASSERT_EQUAL(2, bus.scan(found, 1));
+  TEST_ASSERT_EQUAL_HEX8(0x28, found[0]);
+
+  TEST_ASSERT_EQUAL(0, bus.addDevice(0x28, "a"));
+  TEST_ASSERT_EQUAL(0, bus.addDevice(0x28, "again"));
+  for (size_t i = 1; i < I2cBusManager::MAX_DEVICES; i++) {
+    TEST_ASSERT_EQUAL((int)i, bus.addDevice((uint8_t)(0x30 + i), "x"));
+  }
+  TEST_ASSERT_EQUAL(-1, bus.addDevice(0x50, "overflow"));
+  TEST_ASSERT_TRUE(bus.inBackoff(-1));
+  TEST_ASSERT_NULL(bus.stats(99));
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_begin_clears_stuck_sda);
+  RUN_TEST(test_backoff_is_per_device);
+  RUN_TEST(test_success_resets_backoff);
+  RUN_TEST(test_backoff_across_wraparound);
+  RUN_TEST(test_clock_fallback_when_standard_mode_helps);
+  RUN_TEST(test_failures_after_fallback_back_off);
+  RUN_TEST(test_verify_clock);
+  RUN_TEST(test_bus_hang_recovery);
+  RUN_TEST(test_failed_recovery);
+  RUN_TEST(test_scan_and_limits);
+  return UNITY_END();
+}
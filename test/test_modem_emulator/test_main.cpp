@@ -0,0 +1,153 @@
+// SIM7080 エミュレータの障害注入（回線断・応答の遅れ・ERROR・弱電界）と、ソークの配信率
+#include <string.h>
+#include <unity.h>
+
+#include "modem_backend.h"
+#include "modem_emulator.h"
+#include "soak_stats.h"
+#include "system_clock.h"
+
+void setUp() {}
+void tearDown() {}
+
+static const uint8_t FRAME[20] = { 0x5A };
+
+// 障害がなければ UDP の送信は全て成功する
+void test_no_faults() {
+  static VirtualClock clock;
+  static Sim7080Emulator emulator(clock);
+  AtClient at(emulator, &clock);
+  Sim7080Backend backend(at);
+  TEST_ASSERT_TRUE(backend.udpOpen("uni.soracom.io", 23080, 20000));
+  for (int i = 0; i < 10; i++) {
+    TEST_ASSERT_EQUAL(MODEM_SEND_OK, backend.udpSend(FRAME, sizeof(FRAME)));
+  }
+  TEST_ASSERT_EQUAL_UINT32(10, emulator.stats().udpDatagrams);
+  TEST_ASSERT_EQUAL_UINT32(0, emulator.stats().faultErrors);
+}
+
+// 回線断の間は送信・接続が ERROR になり、開いていたソケットは復旧後も閉じたまま（開き直せば送れる）
+void test_outage_closes_socket() {
+  static VirtualClock clock;
+  static Sim7080Emulator emulator(clock);
+  AtClient at(emulator, &clock);
+  Sim7080Backend backend(at);
+  static const EmulatorFault FAULTS[] = { { 10, 60, FAULT_OUTAGE, 0 } };
+  emulator.setFaults(FAULTS, 1);
+  TEST_ASSERT_TRUE(backend.udpOpen("uni.soracom.io", 23080, 20000));
+  TEST_ASSERT_EQUAL(MODEM_SEND_OK, backend.udpSend(FRAME, sizeof(FRAME)));
+
+  clock.sleepMs(20000);
+  TEST_ASSERT_TRUE(emulator.faultActive(FAULT_OUTAGE));
+  TEST_ASSERT_EQUAL(MODEM_SEND_NOT_STARTED, backend.udpSend(FRAME, sizeof(FRAME)));
+  TEST_ASSERT_FALSE(backend.udpOpen("uni.soracom.io", 23080, 20000));
+  TEST_ASSERT_FALSE(backend.mqttConnect(30000));
+  AtReply pdp;
+  TEST_ASSERT_TRUE(at.query("+CNACT?", 5000, pdp));
+  TEST_ASSERT_FALSE(pdp.pdpIsActive(0));
+
+  clock.sleepMs(60000);
+  TEST_ASSERT_FALSE(emulator.faultActive(FAULT_OUTAGE));
+  TEST_ASSERT_EQUAL(MODEM_SEND_NOT_STARTED, backend.udpSend(FRAME, sizeof(FRAME)));
+  TEST_ASSERT_TRUE(backend.udpOpen("uni.soracom.io", 23080, 20000));
+  TEST_ASSERT_EQUAL(MODEM_SEND_OK, backend.udpSend(FRAME, sizeof(FRAME)));
+  TEST_ASSERT_EQUAL_UINT32(3, emulator.stats().faultErrors);
+}
+
+// プロンプト待ち（1秒）を超える遅れでは送信が始まらず、遅れた応答は後から届く
+void test_slow_response_times_out() {
+  static VirtualClock clock;
+  static Sim7080Emulator emulator(clock);
+  AtClient at(emulator, &clock);
+  Sim7080Backend backend(at);
+  TEST_ASSERT_TRUE(backend.udpOpen("uni.soracom.io", 23080, 20000));
+  static const EmulatorFault FAULTS[] = { { 0, 3600, FAULT_SLOW, 400 }, { 7200, 3600, FAULT_SLOW, 3000 } };
+  emulator.setFaults(FAULTS, 2);
+
+  // 400ms の遅れはタイムアウトに収まる
+  uint32_t t0 = clock.nowMs();
+  TEST_ASSERT_EQUAL(MODEM_SEND_OK, backend.udpSend(FRAME, sizeof(FRAME)));
+  TEST_ASSERT_TRUE(clock.nowMs() - t0 >= 400);
+
+  clock.sleepMs(7200000);
+  TEST_ASSERT_EQUAL(MODEM_SEND_NOT_STARTED, backend.udpSend(FRAME, sizeof(FRAME)));
+  uint32_t timeouts = at.stats().timeouts;
+  TEST_ASSERT_TRUE(timeouts >= 1);
+  // 遅れて届いたプロンプトを読み捨てる
+  clock.sleepMs(5000);
+  AtEvent ev;
+  int late = 0;
+  while (at.next(ev, 0)) late++;
+  TEST_ASSERT_TRUE(late > 0);
+  TEST_ASSERT_TRUE(emulator.stats().slowResponses >= 2);
+}
+
+// FAULT_ERROR は回線を使うコマンドの value 回に1回を ERROR にする（モデム内のコマンドは対象外）
+void test_error_every_nth_command() {
+  static VirtualClock clock;
+  static Sim7080Emulator emulator(clock);
+  AtClient at(emulator, &clock);
+  Sim7080Backend backend(at);
+  TEST_ASSERT_TRUE(backend.udpOpen("uni.soracom.io", 23080, 20000));
+  static const EmulatorFault FAULTS[] = { { 0, 3600, FAULT_ERROR, 4 } };
+  emulator.setFaults(FAULTS, 1);
+  int ok = 0;
+  for (int i = 0; i < 20; i++) {
+    AtReply reply;
+    TEST_ASSERT_TRUE(at.query("+CSQ", 1000, reply));
+    TEST_ASSERT_TRUE(reply.ok());
+    ok += backend.udpSend(FRAME, sizeof(FRAME)) == MODEM_SEND_OK;
+  }
+  TEST_ASSERT_EQUAL_INT(15, ok);
+  TEST_ASSERT_EQUAL_UINT32(5, emulator.stats().faultErrors);
+}
+
+// FAULT_WEAK_SIGNAL の区間は +CSQ/+CESQ が弱い値を返す（連結した問い合わせと +CSQ だけの問い合わせ）
+void test_weak_signal_reported() {
+  static VirtualClock clock;
+  static Sim7080Emulator emulator(clock);
+  AtClient at(emulator, &clock);
+  static const EmulatorFault FAULTS[] = { { 60, 600, FAULT_WEAK_SIGNAL, 116 } };
+  emulator.setFaults(FAULTS, 1);
+  AtReply reply;
+  TEST_ASSERT_TRUE(at.query("+CSQ;+CESQ", 2000, reply));
+  TEST_ASSERT_TRUE(reply.ok());
+  TEST_ASSERT_EQUAL_INT16(-95, reply.rsrpDbm());
+  TEST_ASSERT_TRUE(at.query("+CSQ", 2000, reply));
+  TEST_ASSERT_EQUAL_UINT8(18, reply.rssi);
+
+  clock.sleepMs(120000);
+  TEST_ASSERT_TRUE(at.query("+CSQ;+CESQ", 2000, reply));
+  TEST_ASSERT_EQUAL_INT16(-116, reply.rsrpDbm());
+  TEST_ASSERT_TRUE(at.query("+CSQ", 2000, reply));
+  TEST_ASSERT_EQUAL_UINT8(8, reply.rssi);
+}
+
+// ==== SoakStats ====
+
+// 配信率はサンプルした読み取り値に対する割合（送らなかった分も未配信として数える）
+void test_delivery_ratio_over_sampled() {
+  SoakStats s;
+  soakReset(s);
+  for (int i = 0; i < 10; i++) soakRecordSample(s);
+  for (int i = 0; i < 8; i++) soakRecordSend(s, i < 6, 1000);
+  TEST_ASSERT_EQUAL_UINT32(8, s.attempted);
+  TEST_ASSERT_EQUAL_UINT32(6, s.delivered);
+  TEST_ASSERT_FLOAT_WITHIN(0.0001f, 0.6f, soakDeliveryRatio(s));
+  char report[384];
+  TEST_ASSERT_TRUE(formatSoakReport(s, report, sizeof(report)) > 0);
+  TEST_ASSERT_NOT_NULL(strstr(report, "\"delivery_ratio\":0.6000"));
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_no_faults);
+  RUN_TEST(test_outage_closes_socket);
+  RUN_TEST(test_slow_response_times_out);
+  RUN_TEST(test_error_every_nth_command);
+  RUN_TEST(test_weak_signal_reported);
+  RUN_TEST(test_delivery_ratio_over_sampled);
+  return UNITY_END();
+}
@@ -0,0 +1,320 @@
+// 差分OTA（DPT1）のストリーミング適用器のテスト（分割受信・状態の保存と再開・不正なパッチの拒否）
+#include <unity.h>
+
+#include <string.h>
+
+#include "ota_delta.h"
+
+void setUp() {}
+void tearDown() {}
+
+static const size_t OLD_SIZE = 4096;
+static const size_t PATCH_MAX = 1024;
+static const uint16_t SIG_LEN = 70;
+
+// 決定的な擬似乱数
+static uint32_t seed;
+static uint8_t nextByte() {
+  seed = seed * 1103515245UL + 12345UL;
+  return (uint8_t)(seed >> 16);
+}
+
+// メモリ上の旧イメージ・新イメージ（書き込みは先頭から順であることも確かめる）
+class MemoryDeltaIo : public DeltaIo {
+public:
+  MemoryDeltaIo(const uint8_t* oldImage, size_t oldSize) : old_(oldImage), oldSize_(oldSize) { reset(); }
+  void reset() {
+    memset(out, 0xEE, sizeof(out));
+    written = 0;
+    failWriteAt = (uint32_t)-1;
+  }
+  bool readOld(uint32_t offset, uint8_t* buf, size_t len) override {
+    if (offset > oldSize_ || len > oldSize_ - offset) return false;
+    memcpy(buf, old_ + offset, len);
+    return true;
+  }
+  bool writeNew(uint32_t offset, const uint8_t* data, size_t len) override {
+    if (offset != written || offset + len > sizeof(out)) return false;
+    if (failWriteAt >= offset && failWriteAt < offset + len) return false;
+    memcpy(out + offset, data, len);
+    written += len;
+    return true;
+  }
+
+  uint8_t out[2048];
+  uint32_t written;
+  uint32_t failWriteAt;
+
+private:
+  const uint8_t* old_;
+  size_t oldSize_;
+};
+
+static void putLe32(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+// パッチを組み立てる（署名は適用器では検証しないため中身は任意）
+struct PatchBuilder {
+  uint8_t buf[PATCH_MAX];
+  size_t len;
+  size_t headerSize;
+  uint8_t newImage[2048];
+  uint32_t newSize;
+
+  void header(uint32_t oldSize, uint32_t newSizeField) {
+    memcpy(buf, DELTA_MAGIC, 4);
+    putLe32(buf + 4, oldSize);
+    memset(buf + 8, 0x11, 32);
+    putLe32(buf + 40, newSizeField);
+    memset(buf + 44, 0x22, 32);
+    buf[76] = (uint8_t)SIG_LEN;
+    buf[77] = 0;
+    for (uint16_t i = 0; i < SIG_LEN; i++) buf[78 + i] = (uint8_t)(0x30 + i);
+    len = headerSize = 78 + SIG_LEN;
+  }
+  void copy(const uint8_t* old, uint32_t src, uint32_t n) {
+    buf[len++] = DELTA_OP_COPY;
+    putLe32(buf + len, src);
+    putLe32(buf + len + 4, n);
+    len += 8;
+    memcpy(newImage + newSize, old + src, n);
+    newSize += n;
+  }
+  void insert(uint32_t n) {
+    buf[len++] = DELTA_OP_INSERT;
+    putLe32(buf + len, n);
+    len += 4;
+    for (uint32_t i = 0; i < n; i++) {
+      uint8_t b = nextByte();
+      buf[len++] = b;
+      newImage[newSize++] = b;
+    }
+  }
+};
+
+static uint8_t oldImage[OLD_SIZE];
+static PatchBuilder patch;
+
+// 旧イメージの一部を写し、間に新しいデータを挟んだパッチ（COPY は COPY_BLOCK を跨ぐ長さを含む）
+static void buildPatch() {
+  seed = 2024;
+  for (size_t i = 0; i < OLD_SIZE; i++) oldImage[i] = nextByte();
+  memset(&patch, 0, sizeof(patch));
+  patch.header(OLD_SIZE, 1000 + 37 + 300 + 1 + 64);
+  patch.copy(oldImage, 100, 1000);
+  patch.insert(37);
+  patch.copy(oldImage, 3000, 300);
+  patch.insert(1);
+  patch.copy(oldImage, OLD_SIZE - 64, 64);  // 旧イメージの末尾まで
+}
+
+static DeltaHeader parsedHeader() {
+  DeltaHeader h;
+  TEST_ASSERT_TRUE(parseDeltaHeader(patch.buf, patch.len, h));
+  return h;
+}
+
+static void assertApplied(const MemoryDeltaIo& io, const DeltaPatcher& patcher) {
+  TEST_ASSERT_TRUE(patcher.done());
+  TEST_ASSERT_FALSE(patcher.failed());
+  TEST_ASSERT_EQUAL_UINT32(patch.newSize, io.written);
+  TEST_ASSERT_EQUAL_MEMORY(patch.newImage, io.out, patch.newSize);
+  TEST_ASSERT_EQUAL_UINT32(patch.len, patcher.state().patchOffset);
+  TEST_ASSERT_EQUAL_UINT32(patch.newSize, patcher.state().outputOffset);
+}
+
+void test_header_fields() {
+  buildPatch();
+  DeltaHeader h = parsedHeader();
+  TEST_ASSERT_EQUAL_UINT32(OLD_SIZE, h.oldSize);
+  TEST_ASSERT_EQUAL_UINT32(patch.newSize, h.newSize);
+  TEST_ASSERT_EQUAL_UINT16(SIG_LEN, h.sigLen);
+  TEST_ASSERT_EQUAL_UINT32(patch.headerSize, h.size);
+  TEST_ASSERT_EQUAL_HEX8(0x11, h.oldSha256[31]);
+  TEST_ASSERT_EQUAL_HEX8(0x22, h.newSha256[0]);
+  TEST_ASSERT_EQUAL_MEMORY(patch.buf + 78, h.sig, SIG_LEN);
+}
+
+void test_apply_in_one_piece() {
+  buildPatch();
+  DeltaHeader h = parsedHeader();
+  MemoryDeltaIo io(oldImage, OLD_SIZE);
+  DeltaPatcher patcher(io);
+  patcher.begin(h);
+  TEST_ASSERT_TRUE(patcher.feed(patch.buf + h.size, patch.len - h.size));
+  assertApplied(io, patcher);
+  TEST_ASSERT_EQUAL_UINT32(1000 + 300 + 64, patcher.copiedBytes());
+  TEST_ASSERT_EQUAL_UINT32(37 + 1, patcher.insertedBytes());
+}
+
+// 命令列をどのバイト位置で2つに分けても、1バイトずつ与えても同じ結果になる
+void test_split_at_every_byte_boundary() {
+  buildPatch();
+  DeltaHeader h = parsedHeader();
+  const uint8_t* body = patch.buf + h.size;
+  size_t bodyLen = patch.len - h.size;
+  MemoryDeltaIo io(oldImage, OLD_SIZE);
+  for (size_t cut = 1; cut < bodyLen; cut++) {
+    io.reset();
+    DeltaPatcher patcher(io);
+    patcher.begin(h);
+    TEST_ASSERT_TRUE(patcher.feed(body, cut));
+    TEST_ASSERT_FALSE(patcher.done());
+    TEST_ASSERT_EQUAL_UINT32(h.size + cut, patcher.state().patchOffset);
+    TEST_ASSERT_TRUE(patcher.feed(body + cut, bodyLen - cut));
+    assertApplied(io, patcher);
+  }
+
+  io.reset();
+  DeltaPatcher patcher(io);
+  patcher.begin(h);
+  for (size_t i = 0; i < bodyLen; i++) TEST_ASSERT_TRUE(patcher.feed(body + i, 1));
+  assertApplied(io, patcher);
+}
+
+// どの位置で中断しても、保存した状態（バイト列として書き出したもの）から別の適用器で再開できる
+// COPY の引数の途中・INSERT のデータの途中で切れる位置も含む
+void test_resume_from_serialised_state() {
+  buildPatch();
+  DeltaHeader h = parsedHeader();
+  const uint8_t* body = patch.buf + h.size;
+  size_t bodyLen = patch.len - h.size;
+  MemoryDeltaIo io(oldImage, OLD_SIZE);
+  int midCopyArgs = 0;
+  int midInsert = 0;
+  for (size_t cut = 1; cut < bodyLen; cut++) {
+    io.reset();
+    uint8_t saved[sizeof(DeltaPatchState)];
+    {
+      DeltaPatcher first(io);
+      first.begin(h);
+      TEST_ASSERT_TRUE(first.feed(body, cut));
+      const DeltaPatchState& st = first.state();
+      if (st.phase == DELTA_PHASE_ARGS && st.opcode == DELTA_OP_COPY) midCopyArgs++;
+      if (st.phase == DELTA_PHASE_INSERT && st.remaining > 0 && st.remaining < 37) midInsert++;
+      memcpy(saved, &st, sizeof(saved));
+    }
+    DeltaPatchState restored;
+    memcpy(&restored, saved, sizeof(restored));
+    DeltaPatcher second(io);
+    second.resume(h, restored);
+    // 再開時は保存した patchOffset から続きを要求する（Range: bytes=patchOffset-）
+    TEST_ASSERT_TRUE(second.feed(patch.buf + restored.patchOffset, patch.len - restored.patchOffset));
+    assertApplied(io, second);
+  }
+  TEST_ASSERT_TRUE(midCopyArgs >= 3 * 7);  // 3つの COPY それぞれ、引数8バイトの間の7箇所
+  TEST_ASSERT_TRUE(midInsert >= 36);
+}
+
+// 完了後の状態から再開すると、そのまま完了扱いになる
+void test_resume_after_completion() {
+  buildPatch();
+  DeltaHeader h = parsedHeader();
+  MemoryDeltaIo io(oldImage, OLD_SIZE);
+  DeltaPatcher first(io);
+  first.begin(h);
+  TEST_ASSERT_TRUE(first.feed(patch.buf + h.size, patch.len - h.size));
+  DeltaPatchState st = first.state();
+  st.phase = DELTA_PHASE_OPCODE;  // 完了を書き込む前に電源が落ちた場合
+  DeltaPatcher second(io);
+  second.resume(h, st);
+  TEST_ASSERT_TRUE(second.done());
+  // 完了後のデータは拒否する
+  uint8_t extra = DELTA_OP_INSERT;
+  TEST_ASSERT_FALSE(second.feed(&extra, 1));
+  TEST_ASSERT_TRUE(second.failed());
+}
+
+void test_reject_bad_header() {
+  buildPatch();
+  DeltaHeader h;
+  // 途中で切れたヘッダ（署名の最後の1バイトまで）
+  for (size_t len = 0; len < patch.headerSize; len++) {
+    TEST_ASSERT_FALSE(parseDeltaHeader(patch.buf, len, h));
+  }
+  TEST_ASSERT_TRUE(parseDeltaHeader(patch.buf, patch.headerSize, h));
+
+  patch.buf[0] = 'X';
+  TEST_ASSERT_FALSE(parseDeltaHeader(patch.buf, patch.len, h));
+  patch.buf[0] = 'D';
+  patch.buf[3] = '2';
+  TEST_ASSERT_FALSE(parseDeltaHeader(patch.buf, patch.len, h));
+  patch.buf[3] = '1';
+
+  patch.buf[76] = 0;  // 署名なし
+  TEST_ASSERT_FALSE(parseDeltaHeader(patch.buf, patch.len, h));
+  patch.buf[76] = DELTA_SIGNATURE_MAX + 1;
+  TEST_ASSERT_FALSE(parseDeltaHeader(patch.buf, patch.len, h));
+  patch.buf[76] = (uint8_t)SIG_LEN;
+
+  putLe32(patch.buf + 40, 0);  // 空の新イメージ
+  TEST_ASSERT_FALSE(parseDeltaHeader(patch.buf, patch.len, h));
+}
+
+// 範囲外の COPY・新イメージを超える命令・不明な命令・I/O 失敗は失敗として止まり、以降の入力も受け付けない
+static void expectRejected(const uint8_t* ops, size_t len, const char* error, uint32_t newSize = 64) {
+  DeltaHeader h = parsedHeader();
+  h.newSize = newSize;
+  MemoryDeltaIo io(oldImage, OLD_SIZE);
+  DeltaPatcher patcher(io);
+  patcher.begin(h);
+  TEST_ASSERT_FALSE(patcher.feed(ops, len));
+  TEST_ASSERT_TRUE(patcher.failed());
+  TEST_ASSERT_EQUAL_STRING(error, patcher.error());
+  TEST_ASSERT_FALSE(patcher.feed(ops, len));
+}
+
+void test_reject_invalid_operations() {
+  buildPatch();
+  uint8_t ops[16];
+
+  // 旧イメージの末尾を1バイト超える COPY
+  ops[0] = DELTA_OP_COPY;
+  putLe32(ops + 1, OLD_SIZE - 10);
+  putLe32(ops + 5, 11);
+  expectRejected(ops, 9, "copy source out of range");
+  // src + len が 32ビットで折り返す COPY
+  putLe32(ops + 1, 0xFFFFFFF0UL);
+  putLe32(ops + 5, 0x20);
+  expectRejected(ops, 9, "copy source out of range");
+  putLe32(ops + 1, OLD_SIZE + 1);
+  putLe32(ops + 5, 0);
+  expectRejected(ops, 9, "copy source out of range");
+  // 新イメージのサイズを超える COPY / INSERT
+  putLe32(ops + 1, 0);
+  putLe32(ops + 5, 65);
+  expectRejected(ops, 9, "copy exceeds new image size");
+  ops[0] = DELTA_OP_INSERT;
+  putLe32(ops + 1, 65);
+  expectRejected(ops, 5, "insert exceeds new image size");
+
+  ops[0] = 0x03;
+  expectRejected(ops, 1, "unknown opcode");
+
+  // 書き込み失敗
+  DeltaHeader h = parsedHeader();
+  MemoryDeltaIo io(oldImage, OLD_SIZE);
+  io.failWriteAt = 1200;
+  DeltaPatcher patcher(io);
+  patcher.begin(h);
+  TEST_ASSERT_FALSE(patcher.feed(patch.buf + h.size, patch.len - h.size));
+  TEST_ASSERT_EQUAL_STRING("write failed", patcher.error());
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_header_fields);
+  RUN_TEST(test_apply_in_one_piece);
+  RUN_TEST(test_split_at_every_byte_boundary);
+  RUN_TEST(test_resume_from_serialised_state);
+  RUN_TEST(test_resume_after_completion);
+  RUN_TEST(test_reject_bad_header);
+  RUN_TEST(test_reject_invalid_operations);
+  return UNITY_END();
+}
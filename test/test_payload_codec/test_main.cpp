@@ -0,0 +1,430 @@
+// 読み取り値のエンコード（JSON / CBOR / MessagePack）の往復テスト
+#include <unity.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "payload_codec.h"
+
+void setUp() {}
+void tearDown() {}
+
+// 決定的な擬似乱数（lo..hi の一様分布）
+static uint32_t seed;
+static float uniform(float lo, float hi) {
+  seed = seed * 1103515245UL + 12345UL;
+  return lo + (hi - lo) * (float)((seed >> 8) & 0xFFFF) / 65535.0f;
+}
+
+static ReadingValues reading(float co2, float temp, float humi, float wind, uint32_t ts) {
+  ReadingValues r = { co2, temp, humi, wind, ts };
+  return r;
+}
+
+static ReadingPosition position(int32_t latE6, int32_t lonE6, uint32_t ageS) {
+  ReadingPosition p = { true, latE6, lonE6, ageS, 1.2f };
+  return p;
+}
+
+static const PayloadFormat BINARY_FORMATS[] = { FORMAT_CBOR, FORMAT_MSGPACK };
+
+// decimals 桁に丸めた値との差（CBOR の半精度は丸め幅の半分まで許す）
+static void assertRounded(float expected, float actual, uint8_t decimals) {
+  float scale = decimals == 1 ? 10.0f : 100.0f;
+  float rounded = roundf(expected * scale) / scale;
+  TEST_ASSERT_FLOAT_WITHIN(0.5f / scale + fabsf(expected) * 1e-6f, rounded, actual);
+}
+
+// 受信側で丸め直せば JSON と同じ値（co2/temp/humi は0.1, wind は0.01）になること
+static void assertRoundTrip(PayloadFormat f, const ReadingValues& in, const ReadingPosition* pos) {
+  uint8_t buf[96];
+  size_t n = encodeReading(f, in, buf, sizeof(buf), pos);
+  TEST_ASSERT_TRUE(n > 0);
+  ReadingValues out;
+  memset(&out, 0, sizeof(out));
+  ReadingPosition outPos;
+  TEST_ASSERT_TRUE(decodeReading(f, buf, n, out, &outPos));
+  assertRounded(in.co2, out.co2, 1);
+  assertRounded(in.temp, out.temp, 1);
+  assertRounded(in.humi, out.humi, 1);
+  assertRounded(in.wind, out.wind, 2);
+  TEST_ASSERT_EQUAL_UINT32(in.ts, out.ts);
+  if (pos != nullptr && pos->valid) {
+    TEST_ASSERT_TRUE(outPos.valid);
+    TEST_ASSERT_EQUAL_INT32(pos->latE6, outPos.latE6);
+    TEST_ASSERT_EQUAL_INT32(pos->lonE6, outPos.lonE6);
+    TEST_ASSERT_EQUAL_UINT32(pos->ageS, outPos.ageS);
+  } else {
+    TEST_ASSERT_FALSE(outPos.valid);
+  }
+}
+
+void test_json_layout() {
+  char buf[128];
+  ReadingValues r = reading(612.04f, 26.13f, 54.2f, 0.724f, 1714566896UL);
+  size_t n = encodeReading(FORMAT_JSON, r, (uint8_t*)buf, sizeof(buf));
+  TEST_ASSERT_EQUAL(strlen("{\"co2\":612.0,\"temp\":26.1,\"humi\":54.2,\"wind\":0.72,\"ts\":1714566896}"), n);
+  buf[n] = '\0';
+  TEST_ASSERT_EQUAL_STRING("{\"co2\":612.0,\"temp\":26.1,\"humi\":54.2,\"wind\":0.72,\"ts\":1714566896}", buf);
+
+  ReadingPosition p = position(35681236, 139767125, 42);
+  n = encodeReading(FORMAT_JSON, r, (uint8_t*)buf, sizeof(buf), &p);
+  buf[n] = '\0';
+  TEST_ASSERT_EQUAL_STRING("{\"co2\":612.0,\"temp\":26.1,\"humi\":54.2,\"wind\":0.72,\"ts\":1714566896,"
+                           "\"lat_e6\":35681236,\"lon_e6\":139767125,\"fix_age\":42}", buf);
+
+  // 未測位の位置は付けない
+  p.valid = false;
+  n = encodeReading(FORMAT_JSON, r, (uint8_t*)buf, sizeof(buf), &p);
+  buf[n] = '\0';
+  TEST_ASSERT_NULL(strstr(buf, "lat_e6"));
+
+  // 終端NULを含めて収まらなければ失敗
+  TEST_ASSERT_EQUAL(0, encodeReading(FORMAT_JSON, r, (uint8_t*)buf, 20));
+  TEST_ASSERT_FALSE(decodeReading(FORMAT_JSON, (const uint8_t*)buf, n, r));
+}
+
+void test_round_trip_typical_values() {
+  ReadingPosition p = position(35681236, 139767125, 300);
+  ReadingPosition south = position(-33868820, -151209296, 0);
+  for (PayloadFormat f : BINARY_FORMATS) {
+    assertRoundTrip(f, reading(612.0f, 26.1f, 54.2f, 0.72f, 1714566896UL), nullptr);
+    assertRoundTrip(f, reading(400.0f, 20.0f, 50.0f, 0.0f, 0), nullptr);
+    assertRoundTrip(f, reading(1234.5f, -12.3f, 99.9f, 7.23f, 1714566896UL), &p);
+    assertRoundTrip(f, reading(5000.0f, 60.0f, 0.0f, 3.14f, 0xFFFFFFFFUL), &south);
+  }
+}
+
+void test_round_trip_random_values() {
+  seed = 7;
+  for (int i = 0; i < 2000; i++) {
+    ReadingValues r = reading(uniform(0.0f, 40000.0f), uniform(-40.0f, 70.0f), uniform(0.0f, 100.0f),
+                              uniform(0.0f, 7.23f), (uint32_t)uniform(0.0f, 4.0e9f));
+    ReadingPosition p = position((int32_t)uniform(-90e6f, 90e6f), (int32_t)uniform(-180e6f, 180e6f),
+                                 (uint32_t)uniform(0.0f, 86400.0f));
+    for (PayloadFormat f : BINARY_FORMATS) {
+      assertRoundTrip(f, r, (i & 1) ? &p : nullptr);
+    }
+  }
+}
+
+// 丸めて整数になる値は整数、CBOR で半精度に収まる値は3バイトで送る
+void test_shortest_encoding() {
+  uint8_t buf[16];
+  CompactWriter w(FORMAT_CBOR, buf, sizeof(buf));
+  w.floatValue(612.04f, 1);  // 612 → 0x19 0x02 0x64
+  w.floatValue(0.5f, 2);     // 半精度 0xF9 0x38 0x00
+  w.floatValue(1234.5f, 1);  // 半精度（1024 以上は刻み 1）では 0.05 以内に収まらないので単精度
+  TEST_ASSERT_TRUE(w.ok());
+  TEST_ASSERT_EQUAL(3 + 3 + 5, w.size());
+  TEST_ASSERT_EQUAL_HEX8(0x19, buf[0]);
+  TEST_ASSERT_EQUAL_HEX8(0xF9, buf[3]);
+  TEST_ASSERT_EQUAL_HEX8(0x38, buf[4]);
+  TEST_ASSERT_EQUAL_HEX8(0xFA, buf[6]);
+
+  CompactWriter m(FORMAT_MSGPACK, buf, sizeof(buf));
+  m.intValue(-5);       // 負の fixint
+  m.uintValue(200);     // uint8
+  m.intValue(-40000);   // int32
+  TEST_ASSERT_TRUE(m.ok());
+  TEST_ASSERT_EQUAL(1 + 2 + 5, m.size());
+  TEST_ASSERT_EQUAL_HEX8(0xFB, buf[0]);
+  TEST_ASSERT_EQUAL_HEX8(0xCC, buf[1]);
+  TEST_ASSERT_EQUAL_HEX8(0xD2, buf[3]);
+}
+
+// バイナリ形式は JSON より小さい
+void test_binary_smaller_than_json() {
+  uint8_t buf[128];
+  ReadingValues r = reading(612.0f, 26.1f, 54.2f, 0.72f, 1714566896UL);
+  size_t json = encodeReading(FORMAT_JSON, r, buf, sizeof(buf));
+  for (PayloadFormat f : BINARY_FORMATS) {
+    size_t n = encodeReading(f, r, buf, sizeof(buf));
+    TEST_ASSERT_TRUE(n > 0);
+    TEST_ASSERT_LESS_THAN(json, n);
+  }
+}
+
+// バッファ不足はどの長さでも0を返し、範囲外に書かない
+void test_buffer_too_small() {
+  ReadingValues r = reading(1234.5f, -12.3f, 99.9f, 7.23f, 1714566896UL);
+  ReadingPosition p = position(35681236, 139767125, 300);
+  for (PayloadFormat f : BINARY_FORMATS) {
+    uint8_t full[96];
+    size_t need = encodeReading(f, r, full, sizeof(full), &p);
+    TEST_ASSERT_TRUE(need > 0);
+    for (size_t cap = 0; cap < need; cap++) {
+      uint8_t* buf = (uint8_t*)malloc(cap + 1);  // ASan で範囲外書き込みを検出する
+      TEST_ASSERT_EQUAL(0, encodeReading(f, r, buf, cap, &p));
+      free(buf);
+    }
+  }
+}
+
+// 途中で切れたデータや余分なバイトは拒否する
+void test_decode_rejects_truncated_and_trailing() {
+  ReadingValues r = reading(612.0f, 26.1f, 54.2f, 0.72f, 1714566896UL);
+  ReadingPosition p = position(35681236, 139767125, 300);
+  for (PayloadFormat f : BINARY_FORMATS) {
+    uint8_t full[96];
+    size_t n = encodeReading(f, r, full, sizeof(full), &p);
+    ReadingValues out;
+    for (size_t len = 0; len < n; len++) {
+      uint8_t* buf = (uint8_t*)malloc(len + 1);
+      memcpy(buf, full, len);
+      TEST_ASSERT_FALSE(decodeReading(f, buf, len, out));
+      free(buf);
+    }
+    full[n] = 0x00;
+    TEST_ASSERT_FALSE(decodeReading(f, full, n + 1, out));
+  }
+}
+
+// 未知のキー（値は数値）は読み飛ばす
+void test_decode_ignores_unknown_keys() {
+  uint8_t buf[64];
+  for (PayloadFormat f : BINARY_FORMATS) {
+    CompactWriter w(f, buf, sizeof(buf));
+    w.beginMap(3);
+    w.key("co2");
+    w.uintValue(800);
+    w.key("battery_mv");
+    w.uintValue(4012);
+    w.key("ts");
+    w.uintValue(1714566896UL);
+    TEST_ASSERT_TRUE(w.ok());
+    ReadingValues out;
+    memset(&out, 0, sizeof(out));
+    ReadingPosition pos;
+    TEST_ASSERT_TRUE(decodeReading(f, buf, w.size(), out, &pos));
+    TEST_ASSERT_EQUAL_FLOAT(800.0f, out.co2);
+    TEST_ASSERT_EQUAL_UINT32(1714566896UL, out.ts);
+    TEST_ASSERT_FALSE(pos.valid);
+  }
+}
+
+// 半精度の変換: 正規化数・非正規化数・飽和・最近接偶数丸め
+void test_half_precision() {
+  TEST_ASSERT_EQUAL_HEX16(0x3C00, floatToHalf(1.0f));
+  TEST_ASSERT_EQUAL_HEX16(0xC000, floatToHalf(-2.0f));
+  TEST_ASSERT_EQUAL_HEX16(0x7BFF, floatToHalf(65504.0f));
+  TEST_ASSERT_EQUAL_HEX16(0x7C00, floatToHalf(65520.0f));  // 最大値を超える丸めは無限大
+  TEST_ASSERT_EQUAL_HEX16(0x0001, floatToHalf(ldexpf(1.0f, -24)));
+  TEST_ASSERT_EQUAL_HEX16(0x0000, floatToHalf(ldexpf(1.0f, -26)));
+  TEST_ASSERT_EQUAL_HEX16(0x3C00, floatToHalf(1.0f + ldexpf(1.0f, -11)));  // 偶数側へ
+  TEST_ASSERT_EQUAL_HEX16(0x3C02, floatToHalf(1.0f + 3.0f * ldexpf(1.0f, -11)));
+  TEST_ASSERT_TRUE(isnan(halfToFloat(floatToHalf(NAN))));
+
+  // 全ての有限な半精度値は往復で一致する
+  for (uint32_t h = 0; h < 0x10000; h++) {
+    if ((h & 0x7C00) == 0x7C00) continue;
+    TEST_ASSERT_EQUAL_HEX16((uint16_t)h, floatToHalf(halfToFloat((uint16_t)h)));
+  }
+}
+
+void test_format_names() {
+  PayloadFormat f;
+  TEST_ASSERT_TRUE(parsePayloadFormat("CBOR", f));
+  TEST_ASSERT_EQUAL(FORMAT_CBOR, f);
+  TEST_ASSERT_TRUE(parsePayloadFormat("messagepack", f));
+  TEST_ASSERT_EQUAL(FORMAT_MSGPACK, f);
+  TEST_ASSERT_FALSE(parsePayloadFormat("xml", f));
+  TEST_ASSERT_FALSE(parsePayloadFormat(nullptr, f));
+  TEST_ASSERT_EQUAL_STRING("msgpack", payloadFormatName(FORMAT_MSGPACK));
+}
+
+// ==== UDP フレーム ====
+
+// 固定小数点フレームの量子化誤差は各センサーの精度より十分小さい（全範囲を走査）
+// SCD40: ±(50 ppm + 5%), ±0.8 °C, ±6 %RH / FS3000-1005: ±5% FS（7.23 m/s）
+void test_compact_quantization_within_sensor_accuracy() {
+  uint8_t buf[COMPACT_READING_FRAME_SIZE];
+  float maxCo2 = 0, maxTemp = 0, maxHumi = 0, maxWind = 0;
+  seed = 11;
+  for (int i = 0; i < 20000; i++) {
+    ReadingValues in = reading(uniform(0.0f, 40000.0f), uniform(-10.0f, 60.0f), uniform(0.0f, 100.0f),
+                               uniform(0.0f, 7.23f), 1714566896UL + (uint32_t)i);
+    TEST_ASSERT_EQUAL(COMPACT_READING_FRAME_SIZE, encodeCompactReading(in, 0, buf, sizeof(buf)));
+    ReadingValues out;
+    uint8_t status;
+    TEST_ASSERT_TRUE(decodeCompactReading(buf, sizeof(buf), out, status));
+    TEST_ASSERT_EQUAL_UINT32(in.ts, out.ts);
+    maxCo2 = fmaxf(maxCo2, fabsf(out.co2 - in.co2));
+    maxTemp = fmaxf(maxTemp, fabsf(out.temp - in.temp));
+    maxHumi = fmaxf(maxHumi, fabsf(out.humi - in.humi));
+    maxWind = fmaxf(maxWind, fabsf(out.wind - in.wind));
+  }
+  // ヘッダに記載の量子化誤差（CO2 ±0.5 ppm, 他は ±0.005）
+  TEST_ASSERT_TRUE(maxCo2 <= 0.5f + 0.002f);
+  TEST_ASSERT_TRUE(maxTemp <= 0.005f + 1e-4f);
+  TEST_ASSERT_TRUE(maxHumi <= 0.005f + 1e-4f);
+  TEST_ASSERT_TRUE(maxWind <= 0.005f + 1e-4f);
+  // センサー精度の 1/10 未満
+  TEST_ASSERT_TRUE(maxCo2 < 50.0f / 10.0f);
+  TEST_ASSERT_TRUE(maxTemp < 0.8f / 10.0f);
+  TEST_ASSERT_TRUE(maxHumi < 6.0f / 10.0f);
+  TEST_ASSERT_TRUE(maxWind < 0.05f * 7.23f / 10.0f);
+}
+
+// 範囲外・非有限の値は各型の上下限に飽和する
+void test_compact_saturation() {
+  uint8_t buf[COMPACT_READING_FRAME_SIZE];
+  ReadingValues out;
+  uint8_t status;
+
+  encodeCompactReading(reading(70000.0f, 400.0f, 700.0f, 900.0f, 0), 0, buf, sizeof(buf));
+  TEST_ASSERT_TRUE(decodeCompactReading(buf, sizeof(buf), out, status));
+  TEST_ASSERT_EQUAL_FLOAT(65535.0f, out.co2);
+  TEST_ASSERT_EQUAL_FLOAT(327.67f, out.temp);
+  TEST_ASSERT_EQUAL_FLOAT(655.35f, out.humi);
+  TEST_ASSERT_EQUAL_FLOAT(655.35f, out.wind);
+
+  encodeCompactReading(reading(-5.0f, -400.0f, -1.0f, -0.2f, 0), 0, buf, sizeof(buf));
+  TEST_ASSERT_TRUE(decodeCompactReading(buf, sizeof(buf), out, status));
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, out.co2);
+  TEST_ASSERT_EQUAL_FLOAT(-327.68f, out.temp);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, out.humi);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, out.wind);
+
+  encodeCompactReading(reading(NAN, NAN, INFINITY, NAN, 0), 0, buf, sizeof(buf));
+  TEST_ASSERT_TRUE(decodeCompactReading(buf, sizeof(buf), out, status));
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, out.co2);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, out.temp);
+  TEST_ASSERT_EQUAL_FLOAT(655.35f, out.humi);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, out.wind);
+}
+
+// 固定のバイト配置（SORACOM のバイナリパーサー定義と一致すること）
+void test_compact_layout_and_status() {
+  uint8_t buf[COMPACT_READING_FRAME_SIZE];
+  uint8_t st = READING_STATUS_SCD40_OK | READING_STATUS_ALARM;
+  encodeCompactReading(reading(612.4f, -1.5f, 54.2f, 0.72f, 0x66320AF0UL), st, buf, sizeof(buf));
+  const uint8_t expected[] = { 0xC1, 0x09, 0x64, 0x02, 0x6A, 0xFF, 0x2C, 0x15,
+                               0x48, 0x00, 0xF0, 0x0A, 0x32, 0x66 };
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buf, sizeof(expected));
+
+  ReadingValues out;
+  uint8_t status;
+  TEST_ASSERT_TRUE(decodeCompactReading(buf, sizeof(buf), out, status));
+  TEST_ASSERT_EQUAL_HEX8(st, status);
+
+  // 版・長さの不一致は拒否する（他の種別のフレームと取り違えない）
+  TEST_ASSERT_FALSE(decodeCompactReading(buf, sizeof(buf) - 1, out, status));
+  buf[0] = 0xA1;
+  TEST_ASSERT_FALSE(decodeCompactReading(buf, sizeof(buf), out, status));
+  TEST_ASSERT_EQUAL(0, encodeCompactReading(reading(0, 0, 0, 0, 0), 0, buf, sizeof(buf) - 1));
+}
+
+// 位置付きフレーム: 座標はそのまま、HDOP と経過時間は飽和、未測位は経過 255
+void test_compact_position_frame() {
+  uint8_t buf[COMPACT_POSITION_FRAME_SIZE];
+  ReadingValues in = reading(800.0f, 22.5f, 40.0f, 1.0f, 1714566896UL);
+  ReadingPosition p = { true, -33868820, 151209296, 185, 1.26f };
+  TEST_ASSERT_EQUAL(COMPACT_POSITION_FRAME_SIZE, encodeCompactReading(in, 0, buf, sizeof(buf), &p));
+  TEST_ASSERT_EQUAL_HEX8(COMPACT_POSITION_VERSION, buf[0]);
+
+  ReadingValues out;
+  uint8_t status;
+  ReadingPosition outPos;
+  TEST_ASSERT_TRUE(decodeCompactReading(buf, sizeof(buf), out, status, &outPos));
+  TEST_ASSERT_TRUE(outPos.valid);
+  TEST_ASSERT_EQUAL_INT32(-33868820, outPos.latE6);
+  TEST_ASSERT_EQUAL_INT32(151209296, outPos.lonE6);
+  TEST_ASSERT_FLOAT_WITHIN(0.05f, 1.3f, outPos.hdop);
+  TEST_ASSERT_EQUAL_UINT32(180, outPos.ageS);  // 分単位に切り捨て
+  TEST_ASSERT_FLOAT_WITHIN(0.005f, 22.5f, out.temp);
+
+  // 飽和
+  p.hdop = 99.0f;
+  p.ageS = 86400;
+  encodeCompactReading(in, 0, buf, sizeof(buf), &p);
+  TEST_ASSERT_EQUAL_UINT8(255, buf[22]);
+  TEST_ASSERT_EQUAL_UINT8(254, buf[23]);
+
+  // 未測位でもフレーム長は同じ
+  p.valid = false;
+  TEST_ASSERT_EQUAL(COMPACT_POSITION_FRAME_SIZE, encodeCompactReading(in, 0, buf, sizeof(buf), &p));
+  TEST_ASSERT_EQUAL_UINT8(255, buf[23]);
+  TEST_ASSERT_TRUE(decodeCompactReading(buf, sizeof(buf), out, status, &outPos));
+  TEST_ASSERT_FALSE(outPos.valid);
+
+  // 位置を読まない呼び出しでも受け付ける
+  TEST_ASSERT_TRUE(decodeCompactReading(buf, sizeof(buf), out, status));
+}
+
+// 既定の float フレームは従来の並び（先頭16バイトが導入当初の形式）のまま、float_v2 は種別 0xF1 を前置する
+void test_float_frame_round_trip() {
+  uint8_t buf[FLOAT_V2_READING_FRAME_SIZE];
+  seed = 13;
+  for (int i = 0; i < 1000; i++) {
+    ReadingValues in = reading(uniform(0.0f, 40000.0f), uniform(-10.0f, 60.0f), uniform(0.0f, 100.0f),
+                               uniform(0.0f, 7.23f), (uint32_t)uniform(0.0f, 4.0e9f));
+    ReadingValues out;
+    TEST_ASSERT_EQUAL(FLOAT_READING_FRAME_SIZE, encodeFloatReading(in, false, buf, sizeof(buf)));
+    // 運用中のパーサー設定（co2::float:32:little-endian ...）と同じオフセット
+    float co2;
+    memcpy(&co2, buf, sizeof(co2));
+    TEST_ASSERT_EQUAL_MEMORY(&in.co2, &co2, sizeof(co2));
+    TEST_ASSERT_EQUAL_MEMORY(&in.wind, buf + 12, sizeof(in.wind));
+    TEST_ASSERT_EQUAL_MEMORY(&in.ts, buf + 16, sizeof(in.ts));
+    TEST_ASSERT_TRUE(decodeFloatReading(buf, FLOAT_READING_FRAME_SIZE, out));
+    TEST_ASSERT_EQUAL_MEMORY(&in, &out, sizeof(in));
+
+    TEST_ASSERT_EQUAL(FLOAT_V2_READING_FRAME_SIZE, encodeFloatReading(in, true, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_HEX8(FLOAT_V2_READING_FRAME_TYPE, buf[0]);
+    TEST_ASSERT_EQUAL_MEMORY(&in.co2, buf + 1, sizeof(in.co2));
+    TEST_ASSERT_TRUE(decodeFloatReading(buf, FLOAT_V2_READING_FRAME_SIZE, out));
+    TEST_ASSERT_EQUAL_MEMORY(&in, &out, sizeof(in));
+  }
+  ReadingValues out;
+  TEST_ASSERT_FALSE(decodeFloatReading(buf, FLOAT_READING_FRAME_SIZE - 1, out));
+  buf[0] = COMPACT_READING_VERSION;
+  TEST_ASSERT_FALSE(decodeFloatReading(buf, FLOAT_V2_READING_FRAME_SIZE, out));
+  TEST_ASSERT_EQUAL(0, encodeFloatReading(out, false, buf, FLOAT_READING_FRAME_SIZE - 1));
+  TEST_ASSERT_EQUAL(0, encodeFloatReading(out, true, buf, FLOAT_READING_FRAME_SIZE));
+}
+
+// udp_format の名前と形式毎のフレーム長（既定は従来の float）
+void test_udp_frame_format_names() {
+  UdpFrameFormat f = UDP_FRAME_COMPACT;
+  TEST_ASSERT_TRUE(parseUdpFrameFormat("FLOAT", f));
+  TEST_ASSERT_EQUAL(UDP_FRAME_FLOAT, f);
+  TEST_ASSERT_TRUE(parseUdpFrameFormat("float_v2", f));
+  TEST_ASSERT_EQUAL(UDP_FRAME_FLOAT_V2, f);
+  TEST_ASSERT_TRUE(parseUdpFrameFormat("compact", f));
+  TEST_ASSERT_FALSE(parseUdpFrameFormat("float3", f));
+  TEST_ASSERT_FALSE(parseUdpFrameFormat(nullptr, f));
+  TEST_ASSERT_EQUAL(UDP_FRAME_COMPACT, f);
+  TEST_ASSERT_EQUAL_STRING("float", udpFrameFormatName(UDP_FRAME_FLOAT));
+  TEST_ASSERT_EQUAL_STRING("float_v2", udpFrameFormatName(UDP_FRAME_FLOAT_V2));
+  TEST_ASSERT_EQUAL_STRING("compact", udpFrameFormatName(UDP_FRAME_COMPACT));
+
+  TEST_ASSERT_EQUAL(20, udpReadingFrameSize(UDP_FRAME_FLOAT, true));
+  TEST_ASSERT_EQUAL(21, udpReadingFrameSize(UDP_FRAME_FLOAT_V2, false));
+  TEST_ASSERT_EQUAL(14, udpReadingFrameSize(UDP_FRAME_COMPACT, false));
+  TEST_ASSERT_EQUAL(24, udpReadingFrameSize(UDP_FRAME_COMPACT, true));
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_json_layout);
+  RUN_TEST(test_round_trip_typical_values);
+  RUN_TEST(test_round_trip_random_values);
+  RUN_TEST(test_shortest_encoding);
+  RUN_TEST(test_binary_smaller_than_json);
+  RUN_TEST(test_buffer_too_small);
+  RUN_TEST(test_decode_rejects_truncated_and_trailing);
+  RUN_TEST(test_decode_ignores_unknown_keys);
+  RUN_TEST(test_half_precision);
+  RUN_TEST(test_format_names);
+  RUN_TEST(test_compact_quantization_within_sensor_accuracy);
+  RUN_TEST(test_compact_saturation);
+  RUN_TEST(test_compact_layout_and_status);
+  RUN_TEST(test_compact_position_frame);
+  RUN_TEST(test_float_frame_round_trip);
+  RUN_TEST(test_udp_frame_format_names);
+  return UNITY_END();
+}
@@ -0,0 +1,208 @@
+// 期限ベーススケジューラの仮想時計によるテスト
+#include <unity.h>
+
+#include "scheduler.h"
+#include "system_clock.h"
+
+void setUp() {}
+void tearDown() {}
+
+// 決定的な擬似乱数（0..n-1）
+static uint32_t seed;
+static uint32_t rnd(uint32_t n) {
+  seed = seed * 1103515245UL + 12345UL;
+  return (seed >> 8) % n;
+}
+
+// 期限到来まで眠り、発火したタイマーのIDを返す（処理時間 workMs を消費する）
+static int runOnce(DeadlineScheduler& s, VirtualClock& clock, uint32_t workMs) {
+  uint32_t wait = s.msUntilNext(clock.nowMs());
+  if (wait > 0) clock.sleepMs(wait);
+  int id = s.poll(clock.nowMs());
+  if (id >= 0 && workMs > 0) clock.sleepMs(workMs);
+  return id;
+}
+
+// 処理時間がばらついても、期限は前回期限基準で進み周期がずれない
+void test_no_drift_with_processing_time() {
+  seed = 1;
+  VirtualClock clock;
+  DeadlineScheduler s;
+  int id = s.add("sample", 60000, MISS_SKIP, clock.nowMs(), 60000);
+  TEST_ASSERT_EQUAL(0, id);
+
+  uint32_t lastFire = 0;
+  for (int i = 0; i < 1440; i++) {
+    TEST_ASSERT_EQUAL(id, runOnce(s, clock, 0));
+    lastFire = clock.nowMs();
+    TEST_ASSERT_EQUAL_UINT32(0, lastFire % 60000);
+    clock.sleepMs(rnd(5000)); // 周期より十分短い処理
+  }
+  // 1日分（1440回）で位相のずれなし
+  TEST_ASSERT_EQUAL_UINT32(1440UL * 60000UL, lastFire);
+  const TimerStats* st = s.stats(id);
+  TEST_ASSERT_EQUAL_UINT32(1440, st->fired);
+  TEST_ASSERT_EQUAL_UINT32(0, st->skipped);
+  TEST_ASSERT_EQUAL_UINT32(0, st->maxLateMs);
+}
+
+// ポーリングが遅れた分は遅延として記録されるが、次回期限には持ち越さない
+void test_late_poll_does_not_shift_phase() {
+  seed = 2;
+  VirtualClock clock;
+  DeadlineScheduler s;
+  int id = s.add("uplink", 10000, MISS_SKIP, clock.nowMs(), 10000);
+
+  uint32_t maxLate = 0;
+  uint64_t totalLate = 0;
+  for (int i = 1; i <= 500; i++) {
+    uint32_t late = rnd(3000);
+    clock.sleepMs(s.msUntil(id, clock.nowMs()) + late);
+    TEST_ASSERT_EQUAL(id, s.poll(clock.nowMs()));
+    TEST_ASSERT_EQUAL_UINT32(late, s.stats(id)->lastLateMs);
+    // 次の期限は周期境界のまま
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)(i + 1) * 10000UL, clock.nowMs() + s.msUntil(id, clock.nowMs()));
+    if (late > maxLate) maxLate = late;
+    totalLate += late;
+  }
+  const TimerStats* st = s.stats(id);
+  TEST_ASSERT_EQUAL_UINT32(500, st->fired);
+  TEST_ASSERT_EQUAL_UINT32(maxLate, st->maxLateMs);
+  TEST_ASSERT_TRUE(st->totalLateMs == totalLate);
+}
+
+// 長いブロッキング（周期の5.5倍）の後、MISS_SKIP は逃した期限を捨てて次の周期境界に合わせる
+void test_skip_policy_after_long_block() {
+  VirtualClock clock;
+  DeadlineScheduler s;
+  int id = s.add("sample", 1000, MISS_SKIP, clock.nowMs(), 1000);
+
+  TEST_ASSERT_EQUAL(id, runOnce(s, clock, 0));  // t=1000
+  clock.sleepMs(5500);                          // t=6500（2000 の期限に 4500ms 遅れ、3000..6000 を逃す）
+  TEST_ASSERT_EQUAL(id, s.poll(clock.nowMs()));
+  TEST_ASSERT_EQUAL_UINT32(4500, s.stats(id)->lastLateMs);
+  TEST_ASSERT_EQUAL(-1, s.poll(clock.nowMs()));  // 同じ時刻に再発火しない
+  TEST_ASSERT_EQUAL_UINT32(500, s.msUntil(id, clock.nowMs()));
+
+  TEST_ASSERT_EQUAL(id, runOnce(s, clock, 0));
+  TEST_ASSERT_EQUAL_UINT32(7000, clock.nowMs());
+  const TimerStats* st = s.stats(id);
+  TEST_ASSERT_EQUAL_UINT32(3, st->fired);
+  TEST_ASSERT_EQUAL_UINT32(4, st->skipped);
+  // 発火＋スキップ＝経過した期限の数（1000..7000 の7回）
+  TEST_ASSERT_EQUAL_UINT32(7, st->fired + st->skipped);
+}
+
+// MISS_CATCH_UP は逃した期限を上限 maxCatchUp 回まで順に発火し、超過分は捨てる
+void test_catch_up_policy_after_long_block() {
+  VirtualClock clock;
+  DeadlineScheduler s;
+  int id = s.add("soak", 1000, MISS_CATCH_UP, clock.nowMs(), 1000, 3);
+
+  TEST_ASSERT_EQUAL(id, runOnce(s, clock, 0));  // t=1000
+  clock.sleepMs(5500);                          // t=6500（2000..6000 の5回が期限切れ）
+
+  int burst = 0;
+  while (s.poll(clock.nowMs()) == id) burst++;
+  // 2000 の期限＋追いつき3回（4000, 5000, 6000）。上限を超えた 3000 は捨てる
+  TEST_ASSERT_EQUAL(4, burst);
+  const TimerStats* st = s.stats(id);
+  TEST_ASSERT_EQUAL_UINT32(1, st->skipped);
+  TEST_ASSERT_EQUAL_UINT32(500, st->lastLateMs);  // 最後の追いつきは 6000 の期限
+  TEST_ASSERT_EQUAL_UINT32(500, s.msUntil(id, clock.nowMs()));
+
+  // 追いついた後は通常周期に戻る
+  TEST_ASSERT_EQUAL(id, runOnce(s, clock, 0));
+  TEST_ASSERT_EQUAL_UINT32(7000, clock.nowMs());
+  TEST_ASSERT_EQUAL_UINT32(0, s.stats(id)->lastLateMs);
+  TEST_ASSERT_EQUAL_UINT32(7, st->fired + st->skipped);
+
+  // 追いつきの上限は次のブロッキングで再び使える
+  clock.sleepMs(2500);  // t=9500（8000, 9000 が期限切れ）
+  burst = 0;
+  while (s.poll(clock.nowMs()) == id) burst++;
+  TEST_ASSERT_EQUAL(2, burst);
+  TEST_ASSERT_EQUAL_UINT32(1, st->skipped);
+}
+
+// 複数タイマーの期限が重なったら最も遅れているもの（同時なら登録順）から発火する
+void test_most_late_first_then_registration_order() {
+  VirtualClock clock;
+  DeadlineScheduler s;
+  int a = s.add("a", 5000, MISS_SKIP, clock.nowMs(), 3000);
+  int b = s.add("b", 5000, MISS_SKIP, clock.nowMs(), 1000);
+  int c = s.add("c", 5000, MISS_SKIP, clock.nowMs(), 3000);
+
+  clock.sleepMs(4000);
+  TEST_ASSERT_EQUAL(b, s.poll(clock.nowMs()));
+  TEST_ASSERT_EQUAL(a, s.poll(clock.nowMs()));
+  TEST_ASSERT_EQUAL(c, s.poll(clock.nowMs()));
+  TEST_ASSERT_EQUAL(-1, s.poll(clock.nowMs()));
+  TEST_ASSERT_EQUAL_UINT32(2000, s.msUntilNext(clock.nowMs()));  // b の次回 6000
+}
+
+// millis() のラップアラウンドをまたいでも期限判定と周期が崩れない
+void test_wraparound() {
+  VirtualClock clock((uint64_t)(0xFFFFFFFFUL - 2500UL) * 1000ULL);
+  DeadlineScheduler s;
+  int id = s.add("sample", 1000, MISS_SKIP, clock.nowMs(), 1000);
+  uint32_t start = clock.nowMs();
+
+  for (int i = 1; i <= 10; i++) {
+    TEST_ASSERT_EQUAL(id, runOnce(s, clock, 200));
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)(start + i * 1000 + 200), clock.nowMs());
+  }
+  TEST_ASSERT_TRUE(clock.nowMs() < start);  // 折り返した
+  TEST_ASSERT_EQUAL_UINT32(0, s.stats(id)->skipped);
+  TEST_ASSERT_EQUAL_UINT32(0, s.stats(id)->maxLateMs);
+}
+
+// 周期変更・即時実行・無効化
+void test_set_period_trigger_and_disable() {
+  VirtualClock clock;
+  DeadlineScheduler s;
+  int id = s.add("uplink", 60000, MISS_SKIP, clock.nowMs(), 60000);
+  clock.sleepMs(10000);
+
+  s.setPeriod(id, 30000, clock.nowMs());
+  TEST_ASSERT_EQUAL_UINT32(30000, s.period(id));
+  TEST_ASSERT_EQUAL_UINT32(30000, s.msUntil(id, clock.nowMs()));
+
+  s.trigger(id, clock.nowMs());
+  TEST_ASSERT_EQUAL(id, s.poll(clock.nowMs()));
+  TEST_ASSERT_EQUAL_UINT32(30000, s.msUntil(id, clock.nowMs()));
+
+  s.setEnabled(id, false);
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, s.msUntil(id, clock.nowMs()));
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, s.msUntilNext(clock.nowMs()));
+  clock.sleepMs(120000);
+  TEST_ASSERT_EQUAL(-1, s.poll(clock.nowMs()));
+}
+
+// 登録の上限と不正な引数
+void test_add_limits() {
+  DeadlineScheduler s;
+  TEST_ASSERT_EQUAL(-1, s.add("zero", 0, MISS_SKIP, 0));
+  for (size_t i = 0; i < DeadlineScheduler::MAX_TIMERS; i++) {
+    TEST_ASSERT_EQUAL((int)i, s.add("t", 1000, MISS_SKIP, 0));
+  }
+  TEST_ASSERT_EQUAL(-1, s.add("overflow", 1000, MISS_SKIP, 0));
+  TEST_ASSERT_NULL(s.stats(-1));
+  TEST_ASSERT_NULL(s.stats((int)DeadlineScheduler::MAX_TIMERS));
+  TEST_ASSERT_EQUAL_UINT32(0, s.period(99));
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_no_drift_with_processing_time);
+  RUN_TEST(test_late_poll_does_not_shift_phase);
+  RUN_TEST(test_skip_policy_after_long_block);
+  RUN_TEST(test_catch_up_policy_after_long_block);
+  RUN_TEST(test_most_late_first_then_registration_order);
+  RUN_TEST(test_wraparound);
+  RUN_TEST(test_set_period_trigger_and_disable);
+  RUN_TEST(test_add_limits);
+  return UNITY_END();
+}
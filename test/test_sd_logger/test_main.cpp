@@ -0,0 +1,169 @@
+// SD ロガーを通常のファイル（StdioFileStore）で動かし、記録の往復・ブロック境界・ファイルの切替と、
+// 書き込みスループット・1ブロックの書き出し（write + flush）の所要時間を計測する
+#include <filesystem>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#include "sd_logger.h"
+#include "time_sync.h"
+
+static char root[64];
+
+void setUp() {
+  snprintf(root, sizeof(root), "/tmp/sdlog_XXXXXX");
+  TEST_ASSERT_NOT_NULL(mkdtemp(root));
+}
+
+void tearDown() {
+  std::filesystem::remove_all(root);
+}
+
+static const uint32_t DAY0 = 1760054400UL;  // 2025-10-10 00:00:00 UTC
+
+static SdLogRecord recordAt(uint32_t time, uint32_t i) {
+  SdLogRecord r = { time, true, 400.0f + i % 1000, 20.0f + (i % 50) * 0.1f, 45.5f, 0.25f, true, i % 3 != 0 };
+  return r;
+}
+
+// ファイルを読み込む（ヘッダ + レコード）。読めなければ0
+static size_t readFile(const char* path, uint8_t* out, size_t outSize) {
+  char full[256];
+  snprintf(full, sizeof(full), "%s%s", root, path);
+  FILE* f = fopen(full, "rb");
+  if (f == nullptr) return 0;
+  size_t n = fread(out, 1, outSize, f);
+  fclose(f);
+  return n;
+}
+
+// 書いたレコードを全て読み戻せ、シーケンス番号が連続する
+void test_records_round_trip() {
+  StdioFileStore store(root);
+  SdLogger logger(store, "/logs");
+  logger.configure(4UL * 1024 * 1024, 60000);
+  logger.setDeviceId("03123456789");
+  const uint32_t N = 1000;
+  for (uint32_t i = 0; i < N; i++) {
+    TEST_ASSERT_TRUE(logger.append(recordAt(DAY0 + i * 10, i), i * 10000));
+    while (logger.service(i * 10000)) {
+    }
+  }
+  logger.flushAll(N * 10000);
+
+  static uint8_t data[32 + N * SD_LOG_RECORD_SIZE + 1];
+  char path[40];
+  snprintf(path, sizeof(path), "/logs/%08lu_00.bin", (unsigned long)epochToDayStamp(DAY0));
+  size_t n = readFile(path, data, sizeof(data));
+  TEST_ASSERT_EQUAL_UINT32(SD_LOG_HEADER_SIZE + N * SD_LOG_RECORD_SIZE, n);
+  TEST_ASSERT_TRUE(validSdLogHeader(data, n));
+  TEST_ASSERT_EQUAL_STRING_LEN("03123456789", (const char*)data + 16, 11);
+  for (uint32_t i = 0; i < N; i++) {
+    SdLogRecord r;
+    uint8_t seq;
+    TEST_ASSERT_TRUE(decodeSdLogRecord(data + SD_LOG_HEADER_SIZE + i * SD_LOG_RECORD_SIZE, r, seq));
+    SdLogRecord expected = recordAt(DAY0 + i * 10, i);
+    TEST_ASSERT_EQUAL_UINT32(expected.time, r.time);
+    TEST_ASSERT_EQUAL_UINT8((uint8_t)i, seq);
+    TEST_ASSERT_EQUAL_FLOAT(expected.co2, r.co2);
+    TEST_ASSERT_EQUAL(expected.fs3000Ok, r.fs3000Ok);
+  }
+  SdLogStats s = logger.stats();
+  TEST_ASSERT_EQUAL_UINT32(N, s.records);
+  TEST_ASSERT_EQUAL_UINT32(0, s.dropped);
+  TEST_ASSERT_EQUAL_UINT32(0, s.errors);
+}
+
+// 滞留時間に達するまでは 512 バイト境界に揃うブロック単位でだけ書き出す
+void test_writes_are_block_aligned() {
+  StdioFileStore store(root);
+  SdLogger logger(store, "/logs");
+  logger.configure(4UL * 1024 * 1024, 3600000);
+  char path[40];
+  snprintf(path, sizeof(path), "/logs/%08lu_00.bin", (unsigned long)epochToDayStamp(DAY0));
+  uint32_t writes = 0;
+  for (uint32_t i = 0; i < 500; i++) {
+    logger.append(recordAt(DAY0 + i * 10, i), i * 10000);
+    while (logger.service(i * 10000)) {
+      writes++;
+      TEST_ASSERT_EQUAL_INT32(0, store.fileSize(path) % SdLogger::BLOCK_SIZE);
+    }
+  }
+  TEST_ASSERT_TRUE(writes >= 15);
+  TEST_ASSERT_EQUAL_UINT32(0, logger.stats().partialBlocks);
+  // 滞留時間を超えた端数は書き出す
+  TEST_ASSERT_TRUE(logger.buffered() > 0);
+  TEST_ASSERT_TRUE(logger.service(500 * 10000 + 3600000));
+  TEST_ASSERT_EQUAL_UINT32(1, logger.stats().partialBlocks);
+  TEST_ASSERT_EQUAL_UINT32(0, logger.buffered());
+}
+
+// 日付の変わり目で次の日のファイルへ、途中で切れたファイルには追記せず次の番号へ
+void test_day_rotation_and_truncated_file() {
+  StdioFileStore store(root);
+  TEST_ASSERT_TRUE(store.makeDir("/logs"));
+  // 前回の電源断で途中まで書かれたファイル
+  char path[40];
+  snprintf(path, sizeof(path), "/logs/%08lu_00.bin", (unsigned long)epochToDayStamp(DAY0));
+  TEST_ASSERT_TRUE(store.openAppend(path));
+  uint8_t junk[SD_LOG_HEADER_SIZE + 7] = {};
+  store.write(junk, sizeof(junk));
+  store.close();
+
+  SdLogger logger(store, "/logs");
+  logger.configure(4UL * 1024 * 1024, 60000);
+  for (uint32_t i = 0; i < 100; i++) {
+    // 23:50 から10分毎 → 2件目以降は翌日
+    logger.append(recordAt(DAY0 + 86400 - 600 + i * 600, i), i * 1000);
+  }
+  logger.flushAll(100 * 1000);
+  SdLogStats s = logger.stats();
+  TEST_ASSERT_EQUAL_UINT32(0, s.errors);
+  TEST_ASSERT_EQUAL_UINT32(1, s.rotations);
+
+  char day0[40], day1[40];
+  snprintf(day0, sizeof(day0), "/logs/%08lu_01.bin", (unsigned long)epochToDayStamp(DAY0));
+  snprintf(day1, sizeof(day1), "/logs/%08lu_00.bin", (unsigned long)epochToDayStamp(DAY0 + 86400));
+  TEST_ASSERT_EQUAL_INT32((int32_t)sizeof(junk), store.fileSize(path));
+  TEST_ASSERT_EQUAL_INT32(SD_LOG_HEADER_SIZE + 1 * SD_LOG_RECORD_SIZE, store.fileSize(day0));
+  TEST_ASSERT_EQUAL_INT32(SD_LOG_HEADER_SIZE + 99 * SD_LOG_RECORD_SIZE, store.fileSize(day1));
+}
+
+// 1MB を書き出し、スループットと1ブロックの書き出し時間（fsync まで）を出力する
+// 時間はホストの媒体に依存するため値は判定せず、全件が欠落なく書けたことだけを確かめる
+void test_throughput_and_flush_latency() {
+  StdioFileStore store(root, true);
+  SdLogger logger(store, "/bench");
+  logger.configure(2UL * 1024 * 1024, 60000);
+  const uint32_t N = 65536;  // 1MB
+  uint32_t t0 = store.nowUs();
+  for (uint32_t i = 0; i < N; i++) {
+    logger.append(recordAt(DAY0 + i, i), i);
+    while (logger.buffered() >= SdLogger::BLOCK_SIZE && logger.service(i)) {
+    }
+  }
+  logger.flushAll(N);
+  uint32_t totalUs = store.nowUs() - t0;
+  SdLogStats s = logger.stats();
+  TEST_ASSERT_EQUAL_UINT32(N, s.records);
+  TEST_ASSERT_EQUAL_UINT32(0, s.dropped);
+  TEST_ASSERT_EQUAL_UINT32(0, s.errors);
+  TEST_ASSERT_EQUAL_UINT32(N * SD_LOG_RECORD_SIZE, s.bytesWritten);
+  TEST_ASSERT_TRUE(s.blocks >= N * SD_LOG_RECORD_SIZE / SdLogger::BLOCK_SIZE);
+  printf("SD BENCH: host %lu bytes in %lu ms = %lu KB/s, block write avg %lu us max %lu us, %lu blocks\n",
+         (unsigned long)s.bytesWritten, (unsigned long)(totalUs / 1000),
+         (unsigned long)((uint64_t)s.bytesWritten * 1000000ULL / 1024 / (totalUs > 0 ? totalUs : 1)),
+         (unsigned long)(s.totalFlushUs / s.blocks), (unsigned long)s.maxFlushUs, (unsigned long)s.blocks);
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_records_round_trip);
+  RUN_TEST(test_writes_are_block_aligned);
+  RUN_TEST(test_day_rotation_and_truncated_file);
+  RUN_TEST(test_throughput_and_flush_latency);
+  return UNITY_END();
+}
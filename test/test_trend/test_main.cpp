@@ -0,0 +1,200 @@
+// CO2 推移の履歴（固定メモリ・LTTB の代表点・時刻）と推移グラフの描画量
+#include <stdlib.h>
+#include <unity.h>
+
+#include "trend_chart.h"
+#include "trend_history.h"
+
+void setUp() {}
+void tearDown() {}
+
+// 描画を数えるだけのキャンバス。LCD へ書くピクセル数から描画時間を見積もる
+class CountingCanvas : public TrendCanvas {
+public:
+  CountingCanvas() { reset(); }
+  void reset() {
+    fills = 0;
+    lines = 0;
+    pixels = 0;
+    written = 0;
+  }
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) override {
+    (void)x; (void)y; (void)color;
+    fills++;
+    written += (uint32_t)w * h;
+  }
+  void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color) override {
+    (void)color;
+    int dx = abs(x1 - x0);
+    int dy = abs(y1 - y0);
+    lines++;
+    written += (uint32_t)(dx > dy ? dx : dy) + 1;
+  }
+  void drawPixel(int16_t x, int16_t y, uint16_t color) override {
+    (void)x; (void)y; (void)color;
+    pixels++;
+    written++;
+  }
+  // SPI 40MHz・16ビット/ピクセルで書いた場合の時間 [us]（呼び出し毎のアドレス設定を 2us とする）
+  uint32_t estimatedUs() const { return written * 16 / 40 + (fills + lines + pixels) * 2; }
+
+  uint32_t fills;
+  uint32_t lines;
+  uint32_t pixels;
+  uint32_t written;
+};
+
+static const int16_t W = 320;
+static const int16_t H = 220;
+
+// 在室で上昇し換気で下がる波形（10秒周期で2時間周期）
+static uint16_t waveAt(uint32_t i) {
+  uint32_t k = i % 720;
+  return (uint16_t)(450 + (k < 360 ? k * 2 : (720 - k) * 2));
+}
+
+// ==== TrendHistory ====
+
+// 何日分追加しても保持する点数とメモリは固定（README の約4KB）
+void test_memory_is_fixed() {
+  static TrendHistory history;
+  TEST_ASSERT_TRUE(TrendHistory::memoryBytes() <= 4200);
+  for (uint32_t i = 0; i < 3 * 8640; i++) history.add(i * 10, waveAt(i));
+  TEST_ASSERT_EQUAL_UINT32(TrendHistory::RAW_CAPACITY, history.rawCount());
+  TEST_ASSERT_EQUAL_UINT32(TrendHistory::COARSE_CAPACITY, history.coarseCount());
+  // 詳細は直近1時間、粗い履歴は直近24時間を古い順に持つ
+  uint32_t last = (3 * 8640 - 1) * 10;
+  TEST_ASSERT_EQUAL_UINT32(last - 3590, history.raw(0).t);
+  TEST_ASSERT_EQUAL_UINT32(last, history.raw(history.rawCount() - 1).t);
+  TEST_ASSERT_TRUE(history.coarse(0).t >= last - 86400 - 3 * TrendHistory::COARSE_BUCKET_S);
+  for (size_t i = 1; i < history.coarseCount(); i++) {
+    TEST_ASSERT_TRUE(history.coarse(i).t > history.coarse(i - 1).t);
+  }
+}
+
+// 平坦な波形の中の1サンプルだけのピークも粗い履歴に残る（平均や間引きでは消える）
+void test_coarse_keeps_spike() {
+  static TrendHistory history;
+  const uint32_t spikeAt = 5000;
+  for (uint32_t i = 0; i < 8640; i++) history.add(i * 10, i == spikeAt ? 1800 : 500);
+  bool found = false;
+  for (size_t i = 0; i < history.coarseCount(); i++) {
+    TrendPoint p = history.coarse(i);
+    if (p.value == 1800) {
+      TEST_ASSERT_EQUAL_UINT32(spikeAt * 10, p.t);
+      found = true;
+    }
+  }
+  TEST_ASSERT_TRUE(found);
+}
+
+// 欠測（電源断など）で空いた区間は飛ばして確定を続ける
+void test_gap_is_skipped() {
+  static TrendHistory history;
+  for (uint32_t i = 0; i < 360; i++) history.add(i * 10, 600);
+  size_t before = history.coarseCount();
+  for (uint32_t i = 0; i < 360; i++) history.add(20000 + i * 10, 700);
+  TEST_ASSERT_TRUE(history.coarseCount() > before);
+  TEST_ASSERT_EQUAL_UINT16(700, history.coarse(history.coarseCount() - 1).value);
+}
+
+// 時刻の逆行は捨てる。起動から49.7日（millis() のラップ = 4294967秒）を超えても追加は止まらない
+void test_time_past_millis_wrap() {
+  static TrendHistory history;
+  const uint32_t wrapS = 4294967;
+  uint32_t t0 = wrapS - 3600;
+  for (uint32_t i = 0; i < 720; i++) history.add(t0 + i * 10, waveAt(i));
+  size_t coarseBefore = history.coarseCount();
+  TrendPoint last = history.raw(history.rawCount() - 1);
+  TEST_ASSERT_TRUE(last.t > wrapS);
+  TEST_ASSERT_TRUE(coarseBefore > 0);
+
+  // millis()/1000 をそのまま使うとラップ後は小さな値になり、全て逆行として捨てられる
+  TEST_ASSERT_FALSE(history.add(5, 500));
+  TEST_ASSERT_EQUAL_UINT32(last.t, history.raw(history.rawCount() - 1).t);
+
+  // 64ビットに積算した経過時間ならラップ後も増え続ける
+  uint64_t clockMs = (uint64_t)last.t * 1000;
+  uint32_t lastMs = (uint32_t)clockMs;
+  for (uint32_t i = 1; i <= 720; i++) {
+    uint32_t nowMs = lastMs + 10000;  // uint32 の millis() はこの間に0へ戻る
+    clockMs += (uint32_t)(nowMs - lastMs);
+    lastMs = nowMs;
+    history.add((uint32_t)(clockMs / 1000), 500);
+  }
+  TEST_ASSERT_EQUAL_UINT32(last.t + 7200, history.raw(history.rawCount() - 1).t);
+  TEST_ASSERT_TRUE(history.coarseCount() > coarseBefore);
+}
+
+// ==== TrendChart ====
+
+// 1点の追記は数列分の消去と線分1本だけで、全体の再描画より2桁少ない
+void test_append_draws_far_less_than_redraw() {
+  static TrendHistory history;
+  for (uint32_t i = 0; i < 8640; i++) history.add(i * 10, waveAt(i));
+  uint32_t nowSec = 8639 * 10;
+  CountingCanvas canvas;
+  TrendChart chart(canvas, 0, 20, W, H);
+
+  const TrendSpan spans[] = { TREND_SPAN_1H, TREND_SPAN_24H };
+  for (TrendSpan span : spans) {
+    chart.configure(span, 1500);
+    canvas.reset();
+    chart.redraw(history, nowSec);
+    uint32_t redrawWritten = canvas.written;
+    uint32_t redrawUs = canvas.estimatedUs();
+    TEST_ASSERT_TRUE(redrawWritten >= (uint32_t)W * H);  // 全面の消去を含む
+
+    uint32_t step = span == TREND_SPAN_24H ? TrendHistory::COARSE_BUCKET_S : 10;
+    uint32_t maxWritten = 0;
+    uint32_t maxUs = 0;
+    for (uint32_t i = 1; i <= 30; i++) {
+      canvas.reset();
+      TrendPoint p = { nowSec + i * step, (uint16_t)(800 + i * 10) };
+      TEST_ASSERT_TRUE(chart.append(p));
+      if (canvas.written > maxWritten) maxWritten = canvas.written;
+      if (canvas.estimatedUs() > maxUs) maxUs = canvas.estimatedUs();
+      TEST_ASSERT_TRUE(canvas.fills <= 2);  // 折り返しで2回に分かれる場合のみ2
+      TEST_ASSERT_TRUE(canvas.lines <= 1);
+    }
+    TEST_ASSERT_TRUE(maxWritten * 100 < redrawWritten);
+    // 再描画は数十ms、追記は1ms未満
+    TEST_ASSERT_TRUE(redrawUs > 20000);
+    TEST_ASSERT_TRUE(maxUs < 1000);
+  }
+  TEST_ASSERT_EQUAL_UINT32(60, chart.appended());
+}
+
+// 縦軸の上限を超える値は描かずに再描画を求め、再描画で上限を500ppm単位で広げる
+void test_over_range_requests_redraw() {
+  static TrendHistory history;
+  for (uint32_t i = 0; i < 360; i++) history.add(i * 10, 900);
+  CountingCanvas canvas;
+  TrendChart chart(canvas, 0, 20, W, H);
+  chart.configure(TREND_SPAN_1H, 1500);
+  chart.redraw(history, 3590);
+  TEST_ASSERT_EQUAL_UINT16(TrendChart::Y_MAX_PPM, chart.yMax());
+
+  canvas.reset();
+  TrendPoint p = { 3600, 2300 };
+  TEST_ASSERT_FALSE(chart.append(p));
+  TEST_ASSERT_EQUAL_UINT32(0, canvas.written);
+
+  history.add(p.t, p.value);
+  chart.redraw(history, p.t);
+  TEST_ASSERT_EQUAL_UINT16(2500, chart.yMax());
+  TEST_ASSERT_TRUE(chart.append(TrendPoint{ 3610, 2400 }));
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_memory_is_fixed);
+  RUN_TEST(test_coarse_keeps_spike);
+  RUN_TEST(test_gap_is_skipped);
+  RUN_TEST(test_time_past_millis_wrap);
+  RUN_TEST(test_append_draws_far_less_than_redraw);
+  RUN_TEST(test_over_range_requests_redraw);
+  return UNITY_END();
+}
@@ -0,0 +1,184 @@
+// 換気解析（指数減衰フィットとエピソード検出）の合成データによるテスト
+#include <unity.h>
+
+#include <math.h>
+
+#include "ventilation.h"
+
+void setUp() {}
+void tearDown() {}
+
+// 決定的な擬似乱数（±amp の一様ノイズ）
+static uint32_t seed;
+static float noise(float amp) {
+  seed = seed * 1103515245UL + 12345UL;
+  return ((float)((seed >> 16) % 2001) / 1000.0f - 1.0f) * amp;
+}
+
+// 外気 420 ppm から peakPpm まで上昇させ、換気回数 ach [回/h] で指数減衰させる合成データを投入する
+// 戻り値は発生したイベントの OR
+static uint8_t feedDecay(VentilationAnalyzer& a, uint32_t& t, float peakPpm, float ach, float wind,
+                         uint32_t decaySec, float noiseAmp) {
+  uint8_t events = 0;
+  const float outdoor = 420.0f;
+  for (float c = outdoor + 30.0f; c < peakPpm; c += 50.0f) {
+    events |= a.update(t, c + noise(noiseAmp), true, wind, true);
+    t += 60;
+  }
+  float c = peakPpm;
+  for (uint32_t s = 0; s <= decaySec; s += 60) {
+    c = outdoor + (peakPpm - outdoor) * expf(-ach / 3600.0f * (float)s);
+    events |= a.update(t, c + noise(noiseAmp), true, wind, true);
+    t += 60;
+  }
+  // 再上昇でエピソードを閉じる
+  for (int i = 1; i <= 3; i++) {
+    events |= a.update(t, c + i * 100.0f, true, wind, true);
+    t += 60;
+  }
+  return events;
+}
+
+void test_decay_fit_recovers_exact_rate() {
+  DecayFit fit;
+  const float lambda = 2.0f / 3600.0f;
+  for (int s = 0; s <= 1800; s += 60) fit.add((float)s, 900.0f * expf(-lambda * s));
+  float l = 0, r2 = 0;
+  TEST_ASSERT_TRUE(fit.solve(l, r2));
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, 2.0f, l * 3600.0f);
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 1.0f, r2);
+}
+
+void test_decay_fit_needs_three_points_and_ignores_non_positive_excess() {
+  DecayFit fit;
+  float l = 0, r2 = 0;
+  fit.add(0, 500.0f);
+  fit.add(60, 400.0f);
+  fit.add(120, 0.0f);    // 外気以下は対数を取れないため捨てる
+  fit.add(180, -10.0f);
+  TEST_ASSERT_EQUAL_UINT16(2, fit.count());
+  TEST_ASSERT_FALSE(fit.solve(l, r2));
+  fit.add(120, 320.0f);
+  TEST_ASSERT_TRUE(fit.solve(l, r2));
+  TEST_ASSERT_TRUE(l > 0.0f);
+}
+
+void test_analyzer_estimates_ach_from_noisy_decay() {
+  static const float ACHS[] = { 0.5f, 1.0f, 3.0f, 6.0f };
+  for (size_t i = 0; i < sizeof(ACHS) / sizeof(ACHS[0]); i++) {
+    seed = 42;
+    VentilationAnalyzer a;
+    uint32_t t = 0;
+    // 外気比超過が 50 ppm を切る前に 1時間で打ち切る（低換気でも有効な長さを確保）
+    uint8_t ev = feedDecay(a, t, 1500.0f, ACHS[i], 1.0f, 3600, 5.0f);
+    TEST_ASSERT_TRUE(ev & VentilationAnalyzer::EVENT_EPISODE);
+    TEST_ASSERT_EQUAL_UINT16(1, a.episodeCount());
+    const VentilationEpisode& e = a.lastEpisode();
+    // SCD40 の精度相当のノイズ（±5 ppm）で 10% 以内
+    TEST_ASSERT_FLOAT_WITHIN(ACHS[i] * 0.1f, ACHS[i], e.ach);
+    TEST_ASSERT_TRUE(e.r2 >= 0.8f);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 1.0f, e.meanWind);
+  }
+}
+
+void test_analyzer_rejects_short_and_flat_traces() {
+  seed = 7;
+  VentilationAnalyzer a;
+  uint32_t t = 0;
+  // 10分未満の減衰は有効なエピソードにしない
+  feedDecay(a, t, 1200.0f, 2.0f, 0.5f, 300, 2.0f);
+  TEST_ASSERT_EQUAL_UINT16(0, a.episodeCount());
+  // 減衰しない（ノイズだけの）推移ではエピソードを始めない
+  VentilationAnalyzer flat;
+  for (int i = 0; i < 120; i++) {
+    flat.update(t, 800.0f + noise(10.0f), true, 0.5f, true);
+    t += 60;
+  }
+  TEST_ASSERT_FALSE(flat.decaying());
+  TEST_ASSERT_EQUAL_UINT16(0, flat.episodeCount());
+}
+
+void test_invalid_co2_samples_are_skipped() {
+  seed = 3;
+  VentilationAnalyzer a;
+  uint32_t t = 0;
+  for (int i = 0; i < 10; i++) {
+    TEST_ASSERT_EQUAL_UINT8(VentilationAnalyzer::EVENT_NONE, a.update(t, 5000.0f, false, 0, false));
+    t += 60;
+  }
+  TEST_ASSERT_FALSE(a.alarmActive());
+  TEST_ASSERT_EQUAL_UINT16(0, a.intervalStats().samples);
+}
+
+void test_wind_correlates_with_ach() {
+  VentilationAnalyzer a;
+  uint32_t t = 0;
+  seed = 11;
+  // 風速が強いほど換気回数が大きいエピソード
+  static const float WINDS[] = { 0.2f, 0.8f, 1.5f, 2.5f };
+  for (size_t i = 0; i < sizeof(WINDS) / sizeof(WINDS[0]); i++) {
+    feedDecay(a, t, 1400.0f, 0.8f + WINDS[i] * 1.2f, WINDS[i], 2400, 3.0f);
+  }
+  TEST_ASSERT_EQUAL_UINT16(4, a.episodeCount());
+  TEST_ASSERT_TRUE(a.windAchCorrelation() > 0.9f);
+}
+
+void test_alarm_hysteresis() {
+  VentilationAnalyzer a;
+  TEST_ASSERT_EQUAL_UINT8(0, a.update(0, 990.0f, true, 0, false));
+  TEST_ASSERT_EQUAL_UINT8(VentilationAnalyzer::EVENT_ALARM_ON, a.update(60, 1000.0f, true, 0, false));
+  TEST_ASSERT_TRUE(a.alarmActive());
+  // しきい値 - ヒステリシス（900 ppm）を下回るまでは解除しない
+  TEST_ASSERT_EQUAL_UINT8(0, a.update(120, 950.0f, true, 0, false) & VentilationAnalyzer::EVENT_ALARM_OFF);
+  TEST_ASSERT_EQUAL_UINT8(0, a.update(180, 1100.0f, true, 0, false) & VentilationAnalyzer::EVENT_ALARM_ON);
+  TEST_ASSERT_TRUE(a.update(240, 890.0f, true, 0, false) & VentilationAnalyzer::EVENT_ALARM_OFF);
+  TEST_ASSERT_FALSE(a.alarmActive());
+}
+
+void test_interval_stats_and_frames() {
+  VentilationAnalyzer a;
+  a.update(0, 500.0f, true, 1.0f, true);
+  a.update(60, 700.0f, true, 3.0f, true);
+  VentilationIntervalStats st = a.takeIntervalStats();
+  TEST_ASSERT_EQUAL_UINT16(2, st.samples);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 600.0f, st.meanPpm);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 700.0f, st.maxPpm);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 2.0f, st.meanWind);
+  TEST_ASSERT_EQUAL_UINT16(0, a.intervalStats().samples);
+
+  uint8_t frame[VENTILATION_METRICS_FRAME_SIZE];
+  TEST_ASSERT_EQUAL(VENTILATION_METRICS_FRAME_SIZE, encodeMetricsFrame(a, st, frame, sizeof(frame)));
+  TEST_ASSERT_EQUAL_HEX8(VENTILATION_METRICS_FRAME_TYPE, frame[0]);
+  TEST_ASSERT_EQUAL(0, encodeMetricsFrame(a, st, frame, sizeof(frame) - 1));
+
+  VentilationEpisode e = {};
+  e.startSec = 100;
+  e.endSec = 1900;
+  e.startPpm = 1400;
+  e.endPpm = 600;
+  e.ach = 2.34f;
+  e.r2 = 0.987f;
+  e.meanWind = -1.0f;
+  e.samples = 31;
+  uint8_t ep[VENTILATION_EPISODE_FRAME_SIZE];
+  TEST_ASSERT_EQUAL(VENTILATION_EPISODE_FRAME_SIZE, encodeEpisodeFrame(e, ep, sizeof(ep)));
+  TEST_ASSERT_EQUAL_HEX8(VENTILATION_EPISODE_FRAME_TYPE, ep[0]);
+  TEST_ASSERT_EQUAL_UINT16(1800, ep[2] | (ep[3] << 8));
+  TEST_ASSERT_EQUAL_UINT16(234, ep[8] | (ep[9] << 8));
+  TEST_ASSERT_EQUAL_UINT16(0xFFFF, ep[12] | (ep[13] << 8));   // 風速無効
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_decay_fit_recovers_exact_rate);
+  RUN_TEST(test_decay_fit_needs_three_points_and_ignores_non_positive_excess);
+  RUN_TEST(test_analyzer_estimates_ach_from_noisy_decay);
+  RUN_TEST(test_analyzer_rejects_short_and_flat_traces);
+  RUN_TEST(test_invalid_co2_samples_are_skipped);
+  RUN_TEST(test_wind_correlates_with_ach);
+  RUN_TEST(test_alarm_hysteresis);
+  RUN_TEST(test_interval_stats_and_frames);
+  return UNITY_END();
+}
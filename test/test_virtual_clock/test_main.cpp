@@ -0,0 +1,258 @@
+// 仮想時計のイベント順序・入れ子の待機と、スケジューラ＋経路切替の1日分のシミュレーション
+#include <unity.h>
+
+#include "scheduler.h"
+#include "system_clock.h"
+#include "transport.h"
+
+void setUp() {}
+void tearDown() {}
+
+// ==== VirtualClock ====
+
+// 実行されたイベントの記録
+struct EventLog {
+  VirtualClock* clock;
+  int ids[16];
+  uint32_t times[16];
+  int count;
+};
+
+struct EventCtx {
+  EventLog* log;
+  int id;
+  uint32_t nestedSleepMs;  // イベントの中で待機する時間（モデムの応答待ちなど）
+};
+
+static void recordEvent(void* ctx, uint32_t nowMs) {
+  EventCtx* e = (EventCtx*)ctx;
+  EventLog* log = e->log;
+  log->ids[log->count] = e->id;
+  log->times[log->count] = nowMs;
+  log->count++;
+  if (e->nestedSleepMs > 0) log->clock->sleepMs(e->nestedSleepMs);
+}
+
+// 予約順ではなく時刻順に、同時刻なら予約順に実行し、各イベントはその時刻で呼ばれる
+void test_events_run_in_time_order() {
+  VirtualClock clock;
+  EventLog log = { &clock, {}, {}, 0 };
+  EventCtx a = { &log, 1, 0 }, b = { &log, 2, 0 }, c = { &log, 3, 0 }, d = { &log, 4, 0 };
+  TEST_ASSERT_TRUE(clock.schedule(300, recordEvent, &a));
+  TEST_ASSERT_TRUE(clock.schedule(100, recordEvent, &b));
+  TEST_ASSERT_TRUE(clock.schedule(200, recordEvent, &c));
+  TEST_ASSERT_TRUE(clock.schedule(100, recordEvent, &d));
+  TEST_ASSERT_EQUAL(4, clock.pending());
+
+  clock.sleepMs(250);
+  TEST_ASSERT_EQUAL(3, log.count);
+  TEST_ASSERT_EQUAL(2, log.ids[0]);
+  TEST_ASSERT_EQUAL(4, log.ids[1]);
+  TEST_ASSERT_EQUAL(3, log.ids[2]);
+  TEST_ASSERT_EQUAL_UINT32(100, log.times[0]);
+  TEST_ASSERT_EQUAL_UINT32(100, log.times[1]);
+  TEST_ASSERT_EQUAL_UINT32(200, log.times[2]);
+  TEST_ASSERT_EQUAL_UINT32(250, clock.nowMs());  // 期間の終わりまで進む
+
+  // runNext は次のイベントの時刻ちょうどまで進める
+  TEST_ASSERT_TRUE(clock.runNext());
+  TEST_ASSERT_EQUAL(1, log.ids[3]);
+  TEST_ASSERT_EQUAL_UINT32(300, clock.nowMs());
+  TEST_ASSERT_FALSE(clock.runNext());
+  TEST_ASSERT_EQUAL_UINT32(300, clock.nowMs());
+  TEST_ASSERT_EQUAL_UINT32(4, clock.eventsRun());
+}
+
+// 期限ちょうどのイベントはその待機の中で実行する
+void test_event_at_end_of_sleep_runs() {
+  VirtualClock clock;
+  EventLog log = { &clock, {}, {}, 0 };
+  EventCtx a = { &log, 1, 0 };
+  clock.schedule(1000, recordEvent, &a);
+  clock.sleepMs(999);
+  TEST_ASSERT_EQUAL(0, log.count);
+  clock.sleepMs(1);
+  TEST_ASSERT_EQUAL(1, log.count);
+  TEST_ASSERT_EQUAL_UINT32(1000, log.times[0]);
+}
+
+struct Chain {
+  VirtualClock* clock;
+  int remaining;
+  uint32_t times[8];
+  int count;
+};
+
+static void chainEvent(void* ctx, uint32_t nowMs) {
+  Chain* c = (Chain*)ctx;
+  c->times[c->count++] = nowMs;
+  if (--c->remaining > 0) c->clock->schedule(c->count == 1 ? 0 : 400, chainEvent, c);
+}
+
+// イベントの中で予約したイベントも、待機の期間内なら同じ待機の中で実行する（遅延0は同時刻）
+void test_events_scheduled_from_events() {
+  VirtualClock clock;
+  Chain chain = { &clock, 5, {}, 0 };
+  clock.schedule(100, chainEvent, &chain);
+  clock.sleepMs(1000);
+  TEST_ASSERT_EQUAL(4, chain.count);
+  TEST_ASSERT_EQUAL_UINT32(100, chain.times[0]);
+  TEST_ASSERT_EQUAL_UINT32(100, chain.times[1]);
+  TEST_ASSERT_EQUAL_UINT32(500, chain.times[2]);
+  TEST_ASSERT_EQUAL_UINT32(900, chain.times[3]);
+  TEST_ASSERT_EQUAL(1, clock.pending());  // 1300 の予約
+  TEST_ASSERT_EQUAL_UINT32(1000, clock.nowMs());
+}
+
+// イベントの中の待機（入れ子）は、その間に期限が来る他のイベントを時刻順に実行し、
+// 外側の待機の終わりを越えて進んだ時刻は戻さない
+void test_nested_sleep() {
+  VirtualClock clock;
+  EventLog log = { &clock, {}, {}, 0 };
+  EventCtx blocking = { &log, 1, 500 };  // t=50 で 500ms 待つ
+  EventCtx inside = { &log, 2, 0 };      // t=300（入れ子の待機中）
+  EventCtx after = { &log, 3, 0 };       // t=700（外側の待機の後）
+  clock.schedule(50, recordEvent, &blocking);
+  clock.schedule(300, recordEvent, &inside);
+  clock.schedule(700, recordEvent, &after);
+
+  clock.sleepMs(100);
+  TEST_ASSERT_EQUAL(2, log.count);
+  TEST_ASSERT_EQUAL_UINT32(50, log.times[0]);
+  TEST_ASSERT_EQUAL_UINT32(300, log.times[1]);
+  TEST_ASSERT_EQUAL_UINT32(550, clock.nowMs());
+  TEST_ASSERT_EQUAL(1, clock.pending());
+
+  clock.sleepMs(100);
+  TEST_ASSERT_EQUAL_UINT32(650, clock.nowMs());
+  TEST_ASSERT_EQUAL(2, log.count);
+  clock.sleepMs(50);
+  TEST_ASSERT_EQUAL(3, log.count);
+  TEST_ASSERT_EQUAL_UINT32(700, log.times[2]);
+
+  // 待機の統計は要求した時間の合計（入れ子を含む）
+  TEST_ASSERT_EQUAL_UINT32(4, clock.sleeps());
+  TEST_ASSERT_TRUE(clock.sleptUs() == (100 + 500 + 100 + 50) * 1000ULL);
+}
+
+// millis() 相当は32ビットで折り返すが、elapsedUs() は折り返さない
+void test_wraparound_and_limits() {
+  uint64_t start = (uint64_t)(0xFFFFFFFFUL - 9UL) * 1000ULL;
+  VirtualClock clock(start);
+  EventLog log = { &clock, {}, {}, 0 };
+  EventCtx a = { &log, 1, 0 };
+  clock.schedule(15, recordEvent, &a);
+  clock.sleepMs(20);
+  TEST_ASSERT_EQUAL_UINT32(10, clock.nowMs());
+  TEST_ASSERT_EQUAL_UINT32(5, log.times[0]);
+  TEST_ASSERT_TRUE(clock.elapsedUs() == start + 20000ULL);
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)(start + 20000ULL), clock.nowUs());
+
+  for (size_t i = 0; i < VirtualClock::MAX_EVENTS; i++) TEST_ASSERT_TRUE(clock.schedule(1, recordEvent, &a));
+  TEST_ASSERT_FALSE(clock.schedule(1, recordEvent, &a));
+  TEST_ASSERT_FALSE(clock.schedule(1, nullptr, nullptr));
+}
+
+// ==== 1日分のシミュレーション ====
+
+// 経路毎の回線の状態（通信断・復旧のイベントで切り替える）
+struct Links {
+  bool up[TRANSPORT_COUNT];
+};
+
+static void mqttDown(void* ctx, uint32_t nowMs) {
+  (void)nowMs;
+  ((Links*)ctx)->up[TRANSPORT_MQTT] = false;
+}
+
+static void mqttUp(void* ctx, uint32_t nowMs) {
+  (void)nowMs;
+  ((Links*)ctx)->up[TRANSPORT_MQTT] = true;
+}
+
+static const uint32_t PERIOD_MS = 60000;
+static const uint32_t MQTT_LATENCY_MS = 120;
+static const uint32_t UDP_LATENCY_MS = 80;
+static const uint32_t TIMEOUT_MS = 10000;  // 送信失敗は応答待ちのタイムアウトまでブロックする
+
+// 60秒周期の送信を MQTT 優先で1日（86 400 秒）回し、6時間後から1時間の MQTT 断を挟む。
+// 期限ベースの周期・フェイルオーバー・プローブの倍化・復帰の時刻をミリ秒単位で確かめる
+void test_one_day_with_outage() {
+  VirtualClock clock;
+  Links links = { { true, true } };
+  const uint32_t outageStartMs = 21630000;  // 6:00:30
+  const uint32_t outageEndMs = 25230000;    // 7:00:30
+  TEST_ASSERT_TRUE(clock.schedule(outageStartMs, mqttDown, &links));
+  TEST_ASSERT_TRUE(clock.schedule(outageEndMs, mqttUp, &links));
+
+  DeadlineScheduler scheduler;
+  int uplink = scheduler.add("uplink", PERIOD_MS, MISS_SKIP, clock.nowMs(), PERIOD_MS);
+  TransportManager transport;
+  transport.setPreferred(TRANSPORT_MQTT);
+
+  uint32_t switches[4] = {};
+  int switchCount = 0;
+  uint32_t probeMs[4] = {};
+  int probes = 0;
+  uint32_t sent[TRANSPORT_COUNT] = {};
+  uint32_t lost = 0;
+  while (clock.elapsedUs() < 86400ULL * 1000000ULL) {
+    clock.sleepMs(scheduler.msUntilNext(clock.nowMs()));
+    if (scheduler.poll(clock.nowMs()) != uplink) continue;
+    uint32_t start = clock.nowMs();
+    TransportId t = transport.select(start);
+    if (transport.failedOver() && t == TRANSPORT_MQTT && probes < 4) probeMs[probes++] = start;
+    bool ok = links.up[t];
+    uint32_t latency = ok ? (t == TRANSPORT_MQTT ? MQTT_LATENCY_MS : UDP_LATENCY_MS) : TIMEOUT_MS;
+    clock.sleepMs(latency);
+    if (transport.report(t, ok, latency, t == TRANSPORT_MQTT ? 80 : 48, clock.nowMs()) && switchCount < 4) {
+      switches[switchCount++] = clock.nowMs();
+    }
+    if (ok) {
+      sent[t]++;
+    } else {
+      lost++;
+    }
+  }
+
+  // 周期は送信の所要時間（タイムアウトを含む）に引きずられない
+  const TimerStats* st = scheduler.stats(uplink);
+  TEST_ASSERT_EQUAL_UINT32(1440, st->fired);
+  TEST_ASSERT_EQUAL_UINT32(0, st->skipped);
+  TEST_ASSERT_EQUAL_UINT32(0, st->maxLateMs);
+  TEST_ASSERT_EQUAL_UINT32(2, clock.eventsRun());
+
+  // 21 660 秒と 21 720 秒の送信が失敗し、2回目のタイムアウト（21 730 秒）で UDP へ切替
+  // クールダウン10分 → プローブ 22 380 秒（失敗, 20分へ倍化）→ 23 640 秒（失敗, 40分）→ 26 100 秒で復帰
+  TEST_ASSERT_EQUAL(2, switchCount);
+  TEST_ASSERT_EQUAL_UINT32(21730000, switches[0]);
+  TEST_ASSERT_EQUAL_UINT32(26100000 + MQTT_LATENCY_MS, switches[1]);
+  TEST_ASSERT_EQUAL(3, probes);
+  TEST_ASSERT_EQUAL_UINT32(22380000, probeMs[0]);
+  TEST_ASSERT_EQUAL_UINT32(23640000, probeMs[1]);
+  TEST_ASSERT_EQUAL_UINT32(26100000, probeMs[2]);
+  TEST_ASSERT_EQUAL_UINT32(1, transport.failovers());
+  TEST_ASSERT_FALSE(transport.failedOver());
+
+  // 失われたのは切替前の2回とプローブ2回だけ。断の間の残りは UDP で届く
+  TEST_ASSERT_EQUAL_UINT32(4, lost);
+  TEST_ASSERT_EQUAL_UINT32(70, sent[TRANSPORT_UDP]);
+  TEST_ASSERT_EQUAL_UINT32(1366, sent[TRANSPORT_MQTT]);
+  TEST_ASSERT_EQUAL_UINT32(1370, transport.stats(TRANSPORT_MQTT).attempts);
+  TEST_ASSERT_EQUAL_UINT32(1366, transport.stats(TRANSPORT_MQTT).delivered);
+  TEST_ASSERT_EQUAL_UINT32(70, transport.stats(TRANSPORT_UDP).delivered);
+  TEST_ASSERT_EQUAL_UINT32(86400000 + MQTT_LATENCY_MS, clock.nowMs());  // 最後の送信の後
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_events_run_in_time_order);
+  RUN_TEST(test_event_at_end_of_sleep_runs);
+  RUN_TEST(test_events_scheduled_from_events);
+  RUN_TEST(test_nested_sleep);
+  RUN_TEST(test_wraparound_and_limits);
+  RUN_TEST(test_one_day_with_outage);
+  return UNITY_END();
+}
@@ -0,0 +1,430 @@
+#!/usr/bin/env python3
+"""SORACOM Unified Endpoint / Beam の代わりにローカルで上り送信を受信・デコードし、遅延と欠落を集計する
+
+  python3 tools/ingest_standin.py --udp-port 23080 --mqtt-port 1883 --interval 10
+
+デバイス（ホストビルド・エミュレーター、または stand-in に到達できる回線）を
+-DUDP_SERVER='"192.168.1.10"' -DMQTT_BROKER='"192.168.1.10"' でこのホストへ向けると、
+Harvest を見なくても送信内容とエンドツーエンドの遅延をその場で確認できる。
+
+- UDP: float の読み取り値（udp_format: float, 20バイト / float_v2 は種別 0xF1 を前置した21バイト）は Harvest の
+  バイナリパーサー設定（--parser, 既定は README と同じ）と同じ規則でデコードし、固定小数点フレーム（0xC1, 14バイト /
+  位置付き 0xC2, 24バイト）・ヘルス（0xA1, 32バイト）・エピソード要約（0xA2, 20バイト）・周期メトリクス（0xA3, 16バイト）も識別する
+- MQTT: 最小限のブローカー（MQTT 3.1.1, QoS 0/1）として PUBLISH を受け、JSON / CBOR / MessagePack をデコードする
+- 読み取り値毎に サンプル時刻（ts）→受信 の遅延、重複、時刻の欠落（--interval の1.5倍を超える間隔）、
+  順序の逆転（既に受けた ts より古い）を数え、--report 秒毎と終了時（Ctrl-C）に集計を標準エラーへ出力する
+- --csv を指定すると受信した読み取り値を1行ずつ CSV に書き出す
+"""
+
+import argparse
+import csv
+import json
+import math
+import socketserver
+import struct
+import sys
+import threading
+import time
+
+DEFAULT_PARSER = ("co2::float:32:little-endian Temp::float:32:little-endian Humi::float:32:little-endian "
+                  "Wind::float:32:little-endian ts::uint:32:little-endian")
+
+HEALTH_TYPE = 0xA1
+EPISODE_TYPE = 0xA2
+METRICS_TYPE = 0xA3
+COMPACT_READING_VERSION = 0xC1
+COMPACT_POSITION_VERSION = 0xC2
+FLOAT_V2_READING_TYPE = 0xF1
+
+
+# ==== UDP（バイナリパーサー） ====
+
+def compile_parser(spec):
+    """Harvest のバイナリパーサー設定（name::type:bits[:endian] の空白区切り）を struct 形式に変換する"""
+    codes = {("float", 32): "f", ("float", 64): "d", ("uint", 8): "B", ("uint", 16): "H", ("uint", 32): "I",
+             ("int", 8): "b", ("int", 16): "h", ("int", 32): "i"}
+    names = []
+    fmt = ""
+    endian = "<"
+    for field in spec.split():
+        name, _, rest = field.partition("::")
+        parts = rest.split(":")
+        kind, bits = parts[0], int(parts[1])
+        if (kind, bits) not in codes:
+            raise ValueError("unsupported parser field: %s" % field)
+        if len(parts) > 2:
+            endian = "<" if parts[2] == "little-endian" else ">"
+        names.append(name.lower())
+        fmt += codes[(kind, bits)]
+    return names, struct.Struct(endian + fmt)
+
+
+MIN_EPOCH = 1577836800  # 2020-01-01（デバイスは未同期なら ts=0 を送る）
+
+
+def plausible_reading(r):
+    ts = r.get("ts", 0)
+    values_ok = all(math.isfinite(r.get(k, 0.0)) for k in ("co2", "temp", "humi", "wind"))
+    return values_ok and (ts == 0 or ts >= MIN_EPOCH)
+
+
+def decode_udp(data, parser):
+    names, st = parser
+    if len(data) == st.size + 1 and data[0] == FLOAT_V2_READING_TYPE:
+        # float_v2: 種別の後ろは --parser と同じ並び（Harvest では先頭に type::uint:8 を足した設定にする）
+        return "reading", dict(zip(names, st.unpack(data[1:])))
+    if len(data) == 14 and data[0] == COMPACT_READING_VERSION:
+        # 固定小数点フレーム（udp_format: compact）
+        _, status, co2, temp, humi, wind, ts = struct.unpack("<BBHhHHI", data)
+        return "reading", {"co2": float(co2), "temp": temp / 100.0, "humi": humi / 100.0, "wind": wind / 100.0,
+                           "ts": ts, "status": status}
+    if len(data) == 24 and data[0] == COMPACT_POSITION_VERSION:
+        # 位置付きの固定小数点フレーム（GNSS 有効時。経過分 255 は未測位）
+        _, status, co2, temp, humi, wind, ts, lat, lon, hdop, age = struct.unpack("<BBHhHHIiiBB", data)
+        r = {"co2": float(co2), "temp": temp / 100.0, "humi": humi / 100.0, "wind": wind / 100.0,
+             "ts": ts, "status": status}
+        if age != 255:
+            r.update({"lat": lat / 1e6, "lon": lon / 1e6, "hdop": hdop / 10.0, "fix_age": age * 60})
+        return "reading", r
+    if len(data) == st.size:
+        reading = dict(zip(names, st.unpack(data)))
+        # 既定の float 形式は種別バイトを持たず、エピソード要約も20バイトのため、
+        # 種別バイトが一致し時刻が稼働秒数に見えるものはエピソードとみなす
+        if not (data[0] == EPISODE_TYPE and data[1] == 0 and not plausible_reading(reading)):
+            return "reading", reading
+    if len(data) == 32 and data[0] == HEALTH_TYPE:
+        v = struct.unpack("<BBHIIIIHHHHHH", data)
+        keys = ("type", "rst", "boots", "up", "heap", "minheap", "maxblk", "stk", "logstk", "loopms", "pdp",
+                "mreset", "hreset")
+        return "health", dict(zip(keys[1:], v[1:]))
+    if len(data) == 20 and data[0] == EPISODE_TYPE:
+        v = struct.unpack("<BBHHHHHHHI", data)
+        return "episode", {"dur": v[2], "c0": v[3], "c1": v[4], "ach": v[5] / 100.0, "r2": v[6] / 1000.0,
+                           "wind": -1 if v[7] == 0xFFFF else v[7] / 100.0, "n": v[8], "end": v[9]}
+    if len(data) == 16 and data[0] == METRICS_TYPE:
+        v = struct.unpack("<BBHHHHhHH", data)
+        return "vent", {"alarm": bool(v[1] & 1), "decaying": bool(v[1] & 2), "n": v[2], "co2": v[3],
+                        "co2max": v[4], "ach": v[5] / 100.0, "corr": v[6] / 1000.0,
+                        "wind": -1 if v[7] == 0xFFFF else v[7] / 100.0, "episodes": v[8]}
+    return "unknown", {"len": len(data), "hex": data.hex()}
+
+
+# ==== MQTT ペイロード（JSON / CBOR / MessagePack） ====
+
+def half_to_float(h):
+    return struct.unpack("<e", struct.pack("<H", h))[0]
+
+
+def decode_cbor(buf, pos=0):
+    ib = buf[pos]
+    major, info = ib >> 5, ib & 0x1F
+    pos += 1
+    if major == 7:
+        if info == 25:
+            return half_to_float(struct.unpack_from(">H", buf, pos)[0]), pos + 2
+        if info == 26:
+            return struct.unpack_from(">f", buf, pos)[0], pos + 4
+        if info == 27:
+            return struct.unpack_from(">d", buf, pos)[0], pos + 8
+        return {20: False, 21: True, 22: None}.get(info), pos
+    if info < 24:
+        arg = info
+    else:
+        n = {24: 1, 25: 2, 26: 4, 27: 8}[info]
+        arg = int.from_bytes(buf[pos:pos + n], "big")
+        pos += n
+    if major == 0:
+        return arg, pos
+    if major == 1:
+        return -1 - arg, pos
+    if major in (2, 3):
+        raw = buf[pos:pos + arg]
+        return (raw.decode() if major == 3 else raw), pos + arg
+    if major == 4:
+        out = []
+        for _ in range(arg):
+            v, pos = decode_cbor(buf, pos)
+            out.append(v)
+        return out, pos
+    if major == 5:
+        out = {}
+        for _ in range(arg):
+            k, pos = decode_cbor(buf, pos)
+            out[k], pos = decode_cbor(buf, pos)
+        return out, pos
+    raise ValueError("unsupported CBOR major type %d" % major)
+
+
+def decode_msgpack(buf, pos=0):
+    b = buf[pos]
+    pos += 1
+    if b < 0x80:
+        return b, pos
+    if b >= 0xE0:
+        return b - 0x100, pos
+    if 0x80 <= b <= 0x8F or b == 0xDE:
+        n = b & 0x0F
+        if b == 0xDE:
+            n = struct.unpack_from(">H", buf, pos)[0]
+            pos += 2
+        out = {}
+        for _ in range(n):
+            k, pos = decode_msgpack(buf, pos)
+            out[k], pos = decode_msgpack(buf, pos)
+        return out, pos
+    if 0xA0 <= b <= 0xBF or b == 0xD9:
+        n = b & 0x1F
+        if b == 0xD9:
+            n = buf[pos]
+            pos += 1
+        return buf[pos:pos + n].decode(), pos + n
+    fixed = {0xCA: ">f", 0xCB: ">d", 0xCC: ">B", 0xCD: ">H", 0xCE: ">I", 0xD0: ">b", 0xD1: ">h", 0xD2: ">i"}
+    if b in fixed:
+        v = struct.unpack_from(fixed[b], buf, pos)[0]
+        return v, pos + struct.calcsize(fixed[b])
+    if b in (0xC0, 0xC2, 0xC3):
+        return {0xC0: None, 0xC2: False, 0xC3: True}[b], pos
+    raise ValueError("unsupported MessagePack byte 0x%02x" % b)
+
+
+def decode_mqtt_payload(payload):
+    """(形式, 種別, 値) を返す"""
+    if payload[:1] == b"{":
+        fmt, obj = "json", json.loads(payload.decode())
+    elif payload[0] >> 5 == 5:
+        fmt, obj = "cbor", decode_cbor(payload)[0]
+    else:
+        fmt, obj = "msgpack", decode_msgpack(payload)[0]
+    if isinstance(obj, dict) and len(obj) == 1:
+        kind = next(iter(obj))
+        if kind in ("health", "episode", "vent"):
+            return fmt, kind, obj[kind]
+    if isinstance(obj, dict) and "lat_e6" in obj:
+        obj["lat"] = obj.pop("lat_e6") / 1e6
+        obj["lon"] = obj.pop("lon_e6", 0) / 1e6
+    return fmt, "reading", obj
+
+
+# ==== 集計 ====
+
+class Ingest:
+    def __init__(self, interval, csv_path):
+        self.lock = threading.Lock()
+        self.interval = interval
+        self.started = time.time()
+        self.frames = {}           # (経路, 種別) -> 件数
+        self.bytes = {}            # 経路 -> 受信バイト数
+        self.errors = 0
+        self.readings = 0
+        self.no_ts = 0
+        self.duplicates = 0
+        self.gaps = 0
+        self.missing = 0           # 欠落した周期数の推定
+        self.reordered = 0
+        self.latencies = []
+        self.seen = set()
+        self.max_ts = 0
+        self.csv = None
+        if csv_path:
+            self.csv_file = open(csv_path, "w", newline="")
+            self.csv = csv.writer(self.csv_file)
+            self.csv.writerow(["ingest_utc", "transport", "format", "ts", "latency_s", "co2", "temp", "humi", "wind",
+                               "duplicate", "lat", "lon", "fix_age_s"])
+
+    def frame(self, transport, fmt, kind, value, size):
+        now = time.time()
+        with self.lock:
+            self.frames[(transport, kind)] = self.frames.get((transport, kind), 0) + 1
+            self.bytes[transport] = self.bytes.get(transport, 0) + size
+            if kind != "reading":
+                print("%s %s %s %s" % (transport, fmt, kind, json.dumps(value)), flush=True)
+                return
+            self.readings += 1
+            ts = int(value.get("ts", 0) or 0)
+            key = (ts, round(value.get("co2", 0), 1), round(value.get("temp", 0), 1), round(value.get("humi", 0), 1))
+            dup = ts != 0 and key in self.seen
+            latency = None
+            if ts == 0:
+                self.no_ts += 1
+            elif dup:
+                # フェイルオーバーで同じ読み取り値が別経路から届いた場合など
+                self.duplicates += 1
+            else:
+                self.seen.add(key)
+                latency = now - ts
+                self.latencies.append(latency)
+                if ts < self.max_ts:
+                    self.reordered += 1
+                elif self.max_ts and ts - self.max_ts > self.interval * 1.5:
+                    self.gaps += 1
+                    self.missing += int(round((ts - self.max_ts) / self.interval)) - 1
+                self.max_ts = max(self.max_ts, ts)
+            position = ""
+            if "lat" in value:
+                position = " pos=%.6f,%.6f age=%ss" % (value["lat"], value["lon"], value.get("fix_age", "-"))
+            print("%s %s reading ts=%d co2=%.1f temp=%.1f humi=%.1f wind=%.2f latency=%s%s%s" % (
+                transport, fmt, ts, value.get("co2", 0), value.get("temp", 0), value.get("humi", 0),
+                value.get("wind", 0), "%.2fs" % latency if latency is not None else "-", position,
+                " [dup]" if dup else ""), flush=True)
+            if self.csv:
+                self.csv.writerow([time.strftime("%Y-%m-%dT%H:%M:%SZ", time.gmtime(now)), transport, fmt, ts,
+                                   "%.3f" % latency if latency is not None else ""] +
+                                  ["%.2f" % value.get(k, 0) for k in ("co2", "temp", "humi", "wind")] + [int(dup)] +
+                                  (["%.6f" % value["lat"], "%.6f" % value["lon"], value.get("fix_age", "")]
+                                   if "lat" in value else ["", "", ""]))
+                self.csv_file.flush()
+
+    def error(self, transport, message):
+        with self.lock:
+            self.errors += 1
+        print("%s decode error: %s" % (transport, message), file=sys.stderr, flush=True)
+
+    def report(self):
+        with self.lock:
+            lat = sorted(self.latencies)
+            frames = ", ".join("%s/%s=%d" % (t, k, n) for (t, k), n in sorted(self.frames.items()))
+            totals = ", ".join("%s=%d" % kv for kv in sorted(self.bytes.items()))
+            elapsed = time.time() - self.started
+
+            def pct(p):
+                return lat[min(len(lat) - 1, int(math.ceil(p / 100.0 * len(lat))) - 1)] if lat else 0.0
+
+            print("INGEST: %.0f s, readings=%d (no ts %d) duplicates=%d gaps=%d (missing ~%d) reordered=%d "
+                  "errors=%d latency p50=%.2f p95=%.2f max=%.2f s, frames: %s, bytes: %s" % (
+                      elapsed, self.readings, self.no_ts, self.duplicates, self.gaps, self.missing, self.reordered,
+                      self.errors, pct(50), pct(95), lat[-1] if lat else 0.0, frames or "-", totals or "-"),
+                  file=sys.stderr, flush=True)
+
+
+# ==== 受信 ====
+
+class UdpHandler(socketserver.BaseRequestHandler):
+    ingest = None
+    parser = None
+
+    def handle(self):
+        data = self.request[0]
+        try:
+            kind, value = decode_udp(data, self.parser)
+            self.ingest.frame("udp", "binary", kind, value, len(data))
+        except (struct.error, ValueError) as e:
+            self.ingest.error("udp", "%s (%s)" % (e, data.hex()))
+
+
+def read_exact(sock, n):
+    buf = b""
+    while len(buf) < n:
+        chunk = sock.recv(n - len(buf))
+        if not chunk:
+            raise ConnectionError("closed")
+        buf += chunk
+    return buf
+
+
+def read_remaining_length(sock):
+    value, shift = 0, 0
+    while True:
+        b = read_exact(sock, 1)[0]
+        value |= (b & 0x7F) << shift
+        if not b & 0x80:
+            return value
+        shift += 7
+
+
+class MqttHandler(socketserver.BaseRequestHandler):
+    """PUBLISH を受けるだけの最小限のブローカー（配信はしない）"""
+    ingest = None
+
+    def handle(self):
+        sock = self.request
+        client = "?"
+        try:
+            while True:
+                header = read_exact(sock, 1)[0]
+                body = read_exact(sock, read_remaining_length(sock))
+                ptype = header >> 4
+                if ptype == 1:  # CONNECT
+                    plen = struct.unpack_from(">H", body, 0)[0]
+                    pos = 2 + plen + 4  # プロトコル名, レベル, フラグ, キープアライブ
+                    clen = struct.unpack_from(">H", body, pos)[0]
+                    client = body[pos + 2:pos + 2 + clen].decode(errors="replace")
+                    print("mqtt connect from %s client %s" % (self.client_address[0], client), flush=True)
+                    sock.sendall(b"\x20\x02\x00\x00")
+                elif ptype == 3:  # PUBLISH
+                    qos = (header >> 1) & 3
+                    tlen = struct.unpack_from(">H", body, 0)[0]
+                    pos = 2 + tlen
+                    if qos > 0:
+                        packet_id = body[pos:pos + 2]
+                        pos += 2
+                        sock.sendall(b"\x40\x02" + packet_id)
+                    payload = body[pos:]
+                    try:
+                        fmt, kind, value = decode_mqtt_payload(payload)
+                        self.ingest.frame("mqtt", fmt, kind, value, len(payload))
+                    except (ValueError, KeyError, IndexError, struct.error, UnicodeDecodeError) as e:
+                        self.ingest.error("mqtt", "%s (%s)" % (e, payload[:64].hex()))
+                elif ptype == 8:  # SUBSCRIBE
+                    packet_id = body[:2]
+                    count = 0
+                    pos = 2
+                    while pos < len(body):
+                        pos += 2 + struct.unpack_from(">H", body, pos)[0] + 1
+                        count += 1
+                    sock.sendall(bytes([0x90, 2 + count]) + packet_id + b"\x00" * count)
+                elif ptype == 12:  # PINGREQ
+                    sock.sendall(b"\xd0\x00")
+                elif ptype == 14:  # DISCONNECT
+                    break
+        except ConnectionError:
+            pass
+        print("mqtt disconnect %s" % client, flush=True)
+
+
+class ThreadingUdpServer(socketserver.ThreadingMixIn, socketserver.UDPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+class ThreadingTcpServer(socketserver.ThreadingMixIn, socketserver.TCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    p.add_argument("--bind", default="0.0.0.0")
+    p.add_argument("--udp-port", type=int, default=23080, help="0 = disabled")
+    p.add_argument("--mqtt-port", type=int, default=1883, help="0 = disabled")
+    p.add_argument("--parser", default=DEFAULT_PARSER, help="Harvest binary parser format for readings")
+    p.add_argument("--interval", type=float, default=10, help="expected seconds between readings (interval_s)")
+    p.add_argument("--report", type=float, default=60, help="seconds between summaries")
+    p.add_argument("--csv", help="write decoded readings to this CSV file")
+    args = p.parse_args()
+
+    ingest = Ingest(args.interval, args.csv)
+    servers = []
+    if args.udp_port:
+        UdpHandler.ingest = ingest
+        UdpHandler.parser = compile_parser(args.parser)
+        servers.append(ThreadingUdpServer((args.bind, args.udp_port), UdpHandler))
+    if args.mqtt_port:
+        MqttHandler.ingest = ingest
+        servers.append(ThreadingTcpServer((args.bind, args.mqtt_port), MqttHandler))
+    for server in servers:
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+    print("listening: udp %s, mqtt %s (expected interval %.0f s)" % (args.udp_port or "off", args.mqtt_port or "off",
+                                                                     args.interval), file=sys.stderr)
+    try:
+        while True:
+            time.sleep(args.report)
+            ingest.report()
+    except KeyboardInterrupt:
+        pass
+    for server in servers:
+        server.shutdown()
+    ingest.report()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""遅延ロガーの生レコード（-DLOG_RAW_DUMP の "LOGREC <16進>" 行）をテキストに戻す
+
+  pio device monitor | tee serial.log
+  python3 tools/log_decode.py serial.log
+
+書式文字列は include/log_formats.h の LOG_FORMAT_LIST から読むため、ダンプを取ったビルドと
+同じリビジョンで実行すること。LOGREC 以外の行はそのまま出力する。
+レコードの形式と整形は src/log_ring.cpp の LogRing::format と同じで、引数の長さが
+レコードに収まらない（壊れた・別ビルドの）レコードは "<corrupt record>" として数える。
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+HEADER_SIZE = 8
+MAX_STR_ARG = 64
+LEVEL_CHARS = "-EWID"
+DEFAULT_FORMATS = os.path.join(os.path.dirname(__file__), "..", "include", "log_formats.h")
+
+
+def load_formats(path):
+    with open(path, encoding="utf-8") as f:
+        text = f.read()
+    # X(LF_NAME, "format") の順がフォーマットIDになる
+    return [bytes(m.group(1), "utf-8").decode("unicode_escape")
+            for m in re.finditer(r'X\(\s*LF_\w+\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)', text)]
+
+
+class Corrupt(Exception):
+    pass
+
+
+def parse_args(record):
+    args = []
+    pos = HEADER_SIZE
+    while pos < len(record):
+        tag = chr(record[pos])
+        pos += 1
+        if tag == "s":
+            if pos >= len(record):
+                raise Corrupt()
+            n = record[pos]
+            pos += 1
+            if n > MAX_STR_ARG or pos + n > len(record):
+                raise Corrupt()
+            args.append(("s", record[pos:pos + n].decode("utf-8", errors="replace")))
+            pos += n
+        elif tag in "iuf":
+            if pos + 4 > len(record):
+                raise Corrupt()
+            fmt = {"i": "<i", "u": "<I", "f": "<f"}[tag]
+            args.append((tag, struct.unpack_from(fmt, record, pos)[0]))
+            pos += 4
+        else:
+            raise Corrupt()
+    return args
+
+
+SPEC = re.compile(r"%(%|[-+ #0]*\d*(?:\.\d+)?[lhz]*[diouxXcsfFeEgG])")
+
+
+def format_record(record, formats):
+    if len(record) < HEADER_SIZE or record[0] != len(record):
+        raise Corrupt()
+    level = record[1]
+    fmt_id, ts = struct.unpack_from("<HI", record, 2)
+    head = "[%8u] %s " % (ts, LEVEL_CHARS[level] if level < 5 else "?")
+    if fmt_id >= len(formats):
+        return head + "<unknown format %u>" % fmt_id
+    args = parse_args(record)
+    out = []
+    last = 0
+    fmt = formats[fmt_id]
+    for m in SPEC.finditer(fmt):
+        out.append(fmt[last:m.start()])
+        last = m.end()
+        spec = m.group(1)
+        if spec == "%":
+            out.append("%")
+            continue
+        spec = "%" + re.sub(r"[lhz]", "", spec)
+        conv = spec[-1]
+        if not args:
+            out.append("<?>")
+            continue
+        tag, value = args.pop(0)
+        if tag == "s":
+            out.append(spec % value if conv == "s" else value)
+        elif conv == "s":
+            out.append("<bad arg>")
+        elif conv in "fFeEgG":
+            out.append(spec % float(value))
+        elif conv == "c":
+            out.append(chr(int(value) & 0xFF))
+        elif conv in "di":
+            out.append(spec % int(value))
+        else:
+            # %u/%x は C と同じく 32 ビット符号なしとして表示する
+            out.append(spec.replace("u", "d") % (int(value) & 0xFFFFFFFF))
+    out.append(fmt[last:])
+    return head + "".join(out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("files", nargs="*", help="シリアルの記録（省略時は標準入力）")
+    ap.add_argument("--formats", default=DEFAULT_FORMATS, help="log_formats.h のパス")
+    args = ap.parse_args()
+    formats = load_formats(args.formats)
+    corrupt = 0
+    streams = [open(p, encoding="utf-8", errors="replace") for p in args.files] or [sys.stdin]
+    for stream in streams:
+        for line in stream:
+            line = line.rstrip("\r\n")
+            idx = line.find("LOGREC ")
+            if idx < 0:
+                print(line)
+                continue
+            try:
+                print(format_record(bytes.fromhex(line[idx + 7:].strip()), formats))
+            except (Corrupt, ValueError):
+                corrupt += 1
+                print("<corrupt record>")
+    if corrupt:
+        print("%d corrupt records" % corrupt, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,256 @@
+#!/usr/bin/env python3
+"""差分OTA（DPT1 形式）の作成・検証と、動作確認用のローカル HTTP サーバー
+
+  keygen  署名鍵（ECDSA P-256）を作り、公開鍵を include/ota_pubkey.h に書き出す
+  make    旧イメージと新イメージから署名付きパッチを作る
+  apply   パッチを旧イメージに適用して検証する（実機と同じ手順のホスト実装）
+  serve   Range 要求に応答する HTTP サーバー（帯域制限・通信断の再現つき）
+
+署名には openssl コマンドを使う。
+"""
+
+import argparse
+import hashlib
+import http.server
+import os
+import struct
+import subprocess
+import sys
+import time
+
+MAGIC = b"DPT1"
+OP_COPY = 0x01
+OP_INSERT = 0x02
+BLOCK = 32       # 一致を探すブロック長（COPY 命令9バイトに対して十分長い）
+
+
+def keygen(args):
+    subprocess.run(["openssl", "ecparam", "-name", "prime256v1", "-genkey", "-noout", "-out", args.key], check=True)
+    pem = subprocess.run(["openssl", "ec", "-in", args.key, "-pubout"], check=True,
+                         capture_output=True).stdout.decode()
+    with open(args.pub, "w") as f:
+        f.write(pem)
+    lines = "".join('  "%s\\n"\n' % line for line in pem.strip().splitlines())
+    with open(args.header, "w") as f:
+        f.write("#pragma once\n\n")
+        f.write("// 差分OTAの署名検証用公開鍵（tools/ota_delta.py keygen で生成）\n")
+        f.write("static const char OTA_PUBLIC_KEY_PEM[] =\n%s;\n" % lines.rstrip("\n"))
+    print("private key: %s (keep it out of the repository)" % args.key)
+    print("public key: %s, header: %s" % (args.pub, args.header))
+
+
+def diff(old, new):
+    """旧イメージのブロック索引で一致を探し、COPY / INSERT の命令列を作る"""
+    index = {}
+    for off in range(0, len(old) - BLOCK + 1, 4):
+        index.setdefault(old[off:off + BLOCK], off)
+
+    ops = []
+    literal = bytearray()
+    i = 0
+    while i < len(new):
+        src = index.get(new[i:i + BLOCK]) if i + BLOCK <= len(new) else None
+        if src is None:
+            literal.append(new[i])
+            i += 1
+            continue
+        n = BLOCK
+        while i + n < len(new) and src + n < len(old) and new[i + n] == old[src + n]:
+            n += 1
+        # 直前のリテラルへ一致を後ろ向きに伸ばす
+        while literal and src > 0 and literal[-1] == old[src - 1]:
+            literal.pop()
+            src -= 1
+            i -= 1
+            n += 1
+        if literal:
+            ops.append((OP_INSERT, bytes(literal)))
+            literal = bytearray()
+        ops.append((OP_COPY, src, n))
+        i += n
+    if literal:
+        ops.append((OP_INSERT, bytes(literal)))
+    return ops
+
+
+def encode_ops(ops):
+    out = bytearray()
+    for op in ops:
+        if op[0] == OP_COPY:
+            out += struct.pack("<BII", OP_COPY, op[1], op[2])
+        else:
+            out += struct.pack("<BI", OP_INSERT, len(op[1])) + op[1]
+    return bytes(out)
+
+
+def make(args):
+    old = open(args.old, "rb").read()
+    new = open(args.new, "rb").read()
+    signed = MAGIC + struct.pack("<I", len(old)) + hashlib.sha256(old).digest() \
+        + struct.pack("<I", len(new)) + hashlib.sha256(new).digest()
+    sig = subprocess.run(["openssl", "dgst", "-sha256", "-sign", args.key], input=signed, check=True,
+                         capture_output=True).stdout
+    start = time.time()
+    body = encode_ops(diff(old, new))
+    patch = signed + struct.pack("<H", len(sig)) + sig + body
+    with open(args.out, "wb") as f:
+        f.write(patch)
+    copies = sum(1 for op in parse_ops(body) if op[0] == OP_COPY)
+    print("old %d bytes, new %d bytes -> patch %d bytes (%.1f%% of new, %d copies, %.1f s)"
+          % (len(old), len(new), len(patch), 100.0 * len(patch) / len(new), copies, time.time() - start))
+
+
+def parse_header(patch):
+    if patch[:4] != MAGIC:
+        raise ValueError("bad magic")
+    old_size, = struct.unpack_from("<I", patch, 4)
+    new_size, = struct.unpack_from("<I", patch, 40)
+    sig_len, = struct.unpack_from("<H", patch, 76)
+    return {
+        "old_size": old_size, "old_sha256": patch[8:40],
+        "new_size": new_size, "new_sha256": patch[44:76],
+        "signed": patch[:76], "sig": patch[78:78 + sig_len], "size": 78 + sig_len,
+    }
+
+
+def parse_ops(body):
+    i = 0
+    while i < len(body):
+        op = body[i]
+        if op == OP_COPY:
+            src, n = struct.unpack_from("<II", body, i + 1)
+            yield (OP_COPY, src, n)
+            i += 9
+        elif op == OP_INSERT:
+            n, = struct.unpack_from("<I", body, i + 1)
+            yield (OP_INSERT, body[i + 5:i + 5 + n])
+            i += 5 + n
+        else:
+            raise ValueError("unknown opcode 0x%02x at %d" % (op, i))
+
+
+def apply(args):
+    old = open(args.old, "rb").read()
+    patch = open(args.patch, "rb").read()
+    h = parse_header(patch)
+    if args.pubkey:
+        with open(args.patch + ".sig", "wb") as f:
+            f.write(h["sig"])
+        try:
+            result = subprocess.run(["openssl", "dgst", "-sha256", "-verify", args.pubkey,
+                                     "-signature", args.patch + ".sig"], input=h["signed"], capture_output=True)
+        finally:
+            os.remove(args.patch + ".sig")
+        if result.returncode != 0:
+            sys.exit("signature verification failed")
+        print("signature OK")
+    if len(old) < h["old_size"] or hashlib.sha256(old[:h["old_size"]]).digest() != h["old_sha256"]:
+        sys.exit("base image does not match the patch")
+    out = bytearray()
+    for op in parse_ops(patch[h["size"]:]):
+        out += old[op[1]:op[1] + op[2]] if op[0] == OP_COPY else op[1]
+    if len(out) != h["new_size"] or hashlib.sha256(out).digest() != h["new_sha256"]:
+        sys.exit("patched image hash mismatch")
+    if args.out:
+        with open(args.out, "wb") as f:
+            f.write(out)
+    print("patched image OK (%d bytes, sha256 %s)" % (len(out), h["new_sha256"].hex()))
+
+
+class RangeHandler(http.server.SimpleHTTPRequestHandler):
+    """Range 付き GET に 206 で応答する。rate で帯域を絞り、drop_every 回毎に本文の途中で切断する"""
+
+    rate = 0
+    drop_every = 0
+    requests = 0
+    sent = 0
+
+    def do_GET(self):
+        path = self.translate_path(self.path)
+        if not os.path.isfile(path):
+            self.send_error(404)
+            return
+        data = open(path, "rb").read()
+        first, last = 0, len(data) - 1
+        rng = self.headers.get("Range")
+        if rng and rng.startswith("bytes="):
+            a, _, b = rng[6:].partition("-")
+            first = int(a) if a else 0
+            last = min(int(b), len(data) - 1) if b else len(data) - 1
+            if first > last:
+                self.send_error(416)
+                return
+            self.send_response(206)
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (first, last, len(data)))
+        else:
+            self.send_response(200)
+        body = data[first:last + 1]
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+
+        cls = type(self)
+        cls.requests += 1
+        drop = cls.drop_every > 0 and cls.requests % cls.drop_every == 0
+        limit = len(body) // 2 if drop else len(body)
+        start = time.time()
+        for i in range(0, limit, 512):
+            piece = body[i:min(i + 512, limit)]
+            self.wfile.write(piece)
+            cls.sent += len(piece)
+            if cls.rate > 0:
+                time.sleep(len(piece) / cls.rate)
+        self.wfile.flush()
+        elapsed = time.time() - start
+        self.log_message("range %d-%d: sent %d/%d bytes in %.2f s%s (total %d bytes)", first, last, limit,
+                         len(body), elapsed, " [dropped]" if drop else "", cls.sent)
+        if drop:
+            self.close_connection = True
+
+
+def serve(args):
+    os.chdir(args.dir)
+    RangeHandler.rate = args.rate
+    RangeHandler.drop_every = args.drop_every
+    server = http.server.ThreadingHTTPServer(("", args.port), RangeHandler)
+    print("serving %s on port %d (rate %s, drop every %s)" % (args.dir, args.port, args.rate or "unlimited",
+                                                             args.drop_every or "never"))
+    server.serve_forever()
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = p.add_subparsers(dest="cmd", required=True)
+
+    k = sub.add_parser("keygen")
+    k.add_argument("--key", default="ota_signing_key.pem")
+    k.add_argument("--pub", default="ota_signing_key.pub.pem")
+    k.add_argument("--header", default="include/ota_pubkey.h")
+    k.set_defaults(func=keygen)
+
+    m = sub.add_parser("make")
+    m.add_argument("old")
+    m.add_argument("new")
+    m.add_argument("out")
+    m.add_argument("--key", default="ota_signing_key.pem")
+    m.set_defaults(func=make)
+
+    a = sub.add_parser("apply")
+    a.add_argument("old")
+    a.add_argument("patch")
+    a.add_argument("--out")
+    a.add_argument("--pubkey", help="PEM public key to verify the signature")
+    a.set_defaults(func=apply)
+
+    s = sub.add_parser("serve")
+    s.add_argument("--dir", default=".")
+    s.add_argument("--port", type=int, default=8080)
+    s.add_argument("--rate", type=int, default=0, help="bytes per second (0 = unlimited)")
+    s.add_argument("--drop-every", type=int, default=0, help="cut every Nth response halfway through")
+    s.set_defaults(func=serve)
+
+    args = p.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()
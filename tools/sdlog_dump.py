@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""SDカードのログ（<dir>/YYYYMMDD_NN.bin）を CSV に変換する
+
+  python3 tools/sdlog_dump.py /Volumes/SD/logs/*.bin > readings.csv
+
+ヘッダと各レコードの CRC を検証し、CRC 不一致（電源断で途中まで書かれたレコード）と
+シーケンス番号の欠落（バッファ溢れ・書き込み失敗）を件数として標準エラーへ出力する。
+書き込み失敗後に次のファイルへ書き直されたレコードは重複として1件にまとめる。
+"""
+
+import argparse
+import csv
+import struct
+import sys
+from datetime import datetime, timezone
+
+MAGIC = 0x4C324F43  # "CO2L"
+HEADER_SIZE = 32
+RECORD_SIZE = 16
+FLAG_SCD40_OK = 0x01
+FLAG_FS3000_OK = 0x02
+FLAG_UPTIME = 0x08
+
+
+def crc16_ccitt(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) & 0xFFFF if crc & 0x8000 else (crc << 1) & 0xFFFF
+    return crc
+
+
+def read_file(path, writer, totals, seen):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) < HEADER_SIZE:
+        print("%s: truncated header" % path, file=sys.stderr)
+        totals["bad_files"] += 1
+        return
+    magic, version, rec_size, hdr_size, created, uptime = struct.unpack_from("<IBBHII", data, 0)
+    device = data[16:28].split(b"\0", 1)[0].decode(errors="replace")
+    index, crc = struct.unpack_from("<HH", data, 28)
+    if magic != MAGIC or rec_size != RECORD_SIZE or crc != crc16_ccitt(data[:30]):
+        print("%s: invalid header" % path, file=sys.stderr)
+        totals["bad_files"] += 1
+        return
+
+    prev_seq = None
+    for off in range(hdr_size, len(data) - RECORD_SIZE + 1, RECORD_SIZE):
+        rec = data[off:off + RECORD_SIZE]
+        t, co2, temp, hum, wind, flags, seq, crc = struct.unpack("<IHhHHBBH", rec)
+        if crc != crc16_ccitt(rec[:14]):
+            totals["bad_records"] += 1
+            continue
+        key = (device, t, flags & FLAG_UPTIME, seq)
+        if key in seen:
+            totals["duplicates"] += 1
+            continue
+        seen.add(key)
+        if prev_seq is not None and seq != (prev_seq + 1) & 0xFF:
+            totals["gaps"] += 1
+        prev_seq = seq
+        if flags & FLAG_UPTIME:
+            time_str = ""
+            uptime_s = t
+        else:
+            time_str = datetime.fromtimestamp(t, timezone.utc).strftime("%Y-%m-%dT%H:%M:%SZ")
+            uptime_s = ""
+        writer.writerow([
+            path, device, time_str, uptime_s,
+            co2 if flags & FLAG_SCD40_OK else "",
+            "%.2f" % (temp / 100.0) if flags & FLAG_SCD40_OK else "",
+            "%.2f" % (hum / 100.0) if flags & FLAG_SCD40_OK else "",
+            "%.2f" % (wind / 100.0) if flags & FLAG_FS3000_OK else "",
+            seq,
+        ])
+        totals["records"] += 1
+    tail = (len(data) - hdr_size) % RECORD_SIZE
+    if tail:
+        totals["bad_records"] += 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("files", nargs="+")
+    args = parser.parse_args()
+
+    writer = csv.writer(sys.stdout)
+    writer.writerow(["file", "device", "utc", "uptime_s", "co2_ppm", "temp_c", "humidity_pct", "wind_mps",
+                     "seq"])
+    totals = {"records": 0, "bad_records": 0, "gaps": 0, "duplicates": 0, "bad_files": 0}
+    seen = set()
+    for path in sorted(args.files):
+        read_file(path, writer, totals, seen)
+    print("records=%(records)d crc_errors=%(bad_records)d seq_gaps=%(gaps)d duplicates=%(duplicates)d "
+          "bad_files=%(bad_files)d" % totals,
+          file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()